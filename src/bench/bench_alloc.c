@@ -0,0 +1,95 @@
+// =========================================================
+// 微基准: create 吞吐量 vs Inode 表占用率
+// =========================================================
+// 对比两种 Inode 分配方式 (每次 create = 找空位 + 写回新 Inode):
+//   legacy: 旧实现，从 1 号开始逐个 pread Inode，直到 mode == 0
+//   bitmap: 内存位图 + 摘要，ctz 找空位
+// 用法: ./bench_alloc [镜像文件路径]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "smartfs_types.h"
+#include "bitmap.h"
+
+#define INODE_AREA_BLOCKS 1024   // 与 mkfs 预留的 Inode 区一致
+#define OPS_PER_LEVEL 2000
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void write_mode(int fd, uint64_t ino, mode_t mode) {
+    inode_t node;
+    memset(&node, 0, sizeof(node));
+    node.inode_id = ino;
+    node.mode = mode;
+    pwrite(fd, &node, sizeof(node), (off_t)ino * sizeof(inode_t));
+}
+
+// 旧实现：线性扫描 Inode 表
+static uint64_t legacy_alloc(int fd, uint64_t capacity) {
+    inode_t node;
+    for (uint64_t i = 1; i < capacity; i++) {
+        pread(fd, &node, sizeof(node), (off_t)i * sizeof(inode_t));
+        if (node.mode == 0) return i;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *path = (argc > 1) ? argv[1] : "/tmp/smartfs_bench_alloc.img";
+    uint64_t capacity = (uint64_t)INODE_AREA_BLOCKS * BLOCK_SIZE / sizeof(inode_t);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror("open"); return 1; }
+    if (ftruncate(fd, (off_t)capacity * sizeof(inode_t)) != 0) { perror("ftruncate"); return 1; }
+
+    smartfs_bitmap_t bm;
+    if (bitmap_init(&bm, capacity, 0, (capacity + BLOCK_SIZE * 8 - 1) / (BLOCK_SIZE * 8)) != 0) return 1;
+    bitmap_set(&bm, 0);
+
+    printf("# inode_t = %zu bytes, capacity = %lu inodes, %d creates per level\n",
+           sizeof(inode_t), capacity, OPS_PER_LEVEL);
+    printf("%-8s %16s %16s %10s\n", "fill%", "legacy ops/s", "bitmap ops/s", "speedup");
+
+    int levels[] = {0, 10, 25, 50, 75, 90, 99};
+    uint64_t filled = 1;
+    for (size_t l = 0; l < sizeof(levels) / sizeof(levels[0]); l++) {
+        // 按顺序填充到目标占用率 (与顺序分配的真实镜像一致)
+        uint64_t target = capacity * levels[l] / 100;
+        for (; filled < target && filled < capacity - 1; filled++) {
+            write_mode(fd, filled, S_IFREG | 0644);
+            bitmap_set(&bm, filled);
+        }
+
+        // 每次 create 之后再删掉，保持占用率不变
+        double t0 = now_sec();
+        for (int i = 0; i < OPS_PER_LEVEL; i++) {
+            uint64_t ino = legacy_alloc(fd, capacity);
+            write_mode(fd, ino, S_IFREG | 0644);
+            write_mode(fd, ino, 0);
+        }
+        double legacy = OPS_PER_LEVEL / (now_sec() - t0);
+
+        t0 = now_sec();
+        for (int i = 0; i < OPS_PER_LEVEL; i++) {
+            int64_t ino = bitmap_alloc(&bm);
+            write_mode(fd, (uint64_t)ino, S_IFREG | 0644);
+            write_mode(fd, (uint64_t)ino, 0);
+            bitmap_clear(&bm, (uint64_t)ino);
+        }
+        double fast = OPS_PER_LEVEL / (now_sec() - t0);
+
+        printf("%-8d %16.0f %16.0f %9.1fx\n", levels[l], legacy, fast, fast / legacy);
+    }
+
+    bitmap_destroy(&bm);
+    close(fd);
+    unlink(path);
+    return 0;
+}
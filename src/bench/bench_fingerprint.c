@@ -0,0 +1,124 @@
+// =========================================================
+// 微基准: 4KB 块指纹吞吐量
+// =========================================================
+// 对比写入路径上算指纹的几种方式 (每次算 BATCH 个块，和 write_locked 一样):
+//   legacy:    旧实现，SHA256_Init/Update/Final + 转成 64 个十六进制字符
+//   sha256:    EVP 一次性接口 (有 SHA-NI 时 OpenSSL 自动用)
+//   sha256-mb: 多缓冲 SHA-256，8 个块一起算
+//   blake2b / blake3: 其他可选算法 (blake3 要编译时有 libblake3)
+// 开始前先核对多缓冲实现和 OpenSSL 的结果逐字节一致。
+// 用法: ./bench_fingerprint [总 MB 数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/sha.h>
+#include "smartfs_types.h"
+#include "storage.h"
+
+#define BATCH SHA256_MB_LANES
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void legacy_hash(const char *input, size_t len, char *hex) {
+    unsigned char hash[SHA256_DIGEST_LENGTH];
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, input, len);
+    SHA256_Final(hash, &ctx);
+    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) sprintf(hex + i * 2, "%02x", hash[i]);
+    hex[64] = 0;
+}
+
+// 各种长度 (包括 0、55/56/64 这些补位边界) 和多缓冲里长短混在一起的情况
+static int verify_mb() {
+    char buf[BATCH][3 * 64 + 1];
+    const char *in[BATCH];
+    size_t lens[BATCH];
+    unsigned char got[BATCH][FP_DIGEST_LEN], want[FP_DIGEST_LEN];
+    for (int round = 0; round < 200; round++) {
+        int n = 1 + round % BATCH;
+        for (int l = 0; l < n; l++) {
+            lens[l] = (size_t)((round * 7 + l * 31) % (int)sizeof(buf[l]));
+            for (size_t i = 0; i < lens[l]; i++) buf[l][i] = (char)rand();
+            in[l] = buf[l];
+        }
+        sha256_mb(in, lens, n, got);
+        for (int l = 0; l < n; l++) {
+            SHA256((const unsigned char *)in[l], lens[l], want);
+            if (memcmp(got[l], want, FP_DIGEST_LEN) != 0) {
+                printf("MISMATCH: round %d lane %d len %zu\n", round, l, lens[l]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+typedef void (*batch_fn)(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]);
+
+static void legacy_batch(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]) {
+    char hex[65];
+    for (int i = 0; i < n; i++) {
+        legacy_hash(inputs[i], lens[i], hex);
+        digests[i][0] = (unsigned char)hex[0];
+    }
+}
+
+static void evp_batch(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]) {
+    for (int i = 0; i < n; i++) calculate_sha256(inputs[i], lens[i], digests[i]);
+}
+
+static void run(const char *name, batch_fn fn, const char *data, size_t window, size_t nblocks) {
+    const char *in[BATCH];
+    size_t lens[BATCH];
+    unsigned char out[BATCH][FP_DIGEST_LEN];
+    for (int i = 0; i < BATCH; i++) lens[i] = BLOCK_SIZE;
+
+    double t0 = now_sec();
+    for (size_t b = 0; b < nblocks; b += BATCH) {
+        int n = nblocks - b < BATCH ? (int)(nblocks - b) : BATCH;
+        for (int i = 0; i < n; i++) in[i] = data + ((b + i) % window) * BLOCK_SIZE;
+        fn(in, lens, n, out);
+    }
+    double secs = now_sec() - t0;
+    printf("%-12s %10.1f MB/s %12.0f blocks/s\n", name,
+           nblocks * (double)BLOCK_SIZE / secs / (1 << 20), nblocks / secs);
+}
+
+int main(int argc, char *argv[]) {
+    size_t mb = (argc > 1) ? (size_t)atoi(argv[1]) : 256;
+    size_t nblocks = mb * (1 << 20) / BLOCK_SIZE;
+
+    if (verify_mb() != 0) return 1;
+
+    // 数据集放得下缓存就会偏快：在 64MB 的数据上循环，模拟写入流
+    size_t window = 64 * (1 << 20) / BLOCK_SIZE;
+    if (window > nblocks) window = nblocks;
+    char *data = malloc(window * BLOCK_SIZE);
+    if (!data) { perror("malloc"); return 1; }
+    for (size_t i = 0; i < window * BLOCK_SIZE; i++) data[i] = (char)rand();
+
+    printf("# %zu MB in 4KB blocks, %d blocks per call\n", mb, BATCH);
+    printf("%-12s %15s %19s\n", "engine", "throughput", "rate");
+    run("legacy", legacy_batch, data, window, nblocks);
+    run("sha256", evp_batch, data, window, nblocks);
+    run("sha256-mb", sha256_mb, data, window, nblocks);
+    for (int id = SMARTFS_FP_SHA256; id <= SMARTFS_FP_BLAKE3; id++) {
+        const fp_engine_t *e = fp_engine_get(id);
+        if (!e) {
+            printf("%-12s %15s\n", id == SMARTFS_FP_BLAKE3 ? "blake3" : "?", "(not built)");
+            continue;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "%s*", e->name);
+        run(name, e->hash_many, data, window, nblocks);
+    }
+    printf("# * = engine as used by smartfs (sha256* picks SHA-NI or multi-buffer)\n");
+    free(data);
+    return 0;
+}
@@ -0,0 +1,290 @@
+// =========================================================
+// 基准: 存储引擎热路径 (压缩 / 解压 / 指纹 / 写 / 读) 在几种典型数据上的表现
+// =========================================================
+// 生成 5 种语料，每种切成 4KB 块，逐块调用:
+//   sha256:     calculate_sha256
+//   compress:   smart_compress (文件系统默认编码器，和写入路径一样会跳过高熵块)
+//   decompress: smart_decompress (按 compress 那一步记下的编码器)
+//   write:      smart_write (查重 + 压缩 + 写 L3)
+//   read:       smart_read (L1 只有 100 块，大部分要从 L2 / L3 读出来解压)
+// 语料: text (单词拼成的文本)、binary (定长记录，字段有规律)、compressed (LZ4HC 压过的文本)、
+//       zeros (全零)、dupes (一半的块是前面某块的副本)。
+// 结果是 CSV (每种语料每一步一行，# 开头的是注释)，方便脚本比较两次运行:
+//   corpus,op,blocks,mb_s,ratio,p50_us,p99_us
+// ratio 是输入字节 / 存储字节 (compress: 压缩后的长度，write: 引擎统计的物理字节增量)，
+// 其他步骤、以及一个字节都没存 (zeros 的 write) 时留空。
+// 读回的数据逐块核对，不一致就报错退出 (返回 1)。
+// 存储引擎的文件固定在 /tmp/smartfs.*，已经存在时不运行，结束后删掉 (连同当前目录下的 L2 缓存文件)。
+// 用法: ./bench_storage [每种语料的 MB 数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include "smartfs_types.h"
+#include "storage.h"
+
+#define CORPUS_TEXT 0
+#define CORPUS_BINARY 1
+#define CORPUS_COMPRESSED 2
+#define CORPUS_ZEROS 3
+#define CORPUS_DUPES 4
+#define CORPUS_MAX 5
+
+extern StorageStats global_stats;   // smart_write.c
+
+static const char *corpus_names[CORPUS_MAX] = { "text", "binary", "compressed", "zeros", "dupes" };
+
+static const char *engine_files[] = {
+    "/tmp/smartfs.data", "/tmp/smartfs.idx", "/tmp/smartfs.idx.gc", "/tmp/smartfs.ref",
+    "/tmp/smartfs.fp", "/tmp/smartfs.bloom", "/tmp/smartfs.dict",
+    "/tmp/smartfs.archive", "/tmp/smartfs.atime",
+};
+// lru_init 在当前目录建的 L2 缓存文件 (每次挂载都作废，不用检查是否已经存在)
+#define L2_CACHE_FILE "smartfs_l2.cache"
+
+static const char *words[] = {
+    "the", "block", "file", "system", "data", "of", "and", "a", "to", "in", "is", "that", "write",
+    "read", "cache", "index", "inode", "directory", "snapshot", "version", "compress", "hash",
+    "storage", "layer", "with", "for", "on", "this", "are", "from", "by", "not", "be", "at", "it",
+};
+
+static FILE *out;
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned next_rand(unsigned *x) {
+    *x = *x * 1103515245 + 12345;
+    return *x >> 16;
+}
+
+static void fill_text(char *p, size_t len, unsigned seed) {
+    size_t pos = 0;
+    int col = 0;
+    while (pos < len) {
+        const char *w = words[next_rand(&seed) % (sizeof(words) / sizeof(words[0]))];
+        size_t n = strlen(w);
+        for (size_t i = 0; i < n && pos < len; i++) p[pos++] = w[i];
+        col += (int)n + 1;
+        if (pos < len) p[pos++] = (col > 72) ? '\n' : ' ';
+        if (col > 72) col = 0;
+    }
+}
+
+// 32 字节一条：递增的序号、几种类型、慢慢变的时间戳、8 字节随机数、补 0
+static void fill_binary(char *p, size_t len, unsigned seed) {
+    uint64_t stamp = 1700000000000ULL;
+    for (size_t off = 0, id = 0; off < len; off += 32, id++) {
+        unsigned char rec[32];
+        memset(rec, 0, sizeof(rec));
+        uint32_t rid = (uint32_t)id;
+        uint16_t type = (uint16_t)(next_rand(&seed) % 6);
+        stamp += next_rand(&seed) % 1000;
+        memcpy(rec, &rid, 4);
+        memcpy(rec + 4, &type, 2);
+        memcpy(rec + 8, &stamp, 8);
+        for (int i = 16; i < 24; i++) rec[i] = (unsigned char)next_rand(&seed);
+        memcpy(p + off, rec, len - off < 32 ? len - off : 32);
+    }
+}
+
+// 文本按 64KB 一段用 LZ4HC 压，压出来的首尾相接 (压不小的段换成随机数，一样是高熵数据)
+static int fill_compressed(char *p, size_t len, unsigned seed) {
+    const codec_t *c = codec_get(CODEC_LZ4HC);
+    size_t chunk = 64 * 1024;
+    char *src = malloc(chunk), *dst = malloc(chunk);
+    if (!c || !src || !dst) {
+        free(src);
+        free(dst);
+        return -1;
+    }
+    size_t pos = 0;
+    while (pos < len) {
+        fill_text(src, chunk, seed++);
+        int n = c->compress(src, (int)chunk, dst, (int)chunk, c->default_level);
+        if (n <= 0) {
+            for (size_t i = 0; i < chunk; i++) dst[i] = (char)next_rand(&seed);
+            n = (int)chunk;
+        }
+        size_t take = (size_t)n < len - pos ? (size_t)n : len - pos;
+        memcpy(p + pos, dst, take);
+        pos += take;
+    }
+    free(src);
+    free(dst);
+    return 0;
+}
+
+static int make_corpus(int kind, char *p, size_t nblocks, unsigned seed) {
+    size_t len = nblocks * BLOCK_SIZE;
+    switch (kind) {
+    case CORPUS_TEXT: fill_text(p, len, seed); return 0;
+    case CORPUS_BINARY: fill_binary(p, len, seed); return 0;
+    case CORPUS_COMPRESSED: return fill_compressed(p, len, seed);
+    case CORPUS_ZEROS: memset(p, 0, len); return 0;
+    case CORPUS_DUPES:
+        fill_text(p, len, seed);
+        for (size_t b = 1; b < nblocks; b += 2) {
+            size_t from = next_rand(&seed) % b;
+            memcpy(p + b * BLOCK_SIZE, p + from * BLOCK_SIZE, BLOCK_SIZE);
+        }
+        return 0;
+    }
+    return -1;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// 一行结果：lat 是每块的耗时 (秒，会被排序)，in / stored 算 ratio
+// (stored < 0 的步骤没有 ratio；stored == 0 是全存成空洞 / 全去重了，比值没有意义，也留空)
+static void emit(int kind, const char *op, double *lat, size_t n, double secs, double in, double stored) {
+    qsort(lat, n, sizeof(double), cmp_double);
+    double p50 = lat[n / 2], p99 = lat[n * 99 / 100 < n ? n * 99 / 100 : n - 1];
+    fprintf(out, "%s,%s,%zu,%.1f,", corpus_names[kind], op, n, in / secs / (1 << 20));
+    if (stored > 0) fprintf(out, "%.3f", in / stored);
+    fprintf(out, ",%.2f,%.2f\n", p50 * 1e6, p99 * 1e6);
+    fflush(out);
+}
+
+static int run_corpus(int kind, const char *data, size_t nblocks, double *lat) {
+    char *comp = malloc(nblocks * (BLOCK_SIZE + 100));
+    int *clen = malloc(nblocks * sizeof(int)), *codec = malloc(nblocks * sizeof(int));
+    int *ids = malloc(nblocks * sizeof(int));
+    if (!comp || !clen || !codec || !ids) {
+        free(comp); free(clen); free(codec); free(ids);
+        return -1;
+    }
+    double in = (double)nblocks * BLOCK_SIZE, t0, t, stored;
+    char buf[BLOCK_SIZE];
+    int ok = 1;
+
+    unsigned char digest[32];
+    t0 = now_sec();
+    for (size_t b = 0; b < nblocks; b++) {
+        t = now_sec();
+        calculate_sha256(data + b * BLOCK_SIZE, BLOCK_SIZE, digest);
+        lat[b] = now_sec() - t;
+    }
+    emit(kind, "sha256", lat, nblocks, now_sec() - t0, in, -1);
+
+    stored = 0;
+    t0 = now_sec();
+    for (size_t b = 0; b < nblocks; b++) {
+        t = now_sec();
+        clen[b] = smart_compress(data + b * BLOCK_SIZE, BLOCK_SIZE, comp + b * (BLOCK_SIZE + 100), &codec[b]);
+        lat[b] = now_sec() - t;
+        stored += clen[b];
+    }
+    emit(kind, "compress", lat, nblocks, now_sec() - t0, in, stored);
+
+    t0 = now_sec();
+    for (size_t b = 0; b < nblocks; b++) {
+        t = now_sec();
+        int n = smart_decompress(codec[b], 0, comp + b * (BLOCK_SIZE + 100), clen[b], buf, BLOCK_SIZE);
+        lat[b] = now_sec() - t;
+        if (n != BLOCK_SIZE || memcmp(buf, data + b * BLOCK_SIZE, BLOCK_SIZE) != 0) ok = 0;
+    }
+    emit(kind, "decompress", lat, nblocks, now_sec() - t0, in, -1);
+
+    unsigned long phys = global_stats.total_physical_bytes;
+    t0 = now_sec();
+    for (size_t b = 0; b < nblocks; b++) {
+        t = now_sec();
+        if (smart_write(kind + 1, (long)(b * BLOCK_SIZE), data + b * BLOCK_SIZE, BLOCK_SIZE, &ids[b]) != BLOCK_SIZE) ok = 0;
+        lat[b] = now_sec() - t;
+    }
+    emit(kind, "write", lat, nblocks, now_sec() - t0, in, (double)(global_stats.total_physical_bytes - phys));
+
+    // 块号 0 是空洞 (全零块)：和 main.c 一样不进存储引擎，直接补 0
+    t0 = now_sec();
+    for (size_t b = 0; b < nblocks; b++) {
+        t = now_sec();
+        int n = ids[b] > 0 ? smart_read(kind + 1, ids[b], buf, BLOCK_SIZE) : (memset(buf, 0, BLOCK_SIZE), BLOCK_SIZE);
+        lat[b] = now_sec() - t;
+        if (n != BLOCK_SIZE || memcmp(buf, data + b * BLOCK_SIZE, BLOCK_SIZE) != 0) ok = 0;
+    }
+    emit(kind, "read", lat, nblocks, now_sec() - t0, in, -1);
+
+    free(comp);
+    free(clen);
+    free(codec);
+    free(ids);
+    return ok ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    size_t mb = (argc > 1) ? (size_t)atoi(argv[1]) : 16;
+    size_t nblocks = mb * (1 << 20) / BLOCK_SIZE;
+    if (nblocks == 0) {
+        fprintf(stderr, "usage: %s [MB per corpus]\n", argv[0]);
+        return 1;
+    }
+
+    for (size_t i = 0; i < sizeof(engine_files) / sizeof(engine_files[0]); i++) {
+        if (access(engine_files[i], F_OK) == 0) {
+            fprintf(stderr, "%s exists: unmount SmartFS and remove /tmp/smartfs.* first\n", engine_files[i]);
+            return 1;
+        }
+    }
+
+    // 存储引擎每个块都打一行日志，结果另外输出到原来的 stdout
+    fflush(stdout);
+    out = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    if (!out || devnull < 0) { perror("redirect"); return 1; }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    lru_init(100);
+    if (storage_mount() != 0) {
+        fprintf(out, "storage_mount failed\n");
+        return 1;
+    }
+    storage_refs_rebuild_begin();   // 全新的引擎，没有要重建的引用
+    storage_refs_rebuild_end();
+
+    char *data = malloc(nblocks * BLOCK_SIZE);
+    double *lat = malloc(nblocks * sizeof(double));
+    if (!data || !lat) {
+        fprintf(out, "out of memory\n");
+        return 1;
+    }
+    fprintf(out, "# %zu MB per corpus, %d-byte blocks; ratio = input / stored bytes, latency per block\n",
+            mb, BLOCK_SIZE);
+    fprintf(out, "corpus,op,blocks,mb_s,ratio,p50_us,p99_us\n");
+    int ret = 0;
+    for (int kind = 0; kind < CORPUS_MAX && ret == 0; kind++) {
+        if (make_corpus(kind, data, nblocks, 12345u + (unsigned)kind * 7919u) != 0) {
+            fprintf(out, "# %s: cannot generate corpus\n", corpus_names[kind]);
+            continue;
+        }
+        if (run_corpus(kind, data, nblocks, lat) != 0) {
+            fprintf(out, "# %s: data read back does not match\n", corpus_names[kind]);
+            ret = 1;
+        }
+    }
+    free(data);
+    free(lat);
+    storage_unmount();
+
+    for (size_t i = 0; i < sizeof(engine_files) / sizeof(engine_files[0]); i++) unlink(engine_files[i]);
+    unlink(L2_CACHE_FILE);
+    // 垃圾回收换出来的各代数据文件和归档段
+    for (int gen = 1; gen < 1024; gen++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/smartfs.data.%d", gen);
+        unlink(path);
+        snprintf(path, sizeof(path), "/tmp/smartfs.archive.%d", gen);
+        unlink(path);
+    }
+    fclose(out);
+    return ret;
+}
@@ -0,0 +1,160 @@
+// =========================================================
+// 微基准: 写入吞吐量 vs 写线程数 (写入流水线)
+// =========================================================
+// 1~32 个线程同时写 (每个线程一个 "文件"，每次交 64 个 4KB 块，和 write_locked 一样)，
+// 数据都不重复，每块一半可压缩。对比两种方式:
+//   inline:   旧实现，指纹、查重、压缩、写 L3 都在写线程上做
+//   pipeline: 写入流水线，工作线程数 = CPU 核数
+// 除了总吞吐量，还按进程 CPU 时间折算成每个核的吞吐量 (MB/s / 用掉的核数)。
+// 存储引擎的文件固定在 /tmp/smartfs.*，已经存在 (有挂着的或者留下的 SmartFS) 时不运行，结束后删掉。
+// 用法: ./bench_write [每轮 MB 数]
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "smartfs_types.h"
+#include "storage.h"
+
+#define BATCH 64
+#define MAX_WRITERS 32
+
+static const char *engine_files[] = {
+    "/tmp/smartfs.data", "/tmp/smartfs.idx", "/tmp/smartfs.idx.gc", "/tmp/smartfs.ref",
+    "/tmp/smartfs.fp", "/tmp/smartfs.bloom", "/tmp/smartfs.dict",
+    "/tmp/smartfs.archive", "/tmp/smartfs.atime",
+};
+
+typedef struct {
+    int writer;
+    int round;
+    size_t nblocks;
+    int failed;
+} writer_arg_t;
+
+static double now_sec(clockid_t clk) {
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 前半块是重复的文本 (好压缩)，后半块是随机数；块号、线程、轮次都编进去，哪两块都不一样
+static void fill_block(char *blk, int round, int writer, size_t b) {
+    unsigned x = (unsigned)(round * 7919 + writer * 104729) ^ (unsigned)(b * 2654435761u);
+    for (int i = 0; i < BLOCK_SIZE / 2; i++) blk[i] = "smartfs write pipeline "[i % 23];
+    for (int i = BLOCK_SIZE / 2; i < BLOCK_SIZE; i++) {
+        x = x * 1103515245 + 12345;
+        blk[i] = (char)(x >> 16);
+    }
+    memcpy(blk, &round, sizeof(round));
+    memcpy(blk + 4, &writer, sizeof(writer));
+    memcpy(blk + 8, &b, sizeof(b));
+}
+
+static void *writer_main(void *p) {
+    writer_arg_t *a = p;
+    char *buf = malloc((size_t)BATCH * BLOCK_SIZE);
+    if (!buf) {
+        a->failed = 1;
+        return NULL;
+    }
+    const char *data[BATCH];
+    int lens[BATCH], ids[BATCH];
+    long offs[BATCH];
+    for (size_t b = 0; b < a->nblocks; b += BATCH) {
+        int n = (a->nblocks - b < BATCH) ? (int)(a->nblocks - b) : BATCH;
+        for (int i = 0; i < n; i++) {
+            fill_block(buf + (size_t)i * BLOCK_SIZE, a->round, a->writer, b + i);
+            data[i] = buf + (size_t)i * BLOCK_SIZE;
+            lens[i] = BLOCK_SIZE;
+            offs[i] = (long)((b + i) * BLOCK_SIZE);
+        }
+        if (smart_write_many(a->writer, offs, data, lens, n, ids) != 0) a->failed = 1;
+    }
+    free(buf);
+    return NULL;
+}
+
+// 跑一轮，返回总吞吐量 (MB/s)，*cores 是这段时间平均用掉的核数
+static double run(int round, int writers, size_t total_blocks, double *cores) {
+    pthread_t th[MAX_WRITERS];
+    writer_arg_t args[MAX_WRITERS];
+    double t0 = now_sec(CLOCK_MONOTONIC), c0 = now_sec(CLOCK_PROCESS_CPUTIME_ID);
+    for (int w = 0; w < writers; w++) {
+        args[w].writer = w + 1;
+        args[w].round = round;
+        args[w].nblocks = total_blocks / writers;
+        args[w].failed = 0;
+        pthread_create(&th[w], NULL, writer_main, &args[w]);
+    }
+    int failed = 0;
+    for (int w = 0; w < writers; w++) {
+        pthread_join(th[w], NULL);
+        failed |= args[w].failed;
+    }
+    double secs = now_sec(CLOCK_MONOTONIC) - t0, cpu = now_sec(CLOCK_PROCESS_CPUTIME_ID) - c0;
+    if (failed) return -1;
+    *cores = cpu / secs;
+    return (total_blocks / writers) * writers * (double)BLOCK_SIZE / secs / (1 << 20);
+}
+
+int main(int argc, char *argv[]) {
+    size_t mb = (argc > 1) ? (size_t)atoi(argv[1]) : 64;
+    size_t total_blocks = mb * (1 << 20) / BLOCK_SIZE;
+
+    for (size_t i = 0; i < sizeof(engine_files) / sizeof(engine_files[0]); i++) {
+        if (access(engine_files[i], F_OK) == 0) {
+            fprintf(stderr, "%s exists: unmount SmartFS and remove /tmp/smartfs.* first\n", engine_files[i]);
+            return 1;
+        }
+    }
+
+    // 存储引擎每个块都打一行日志，结果另外输出到原来的 stdout
+    fflush(stdout);
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    int devnull = open("/dev/null", O_WRONLY);
+    if (!out || devnull < 0) { perror("redirect"); return 1; }
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+
+    lru_init(100);
+    if (storage_mount() != 0) {
+        fprintf(out, "storage_mount failed\n");
+        return 1;
+    }
+    storage_refs_rebuild_begin();   // 全新的引擎，没有要重建的引用
+    storage_refs_rebuild_end();
+
+    int workers = write_pipeline_default_threads();
+    fprintf(out, "# %zu MB of unique 4KB blocks per run, %d blocks per call, pipeline workers: %d\n",
+            mb, BATCH, workers);
+    fprintf(out, "%-8s %12s %12s %12s %12s\n", "writers", "inline MB/s", "per core", "pipeline", "per core");
+    int round = 0;
+    for (int writers = 1; writers <= MAX_WRITERS; writers *= 2) {
+        double cores[2], rate[2];
+        write_pipeline_init(0);
+        rate[0] = run(round++, writers, total_blocks, &cores[0]);
+        write_pipeline_init(workers);
+        rate[1] = run(round++, writers, total_blocks, &cores[1]);
+        write_pipeline_shutdown();
+        if (rate[0] < 0 || rate[1] < 0) {
+            fprintf(out, "%-8d write failed\n", writers);
+            break;
+        }
+        fprintf(out, "%-8d %12.1f %12.1f %12.1f %12.1f\n", writers,
+                rate[0], rate[0] / cores[0], rate[1], rate[1] / cores[1]);
+        fflush(out);
+    }
+    storage_unmount();
+
+    for (size_t i = 0; i < sizeof(engine_files) / sizeof(engine_files[0]); i++) unlink(engine_files[i]);
+    for (int gen = 1; gen < 1024; gen++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/smartfs.data.%d", gen);
+        unlink(path);
+    }
+    fclose(out);
+    return 0;
+}
@@ -30,8 +30,27 @@ typedef struct {
     uint64_t inode_area_start;   // Inode区起始位置
     uint64_t data_area_start;
     uint64_t inode_bitmap_start;    // 数据区起始位置
+    uint32_t state;              // [新增] 挂载状态 (SMARTFS_STATE_*)
+    uint32_t inode_size;         // [新增] 磁盘 Inode 大小，与 sizeof(inode_t) 不一致说明是旧格式镜像
+    uint64_t features;           // [新增] 磁盘格式特性 (SMARTFS_FEATURE_*)
+    uint32_t fp_algo;            // [新增] 去重指纹算法 (SMARTFS_FP_*)，旧镜像是 0 = SHA-256
+    uint32_t reserved;
 } super_block_t;
 
+// 超级块 state: 正常卸载时为 CLEAN；挂载期间为 MOUNTED，
+// 如果挂载时发现不是 CLEAN (异常退出/旧镜像)，就从 Inode 表重建位图
+#define SMARTFS_STATE_CLEAN   1
+#define SMARTFS_STATE_MOUNTED 2
+
+// 超级块 features: 挂载时必须具备 SMARTFS_FEATURES_REQUIRED 里的所有位
+#define SMARTFS_FEATURE_HASHED_DIR (1ULL << 0)   // 多块哈希目录 + 变长目录项
+#define SMARTFS_FEATURES_REQUIRED  (SMARTFS_FEATURE_HASHED_DIR)
+
+// 超级块 fp_algo: mkfs 时选定，之后不能换 (指纹库里的摘要都是这个算法算的，换了就对不上)
+#define SMARTFS_FP_SHA256  0
+#define SMARTFS_FP_BLAKE2B 1     // BLAKE2b-512 取前 32 字节
+#define SMARTFS_FP_BLAKE3  2     // 需要编译时有 libblake3
+
 // ---------------------------------------------------------
 // 2. 数据块索引 (Block Pointer) - 用于去重
 // ---------------------------------------------------------
@@ -46,39 +65,122 @@ typedef struct {
 // ---------------------------------------------------------
 // 3. 文件版本 (File Version) - 透明版本管理的核心
 // ---------------------------------------------------------
+// 块映射 (Block Map): block_list_start_index 是一棵基数树的根
+//   map_depth == 0: 根本身就是唯一数据块的 Block ID (兼容旧的单块文件)
+//   map_depth == N: 根是磁盘上的索引块，每块存 BMAP_PTRS_PER_BLOCK 个指针，
+//                   共 N 层，最底层存数据块 ID；指针为 0 表示空洞
 typedef struct {
     uint32_t version_id;
     time_t timestamp;
     uint64_t file_size;
     uint64_t block_list_start_index;
-    uint32_t block_count;
+    uint32_t block_count;        // 逻辑块数 = ceil(file_size / BLOCK_SIZE)
     char commit_msg[64];
     int is_pinned; // [新增] 1=锁定(不被自动清理), 0=普通
+    uint16_t map_depth;          // [新增] 块映射树高度
+    uint16_t map_shared;         // [新增] 1=索引块与上一版本共享，写入前需先复制 (CoW)
 } file_version_t;
 
+#define BMAP_PTRS_PER_BLOCK (BLOCK_SIZE / sizeof(uint64_t)) // 每个索引块 512 个指针
+#define BMAP_MAX_DEPTH 4
+
 // ---------------------------------------------------------
 // 4. Inode (元数据) - 文件的“户口本”
 // ---------------------------------------------------------
+// 磁盘上的 Inode 固定 256 字节 (一个块放 16 个)，只保存热数据：
+// 属性 + 最新版本 current。历史版本和扩展属性放在单独的版本历史表里，
+// 只有访问 @vN/@2h、创建快照、Pin、读写 xattr 时才需要读它。
+#define SMARTFS_INODE_SIZE 256
+
+// [新增] 内联数据：不超过 SMARTFS_INLINE_MAX 字节的普通文件和软链接目标直接放在 Inode 里，
+// 不分配数据块、不算指纹、不压缩、不进 L3。普通文件长大超过上限或者要做快照时搬到数据块里
+// (有历史版本的文件不内联，版本之间靠块映射共享数据)
+#define SMARTFS_INLINE_MAX 96
+#define SMARTFS_INODE_INLINE 0x1     // inode.flags: 数据在 inline_data 里，current 没有块映射
+
+// [新增] 按文件 / 目录的压缩策略 (xattr user.smartfs.compress)：flags 的 8~15 位是编码器 id + 1
+// (0 = 跟文件系统默认)，16~23 位是级别 (0 = 编码器默认)。新建的文件和子目录继承父目录的策略
+#define SMARTFS_INODE_CODEC_SHIFT 8
+#define SMARTFS_INODE_CODEC_MASK 0xff00
+#define SMARTFS_INODE_LEVEL_SHIFT 16
+#define SMARTFS_INODE_LEVEL_MASK 0xff0000
+#define SMARTFS_INODE_POLICY_MASK (SMARTFS_INODE_CODEC_MASK | SMARTFS_INODE_LEVEL_MASK)
+
 typedef struct {
     uint64_t inode_id;           // 唯一编号
     mode_t   mode;               // 文件类型和权限 (rwxr-xr-x)
     uint32_t uid;                // 用户ID
     uint32_t gid;                // 组ID
     uint32_t latest_version;     // 当前最新版本号
-    uint32_t total_versions;     // 历史版本总数
+    uint32_t total_versions;     // 历史版本总数 (包含 current)
     uint32_t link_count;
-    // 版本链表/数组：指向该文件的所有历史版本
-    // 这里简单化处理，实际可能需要单独的元数据区存储版本信息
-    file_version_t versions[MAX_VERSIONS]; 
-    xattr_entry_t xattrs[4];
+    uint32_t xattr_count;        // [新增] 有效扩展属性个数，为 0 时不用读历史表
+    uint32_t flags;              // [修改] SMARTFS_INODE_* 标志
+    uint64_t history_block;      // [新增] 版本历史表的起始块号，0 = 还没有历史 (只有 current)
+    file_version_t current;      // [新增] 最新版本 (读写/getattr 只看这里)
+    uint8_t  inline_data[SMARTFS_INLINE_MAX]; // [修改] 内联数据 (原来的预留区)，凑满 SMARTFS_INODE_SIZE
 } inode_t;
+
+// 编译期检查：改了 inode_t 却忘了调整 SMARTFS_INLINE_MAX 会直接编译失败
+typedef char smartfs_inode_size_check[(sizeof(inode_t) == SMARTFS_INODE_SIZE) ? 1 : -1];
+
 // ---------------------------------------------------------
-// 5. 目录项 (Directory Entry)
+// 4.1 版本历史表 (Version Table) - Inode 的“附页”
 // ---------------------------------------------------------
-// 目录本质上是一个特殊的文件，它的内容就是一堆这种结构体
+// 占用数据区里连续的 VERSION_TABLE_BLOCKS 个块 (由 inode.history_block 指向)。
+// 最后一项是 current 的副本，可能过期：读入后总以 inode.current 为准。
 typedef struct {
-    char     name[MAX_FILENAME]; // 文件名 (例如 "homework.doc")
-    uint64_t inode_no;           // 对应的 Inode 编号
-    uint8_t  is_valid;           // 1=有效，0=已删除
-} smartfs_dir_entry_t;
+    uint32_t total_versions;
+    uint32_t latest_version;
+    file_version_t versions[MAX_VERSIONS];
+    xattr_entry_t xattrs[4];
+} version_table_t;
+
+#define VERSION_TABLE_BLOCKS ((sizeof(version_table_t) + BLOCK_SIZE - 1) / BLOCK_SIZE)
+
+// ---------------------------------------------------------
+// 5. 目录 (Directory) - 可扩展哈希 (Extendible Hashing)
+// ---------------------------------------------------------
+// 目录本质上也是一个通过块映射组织的“文件”，只是映射里存的是磁盘块号：
+//   逻辑块 0                 目录头 (dir_header_t)，小目录的槽位表就在里面
+//   逻辑块 1 .. nblocks-1    叶子块，存变长目录项
+//   逻辑块 DIR_TABLE_LBLK+   大目录 (global_depth > DIR_INLINE_DEPTH) 的槽位表
+// 名字哈希的低 global_depth 位选槽位，槽位指向叶子；叶子满了就一分为二，
+// 查找/插入/删除都只需要读 槽位表 + 一个叶子。
+#define DIR_MAGIC           0x52494453   // "SDIR"
+#define DIR_INLINE_DEPTH    9            // 512 个槽位以内放在目录头里
+#define DIR_MAX_DEPTH       20           // 最多 2^20 个槽位
+#define DIR_TABLE_LBLK      (1u << 21)   // 外部槽位表的起始逻辑块
+#define DIR_SLOTS_PER_BLOCK (BLOCK_SIZE / sizeof(uint32_t))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t global_depth;       // 槽位表有 2^global_depth 项
+    uint32_t nblocks;            // 已使用的逻辑块数 (目录头 + 叶子)
+    uint32_t reserved;
+    uint64_t nentries;           // 目录项总数 (不含 . 和 ..)
+    uint64_t parent_ino;         // 上级目录，readdir 用它生成 ".."
+    uint32_t table[(BLOCK_SIZE - 32) / sizeof(uint32_t)]; // 槽位 -> 叶子的逻辑块号
+} dir_header_t;
+
+// 叶子块头，后面紧跟首尾相接的目录项，直到块尾
+typedef struct {
+    uint32_t magic;
+    uint16_t local_depth;        // 这个叶子负责哈希低 local_depth 位相同的名字
+    uint16_t count;              // 叶子里的有效目录项数
+} dir_leaf_t;
+
+// 变长目录项 (名字不带 \0)
+typedef struct {
+    uint64_t inode_no;           // 0 = 空闲记录
+    uint16_t rec_len;            // 记录占用的字节数 (含尾部空闲)，按 8 字节对齐
+    uint8_t  name_len;
+    uint8_t  file_type;          // mode >> 12，readdir 不用再读子 Inode
+    char     name[];
+} smartfs_dirent_t;
+
+#define DIRENT_HEADER_SIZE 12    // offsetof(smartfs_dirent_t, name)
+#define DIRENT_SIZE(name_len) ((DIRENT_HEADER_SIZE + (name_len) + 7) & ~7)
+
+typedef char smartfs_dir_header_size_check[(sizeof(dir_header_t) == BLOCK_SIZE) ? 1 : -1];
 #endif
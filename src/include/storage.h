@@ -2,35 +2,243 @@
 #define SMARTFS_STORAGE_H
 
 #include <stddef.h> // 为了识别 size_t
+
+// [新增] 块在 L3 数据文件里的位置。没压缩的块 (raw) 可以直接从 fd 读或者 splice 给内核
+typedef struct {
+    int fd;
+    long offset;
+    int length;     // 存储的长度
+    int raw_len;    // 解压后的长度 (旧索引里是 0)
+    int raw;        // 1 = 存的就是原文
+    int recipe;     // [新增] 1 = 分片清单 (CDC 模式下一个逻辑块由哪几个数据块的哪几段拼成)
+    int codec;      // [新增] 压缩用的编码器 (CODEC_*，原文和分片清单是 CODEC_NONE)
+    int dict_id;    // [新增] 压缩用的字典版本 (dict.c)，0 = 没用字典
+    int archived;   // [新增] 1 = 在归档段里 (冷块用强编码器重新压过，见 archive.c)
+} l3_extent_t;
+
 void storage_attach_disk(int fd);
 // === 模块 C 功能清单 ===
 
 // 1. 计算数据指纹 (来自 dedup.c)
-void calculate_sha256(const char *input, size_t len, char *output);
+// [修改] 输出 32 字节的原始摘要，不再转成 64 个十六进制字符 (只有打印时才需要)
+#define FP_DIGEST_LEN 32
+void calculate_sha256(const char *input, size_t len, unsigned char *digest);
+
+// [新增] 可选的指纹算法 (id 见 smartfs_types.h SMARTFS_FP_*)，镜像里记着用哪个
+typedef struct {
+    int id;
+    const char *name;
+    void (*hash)(const char *input, size_t len, unsigned char *digest);
+    // 一次算一批 (写入路径凑齐一批块再算，多缓冲实现一条指令推进多个块)
+    void (*hash_many)(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]);
+} fp_engine_t;
+
+const fp_engine_t *fp_engine_get(int id);   // 这个构建不支持返回 NULL
+int fp_engine_select(int id);               // 挂载时按超级块选定，不支持返回 -1
+const fp_engine_t *fp_engine_current();
+// 按当前算法算指纹 (写入路径用这两个)
+void calculate_fingerprint(const char *input, size_t len, unsigned char *digest);
+void calculate_fingerprints(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]);
+
+// [新增] 多缓冲 SHA-256 (sha256_mb.c)：n <= SHA256_MB_LANES 个消息一起算，结果和 SHA-256 一致
+#define SHA256_MB_LANES 8
+void sha256_mb(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]);
+
+// [新增] 指纹索引 (fp_index.c)：摘要 -> 块号，开放寻址哈希表，不加锁 (调用者持有 fp_lock)
+int fp_index_lookup(const unsigned char *digest);           // 没有返回 -1
+int fp_index_insert(const unsigned char *digest, int block_id);
+void fp_index_foreach(void (*fn)(const unsigned char *digest, int block_id, void *arg), void *arg);
+unsigned long fp_index_count();
+void fp_index_clear();
+void fp_index_report();
+
+// [新增] 持久化指纹库 (fp_store.c)：日志 + fp_index + Bloom 过滤器，线程安全
+int fp_store_open();                                        // 挂载时调用，日志在后台加载
+void fp_store_close();
+int fp_store_lookup(const unsigned char *digest);           // 没有返回 -1
+void fp_store_add(const unsigned char *digest, int block_id);
+void fp_store_report();
+
+// [新增] 存储引擎挂载/卸载：恢复块号分配位置、打开指纹库
+// [修改] 还要读入块引用计数、启动 L3 垃圾回收
+int storage_mount();
+void storage_unmount();
+
+// [新增] 块引用计数 (smart_write.c)：块映射里每指向一次算一个引用，分片清单每一段算它的数据块一个引用。
+// 写入接口 (smart_write*) 返回的块号已经带着调用者的一个引用；计数归零的块由 L3 垃圾回收清掉
+void storage_ref_block(int block_id);       // 再加一个引用 (快照、写时复制复制了指向它的指针)
+void storage_release_block(int block_id);   // 去掉一个引用 (覆盖、截断、删除、淘汰版本)
+int storage_block_live(int block_id);       // [新增] 块还有没有引用 (引用计数还没重建时都当没有)
+// 引用计数文件不存在或者上次没有正常卸载：挂载后由调用者从元数据重建，
+// begin 清零 -> 每个指针 storage_ref_block 一次 -> end (补上清单对数据块的引用，启动垃圾回收)
+int storage_refs_need_rebuild();
+void storage_refs_rebuild_begin();
+void storage_refs_rebuild_end();
+// 垃圾回收提交之前调用，让 Inode / 块映射先落盘 (挂载前设置)
+void storage_set_metadata_sync(int (*fn)(void));
+
+// [新增] 压缩编码器。id 记在 L3 索引条目里 (一个字节)，已经写进镜像的 id 不能改
+#define CODEC_NONE 0        // 原文
+#define CODEC_LZ4 1
+#define CODEC_LZ4HC 2
+#define CODEC_ZSTD 3        // 编译时找到 libzstd 才有
+#define CODEC_MAX 4
+#define CODEC_LEGACY 255    // 旧索引没记编码器：先按 LZ4 解，失败当原文 (只能解压)
+#define CODEC_DEFAULT -1    // 文件策略：跟文件系统默认
+
+typedef struct {
+    int id;
+    const char *name;
+    int min_level, max_level, default_level;
+    int fast_level;         // 系统负载高时用的级别
+    // 输出不超过 cap 字节，压不进去返回 <= 0
+    int (*compress)(const char *input, int input_len, char *output, int cap, int level);
+    int (*decompress)(const char *input, int input_len, char *output, int cap);   // 失败返回 < 0
+} codec_t;
+
+const codec_t *codec_get(int id);           // 这个构建不支持返回 NULL
+// "lz4" / "lz4hc:12" / "zstd:19" / "none"，不合法或不支持返回 -1；没写级别时 *level = 0 (编码器默认)
+int codec_parse(const char *spec, int *codec, int *level);
+int codec_format(int codec, int level, char *buf, size_t size);
+// 文件系统默认的编码器 (挂载选项 -o compress=)，默认 lz4
+int compress_set_default(int codec, int level);
+// 按文件的策略 (main.c 从 Inode 里取出来，写之前设好)；codec = CODEC_DEFAULT 回到文件系统默认
+void compress_set_file_policy(long inode_id, int codec, int level);
+void compress_forget_file(long inode_id);   // [新增] 文件删掉时调用 (Inode 号会分给新文件)
 
 // 2. 智能压缩 (来自 compress.c)
-int smart_compress(const char *input, int input_len, char *output);
+// [修改] 先采样估计熵，已经压不动的数据 (压缩/加密过的) 不跑压缩；系统负载每秒采样一次
+// [修改] *codec 返回实际用的编码器 (存原文时是 CODEC_NONE)，落盘时要一起记进 L3 索引
+int smart_compress(const char *input, int input_len, char *output, int *codec);
+// [新增] 同上，另外按 Inode 记住压不动的文件 (连续几块都压不动)，之后这个文件的块直接存原文
+// [修改] 按这个文件的策略选编码器
+// [修改] dict_id 不为空时，小块 (不超过 DICT_BLOCK_MAX) 有训练好的字典就用 zstd + 字典压，
+// *dict_id 返回字典版本 (没用字典是 0)，落盘时和编码器一起记进 L3 索引
+int smart_compress_file(long inode_id, const char *input, int input_len, char *output, int *codec, int *dict_id);
+void compress_report();
+double get_system_load();   // [新增] 1 分钟平均负载 (每秒最多读一次)
 
 // 3. 智能解压 (来自 compress.c)
-int smart_decompress(const char *input, int input_len, char *output, int max_output_len);
+// [修改] 按块记着的编码器 (和字典版本) 解压，不再猜；失败返回 -1
+int smart_decompress(int codec, int dict_id, const char *input, int input_len, char *output, int max_output_len);
+
+// [新增] 小块的字典压缩 (dict.c)：写入路径抽样，后台训练 zstd 字典，按版本追加进字典文件，只增不删。
+// 没有 libzstd 的构建里不训练、dict_compress 一直返回 0
+#define DICT_BLOCK_MAX 2048
+int dict_open();                            // 挂载时读入已有的字典，启动后台训练
+void dict_close();
+void dict_sample(const char *data, int len);
+// 用最新一版字典压 (level <= 0 用默认级别)，没有字典或者压不小返回 <= 0，成功时 *dict_id 是字典版本
+int dict_compress(const char *input, int input_len, char *output, int cap, int level, int *dict_id);
+int dict_decompress(int dict_id, const char *input, int input_len, char *output, int cap);
+int dict_train_now();                       // 测试和基准用：马上用已有样本训练一版，返回字典版本，失败 -1
+void dict_report();
+
+// [新增] 冷块归档 (archive.c)：记每个块最后一次被读写的日子，空闲时把好几天没碰过的
+// LZ4 块用最强的编码器 (有 zstd 用 zstd:19，否则 lz4hc:12) 重新压一遍，挪进 L3 归档段。
+// 挂载选项 -o archive_days=N (默认 30，0 = 关掉)
+#define ARCHIVE_DEFAULT_DAYS 30
+void archive_configure(int days);
+int archive_open();                         // 挂载时读入访问记录，启动后台线程
+void archive_close();                       // 停后台线程，访问记录落盘
+void archive_touch(int block_id);           // 块被读写 (去重命中也算) 时调用
+// 同步扫一遍 (测试和基准用)：min_age_days 天没碰过的块就归档，throttle = 0 不让路，返回归档的块数
+int archive_run(int min_age_days, int throttle);
+void archive_report();
+
+// [新增] 内容定义分块 (cdc.c, FastCDC)：挂载选项 -o cdc[=min:avg:max] 打开
+#define CDC_MIN_CHUNK 512
+#define CDC_MAX_CHUNK (256 * 1024)
+#define CDC_DEFAULT_MIN 2048
+#define CDC_DEFAULT_AVG 8192
+#define CDC_DEFAULT_MAX 65536
+int cdc_configure(size_t min, size_t avg, size_t max);   // 参数不合法返回 -1
+int cdc_enabled();
+size_t cdc_next_cut(const unsigned char *src, size_t n); // 从 src 开头切下一块，返回块长
 
 // === 模块 C 核心业务接口 ===
 
 // 智能写入函数 (总指挥)
 int smart_write(long inode_id, long offset, const char *data, int len, int *out_block_id);
+// [新增] 调用者已经算好了指纹 (calculate_fingerprints 一批算的)
+int smart_write_digest(long inode_id, long offset, const char *data, int len,
+                       const unsigned char *digest, int *out_block_id);
+// [新增] 全零块检测：是全零块就记进统计、返回 1 (调用者把它当空洞，块号 0)，否则返回 0。
+// smart_write / smart_write_many / smart_write_cdc 都先过这一步，全零块的块号是 0
+int storage_zero_block(const char *data, int len);
+// [新增] 写入流水线的查重、落盘两步 (write_pipeline.c 在工作线程上调用)
+// 查重命中返回块号 (已带一个引用)，没有返回 0；落盘返回新块号，失败返回 -1
+int storage_dedup_block(const unsigned char *digest, int len);
+int storage_store_block(const char *data, int len, const char *compressed, int c_size, int codec, int dict_id,
+                        const unsigned char *digest);
+// [新增] CDC 模式写入：data 是从 offset 开始的连续逻辑块 (只有最后一块可能不满 4KB)。
+// 整段按内容切块、按块去重，每个逻辑块存成一个分片清单；整块和已有数据一样时直接引用。
+// out_block_ids[i] 是第 i 个逻辑块的块号，成功返回 len，失败返回 -1
+int smart_write_cdc(long inode_id, long offset, const char *data, int len, int *out_block_ids);
+
+// === [新增] 并行写入流水线 (write_pipeline.c) ===
+// 指纹 -> 查重 -> 压缩 -> 落盘 四个阶段分到一组工作线程上；流水线满了提交的线程要等 (反压)
+void write_pipeline_init(int nthreads);     // nthreads <= 0: 不开线程，在调用线程上做
+void write_pipeline_shutdown();
+int write_pipeline_default_threads();       // 在线 CPU 核数 (有上限，单核返回 0)
+// 一批块 (每块不超过 4KB) 一起写，全部完成才返回。out_block_ids[i] 带调用者的一个引用；
+// 都成功返回 0，有块失败返回 -1 (失败的块是 -1，成功的照样填好；[新增] 全零块是 0)
+int smart_write_many(long inode_id, const long *offsets, const char *const *data, const int *lens,
+                     int n, int *out_block_ids);
+void write_pipeline_report();
 
 // === LRU 缓存接口 ===
 void lru_init(int capacity);
-void lru_put(int block_id, const char *data); // 只有 ID 和 数据
-char* lru_get(int block_id);
+// 以下接口都是线程安全的
+void lru_put(int block_id, const char *data, int len); // ID + 数据 + 长度
+// [修改] 命中时把数据拷进 out (至少 4096 字节) 并返回长度，未命中返回 -1
+int lru_get(int block_id, char *out);
+// [新增] 只拷块里 [off, off + len) 这一段，块里没有的部分补 0；命中返回块的长度，未命中返回 -1
+int lru_read(int block_id, int off, char *out, int len);
+// [新增] 块是否在 L1 里 (不影响 LRU 顺序)
+int lru_contains(int block_id);
 
 // 智能读取函数
+// [修改] 块比 size 短时后面补 0，返回块里的有效长度
 int smart_read(long inode_id, long offset, char *buffer, int size);
 
+// [新增] 零拷贝读：读块里 [off, off + len) 这一段到 dst，块里没有的部分补 0，返回有效字节数，失败返回 -1。
+// 缓存命中只拷一次，整块读压缩块时直接解压进 dst。
+// ext 不为空时，不在缓存里的未压缩块不读数据：ext->fd >= 0，有效字节由调用者从 ext 指的位置 splice
+int smart_read_range(int block_id, int off, int len, char *dst, l3_extent_t *ext);
+
+// === [新增] 预读接口 (prefetch.c) ===
+// 后台线程把块从 L3 读出、解压后放进 L1，顺序读到那里时直接命中
+void prefetch_init(int nthreads);
+void prefetch_shutdown();
+// 非阻塞：把块号放进预读队列，队列满了就丢掉，返回实际入队的个数
+int prefetch_submit(const int *block_ids, int n);
+void prefetch_report();
+// 同步把一个块预读进 L1：已在缓存返回 0，读入返回 1，失败返回 -1
+int smart_prefetch(int block_id);
+
 // === [新增] L3 物理磁盘存储接口 (在这里添加!) ===
-int l3_write(int block_id, const char *data, int len);
+// [修改] raw_len 是压缩前的长度 (len == raw_len 表示存的是原文)
+// [修改] codec 是压缩用的编码器，和长度一起记在索引条目里；[新增] dict_id 是用的字典版本 (0 = 没用)
+int l3_write(int block_id, const char *data, int len, int raw_len, int codec, int dict_id);
+// [新增] 写分片清单 (不压缩，l3_locate 返回 recipe = 1)
+int l3_write_recipe(int block_id, const char *data, int len);
 int l3_read(int block_id, char *buffer, int max_len);
 
+int l3_locate(int block_id, l3_extent_t *ext);
+// [新增] L3 索引里用过的最大块号 + 1 (块号分配从这里继续，重新挂载也不会重用)
+int l3_next_block_id();
+// [新增] L3 垃圾回收：块的最后一个引用没了就 l3_release，死掉的字节多了后台线程压缩数据文件
+void l3_release(int block_id, int length);
+int l3_gc_start(int (*live)(int block_id), int (*sync_metadata)(void));
+void l3_gc_stop();
+int l3_gc_run(int throttle);    // 同步回收一次 (throttle = 0 不限速)，返回回收的字节数，失败返回 -1
+void l3_gc_report();
+// [新增] 把压缩块换成 codec 重新压过的 data，放进归档段。old 是调用者之前 l3_locate 的结果，
+// 条目在这之间变了 (块被释放、已经归档) 或者归档段这期间换了代，就什么也不改，返回 -1
+int l3_archive(int block_id, const l3_extent_t *old, const char *data, int len, int codec);
+unsigned long l3_activity();    // [新增] 前台读写计数，后台任务用来判断是否空闲
+
 // === 模块 C 监控接口 ===
 
 typedef struct {
@@ -38,9 +246,14 @@ typedef struct {
     unsigned long bytes_after_dedup;     // 去重后大小
     unsigned long total_physical_bytes;  // 实际物理大小(压缩后)
     unsigned long deduplication_count;   // 触发去重的次数
+    unsigned long zero_blocks;           // [新增] 全零块 (存成空洞，没进 L3) 的个数
 } StorageStats;
 
 // 打印监控报表
 void print_storage_report();
 
+// [新增] 其他模块 (如 Inode 缓存) 往报表里追加自己的统计，最多 STORAGE_REPORT_MAX 个
+#define STORAGE_REPORT_MAX 8
+void storage_add_report(void (*fn)(void));
+
 #endif
\ No newline at end of file
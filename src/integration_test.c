@@ -15,13 +15,14 @@ int main() {
 
     // 2. 写入数据 (预期：会触发 lru_put)
     printf("\n--- 步骤1: 写入数据 ---\n");
-    smart_write(101, 0, data, len);
+    int block_id = 0;
+    smart_write(101, 0, data, len, &block_id);
 
     // 3. 马上读取 (预期：应该命中缓存，速度极快)
     printf("\n--- 步骤2: 读取数据 ---\n");
     char read_buf[100];
-    // 这里的 offset 0 对应我们在 smart_read 里模拟的 block_id 1
-    smart_read(101, 0, read_buf, len); 
+    // [修改] 第二个参数是 smart_write 返回的块号
+    smart_read(101, block_id, read_buf, len);
     print_storage_report();
 
     return 0;
@@ -1,6 +1,6 @@
 #define FUSE_USE_VERSION 31
 
-#include <fuse3/fuse.h>
+#include <fuse3/fuse_lowlevel.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 #include "smartfs_types.h"
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -15,11 +16,69 @@
 #include "versioning/version_mgr.h"
 #include "versioning/version_utils.h"
 #include "storage.h"
+#include "metadata/block_map.h"
+#include "metadata/bitmap.h"
+#include "metadata/dcache.h"
+#include "metadata/dir.h"
+#include "metadata/icache.h"
 
 // 全局变量
 static int disk_fd = -1;
 static super_block_t sb;
+static smartfs_bitmap_t inode_bitmap;  // [新增] 常驻内存的 Inode 位图
+static smartfs_bitmap_t block_bitmap;  // [新增] 常驻内存的 Block 位图
+static int write_threads = 0;          // [新增] 写入流水线的工作线程数 (挂载选项，smartfs_init 里启动)
+// [新增] 多线程下的锁 (加锁顺序: rename_lock -> Inode 锁 -> alloc_lock)
+//   alloc_lock:  两张位图 + sb.free_blocks + 超级块落盘
+//   rename_lock: 同一时刻只有一个 rename 在跨目录搬东西 (和 Linux 的 s_vfs_rename_mutex 一样)
+//   Inode 锁:    见 icache_lock，文件内容/属性/目录内容/写缓冲都由它保护
+//   of_lock:     打开文件表 (最内层)
+//   node_lock:   内核 lookup 引用计数表 (只会在它里面再拿 inval_lock)
+//   inval_lock:  失效通知队列 (最内层)
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t rename_lock = PTHREAD_MUTEX_INITIALIZER;
 static const char *disk_path = "test.img";
+
+// 单次 FUSE 读写请求的最大字节数 (内核上限为 1MB)
+#define SMARTFS_MAX_IO_SIZE (1024 * 1024)
+// 目录项缓存的条目上限 (正向 + 负向)
+#define DCACHE_CAPACITY 65536
+// [新增] Inode 缓存条目数 (每条约 300 字节)
+#define ICACHE_CAPACITY 16384
+// [新增] 每个打开的文件最多缓存多少个脏块 (32 块 = 128KB)；不小于这个大小的写请求直接落盘
+#define WBUF_BLOCKS 32
+// [新增] 写入时一次算多少个块的指纹 (多缓冲 SHA-256 一次 8 条通道)
+// [修改] 一次交给写入流水线的块数：一批分到所有工作线程上，256KB 足够把它们都喂饱
+#define WRITE_BATCH 64
+// [新增] 顺序读预读窗口 (块数)：起步 4 块，命中率高就翻倍，最多 32 块
+#define RA_MIN_BLOCKS 4
+#define RA_MAX_BLOCKS 32
+#define PREFETCH_THREADS 2
+// [修改] L1 缓存块数 (原来 100 块)：一次读请求最多 256 块，预读进来的块要在后面的请求到达前留在 L1 里，
+// 100 块时一个 1MB 的读请求就把前面预读的块全挤出去了。按 4 路顺序读 × (最大请求 + 预读窗口) 算，约 4.5MB
+#define L1_CACHE_BLOCKS (4 * (SMARTFS_MAX_IO_SIZE / BLOCK_SIZE + RA_MAX_BLOCKS))
+// [修改] 内核缓存目录项、属性、“不存在”的时间 (秒)。
+// 所有经过内核的修改内核自己会更新缓存；内核不知道的变化 (快照改了版本视图) 由失效通知纠正，
+// 所以可以放心缓存很久，ls -l / stat 基本不用进用户态
+#define SMARTFS_ENTRY_TIMEOUT 60.0
+#define SMARTFS_ATTR_TIMEOUT 60.0
+#define SMARTFS_NEGATIVE_TIMEOUT 60.0
+// [新增] 记录内核 lookup 引用计数的哈希桶数
+#define NODE_BUCKETS 4096
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+// [新增] fallocate 打洞、lseek 找数据/空洞 (没开 _GNU_SOURCE 时头文件里没有)
+#ifndef FALLOC_FL_KEEP_SIZE
+#define FALLOC_FL_KEEP_SIZE 0x01
+#endif
+#ifndef FALLOC_FL_PUNCH_HOLE
+#define FALLOC_FL_PUNCH_HOLE 0x02
+#endif
+#ifndef SEEK_DATA
+#define SEEK_DATA 3
+#define SEEK_HOLE 4
+#endif
 void wal_init();
 void wal_begin(const char *op_name);
 void wal_log_write(int block_id, uint32_t checksum);
@@ -30,201 +89,840 @@ int backup_create(const char *backup_file, int is_full);
 // Level 1: 基础磁盘操作 (必须放在最前面)
 // =========================================================
 
-// 读取 Inode 信息
+// 读取 Inode 信息 (先查 Inode 缓存，命中时没有系统调用)
 void load_inode(uint64_t inode_id, inode_t *inode) {
-    off_t offset = sb.inode_area_start * BLOCK_SIZE + inode_id * sizeof(inode_t);
-    lseek(disk_fd, offset, SEEK_SET);
-    read(disk_fd, inode, sizeof(inode_t));
+    icache_read(inode_id, inode);
 }
 
-// 保存 Inode 信息
+// 保存 Inode 信息 (只写进缓存并标记为脏，flush/fsync/卸载时统一写回)
 void save_inode(inode_t *inode) {
-    off_t offset = sb.inode_area_start * BLOCK_SIZE + inode->inode_id * sizeof(inode_t);
-    lseek(disk_fd, offset, SEEK_SET);
-    write(disk_fd, inode, sizeof(inode_t));
+    icache_write(inode);
 }
 
-// 保存超级块
+// 保存超级块 (调用者持有 alloc_lock，或者还没有启动多线程)
 void save_superblock() {
-    lseek(disk_fd, 0, SEEK_SET);
-    write(disk_fd, &sb, sizeof(super_block_t));
+    pwrite(disk_fd, &sb, sizeof(super_block_t), 0);
+}
+
+// Inode 表能容纳多少个 Inode (由 mkfs 预留的 Inode 区大小决定)
+static uint64_t inode_capacity() {
+    return (sb.data_area_start - sb.inode_area_start) * BLOCK_SIZE / sizeof(inode_t);
 }
 
-// 分配新的 Inode
+// 分配新的 Inode (位图里找空位，不再逐个 load_inode)
 uint64_t allocate_inode() {
+    pthread_mutex_lock(&alloc_lock);
+    int64_t ino = bitmap_alloc(&inode_bitmap);
+    pthread_mutex_unlock(&alloc_lock);
+    if (ino < 0) return 0;
+    return (uint64_t)ino;
+}
+
+// 把 Inode 号还给位图 (free_inode 或者创建失败时调用)
+static void release_inode_no(uint64_t inode_id) {
+    pthread_mutex_lock(&alloc_lock);
+    bitmap_clear(&inode_bitmap, inode_id);
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// 分配新的数据块 (位图分配，回收的块可以再次使用)
+uint64_t allocate_block() {
+    pthread_mutex_lock(&alloc_lock);
+    int64_t blk = bitmap_alloc(&block_bitmap);
+    if (blk >= 0) sb.free_blocks--;
+    pthread_mutex_unlock(&alloc_lock);
+    if (blk < 0) return 0;
+    return (uint64_t)blk;
+}
+
+// 回收数据块 (块映射释放索引块、删除目录/软链接时调用)
+void free_block(uint64_t block_no) {
+    if (block_no < sb.data_area_start || block_no >= sb.total_blocks) return;
+    pthread_mutex_lock(&alloc_lock);
+    if (bitmap_test(&block_bitmap, block_no)) {
+        bitmap_clear(&block_bitmap, block_no);
+        sb.free_blocks++;
+    }
+    pthread_mutex_unlock(&alloc_lock);
+}
+
+// [新增] 块映射里多了 / 少了一个指向数据块的指针 (block_map.c 调用)，转给存储引擎的引用计数
+void data_block_ref(uint64_t block_id) {
+    storage_ref_block((int)block_id);
+}
+
+void data_block_unref(uint64_t block_id) {
+    storage_release_block((int)block_id);
+}
+
+// ---------------------------------------------------------
+// [新增] 版本历史表 (只有访问历史版本/快照/Pin/xattr 时才读写)
+// ---------------------------------------------------------
+
+// 读入版本历史表；还没有历史表的文件只有 current 一个版本
+// 表里的最后一项总是用 inode.current 覆盖 (普通写入只更新 inode，不写历史表)
+int load_history(const inode_t *inode, version_table_t *vt) {
+    memset(vt, 0, sizeof(version_table_t));
+    if (inode->history_block != 0) {
+        off_t offset = inode->history_block * BLOCK_SIZE;
+        if (pread(disk_fd, vt, sizeof(version_table_t), offset) != sizeof(version_table_t)) return -EIO;
+    }
+    vt->total_versions = (inode->total_versions < MAX_VERSIONS) ? inode->total_versions : MAX_VERSIONS;
+    vt->latest_version = inode->latest_version;
+    if (vt->total_versions > 0) vt->versions[vt->total_versions - 1] = inode->current;
+    return 0;
+}
+
+// 写回版本历史表 (第一次写时分配连续的块)，并把最新版本同步回 inode
+// 调用者随后负责 save_inode
+int save_history(inode_t *inode, const version_table_t *vt) {
+    if (inode->history_block == 0) {
+        pthread_mutex_lock(&alloc_lock);
+        int64_t blk = bitmap_alloc_run(&block_bitmap, VERSION_TABLE_BLOCKS);
+        if (blk >= 0) sb.free_blocks -= VERSION_TABLE_BLOCKS;
+        pthread_mutex_unlock(&alloc_lock);
+        if (blk < 0) return -ENOSPC;
+        inode->history_block = (uint64_t)blk;
+    }
+
+    off_t offset = inode->history_block * BLOCK_SIZE;
+    if (pwrite(disk_fd, vt, sizeof(version_table_t), offset) != sizeof(version_table_t)) return -EIO;
+
+    inode->total_versions = vt->total_versions;
+    inode->latest_version = vt->latest_version;
+    if (vt->total_versions > 0) inode->current = vt->versions[vt->total_versions - 1];
+    inode->xattr_count = 0;
+    for (int i = 0; i < 4; i++) {
+        if (vt->xattrs[i].valid) inode->xattr_count++;
+    }
+    return 0;
+}
+
+// 回收版本历史表占用的块
+static void free_history(inode_t *inode) {
+    if (inode->history_block == 0) return;
+    for (uint64_t i = 0; i < VERSION_TABLE_BLOCKS; i++) free_block(inode->history_block + i);
+    inode->history_block = 0;
+}
+
+// 按路径里的版本后缀找目标版本：不带后缀直接返回 inode->current，不读历史表
+// vt 由调用者提供 (带后缀时返回的指针指向 vt 内部)
+static file_version_t *lookup_version(inode_t *inode, version_query_type_t query_type,
+                                      int version_id, const char *time_str, version_table_t *vt) {
+    if (query_type == VER_QUERY_NONE) {
+        return (inode->total_versions > 0) ? &inode->current : NULL;
+    }
+    if (load_history(inode, vt) != 0) return NULL;
+    if (query_type == VER_QUERY_ID) return version_mgr_get_version(vt, version_id);
+    return version_mgr_find_by_time_str(vt, time_str);
+}
+
+static void inval_attr(uint64_t inode_id);
+static void inval_version(uint64_t inode_id, int vid, int dropped);
+
+// [新增] 第 i 个版本的树是不是和前面某个版本是同一棵
+static int shared_with_earlier(const version_table_t *vt, uint32_t i) {
+    for (uint32_t j = 0; j < i; j++) {
+        if (vt->versions[j].map_depth == vt->versions[i].map_depth &&
+            vt->versions[j].block_list_start_index == vt->versions[i].block_list_start_index) return 1;
+    }
+    return 0;
+}
+
+// [新增] 版本轮转淘汰了 victim：它拥有的树如果还有别的版本在共享，把拥有权交给其中一个；
+// 没人用了才整棵释放 (数据块各放掉一个引用)
+static void release_dropped_version(version_table_t *vt, file_version_t *victim) {
+    if (victim->map_depth > 0 && victim->block_list_start_index != 0) {
+        for (uint32_t i = 0; i < vt->total_versions; i++) {
+            file_version_t *v = &vt->versions[i];
+            if (v->map_depth == victim->map_depth && v->block_list_start_index == victim->block_list_start_index) {
+                if (!victim->map_shared) v->map_shared = 0;
+                return;
+            }
+        }
+        victim->map_shared = 0;
+    }
+    bmap_release(victim);
+}
+
+// [新增] 写完 (或截断到) end 字节后能不能放在 Inode 里：已经是内联的，
+// 或者还没有任何数据块的普通文件 (新建的、截断成 0 或空洞的)；有历史版本的不行
+static int inline_fits(const inode_t *inode, uint64_t end) {
+    if (!S_ISREG(inode->mode) || inode->history_block != 0) return 0;
+    if (end < inode->current.file_size) end = inode->current.file_size;
+    if (end > SMARTFS_INLINE_MAX) return 0;
+    return (inode->flags & SMARTFS_INODE_INLINE) || inode->current.block_list_start_index == 0;
+}
+
+// [新增] Inode 里记的压缩策略，没设返回 CODEC_DEFAULT
+static int inode_codec(const inode_t *inode, int *level) {
+    *level = (int)((inode->flags & SMARTFS_INODE_LEVEL_MASK) >> SMARTFS_INODE_LEVEL_SHIFT);
+    int codec = (int)((inode->flags & SMARTFS_INODE_CODEC_MASK) >> SMARTFS_INODE_CODEC_SHIFT);
+    return codec ? codec - 1 : CODEC_DEFAULT;
+}
+
+// [新增] 存储引擎按 Inode 号查压缩策略：写数据之前把这个文件的策略交给它
+static void bind_codec(const inode_t *inode) {
+    int level, codec = inode_codec(inode, &level);
+    compress_set_file_policy((long)inode->inode_id, codec, level);
+}
+
+// [新增] 内联数据搬到数据块里 (文件长大超过上限、要做快照时)，之后和普通文件一样走块映射。
+// 调用者随后负责 save_inode
+static int inline_spill(inode_t *inode) {
+    if (!(inode->flags & SMARTFS_INODE_INLINE)) return 0;
+    bind_codec(inode);
+    file_version_t *v = &inode->current;
+    if (v->file_size > 0) {
+        int block_id = 0;
+        if (smart_write((long)inode->inode_id, 0, (const char *)inode->inline_data, (int)v->file_size, &block_id) < 0) {
+            return -EIO;
+        }
+        if (bmap_assign(NULL, v, 0, (uint64_t)block_id, NULL) != 0) {
+            storage_release_block(block_id);
+            return -EIO;
+        }
+    }
+    inode->flags &= ~SMARTFS_INODE_INLINE;
+    memset(inode->inline_data, 0, sizeof(inode->inline_data));
+    return 0;
+}
+
+// 创建快照：读入历史表 -> 追加新版本 -> 写回，返回新版本号或 -errno
+// [修改] 成功后通知内核：活文件的时间变了；版本表满了淘汰掉的那个版本视图也要作废
+static int snapshot_inode(inode_t *inode, const char *msg) {
+    // [新增] 版本之间共享块映射，内联的数据先搬到数据块里
+    int ret = inline_spill(inode);
+    if (ret != 0) return ret;
+
+    version_table_t vt;
+    ret = load_history(inode, &vt);
+    if (ret != 0) return ret;
+
+    // 轮转会把被淘汰的版本后面的整体前移，比较前后的版本号就能找到它
+    uint32_t old_ids[MAX_VERSIONS];
+    uint32_t old_total = vt.total_versions;
+    for (uint32_t i = 0; i < old_total; i++) old_ids[i] = vt.versions[i].version_id;
+
+    // [新增] 被淘汰的版本要放掉它的块映射，先留一份轮转前的表
+    file_version_t old_versions[MAX_VERSIONS];
+    memcpy(old_versions, vt.versions, sizeof(file_version_t) * old_total);
+
+    int new_vid = version_mgr_create_snapshot(&vt, msg);
+    if (new_vid < 0) return -ENOSPC; // 可能由于全被Pin住导致无法创建
+
+    // 新版本和上一版本指向同样的数据：单块文件的根就是数据块，多了一个引用
+    // (有索引块的树是共享的，只有拥有它的那个版本算引用)
+    file_version_t *latest = &vt.versions[vt.total_versions - 1];
+    if (latest->map_depth == 0 && latest->block_list_start_index != 0) data_block_ref(latest->block_list_start_index);
+
+    int dropped = -1;
+    if (vt.total_versions == old_total) {
+        uint32_t i = 0;
+        while (i + 1 < old_total && vt.versions[i].version_id == old_ids[i]) i++;
+        dropped = (int)i;
+        release_dropped_version(&vt, &old_versions[i]);
+    }
+
+    ret = save_history(inode, &vt);
+    if (ret != 0) return ret;
+
+    if (dropped >= 0) inval_version(inode->inode_id, (int)old_ids[dropped], 1);
+    inval_attr(inode->inode_id);
+    return new_vid;
+}
+
+// 超级块、位图、Inode 区永远是占用的 (根目录的块由 allocator_rebuild 从根 Inode 找到)
+static void allocator_reserve() {
+    bitmap_set(&inode_bitmap, sb.root_inode);
+    for (uint64_t b = 0; b < sb.data_area_start; b++) bitmap_set(&block_bitmap, b);
+}
+
+static void mark_block_used(uint64_t blk, void *arg) {
+    (void) arg;
+    bitmap_set(&block_bitmap, blk);
+}
+
+// 从 Inode 表重建两张位图 (旧镜像或上次没有正常卸载)
+static void allocator_rebuild() {
+    printf("[Alloc] Rebuilding bitmaps from inode table...\n");
+    bitmap_reset(&inode_bitmap);
+    bitmap_reset(&block_bitmap);
+    allocator_reserve();
+
     inode_t node;
-    // 简单暴力搜索，实际应使用位图
-    for (uint64_t i = 1; i < 1024; i++) { 
+    version_table_t vt;
+    for (uint64_t i = 0; i < inode_bitmap.nbits; i++) {
         load_inode(i, &node);
-        if (node.mode == 0) { 
-            return i;
+        if (node.mode == 0) continue;
+        // 删掉时还开着的文件 (孤儿) 没等到 forget 就掉电了：直接回收，它的块也不标记
+        if (node.link_count == 0 && i != sb.root_inode) {
+            node.mode = 0;
+            save_inode(&node);
+            continue;
+        }
+        bitmap_set(&inode_bitmap, i);
+
+        for (uint64_t b = 0; node.history_block != 0 && b < VERSION_TABLE_BLOCKS; b++) {
+            mark_block_used(node.history_block + b, NULL);
+        }
+
+        if (S_ISDIR(node.mode)) {
+            dir_for_each_block(&node.current, mark_block_used, NULL);
+        } else if (S_ISLNK(node.mode)) {
+            // 软链接的目标路径直接放在一个磁盘块里 ([修改] 短的放在 Inode 里，没有块)
+            if (!(node.flags & SMARTFS_INODE_INLINE)) mark_block_used(node.current.block_list_start_index, NULL);
+        } else if (node.history_block == 0) {
+            bmap_for_each_index(&node.current, mark_block_used, NULL);
+        } else if (load_history(&node, &vt) == 0) {
+            for (uint32_t v = 0; v < vt.total_versions; v++) {
+                bmap_for_each_index(&vt.versions[v], mark_block_used, NULL);
+            }
         }
     }
-    return 0;
 }
 
-// 分配新的数据块
-uint64_t allocate_block() {
-    static uint64_t last_alloc = 0;
-    uint64_t start_block = sb.data_area_start;
-    
-    if (last_alloc == 0) last_alloc = start_block + 1;
+static void ref_data_block(uint64_t block_id, void *arg) {
+    (void) arg;
+    storage_ref_block((int)block_id);
+}
+
+// [新增] 从 Inode 表重建块引用计数 (引用计数文件丢了或者上次没有正常卸载)：
+// 每棵不同的树指向的数据块各算一次，单块文件的每个版本各算一次
+static void refcount_rebuild() {
+    storage_refs_rebuild_begin();
+    inode_t node;
+    version_table_t vt;
+    for (uint64_t i = 0; i < inode_bitmap.nbits; i++) {
+        if (!bitmap_test(&inode_bitmap, i)) continue;
+        load_inode(i, &node);
+        if (node.mode == 0 || !S_ISREG(node.mode)) continue;
+        if (node.history_block == 0) {
+            bmap_for_each_data(&node.current, ref_data_block, NULL);
+        } else if (load_history(&node, &vt) == 0) {
+            for (uint32_t v = 0; v < vt.total_versions; v++) {
+                if (vt.versions[v].map_depth > 0 && shared_with_earlier(&vt, v)) continue;
+                bmap_for_each_data(&vt.versions[v], ref_data_block, NULL);
+            }
+        }
+    }
+    storage_refs_rebuild_end();
+}
 
-    if (sb.free_blocks == 0) return 0;
+// 挂载时加载位图
+static int allocator_mount() {
+    uint64_t inode_bits = inode_capacity();
+    if (bitmap_init(&inode_bitmap, inode_bits, sb.inode_bitmap_start,
+                    sb.block_bitmap_start - sb.inode_bitmap_start) != 0) return -1;
+    if (bitmap_init(&block_bitmap, sb.total_blocks, sb.block_bitmap_start,
+                    sb.inode_area_start - sb.block_bitmap_start) != 0) return -1;
+
+    if (sb.state != SMARTFS_STATE_CLEAN ||
+        bitmap_load(&inode_bitmap, disk_fd) != 0 ||
+        bitmap_load(&block_bitmap, disk_fd) != 0 ||
+        !bitmap_test(&inode_bitmap, sb.root_inode)) {
+        allocator_rebuild();
+    }
+    allocator_reserve();
+    sb.free_blocks = block_bitmap.free_count;
 
-    sb.free_blocks--;
+    // 标记为已挂载，异常退出后下次挂载会自动重建
+    sb.state = SMARTFS_STATE_MOUNTED;
     save_superblock();
-    return last_alloc++; 
+    printf("[Alloc] Inodes: %lu free / %lu, Blocks: %lu free / %lu\n",
+           inode_bitmap.free_count, inode_bitmap.nbits, block_bitmap.free_count, block_bitmap.nbits);
+    return 0;
+}
+
+// [修改] 超级块读出来之后：先把 disk_fd 交给各模块、建好 Inode 缓存，再加载位图。
+// 上次没有正常卸载时 allocator_rebuild 要靠它们读 Inode、目录块和块映射，
+// 反过来做的话读到的全是空 Inode，元数据块不会被标记，之后就被当成空闲块分出去
+static int disk_mount() {
+    // [新增] 将 disk_fd 传给模块 C
+    storage_attach_disk(disk_fd);
+    bmap_attach_disk(disk_fd);
+    dir_attach_disk(disk_fd);
+    icache_attach_disk(disk_fd, sb.inode_area_start * BLOCK_SIZE);
+    icache_init(ICACHE_CAPACITY);
+    return allocator_mount();
+}
+
+// 位图和超级块落盘 (flush/fsync/卸载时调用，而不是每次分配都写)
+static int allocator_sync(uint32_t state) {
+    int ret = icache_flush();   // 脏 Inode 先落盘，再写位图和超级块
+    pthread_mutex_lock(&alloc_lock);
+    if (bitmap_sync(&inode_bitmap, disk_fd) != 0) ret = -EIO;
+    if (bitmap_sync(&block_bitmap, disk_fd) != 0) ret = -EIO;
+    sb.state = state;
+    save_superblock();
+    pthread_mutex_unlock(&alloc_lock);
+    return ret;
 }
 
 // =========================================================
-// Level 2: 目录与查找助手 (依赖 Level 1)
+// [新增] 打开文件表 + 写缓冲
 // =========================================================
+// open/create 时分配一个 open_file_t 放进 fi->fh。小块写先合并进它的写缓冲，
+// 等 flush/fsync/release 或者缓冲满了才整块交给去重压缩流水线，
+// 应用 128 字节一次地写 4KB 只产生一个 L3 记录，而不是 32 个。
+//
+// 缓冲里的块由所属 Inode 的锁保护 (写缓冲、下刷都要 EXCL)；
+// of_lock 只保护下面的哈希表，是最内层的锁，持有它时不再去拿别的锁。
+
+typedef struct {
+    uint64_t lblk;
+    uint32_t lo, hi;             // 块内 [lo, hi) 是缓冲里确定的内容
+    char data[BLOCK_SIZE];
+} wbuf_block_t;
+
+typedef struct open_file {
+    uint64_t inode_id;
+    int stale;                   // Inode 已经被回收 (文件被删了)，之后的读写都返回 -ENOENT
+    int nblocks;                 // 缓冲里的脏块数
+    wbuf_block_t *blocks;        // 第一次缓冲写入时才分配 WBUF_BLOCKS 个
+    // [新增] 顺序读检测与预读状态 (读只持有 SHARED 锁，所以单独用 ra_lock 保护)
+    pthread_mutex_t ra_lock;
+    uint64_t ra_next;            // 顺序读的话，下一次读应该从这个逻辑块开始
+    uint64_t ra_start, ra_end;   // 已经提交预读的逻辑块范围 [ra_start, ra_end)
+    uint32_t ra_window;          // 当前预读窗口，0 = 没有检测到顺序读
+    struct open_file *hnext;
+} open_file_t;
+
+#define OF_BUCKETS 1024
+static open_file_t *of_table[OF_BUCKETS];
+static pthread_mutex_t of_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static open_file_t *of_get(struct fuse_file_info *fi) {
+    return (fi && fi->fh) ? (open_file_t *)(uintptr_t)fi->fh : NULL;
+}
 
-// 通用查找函数：在指定的 parent_inode_id 中查找名字为 name 的子项
-// 返回子项的 inode_id，找不到返回 0
-uint64_t find_entry_in_dir(uint64_t parent_inode_id, const char *name) {
-    uint64_t phys_block;
-    
-    // 1. 确定去哪里读数据
-    if (parent_inode_id == 0) {
-        // 根目录
-        phys_block = sb.data_area_start;
-    } else {
-        // 子目录：先读 Inode 找到数据块位置
-        inode_t parent_inode;
-        load_inode(parent_inode_id, &parent_inode);
-        phys_block = parent_inode.versions[0].block_list_start_index;
+// open/create 成功后调用：登记并 pin 住 Inode 缓存条目 (release 时 unpin)
+static int of_open(uint64_t inode_id, struct fuse_file_info *fi) {
+    open_file_t *of = calloc(1, sizeof(open_file_t));
+    if (!of) return -ENOMEM;
+    of->inode_id = inode_id;
+    pthread_mutex_init(&of->ra_lock, NULL);
+    pthread_mutex_lock(&of_lock);
+    of->hnext = of_table[inode_id % OF_BUCKETS];
+    of_table[inode_id % OF_BUCKETS] = of;
+    pthread_mutex_unlock(&of_lock);
+    icache_pin(inode_id);
+    fi->fh = (uint64_t)(uintptr_t)of;
+    // [新增] 重新打开时保留内核页面缓存：内容只会被经过内核的写入改变，别的变化有失效通知
+    fi->keep_cache = 1;
+    return 0;
+}
+
+static void of_close(open_file_t *of) {
+    pthread_mutex_lock(&of_lock);
+    open_file_t **pp = &of_table[of->inode_id % OF_BUCKETS];
+    while (*pp && *pp != of) pp = &(*pp)->hnext;
+    if (*pp) *pp = of->hnext;
+    pthread_mutex_unlock(&of_lock);
+    icache_unpin(of->inode_id);
+    pthread_mutex_destroy(&of->ra_lock);
+    free(of->blocks);
+    free(of);
+}
+
+// 找到这个 Inode 的一个有脏数据的句柄 (skip 除外)，没有返回 NULL
+static open_file_t *of_find_dirty(uint64_t inode_id, open_file_t *skip) {
+    pthread_mutex_lock(&of_lock);
+    open_file_t *of = of_table[inode_id % OF_BUCKETS];
+    while (of && (of->inode_id != inode_id || of->nblocks == 0 || of == skip)) of = of->hnext;
+    pthread_mutex_unlock(&of_lock);
+    return of;
+}
+
+// 缓冲写入之后文件的逻辑大小 (getattr 用，调用者持有 Inode 锁)
+static uint64_t wbuf_size(uint64_t inode_id, uint64_t size) {
+    pthread_mutex_lock(&of_lock);
+    for (open_file_t *of = of_table[inode_id % OF_BUCKETS]; of; of = of->hnext) {
+        if (of->inode_id != inode_id) continue;
+        for (int i = 0; i < of->nblocks; i++) {
+            uint64_t end = of->blocks[i].lblk * BLOCK_SIZE + of->blocks[i].hi;
+            if (end > size) size = end;
+        }
     }
+    pthread_mutex_unlock(&of_lock);
+    return size;
+}
 
-    // 2. 读取目录内容
-    char buffer[BLOCK_SIZE];
-    smartfs_dir_entry_t *entries = (smartfs_dir_entry_t *)buffer;
-    
-    off_t offset = phys_block * BLOCK_SIZE;
-    lseek(disk_fd, offset, SEEK_SET);
-    if (read(disk_fd, entries, BLOCK_SIZE) != BLOCK_SIZE) return 0;
-
-    // 3. 遍历查找
-    int max_entries = BLOCK_SIZE / sizeof(smartfs_dir_entry_t);
-    for (int i = 0; i < max_entries; i++) {
-        if (entries[i].is_valid && strcmp(entries[i].name, name) == 0) {
-            return entries[i].inode_no;
+// Inode 被回收：丢掉缓冲 (数据已经没人要了)，句柄作废，
+// 防止 Inode 号被新文件复用后，旧句柄把数据写进别人的文件
+static void of_forget(uint64_t inode_id) {
+    pthread_mutex_lock(&of_lock);
+    for (open_file_t *of = of_table[inode_id % OF_BUCKETS]; of; of = of->hnext) {
+        if (of->inode_id != inode_id) continue;
+        of->stale = 1;
+        of->nblocks = 0;
+    }
+    pthread_mutex_unlock(&of_lock);
+}
+
+// =========================================================
+// [新增] FUSE 节点号 + 内核引用计数 (low-level API)
+// =========================================================
+// 内核按节点号 (fuse_ino_t) 调用我们，路径只在 lookup 时逐级解析一次。
+// 节点号 = (版本号 << 32) | (Inode 号 + 1)：
+//   低 32 位是 Inode 号 + 1，根目录 Inode 0 正好是 FUSE_ROOT_ID (1)；
+//   高 32 位非 0 表示 "file@vN" 这种只读的历史版本视图，lookup 时已经确定了版本号，
+//   之后 getattr/read 不用再解析 @ 后缀。
+static inline uint64_t node_ino(fuse_ino_t node) { return (node & 0xffffffffULL) - 1; }
+static inline int node_vid(fuse_ino_t node) { return (int)(node >> 32); }
+static inline fuse_ino_t make_node(uint64_t inode_id, int vid) {
+    return ((fuse_ino_t)(uint32_t)vid << 32) | (inode_id + 1);
+}
+
+// 每回复一次 lookup/create/mkdir/... 内核的引用 +1，forget 时减掉。
+// 引用计数不为 0 的 Inode 即使最后一个名字被删了也先不回收 (文件还开着、还是谁的 cwd)，
+// 等 forget 把计数减到 0 再回收，Inode 号不会在内核还认识它的时候被分给新文件。
+// 同一个 Inode 的所有版本视图共用一个计数。
+// [新增] 版本视图还记下内核是在哪个目录、用哪个名字查到的，版本被淘汰时按名字通知内核作废
+typedef struct view_ref {
+    fuse_ino_t parent;
+    int vid;
+    struct view_ref *next;
+    char name[];
+} view_ref_t;
+
+typedef struct node_ref {
+    uint64_t inode_id;
+    uint64_t nlookup;
+    view_ref_t *views;
+    struct node_ref *next;
+} node_ref_t;
+
+static node_ref_t *node_table[NODE_BUCKETS];
+static pthread_mutex_t node_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void node_ref_free(node_ref_t *r) {
+    while (r->views) {
+        view_ref_t *v = r->views;
+        r->views = v->next;
+        free(v);
+    }
+    free(r);
+}
+
+static void node_get(uint64_t inode_id) {
+    pthread_mutex_lock(&node_lock);
+    node_ref_t *r = node_table[inode_id % NODE_BUCKETS];
+    while (r && r->inode_id != inode_id) r = r->next;
+    if (!r && (r = calloc(1, sizeof(node_ref_t))) != NULL) {
+        r->inode_id = inode_id;
+        r->next = node_table[inode_id % NODE_BUCKETS];
+        node_table[inode_id % NODE_BUCKETS] = r;
+    }
+    if (r) r->nlookup++;
+    pthread_mutex_unlock(&node_lock);
+}
+
+// 减少 n 个引用，返回剩下的引用数
+static uint64_t node_put(uint64_t inode_id, uint64_t n) {
+    pthread_mutex_lock(&node_lock);
+    node_ref_t **pp = &node_table[inode_id % NODE_BUCKETS];
+    while (*pp && (*pp)->inode_id != inode_id) pp = &(*pp)->next;
+    uint64_t left = 0;
+    if (*pp) {
+        node_ref_t *r = *pp;
+        r->nlookup = (r->nlookup > n) ? r->nlookup - n : 0;
+        left = r->nlookup;
+        if (left == 0) {
+            *pp = r->next;
+            node_ref_free(r);
         }
     }
-    return 0; // 没找到
+    pthread_mutex_unlock(&node_lock);
+    return left;
 }
 
-// 在父目录中添加一个文件条目
-int add_dir_entry(uint64_t parent_inode_id, const char *name, uint64_t child_inode_id) {
-    inode_t parent;
-    uint64_t phys_block;
+static int node_in_use(uint64_t inode_id) {
+    pthread_mutex_lock(&node_lock);
+    node_ref_t *r = node_table[inode_id % NODE_BUCKETS];
+    while (r && r->inode_id != inode_id) r = r->next;
+    pthread_mutex_unlock(&node_lock);
+    return r != NULL;
+}
 
-    if (parent_inode_id == 0) {
-        phys_block = sb.data_area_start;
-    } else {
-        load_inode(parent_inode_id, &parent);
-        phys_block = parent.versions[0].block_list_start_index;
+// 记下内核通过 parent/name 拿到了版本视图 vid (lookup 在 node_get 之后调用)
+static void node_add_view(uint64_t inode_id, fuse_ino_t parent, const char *name, int vid) {
+    pthread_mutex_lock(&node_lock);
+    node_ref_t *r = node_table[inode_id % NODE_BUCKETS];
+    while (r && r->inode_id != inode_id) r = r->next;
+    view_ref_t *v = r ? r->views : NULL;
+    while (v && (v->vid != vid || v->parent != parent || strcmp(v->name, name) != 0)) v = v->next;
+    if (r && !v && (v = malloc(sizeof(view_ref_t) + strlen(name) + 1)) != NULL) {
+        v->parent = parent;
+        v->vid = vid;
+        strcpy(v->name, name);
+        v->next = r->views;
+        r->views = v;
     }
+    pthread_mutex_unlock(&node_lock);
+}
 
-    char buffer[BLOCK_SIZE]; 
-    smartfs_dir_entry_t *entries = (smartfs_dir_entry_t *)buffer;
-    
-    off_t offset = phys_block * BLOCK_SIZE;
-    lseek(disk_fd, offset, SEEK_SET);
-    read(disk_fd, entries, BLOCK_SIZE);
-
-    int max_entries = BLOCK_SIZE / sizeof(smartfs_dir_entry_t);
-    for (int i = 0; i < max_entries; i++) {
-        if (!entries[i].is_valid) {
-            strncpy(entries[i].name, name, MAX_FILENAME);
-            entries[i].inode_no = child_inode_id;
-            entries[i].is_valid = 1;
-            
-            lseek(disk_fd, offset, SEEK_SET);
-            write(disk_fd, entries, BLOCK_SIZE);
-            return 0;
+// =========================================================
+// [新增] 内核缓存失效通知
+// =========================================================
+// 内核缓存的目录项/属性/页面只有在内核不知道的变化发生时才需要我们通知：
+// 版本视图 "file@vN" 的 N 还是当前版本时，写入会原地改它的内容；
+// 快照会改活文件的时间，版本表满了还会淘汰最老的版本。
+// 通知由单独的线程发：在处理请求的路径上发通知，内核可能正拿着同一个 inode/目录的锁等我们回复，会死锁。
+
+typedef struct inval_req {
+    fuse_ino_t node;             // inval_inode 的节点 (name 为空时)
+    fuse_ino_t parent;           // inval_entry 的父目录
+    off_t off;                   // < 0 只作废属性，0 连页面缓存一起作废
+    struct inval_req *next;
+    char name[];
+} inval_req_t;
+
+static struct fuse_session *smartfs_session = NULL;
+static inval_req_t *inval_head = NULL, *inval_tail = NULL;
+static pthread_mutex_t inval_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t inval_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t inval_thread;
+static int inval_running = 0, inval_stop = 0;
+static uint64_t inval_sent = 0;
+
+static void *inval_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&inval_lock);
+    for (;;) {
+        while (!inval_head && !inval_stop) pthread_cond_wait(&inval_cond, &inval_lock);
+        inval_req_t *req = inval_head;
+        if (!req) break;
+        inval_head = req->next;
+        if (!inval_head) inval_tail = NULL;
+        pthread_mutex_unlock(&inval_lock);
+
+        // 内核没有这个节点/名字时返回 -ENOENT，不用管
+        if (req->name[0]) {
+            fuse_lowlevel_notify_inval_entry(smartfs_session, req->parent, req->name, strlen(req->name));
+        } else {
+            fuse_lowlevel_notify_inval_inode(smartfs_session, req->node, req->off, 0);
         }
+        free(req);
+
+        pthread_mutex_lock(&inval_lock);
+        inval_sent++;
+    }
+    pthread_mutex_unlock(&inval_lock);
+    return NULL;
+}
+
+static void inval_queue(fuse_ino_t node, fuse_ino_t parent, const char *name, off_t off) {
+    pthread_mutex_lock(&inval_lock);
+    // 连续写同一个文件会反复作废同一个节点，队尾的请求已经包含这一个的就不重复排队了。
+    // off < 0 只作废属性 (哪个请求都包含)；off >= 0 还作废 off 之后的页面，队尾得是从更前面开始的页面作废
+    if (!inval_running || (!name && inval_tail && !inval_tail->name[0] && inval_tail->node == node &&
+                           (off < 0 || (inval_tail->off >= 0 && inval_tail->off <= off)))) {
+        pthread_mutex_unlock(&inval_lock);
+        return;
+    }
+    size_t len = name ? strlen(name) : 0;
+    inval_req_t *req = malloc(sizeof(inval_req_t) + len + 1);
+    if (req) {
+        req->node = node;
+        req->parent = parent;
+        req->off = off;
+        req->next = NULL;
+        memcpy(req->name, name ? name : "", len + 1);
+        if (inval_tail) inval_tail->next = req;
+        else inval_head = req;
+        inval_tail = req;
+        pthread_cond_signal(&inval_cond);
+    }
+    pthread_mutex_unlock(&inval_lock);
+}
+
+// 活文件的属性变了 (快照改了时间)，内核还认识它才需要通知
+static void inval_attr(uint64_t inode_id) {
+    if (node_in_use(inode_id)) inval_queue(make_node(inode_id, 0), 0, NULL, -1);
+}
+
+// 版本 vid 的内容变了 (dropped = 0) 或者被淘汰了 (dropped = 1)：
+// 作废内核手里这个版本视图的属性和页面，淘汰时连名字一起作废。vid < 0 表示所有视图 (权限变了)
+static void inval_version(uint64_t inode_id, int vid, int dropped) {
+    pthread_mutex_lock(&node_lock);
+    node_ref_t *r = node_table[inode_id % NODE_BUCKETS];
+    while (r && r->inode_id != inode_id) r = r->next;
+    for (view_ref_t *v = r ? r->views : NULL; v; v = v->next) {
+        if (vid >= 0 && v->vid != vid) continue;
+        if (dropped) inval_queue(0, v->parent, v->name, 0);
+        inval_queue(make_node(inode_id, v->vid), 0, NULL, vid < 0 ? -1 : 0);
+    }
+    pthread_mutex_unlock(&node_lock);
+}
+
+static void inval_start() {
+    pthread_mutex_lock(&inval_lock);
+    inval_stop = 0;
+    inval_running = (pthread_create(&inval_thread, NULL, inval_worker, NULL) == 0);
+    pthread_mutex_unlock(&inval_lock);
+}
+
+// 卸载时停掉通知线程 (还没发的通知没有意义了，直接丢掉)
+static void inval_shutdown() {
+    pthread_mutex_lock(&inval_lock);
+    if (!inval_running) {
+        pthread_mutex_unlock(&inval_lock);
+        return;
     }
-    return -ENOSPC; 
+    inval_running = 0;
+    inval_stop = 1;
+    while (inval_head) {
+        inval_req_t *req = inval_head;
+        inval_head = req->next;
+        free(req);
+    }
+    inval_tail = NULL;
+    pthread_cond_signal(&inval_cond);
+    pthread_mutex_unlock(&inval_lock);
+    pthread_join(inval_thread, NULL);
+}
+
+static void inval_report() {
+    pthread_mutex_lock(&inval_lock);
+    uint64_t sent = inval_sent;
+    pthread_mutex_unlock(&inval_lock);
+    printf("[Inval] Kernel cache invalidations sent: %lu\n", sent);
 }
 
-// 从目录中移除条目
-int remove_dir_entry(uint64_t parent_inode_id, const char *name) {
+// =========================================================
+// Level 2: 目录与查找助手 (依赖 Level 1)
+// =========================================================
+
+// 通用查找函数：在指定的 parent_inode_id 中查找名字为 name 的子项
+// 直接查目录的哈希索引，不经过目录项缓存 (路径解析请用 lookup_entry)
+// 调用者持有 parent 的锁 (共享即可)
+// 返回子项的 inode_id，找不到 (或 parent 不是目录) 返回 0
+uint64_t find_entry_in_dir(uint64_t parent_inode_id, const char *name) {
     inode_t parent;
-    uint64_t phys_block;
+    load_inode(parent_inode_id, &parent);
+    if (!S_ISDIR(parent.mode)) return 0;
 
-    if (parent_inode_id == 0) {
-        phys_block = sb.data_area_start;
-    } else {
-        load_inode(parent_inode_id, &parent);
-        phys_block = parent.versions[0].block_list_start_index;
+    uint64_t ino = 0;
+    if (dir_lookup(&parent.current, name, &ino) != 0) return 0;
+    return ino;
+}
+
+// 在父目录中添加一个文件条目 (mode 只用到文件类型，给 readdir 的 d_type)
+// 在父目录的锁里完成，名字查重 + 插入是原子的
+int add_dir_entry(uint64_t parent_inode_id, const char *name, uint64_t child_inode_id, mode_t mode) {
+    icache_lock(parent_inode_id, ICACHE_EXCL);
+    inode_t parent;
+    load_inode(parent_inode_id, &parent);
+
+    // 父目录在我们等锁的时候被 rmdir 了 (可能还是个等 forget 的孤儿)
+    int ret = -ENOENT;
+    if (S_ISDIR(parent.mode) && parent.link_count > 0) {
+        // 目录可能长出新块 (块映射变了)，要把 Inode 写回
+        ret = dir_add(&parent.current, name, child_inode_id, mode);
+        save_inode(&parent);
+        if (ret == 0) dcache_add(parent_inode_id, name, child_inode_id);
     }
+    icache_unlock(parent_inode_id);
+    return ret;
+}
 
-    char buffer[BLOCK_SIZE]; 
-    smartfs_dir_entry_t *entries = (smartfs_dir_entry_t *)buffer;
-    
-    off_t offset = phys_block * BLOCK_SIZE;
-    lseek(disk_fd, offset, SEEK_SET);
-    read(disk_fd, entries, BLOCK_SIZE);
-
-    int max_entries = BLOCK_SIZE / sizeof(smartfs_dir_entry_t);
-    for (int i = 0; i < max_entries; i++) {
-        if (entries[i].is_valid && strcmp(entries[i].name, name) == 0) {
-            entries[i].is_valid = 0; 
-            entries[i].inode_no = 0;
-            memset(entries[i].name, 0, MAX_FILENAME);
-            
-            lseek(disk_fd, offset, SEEK_SET);
-            write(disk_fd, entries, BLOCK_SIZE);
-            return 0; 
-        }
+// 从目录中移除条目，removed (可为 NULL) 输出这个名字原来指向的 Inode
+int remove_dir_entry(uint64_t parent_inode_id, const char *name, uint64_t *removed) {
+    icache_lock(parent_inode_id, ICACHE_EXCL);
+    inode_t parent;
+    load_inode(parent_inode_id, &parent);
+
+    int ret = -ENOENT;
+    if (S_ISDIR(parent.mode)) {
+        ret = dir_remove(&parent.current, name, removed);
+        if (ret == 0) dcache_add_negative(parent_inode_id, name);
     }
-    return -ENOENT; 
+    icache_unlock(parent_inode_id);
+    return ret;
 }
 
-// 回收 Inode
+// 回收 Inode (调用者持有它的锁，或者它还没有出现在任何目录里)
 void free_inode(uint64_t inode_id) {
     inode_t inode;
     load_inode(inode_id, &inode);
+    compress_forget_file((long)inode_id);
+
+    // 回收它占用的磁盘块：目录的叶子/槽位表，软链接的数据块，普通文件各版本的块映射
+    if (S_ISDIR(inode.mode)) {
+        dir_release(&inode.current);
+        // Inode 号以后可能分给新目录，缓存里挂在它下面的条目作废
+        dcache_purge_dir(inode_id);
+    } else if (S_ISLNK(inode.mode)) {
+        if (!(inode.flags & SMARTFS_INODE_INLINE)) free_block(inode.current.block_list_start_index);
+    } else if (inode.history_block == 0) {
+        bmap_release(&inode.current);
+    } else {
+        version_table_t vt;
+        if (load_history(&inode, &vt) == 0) {
+            // [修改] 几个版本共享的树只释放一次 (拥有者可能已经被淘汰，不能只看 map_shared)
+            for (uint32_t i = 0; i < vt.total_versions; i++) {
+                file_version_t *v = &vt.versions[i];
+                if (v->map_depth > 0 && shared_with_earlier(&vt, i)) continue;
+                v->map_shared = 0;
+                bmap_release(v);
+            }
+        }
+    }
+    free_history(&inode);
+    of_forget(inode_id);
+
     inode.mode = 0; // 标记为空闲
     save_inode(&inode);
+    release_inode_no(inode_id);
     printf("DEBUG: Inode %lu freed.\n", inode_id);
 }
 
-// ---------------------------------------------------------
-// 辅助工具：解析路径并找到对应的 Inode ID
-// 支持 /file 和 /dir/file
-// ---------------------------------------------------------
-// [修改] 升级后的路径解析 (支持 @ 版本后缀)
-uint64_t resolve_path_to_inode(const char *path) {
-    // 1. 先分离版本号
-    char real_path[MAX_FILENAME];
-    int version_id_dummy;
-    char time_str_dummy[32]; // [新增]
-    parse_version_path(path, real_path, &version_id_dummy, time_str_dummy);
-    // 注意：这里我们只关心 inode 对应的文件名，具体的 version_id 留给 read/write 处理
-
-    // 2. 解析父目录和文件名 (使用 real_path)
-    char full_path[MAX_FILENAME];
-    strncpy(full_path, real_path + 1, MAX_FILENAME - 1); // 去掉开头的 /
-    full_path[MAX_FILENAME - 1] = '\0';
-
-    char *dir_name = NULL;
-    char *file_name = full_path;
-    uint64_t search_in = 0; // 默认根目录
-
-    char *slash = strchr(full_path, '/');
-    if (slash) {
-        *slash = '\0';
-        dir_name = full_path;
-        file_name = slash + 1;
-        
-        search_in = find_entry_in_dir(0, dir_name);
-        if (search_in == 0) return 0; // 父目录不存在
+// 带缓存的单级查找：先查目录项缓存，未命中再读目录块，
+// 结果 (包括“不存在”) 记入缓存。返回子项 inode_id，找不到返回 0
+uint64_t lookup_entry(uint64_t parent_inode_id, const char *name) {
+    uint64_t ino = 0;
+    int hit = dcache_lookup(parent_inode_id, name, &ino);
+    if (hit == DCACHE_HIT) return ino;
+    if (hit == DCACHE_NEGATIVE) return 0;
+
+    // 读目录和回填缓存都在父目录的锁里，不会和 add/remove_dir_entry 交错
+    icache_lock(parent_inode_id, ICACHE_SHARED);
+    ino = find_entry_in_dir(parent_inode_id, name);
+    if (ino != 0) dcache_add(parent_inode_id, name, ino);
+    else dcache_add_negative(parent_inode_id, name);
+    icache_unlock(parent_inode_id);
+    return ino;
+}
+
+// [新增] 给 FUSE 节点对应的 Inode 加锁 (已打开的文件直接用句柄里的 Inode 号)，
+// 并确认它还活着。成功后调用者负责 icache_unlock(*out)
+static int lock_node(fuse_ino_t node, struct fuse_file_info *fi, int mode, uint64_t *out) {
+    open_file_t *of = of_get(fi);
+    uint64_t inode_id = of ? of->inode_id : node_ino(node);
+    if (inode_id >= inode_bitmap.nbits) return -ENOENT;
+
+    icache_lock(inode_id, mode);
+    inode_t inode;
+    load_inode(inode_id, &inode);
+    if (inode.mode == 0 || (of && of->stale)) {
+        icache_unlock(inode_id);
+        return -ENOENT;
     }
+    *out = inode_id;
+    return 0;
+}
 
-    return find_entry_in_dir(search_in, file_name);
+// 名字的最后一个链接被删掉了 (调用者持有它的 EXCL 锁)：
+// 内核还引用着它就先留成孤儿 (link_count = 0)，等 forget 时再回收
+static void drop_inode(uint64_t inode_id, inode_t *inode) {
+    if (node_in_use(inode_id)) {
+        printf("DEBUG: Inode %lu still referenced, freeing on forget\n", inode_id);
+        inode->link_count = 0;
+        save_inode(inode);
+    } else {
+        free_inode(inode_id);
+    }
 }
 
 // =========================================================
@@ -232,143 +930,262 @@ uint64_t resolve_path_to_inode(const char *path) {
 // =========================================================
 
 // 1. 获取文件属性 (getattr)
-// 1. 获取文件属性 (getattr)
-static int smartfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
-    (void) fi;
+// [修改] 版本号在 lookup 时已经解析好了 (vid = 0 是最新版本)，这里不再解析 @ 后缀
+static int getattr_locked(uint64_t inode_id, int vid, struct stat *stbuf) {
     memset(stbuf, 0, sizeof(struct stat));
 
-    if (strcmp(path, "/") == 0) {
+    if (inode_id == sb.root_inode) {
+        stbuf->st_ino = FUSE_ROOT_ID;
         stbuf->st_mode = S_IFDIR | 0755;
         stbuf->st_nlink = 2;
         return 0;
     }
 
-    // --- [模块 B] 新版本逻辑开始 ---
-    char real_path[MAX_FILENAME];
-    int version_id = 0;
-    char time_str[32] = {0}; 
-    // 1. 调用新接口解析 @v1 或 @2h
-    version_query_type_t query_type = parse_version_path(path, real_path, &version_id, time_str);
-    
-    // ⚠️ 删除旧变量：int has_version ...
-    
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
-    
     inode_t inode;
     load_inode(inode_id, &inode);
 
-    // 2. 确定我们要读哪个版本 (使用指针 file_version_t*)
-    file_version_t *target_ver = NULL;
-
-    if (query_type == VER_QUERY_ID) {
-        target_ver = version_mgr_get_version(&inode, version_id);
-    } 
-    else if (query_type == VER_QUERY_TIME) {
-        target_ver = version_mgr_find_by_time_str(&inode, time_str);
-    } 
-    else {
-        target_ver = version_mgr_get_version(&inode, 0); // 最新版
-    }
+    // 确定我们要读哪个版本 (使用指针 file_version_t*)
+    // 最新版直接用 inode.current；只有版本视图才读版本历史表
+    version_table_t vt;
+    version_query_type_t query_type = vid ? VER_QUERY_ID : VER_QUERY_NONE;
+    file_version_t *target_ver = lookup_version(&inode, query_type, vid, NULL, &vt);
 
     if (!target_ver) return -ENOENT; 
 
-    // ⚠️ 删除整个 target_idx / has_version 的 if-else 块
-
-    // 3. 填充属性
-    stbuf->st_ino = inode_id;
+    // 填充属性
+    stbuf->st_ino = make_node(inode_id, vid);
     stbuf->st_mode = inode.mode;
     stbuf->st_nlink = inode.link_count;
     
     // [关键] 只使用 target_ver 填充
     stbuf->st_size = target_ver->file_size;   
     stbuf->st_mtime = target_ver->timestamp;
-    
-    // ⚠️ 删除后面那两行重复赋值 st_size/st_mtime 的旧代码
+    if (vid == 0 && S_ISREG(inode.mode)) {
+        // [新增] 还在写缓冲里的数据也算进文件大小
+        stbuf->st_size = wbuf_size(inode_id, stbuf->st_size);
+    }
 
-    if (query_type != VER_QUERY_NONE) {
+    if (vid != 0) {
         stbuf->st_mode &= ~0222; 
     }
 
     stbuf->st_uid = inode.uid;
     stbuf->st_gid = inode.gid;
     stbuf->st_blocks = (stbuf->st_size + 511) / 512;
+    if (inode.flags & SMARTFS_INODE_INLINE) stbuf->st_blocks = 0;   // [新增] 内联数据不占数据块
 
     return 0;
 }
 
-// 2. 读取目录 (readdir)
-static int smartfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                         off_t offset, struct fuse_file_info *fi,
-                         enum fuse_readdir_flags flags)
-{
-    (void) offset; (void) fi; (void) flags;
+// [新增] 回复给内核的目录项：属性 + 节点号 (调用者持有 Inode 锁)
+// 回复成功后内核的引用计数要 +1，由调用者 node_get
+static int fill_entry(uint64_t inode_id, int vid, struct fuse_entry_param *e) {
+    memset(e, 0, sizeof(*e));
+    int ret = getattr_locked(inode_id, vid, &e->attr);
+    if (ret != 0) return ret;
+    e->ino = make_node(inode_id, vid);
+    e->attr_timeout = SMARTFS_ATTR_TIMEOUT;
+    e->entry_timeout = SMARTFS_ENTRY_TIMEOUT;
+    return 0;
+}
 
-    uint64_t phys_block;
+static void forget_one(fuse_ino_t node, uint64_t nlookup);
+
+// 新建出来的 Inode (create/mkdir/symlink) 加锁后回复。
+// 引用在它出现在目录里之前就已经 node_get 过了 (免得刚加进去就被 unlink 回收、
+// Inode 号又被别人复用)，失败时还掉这个引用
+static int make_entry(uint64_t inode_id, struct fuse_entry_param *e) {
+    uint64_t locked;
+    int ret = lock_node(make_node(inode_id, 0), NULL, ICACHE_SHARED, &locked);
+    if (ret == 0) {
+        ret = fill_entry(inode_id, 0, e);
+        icache_unlock(inode_id);
+    }
+    if (ret != 0) forget_one(make_node(inode_id, 0), 1);
+    return ret;
+}
 
-    // 1. 确定目录的数据块在哪里
-    if (strcmp(path, "/") == 0) {
-        // 情况 A: 根目录
-        phys_block = sb.data_area_start;
-    } else {
-        // 情况 B: 子目录 (例如 /mydir)
-        // 解析路径找到该目录的 Inode
-        uint64_t inode_id = resolve_path_to_inode(path);
-        if (inode_id == 0) return -ENOENT;
+// 在 parent 下增删名字之前的检查 (版本视图是只读的文件，下面不能有名字)
+static int check_name(fuse_ino_t parent, const char *name) {
+    if (node_vid(parent) != 0) return -EROFS;
+    if (strlen(name) > MAX_FILENAME) return -ENAMETOOLONG;
+    return 0;
+}
+
+// [新增] 查找 (lookup)：内核每个目录项只调用一次，结果缓存在内核的 dentry 里
+// 名字本身不存在时再按 "name@v1" / "name@2h" 解析成某个历史版本的只读视图
+static void smartfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    if (node_vid(parent) != 0) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+    if (strlen(name) > MAX_FILENAME) {
+        fuse_reply_err(req, ENAMETOOLONG);
+        return;
+    }
+
+    uint64_t parent_id = node_ino(parent);
+    uint64_t inode_id = lookup_entry(parent_id, name);
+
+    char real_name[MAX_FILENAME + 1];
+    int version_id = 0;
+    char time_str[MAX_FILENAME + 1] = {0};
+    version_query_type_t query_type = VER_QUERY_NONE;
+    if (inode_id == 0) {
+        query_type = parse_version_path(name, real_name, &version_id, time_str);
+        if (query_type != VER_QUERY_NONE) inode_id = lookup_entry(parent_id, real_name);
+    }
+    if (inode_id == 0) {
+        // [新增] 普通名字不存在的结果让内核缓存 (ino = 0)，以后在这里创建它内核自己会更新；
+        // 版本名 "x@v9" 将来可能因为快照而出现，内核不知道，不能缓存
+        if (query_type != VER_QUERY_NONE) {
+            fuse_reply_err(req, ENOENT);
+            return;
+        }
+        struct fuse_entry_param e;
+        memset(&e, 0, sizeof(e));
+        e.entry_timeout = SMARTFS_NEGATIVE_TIMEOUT;
+        fuse_reply_entry(req, &e);
+        return;
+    }
 
-        // 读取 Inode 获取数据块位置
+    uint64_t locked;
+    int ret = lock_node(make_node(inode_id, 0), NULL, ICACHE_SHARED, &locked);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+
+    int vid = 0;
+    if (query_type != VER_QUERY_NONE) {
+        // 只有普通文件有历史版本
         inode_t inode;
         load_inode(inode_id, &inode);
-        
-        // 确保它是个目录，不是文件
-        if (!S_ISDIR(inode.mode)) return -ENOTDIR;
+        version_table_t vt;
+        file_version_t *v = S_ISREG(inode.mode) ?
+            lookup_version(&inode, query_type, version_id, time_str, &vt) : NULL;
+        if (v) vid = (int)v->version_id;
+        else ret = -ENOENT;
+    }
+
+    struct fuse_entry_param e;
+    if (ret == 0 && (ret = fill_entry(inode_id, vid, &e)) == 0) {
+        node_get(inode_id);
+        if (vid != 0) node_add_view(inode_id, parent, name, vid);
+    }
+    icache_unlock(inode_id);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    // "@2h" 指向哪个版本会随时间变化，不让内核缓存这个名字
+    if (query_type == VER_QUERY_TIME) e.entry_timeout = 0;
+    fuse_reply_entry(req, &e);
+}
+
+// [新增] 内核不再引用这个节点了：计数减到 0 时回收已经没有名字的孤儿 Inode
+static void forget_one(fuse_ino_t node, uint64_t nlookup) {
+    uint64_t inode_id = node_ino(node);
+    if (node_put(inode_id, nlookup) > 0 || inode_id == sb.root_inode) return;
 
-        phys_block = inode.versions[0].block_list_start_index;
+    icache_lock(inode_id, ICACHE_EXCL);
+    inode_t inode;
+    load_inode(inode_id, &inode);
+    // 孤儿不会再被 lookup 找到，但加锁前可能又有人 create 复用了这个 Inode 号，所以再确认一遍
+    if (inode.mode != 0 && inode.link_count == 0 && !node_in_use(inode_id)) {
+        printf("DEBUG: Last reference to inode %lu dropped\n", inode_id);
+        free_inode(inode_id);
     }
+    icache_unlock(inode_id);
+}
 
-    // 2. 读取目录内容
-    char buffer[BLOCK_SIZE];
-    smartfs_dir_entry_t *entries = (smartfs_dir_entry_t *)buffer;
-    
-    lseek(disk_fd, phys_block * BLOCK_SIZE, SEEK_SET);
-    read(disk_fd, entries, BLOCK_SIZE);
-
-    // 3. 填入 buffer 让 ls 显示
-    int max_entries = BLOCK_SIZE / sizeof(smartfs_dir_entry_t);
-    for (int i = 0; i < max_entries; i++) {
-        if (entries[i].is_valid) {
-            // filler 是 FUSE 的回调，把名字告诉 ls
-            filler(buf, entries[i].name, NULL, 0, 0);
-        }
+static void smartfs_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    forget_one(ino, nlookup);
+    fuse_reply_none(req);
+}
+
+static void smartfs_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data *forgets) {
+    for (size_t i = 0; i < count; i++) forget_one(forgets[i].ino, forgets[i].nlookup);
+    fuse_reply_none(req);
+}
+
+static void smartfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    uint64_t inode_id;
+    int ret = lock_node(ino, fi, ICACHE_SHARED, &inode_id);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
     }
+    struct stat st;
+    ret = getattr_locked(inode_id, node_vid(ino), &st);
+    icache_unlock(inode_id);
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_attr(req, &st, SMARTFS_ATTR_TIMEOUT);
+}
+
+// 2. 读取目录 (readdir)
+typedef struct {
+    fuse_req_t req;
+    char *buf;
+    size_t size;
+    size_t pos;
+} readdir_ctx_t;
+
+static int readdir_fill(void *arg, const char *name, uint64_t ino, mode_t mode, off_t next_off) {
+    readdir_ctx_t *ctx = (readdir_ctx_t *)arg;
+    struct stat st;
+    memset(&st, 0, sizeof(st));
+    st.st_ino = make_node(ino, 0);
+    st.st_mode = mode;
+    // 把名字编码进回复缓冲；返回 1 表示这一批装满了
+    size_t len = fuse_add_direntry(ctx->req, ctx->buf + ctx->pos, ctx->size - ctx->pos, name, &st, next_off);
+    if (len > ctx->size - ctx->pos) return 1;
+    ctx->pos += len;
     return 0;
 }
 
-// 3. 创建文件 (create)
-static int smartfs_create(const char *path, mode_t mode, struct fuse_file_info *fi) {
+// 带 offset 的 readdir：每一项都告诉 FUSE 下一项的 offset，
+// 大目录分多批列出时，后面的批次直接从 offset 接着列，不用从头再扫
+static void smartfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                            off_t offset, struct fuse_file_info *fi)
+{
     (void) fi;
-    printf("DEBUG: Create %s\n", path);
-    fflush(stdout);
 
-    char full_path[MAX_FILENAME];
-    strncpy(full_path, path + 1, MAX_FILENAME - 1);
-    full_path[MAX_FILENAME - 1] = '\0';
-    
-    char *dir_name = NULL;
-    char *file_name = full_path;
-    uint64_t parent_inode_id = 0; 
-
-    char *slash = strchr(full_path, '/');
-    if (slash) {
-        *slash = '\0';
-        dir_name = full_path;
-        file_name = slash + 1;
-        
-        parent_inode_id = find_entry_in_dir(0, dir_name);
-        if (parent_inode_id == 0) return -ENOENT;
+    // 1. 找到目录的 Inode (根目录也一样)，列目录期间持有共享锁
+    uint64_t inode_id;
+    int ret = lock_node(ino, NULL, ICACHE_SHARED, &inode_id);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
     }
 
-    if (strlen(file_name) > MAX_FILENAME) return -ENAMETOOLONG;
+    inode_t inode;
+    load_inode(inode_id, &inode);
+
+    // 确保它是个目录，不是文件
+    readdir_ctx_t ctx = { req, malloc(size), size, 0 };
+    if (!S_ISDIR(inode.mode) || node_vid(ino) != 0) ret = -ENOTDIR;
+    else if (!ctx.buf) ret = -ENOMEM;
+    // 2. 从 offset 开始遍历哈希目录
+    else ret = dir_iterate(&inode.current, inode_id, offset, readdir_fill, &ctx);
+    icache_unlock(inode_id);
+
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_buf(req, ctx.buf, ctx.pos);
+    free(ctx.buf);
+}
+
+// [新增] 新建的文件、子目录继承父目录的压缩策略
+static uint32_t inherit_policy(uint64_t parent_id) {
+    inode_t parent;
+    load_inode(parent_id, &parent);
+    return parent.flags & SMARTFS_INODE_POLICY_MASK;
+}
+
+// 3. 创建文件 (create)
+static int create_file(uint64_t parent_inode_id, const char *file_name, mode_t mode, uint64_t *out) {
+    printf("DEBUG: Create %s in dir %lu\n", file_name, parent_inode_id);
+    fflush(stdout);
 
     uint64_t new_inode_id = allocate_inode();
     if (new_inode_id == 0) return -ENOSPC;
@@ -378,51 +1195,119 @@ static int smartfs_create(const char *path, mode_t mode, struct fuse_file_info *
     new_inode.link_count = 1;
     new_inode.inode_id = new_inode_id;
     new_inode.mode = mode | S_IFREG; 
+    new_inode.flags = inherit_policy(parent_inode_id);
     new_inode.uid = getuid();
     new_inode.gid = getgid();
     new_inode.total_versions = 1;
     new_inode.latest_version = 1;
-    new_inode.versions[0].version_id = 1;
-    new_inode.versions[0].timestamp = time(NULL);
+    new_inode.current.version_id = 1;
+    new_inode.current.timestamp = time(NULL);
     
     save_inode(&new_inode);
 
-    int ret = add_dir_entry(parent_inode_id, file_name, new_inode_id);
-    if (ret != 0) return ret;
-
+    node_get(new_inode_id);
+    int ret = add_dir_entry(parent_inode_id, file_name, new_inode_id, new_inode.mode);
+    if (ret != 0) {
+        node_put(new_inode_id, 1);
+        free_inode(new_inode_id);
+        return ret;
+    }
+    *out = new_inode_id;
     return 0;
 }
+static void smartfs_create(fuse_req_t req, fuse_ino_t parent, const char *name,
+                           mode_t mode, struct fuse_file_info *fi) {
+    uint64_t inode_id = 0;
+    struct fuse_entry_param e;
+    int ret = check_name(parent, name);
+    if (ret == 0) ret = create_file(node_ino(parent), name, mode, &inode_id);
+    // create 同时打开了文件，和 open 一样登记句柄
+    if (ret == 0 && (ret = of_open(inode_id, fi)) != 0) forget_one(make_node(inode_id, 0), 1);
+    if (ret == 0 && (ret = make_entry(inode_id, &e)) != 0) {
+        of_close(of_get(fi));
+        fi->fh = 0;
+    }
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_create(req, &e, fi);
+}
+
+// [新增] CDC 模式 (-o cdc)：整段写入拼成连续的逻辑块 (首尾不完整的块先补上旧数据)，
+// 交给 smart_write_cdc 一起按内容切块。逐块交下去的话每块各切各的，插入数据之后切点就对不齐了
+static int write_cdc_locked(uint64_t inode_id, file_version_t *v, bmap_cursor_t *cur,
+                            const char *buf, size_t size, off_t offset, uint64_t old_size, size_t *done) {
+    uint64_t first = offset / BLOCK_SIZE, last = (offset + size - 1) / BLOCK_SIZE;
+    size_t nblk = last - first + 1;
+    // 写入后最后一块的有效长度：写到哪里，或者原来的数据到哪里
+    uint64_t end = offset + size;
+    if (old_size > end) end = (old_size < (last + 1) * BLOCK_SIZE) ? old_size : (last + 1) * BLOCK_SIZE;
+
+    char *data = malloc(nblk * BLOCK_SIZE);
+    int *ids = malloc(nblk * sizeof(int));
+    int ret = 0;
+    if (!data || !ids) {
+        ret = -ENOMEM;
+        goto out;
+    }
+    // 第一块从中间开始写、最后一块后面还有旧数据时要先读旧内容 (首尾是同一块只读一次)
+    int head = (offset % BLOCK_SIZE) != 0;
+    int tail = end > (uint64_t)(offset + size) && !(head && first == last);
+    for (int i = 0; i < 2; i++) {
+        if (!(i == 0 ? head : tail)) continue;
+        uint64_t lblk = (i == 0) ? first : last;
+        char *dst = data + (lblk - first) * BLOCK_SIZE;
+        uint64_t old_block_id = 0;
+        if ((ret = bmap_lookup(cur, v, lblk, &old_block_id)) != 0) goto out;
+        if (old_block_id == 0 || smart_read((long)inode_id, (long)old_block_id, dst, BLOCK_SIZE) < 0) {
+            memset(dst, 0, BLOCK_SIZE);
+        }
+    }
+    memcpy(data + offset % BLOCK_SIZE, buf, size);
+
+    if (smart_write_cdc((long)inode_id, (long)(first * BLOCK_SIZE), data, (int)(end - first * BLOCK_SIZE), ids) < 0) {
+        ret = -EIO;
+        goto out;
+    }
+    // [修改] 换下来的旧块放掉引用；挂不上去的新块 (以及后面还没挂的) 也要放掉
+    size_t i;
+    for (i = 0; i < nblk; i++) {
+        uint64_t old_id = 0;
+        if (ids[i] > 0) wal_log_write(ids[i], 0);
+        if ((ret = bmap_assign(cur, v, first + i, (uint64_t)ids[i], &old_id)) != 0) break;
+        if (old_id != 0) storage_release_block((int)old_id);
+        uint64_t blk_end = (first + i + 1) * BLOCK_SIZE;
+        *done = (blk_end - offset < size) ? (size_t)(blk_end - offset) : size;
+    }
+    for (; i < nblk; i++) {
+        if (ids[i] > 0) storage_release_block(ids[i]);
+    }
+out:
+    free(data);
+    free(ids);
+    return ret;
+}
 
 // 4. 写入文件 (write)
 // [修改] 集成快照与CoW的 write
 // =========================================================
 // 智能写入 (Smart Write Integration) - 模块A+B+C 集成版
 // =========================================================
-static int smartfs_write(const char *path, const char *buf, size_t size,
-                         off_t offset, struct fuse_file_info *fi) 
+static int write_locked(uint64_t inode_id, const char *buf, size_t size, off_t offset)
 {
-    (void) fi;
-    printf("DEBUG: smartfs_write path=%s size=%lu offset=%ld\n", path, size, offset);
-
-    // 1. 解析路径找到 Inode ID
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
+    printf("DEBUG: smartfs_write inode=%lu size=%lu offset=%ld\n", inode_id, size, offset);
 
     // 加载 Inode
     inode_t inode;
     load_inode(inode_id, &inode);
-
-    int current_idx = inode.total_versions - 1;
-    if (current_idx < 0) current_idx = 0;
+    bind_codec(&inode);
 
     // 🔴 [优化] 时间间隔策略
     int SNAPSHOT_INTERVAL = 30; 
     
-    if (inode.versions[current_idx].file_size > 0) {
+    if (inode.current.file_size > 0) {
         // 如果满足时间间隔，且文件不为空，则创建快照
         if (version_mgr_should_snapshot(&inode, SNAPSHOT_INTERVAL)) {
             printf("DEBUG: Time strategy triggered. Creating snapshot...\n");
-            int res = version_mgr_create_snapshot(&inode, "Auto-save (Time Triggered)");
+            int res = snapshot_inode(&inode, "Auto-save (Time Triggered)");
             if (res < 0) {
                  printf("WARNING: Snapshot failed (Pinned?), writing to current version.\n");
             }
@@ -430,102 +1315,457 @@ static int smartfs_write(const char *path, const char *buf, size_t size,
             printf("DEBUG: Write inside interval (<%ds), updating current version.\n", SNAPSHOT_INTERVAL);
         }
     } 
-    // 注意：这里删除了你代码中那个重复的 "if (inode.versions[current_idx].file_size > 0)" 块
+    // 注意：这里删除了你代码中那个重复的 "if (inode.current.file_size > 0)" 块
     // 因为上面的逻辑已经涵盖了快照判断
 
     // ---------------------------------------------------------
-    // 步骤 A: 准备缓冲区 (Read-Modify-Write)
-    // ---------------------------------------------------------
-    char merge_buffer[BLOCK_SIZE];
-    memset(merge_buffer, 0, BLOCK_SIZE);
-
-    int latest_idx = inode.total_versions - 1;
-    int old_block_id = inode.versions[latest_idx].block_list_start_index;
-    int old_size = inode.versions[latest_idx].file_size;
-
-    if (old_block_id > 0 && old_size > 0) {
-        smart_read((long)inode_id, (long)old_block_id, merge_buffer, BLOCK_SIZE);
-    }
-
-    // ---------------------------------------------------------
-    // 步骤 B: 合并数据
+    // 步骤 A: 写时复制 (快照之后第一次写入，先复制共享的块映射)
     // ---------------------------------------------------------
-    if (offset + size > BLOCK_SIZE) {
-        return -EFBIG; 
+    file_version_t *v = &inode.current;
+    uint64_t old_size = v->file_size;
+
+    // [新增] 小文件直接写进 Inode (不算指纹、不压缩、不进 L3)；写完放不下了先把内联数据搬到数据块里
+    if (inline_fits(&inode, (uint64_t)offset + size)) {
+        if (!(inode.flags & SMARTFS_INODE_INLINE)) {
+            memset(inode.inline_data, 0, sizeof(inode.inline_data));
+            inode.flags |= SMARTFS_INODE_INLINE;
+            v->map_depth = 0;
+            v->block_count = 0;
+        }
+        memcpy(inode.inline_data + offset, buf, size);
+        if (offset + size > v->file_size) v->file_size = offset + size;
+        v->timestamp = time(NULL);
+        save_inode(&inode);
+        inval_version(inode_id, (int)v->version_id, 0);
+        return size;
     }
+    int spill = inline_spill(&inode);
+    if (spill != 0) return spill;
 
-    memcpy(merge_buffer + offset, buf, size);
-
-    int new_total_size = offset + size;
-    if (new_total_size < old_size) new_total_size = old_size;
+    if (bmap_unshare(v) != 0) return -ENOSPC;
 
     // ---------------------------------------------------------
-    // 步骤 C: 写入新块 (集成 WAL)
+    // 步骤 B: 逐块合并并写入 (集成 WAL)
+    // 整块覆盖直接写；只有首尾不完整的块才需要 Read-Modify-Write
     // ---------------------------------------------------------
-    int physical_block_id = 0;
+    // [修改] 每次凑 WRITE_BATCH 个块一起交给写入流水线 (指纹、查重、压缩、落盘在工作线程上并行做)，
+    // 回来之后按顺序挂进块映射；不完整的块只可能是第一块和最后一块，两个合并缓冲就够
+    bmap_cursor_t cur;
+    bmap_cursor_init(&cur);
+    char merge_buffer[2][BLOCK_SIZE];
+    size_t done = 0;
+    int ret = 0;
 
     // [WAL] 1. 开启事务
     wal_begin("Write Data Block");
 
-    // 2. 执行写入
-    int written = smart_write((long)inode_id, 0, merge_buffer, new_total_size, &physical_block_id);
-    
-    if (written < 0) {
-        return -EIO;
-    }
+    if (cdc_enabled() && size > 0) ret = write_cdc_locked(inode_id, v, &cur, buf, size, offset, old_size, &done);
+
+    while (done < size && ret == 0) {
+        const char *srcs[WRITE_BATCH];
+        int lens[WRITE_BATCH];
+        long offs[WRITE_BATCH];
+        uint64_t lblks[WRITE_BATCH];
+        size_t chunks[WRITE_BATCH];
+        int ids[WRITE_BATCH];
+        int n = 0, merged = 0;
+
+        for (size_t at = done; n < WRITE_BATCH && at < size; n++) {
+            uint64_t pos = offset + at;
+            uint64_t lblk = pos / BLOCK_SIZE;
+            size_t in_blk = pos % BLOCK_SIZE;
+            size_t chunk = BLOCK_SIZE - in_blk;
+            if (chunk > size - at) chunk = size - at;
+
+            // 写入后这个块里的有效字节数
+            uint64_t blk_start = lblk * BLOCK_SIZE;
+            size_t blk_len = 0;
+            if (old_size > blk_start) {
+                blk_len = (old_size - blk_start < BLOCK_SIZE) ? (size_t)(old_size - blk_start) : BLOCK_SIZE;
+            }
+            if (in_blk + chunk > blk_len) blk_len = in_blk + chunk;
+
+            const char *src = buf + at;
+            if (in_blk != 0 || chunk != blk_len) {
+                char *mb = merge_buffer[merged++];
+                uint64_t old_block_id = 0;
+                if ((ret = bmap_lookup(&cur, v, lblk, &old_block_id)) != 0) break;
+                // smart_read 会把块后面不足的部分补 0，只有空洞才需要自己清零
+                if (old_block_id == 0 || smart_read((long)inode_id, (long)old_block_id, mb, BLOCK_SIZE) < 0) {
+                    memset(mb, 0, BLOCK_SIZE);
+                }
+                memcpy(mb + in_blk, buf + at, chunk);
+                src = mb;
+            }
+            srcs[n] = src;
+            lens[n] = (int)blk_len;
+            offs[n] = (long)blk_start;
+            lblks[n] = lblk;
+            chunks[n] = chunk;
+            at += chunk;
+        }
+        // 合并旧数据失败：已经凑好的块照样写完再停
+        int gather_ret = ret;
+        ret = 0;
+        // 2. 执行写入 (整批)
+        smart_write_many((long)inode_id, offs, srcs, lens, n, ids);
+
+        int i;
+        for (i = 0; i < n; i++) {
+            int physical_block_id = ids[i];
+            if (physical_block_id < 0) {
+                ret = -EIO;
+                break;
+            }
 
-    // [WAL] 3. 记日志
-    if (physical_block_id > 0) {
-        wal_log_write(physical_block_id, 0); 
+            // [WAL] 3. 记日志
+            if (physical_block_id > 0) {
+                wal_log_write(physical_block_id, 0); 
+            }
+
+            // [修改] 换下来的旧块放掉引用 (没挂上去的新块也是)
+            uint64_t old_id = 0;
+            if ((ret = bmap_assign(&cur, v, lblks[i], (uint64_t)physical_block_id, &old_id)) != 0) {
+                if (physical_block_id > 0) storage_release_block(physical_block_id);
+                i++;
+                break;
+            }
+            if (old_id != 0) storage_release_block((int)old_id);
+            done += chunks[i];
+        }
+        // 中途失败：后面已经写好的块不会挂上去了
+        for (; i < n; i++) {
+            if (ids[i] > 0) storage_release_block(ids[i]);
+        }
+        if (ret == 0) ret = gather_ret;
     }
 
     // [WAL] 4. 提交事务
     wal_commit();
 
     // ---------------------------------------------------------
-    // 步骤 D: 更新元数据
+    // 步骤 C: 更新元数据
     // ---------------------------------------------------------
-    if (physical_block_id > 0) {
-        inode.versions[latest_idx].block_list_start_index = physical_block_id;
-        inode.versions[latest_idx].block_count = 1; 
+    if (bmap_cursor_flush(&cur) != 0 && ret == 0) ret = -EIO;
+
+    if (offset + done > v->file_size) v->file_size = offset + done;
+    v->timestamp = time(NULL);
+
+    save_inode(&inode);
+    // [新增] 内核不知道 "file@vN" 和活文件是同一份数据，当前版本的视图要单独作废
+    inval_version(inode_id, (int)v->version_id, 0);
+
+    if (done == 0 && ret != 0) return ret;
+    return done;
+}
+
+// [新增] 写缓冲：合并小块写，下刷时才走一次 Read-Modify-Write + 去重压缩
+static int cmp_wbuf_block(const void *a, const void *b) {
+    uint64_t x = ((const wbuf_block_t *)a)->lblk, y = ((const wbuf_block_t *)b)->lblk;
+    return (x > y) - (x < y);
+}
+
+// 把句柄缓冲的块写下去 (调用者持有 Inode 的 EXCL 锁)
+// 首尾相接的整块合并成一次 write_locked，不完整的块由 write_locked 补齐旧数据
+static int wbuf_flush(open_file_t *of) {
+    if (of->nblocks == 0) return 0;
+    qsort(of->blocks, of->nblocks, sizeof(wbuf_block_t), cmp_wbuf_block);
+
+    char *run = malloc((size_t)WBUF_BLOCKS * BLOCK_SIZE);
+    if (!run) {
+        of->nblocks = 0;
+        return -ENOMEM;
+    }
+    int ret = 0;
+    int i = 0;
+    while (i < of->nblocks) {
+        wbuf_block_t *first = &of->blocks[i];
+        size_t len = first->hi - first->lo;
+        memcpy(run, first->data + first->lo, len);
+        int j = i + 1;
+        while (j < of->nblocks && of->blocks[j - 1].hi == BLOCK_SIZE &&
+               of->blocks[j].lblk == of->blocks[j - 1].lblk + 1 && of->blocks[j].lo == 0) {
+            memcpy(run + len, of->blocks[j].data, of->blocks[j].hi);
+            len += of->blocks[j].hi;
+            j++;
+        }
+        off_t off = (off_t)(first->lblk * BLOCK_SIZE + first->lo);
+        int res = write_locked(of->inode_id, run, len, off);
+        if (res < 0 && ret == 0) ret = res;
+        else if (res >= 0 && (size_t)res < len && ret == 0) ret = -EIO;
+        i = j;
+    }
+    free(run);
+    // 出错也清空缓冲：错误由这次 flush/fsync/close 返回，和内核回写脏页失败一样
+    of->nblocks = 0;
+    return ret;
+}
+
+// 下刷这个 Inode 所有句柄的缓冲 (skip 除外)，读、截断、快照之前调用
+static int wbuf_flush_inode(uint64_t inode_id, open_file_t *skip) {
+    int ret = 0;
+    open_file_t *of;
+    while ((of = of_find_dirty(inode_id, skip)) != NULL) {
+        int res = wbuf_flush(of);
+        if (res != 0 && ret == 0) ret = res;
+    }
+    return ret;
+}
+
+// 块里 [lo, hi) 之外的字节用磁盘上的旧内容补齐，之后整块都是确定的
+static int wbuf_fill(open_file_t *of, wbuf_block_t *b) {
+    inode_t inode;
+    load_inode(of->inode_id, &inode);
+    uint64_t blk_start = b->lblk * BLOCK_SIZE;
+    uint32_t old_len = 0;
+    if (inode.current.file_size > blk_start) {
+        uint64_t rest = inode.current.file_size - blk_start;
+        old_len = rest < BLOCK_SIZE ? (uint32_t)rest : BLOCK_SIZE;
+    }
+
+    char old[BLOCK_SIZE];
+    memset(old, 0, sizeof(old));
+    if (inode.flags & SMARTFS_INODE_INLINE) {
+        // [新增] 内联文件只有第 0 块，旧内容就在 Inode 里
+        if (old_len > 0) memcpy(old, inode.inline_data, old_len);
+    } else if (old_len > 0) {
+        bmap_cursor_t cur;
+        bmap_cursor_init(&cur);
+        uint64_t block_id = 0;
+        if (bmap_lookup(&cur, &inode.current, b->lblk, &block_id) != 0) return -EIO;
+        if (block_id > 0 && smart_read((long)of->inode_id, (long)block_id, old, BLOCK_SIZE) < 0) return -EIO;
+    }
+    memcpy(b->data, old, b->lo);
+    if (old_len > b->hi) {
+        memcpy(b->data + b->hi, old + b->hi, old_len - b->hi);
+        b->hi = old_len;
+    } else {
+        memset(b->data + b->hi, 0, BLOCK_SIZE - b->hi);
+    }
+    b->lo = 0;
+    return 0;
+}
+
+// 把一次写请求合并进句柄的缓冲 (调用者持有 Inode 的 EXCL 锁)
+static int wbuf_write(open_file_t *of, const char *buf, size_t size, off_t offset) {
+    if (!of->blocks) {
+        of->blocks = malloc(WBUF_BLOCKS * sizeof(wbuf_block_t));
+        if (!of->blocks) return -ENOMEM;
+    }
+
+    size_t done = 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint64_t lblk = pos / BLOCK_SIZE;
+        uint32_t in_blk = pos % BLOCK_SIZE;
+        uint32_t chunk = BLOCK_SIZE - in_blk;
+        if (chunk > size - done) chunk = size - done;
+
+        wbuf_block_t *b = NULL;
+        for (int i = 0; i < of->nblocks; i++) {
+            if (of->blocks[i].lblk == lblk) { b = &of->blocks[i]; break; }
+        }
+        if (!b) {
+            if (of->nblocks == WBUF_BLOCKS) {
+                int ret = wbuf_flush(of);
+                if (ret != 0) return ret;
+            }
+            b = &of->blocks[of->nblocks];
+            b->lblk = lblk;
+            b->lo = in_blk;
+            b->hi = in_blk;
+            of->nblocks++;
+        } else if (in_blk > b->hi || in_blk + chunk < b->lo) {
+            // 和已缓冲的范围不相接，中间的空隙要用旧数据补上
+            int ret = wbuf_fill(of, b);
+            if (ret != 0) return ret;
+        }
+        memcpy(b->data + in_blk, buf + done, chunk);
+        if (in_blk < b->lo) b->lo = in_blk;
+        if (in_blk + chunk > b->hi) b->hi = in_blk + chunk;
+        done += chunk;
+    }
+    return (int)size;
+}
+
+// 下刷一个句柄的缓冲 (flush/fsync/release 调用)；文件已经被删掉的话缓冲早就丢弃了
+static int of_flush(open_file_t *of) {
+    if (!of) return 0;
+    icache_lock(of->inode_id, ICACHE_EXCL);
+    int ret = of->stale ? 0 : wbuf_flush(of);
+    icache_unlock(of->inode_id);
+    return ret;
+}
+
+// 卸载时下刷所有句柄的缓冲 (正常情况下内核已经 release 过所有文件)
+static void wbuf_flush_all() {
+    for (int b = 0; b < OF_BUCKETS; b++) {
+        for (;;) {
+            // 不能拿着 of_lock 去拿 Inode 锁，每次只取一个 Inode 号出来
+            uint64_t id = 0;
+            int found = 0;
+            pthread_mutex_lock(&of_lock);
+            for (open_file_t *of = of_table[b]; of; of = of->hnext) {
+                if (of->nblocks > 0) { id = of->inode_id; found = 1; break; }
+            }
+            pthread_mutex_unlock(&of_lock);
+            if (!found) break;
+            icache_lock(id, ICACHE_EXCL);
+            wbuf_flush_inode(id, NULL);
+            icache_unlock(id);
+        }
+    }
+}
+
+static int write_node(fuse_ino_t ino, const char *buf, size_t size,
+                      off_t offset, struct fuse_file_info *fi) {
+    // 历史版本视图是只读的
+    if (node_vid(ino) != 0) return -EROFS;
+    uint64_t inode_id;
+    int ret = lock_node(ino, fi, ICACHE_EXCL, &inode_id);
+    if (ret != 0) return ret;
+
+    open_file_t *of = of_get(fi);
+    if (of && size < (size_t)WBUF_BLOCKS * BLOCK_SIZE) {
+        // 别的句柄缓冲的数据先落盘，保证同一个 Inode 上后写的覆盖先写的
+        ret = wbuf_flush_inode(inode_id, of);
+        if (ret == 0) ret = wbuf_write(of, buf, size, offset);
+    } else {
+        // 大块写 (或没有句柄) 不经过缓冲，先把缓冲里更早的数据写下去
+        ret = wbuf_flush_inode(inode_id, NULL);
+        if (ret == 0) ret = write_locked(inode_id, buf, size, offset);
+    }
+    icache_unlock(inode_id);
+    return ret;
+}
+static void smartfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size,
+                          off_t offset, struct fuse_file_info *fi) {
+    int ret = write_node(ino, buf, size, offset, fi);
+    if (ret < 0) fuse_reply_err(req, -ret);
+    else fuse_reply_write(req, (size_t)ret);
+}
+// [新增] write_buf：请求数据已经在 libfuse 的内存缓冲区里时直接用，不再拷贝；
+// 数据还在管道里 (splice 读请求) 才拷出来一次。整块数据就这样直接交给去重和压缩
+static void smartfs_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec *in_buf,
+                              off_t offset, struct fuse_file_info *fi) {
+    size_t size = fuse_buf_size(in_buf);
+    const struct fuse_buf *b = &in_buf->buf[0];
+    char *copy = NULL;
+    const char *data;
+    int ret = 0;
+    if (in_buf->count == 1 && !(b->flags & FUSE_BUF_IS_FD)) {
+        data = (const char *)b->mem + in_buf->off;
+        size -= in_buf->off;
+    } else {
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(size);
+        dst.buf[0].mem = copy = malloc(size ? size : 1);
+        ssize_t n = copy ? fuse_buf_copy(&dst, in_buf, 0) : -ENOMEM;
+        if (n < 0) ret = (int)n;
+        else size = (size_t)n;
+        data = copy;
+    }
+    if (ret == 0) ret = write_node(ino, data, size, offset, fi);
+    if (ret < 0) fuse_reply_err(req, -ret);
+    else fuse_reply_write(req, (size_t)ret);
+    free(copy);
+}
+// [新增] 顺序读预读 (类似内核的 ondemand readahead)
+// 这次读 [first, last] 块；hits 是其中预读过、已经在 L1 里的块数，
+// misses 是预读提交了一整个窗口之前、却还是不在 L1 里的块数 (多半是没用上就被挤出去了)。
+// 接着上次读的位置读就是顺序读：窗口翻倍，misses 占多数说明 L1 装不下就减半；
+// 跳着读则清空窗口。剩下的提前量不到半个窗口时再往前提交一批块号给预读线程。
+static void readahead(open_file_t *of, file_version_t *v, uint64_t first, uint64_t last,
+                      uint32_t hits, uint32_t misses) {
+    pthread_mutex_lock(&of->ra_lock);
+    int sequential = (first == of->ra_next) ||
+                     (of->ra_window > 0 && first >= of->ra_start && first < of->ra_end);
+    of->ra_next = last + 1;
+    if (!sequential) {
+        of->ra_window = 0;
+        of->ra_start = of->ra_end = 0;
+        pthread_mutex_unlock(&of->ra_lock);
+        return;
     }
 
-    inode.versions[latest_idx].file_size = new_total_size;
-    inode.versions[latest_idx].timestamp = time(NULL);
+    if (of->ra_window == 0) of->ra_window = RA_MIN_BLOCKS;
+    else if (misses > hits) of->ra_window = of->ra_window / 2 > RA_MIN_BLOCKS ? of->ra_window / 2 : RA_MIN_BLOCKS;
+    else if (of->ra_window < RA_MAX_BLOCKS) of->ra_window *= 2;
+
+    uint64_t nblocks = (v->file_size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint64_t from = of->ra_end > of->ra_next ? of->ra_end : of->ra_next;
+    uint64_t to = of->ra_next + of->ra_window;
+    if (to > nblocks) to = nblocks;
+    if (from >= to || from - of->ra_next > of->ra_window / 2) {
+        pthread_mutex_unlock(&of->ra_lock);
+        return;
+    }
 
-    save_inode(&inode);
+    int ids[RA_MAX_BLOCKS];
+    int n = 0;
+    bmap_cursor_t cur;
+    bmap_cursor_init(&cur);
+    for (uint64_t lblk = from; lblk < to && n < RA_MAX_BLOCKS; lblk++) {
+        uint64_t block_id = 0;
+        if (bmap_lookup(&cur, v, lblk, &block_id) != 0) break;
+        if (block_id > 0) ids[n++] = (int)block_id;   // 空洞不用预读
+    }
+    if (of->ra_end <= of->ra_next) of->ra_start = from;
+    of->ra_end = to;
+    pthread_mutex_unlock(&of->ra_lock);
 
-    return size;
+    if (n > 0) prefetch_submit(ids, n);
 }
-static int smartfs_read(const char *path, char *buf, size_t size, 
-                       off_t offset, struct fuse_file_info *fi) 
-{
-    (void) fi;
 
-    // 1. 解析路径与版本
-    char real_path[MAX_FILENAME];
-    int version_id = 0; 
-    char time_str[32] = {0}; 
+// [新增] 读回复：数据按文件顺序放在 mem 里，没压缩、又不在缓存里的块不读出来，
+// 记成指向 L3 数据文件的一段，回复时由 libfuse 直接 splice 给内核
+typedef struct {
+    struct fuse_bufvec *bv;
+    char *mem;
+    size_t mem_from;        // mem 里还没加进 bv 的数据从这里开始
+} read_reply_t;
+
+static void rr_add_mem(read_reply_t *rr, size_t end) {
+    if (end <= rr->mem_from) return;
+    struct fuse_buf *b = &rr->bv->buf[rr->bv->count++];
+    memset(b, 0, sizeof(*b));
+    b->size = end - rr->mem_from;
+    b->mem = rr->mem + rr->mem_from;
+    b->fd = -1;
+    rr->mem_from = end;
+}
 
-    version_query_type_t query_type = parse_version_path(path, real_path, &version_id, time_str);
+// 回复里 [at, at + ext->length) 这一段来自数据文件
+static void rr_add_fd(read_reply_t *rr, size_t at, const l3_extent_t *ext) {
+    int adjacent = (rr->mem_from == at);
+    rr_add_mem(rr, at);
+    struct fuse_buf *b = rr->bv->count ? &rr->bv->buf[rr->bv->count - 1] : NULL;
+    // 顺序写入的块在数据文件里也是挨着的，合并成一段
+    if (adjacent && b && (b->flags & FUSE_BUF_IS_FD) && b->pos + (off_t)b->size == ext->offset) {
+        b->size += ext->length;
+    } else {
+        b = &rr->bv->buf[rr->bv->count++];
+        memset(b, 0, sizeof(*b));
+        b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        b->fd = ext->fd;
+        b->pos = ext->offset;
+        b->size = ext->length;
+    }
+    rr->mem_from = at + ext->length;
+}
 
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
+// [修改] rr 不为空时读到 rr->mem (就是 buf)，未压缩的块只记位置
+static int read_locked(uint64_t inode_id, int vid, char *buf, size_t size,
+                       off_t offset, struct fuse_file_info *fi, read_reply_t *rr)
+{
+    open_file_t *of = of_get(fi);
 
+    // 1. 找到要读的版本 (vid 在 lookup 时就解析好了)
     inode_t inode;
     load_inode(inode_id, &inode);
     
-    file_version_t *v = NULL;
-
-    if (query_type == VER_QUERY_ID) {
-        v = version_mgr_get_version(&inode, version_id);
-    } 
-    else if (query_type == VER_QUERY_TIME) {
-        v = version_mgr_find_by_time_str(&inode, time_str);
-    } 
-    else {
-        v = version_mgr_get_version(&inode, 0);
-    }
+    version_table_t vt;
+    version_query_type_t query_type = vid ? VER_QUERY_ID : VER_QUERY_NONE;
+    file_version_t *v = lookup_version(&inode, query_type, vid, NULL, &vt);
     
     if (!v) return -ENOENT;
 
@@ -539,104 +1779,168 @@ static int smartfs_read(const char *path, char *buf, size_t size,
         size = v->file_size - offset;
     }
 
-    int physical_block_id = v->block_list_start_index;
-    if (physical_block_id == 0) return 0;
+    // [新增] 内联的小文件直接从 Inode 里拷 (内联的文件没有历史版本，读到的一定是它)
+    if (inode.flags & SMARTFS_INODE_INLINE) {
+        memcpy(buf, inode.inline_data + offset, size);
+        return size;
+    }
 
-    // [块内读取]
-    char temp_block[BLOCK_SIZE]; 
-    
-    // 使用 smart_read 读取解压
-    int bytes_in_block = smart_read((long)inode_id, (long)physical_block_id, temp_block, BLOCK_SIZE);
-    
-    if (bytes_in_block <= 0) return 0;
+    // [逐块读取] 通过块映射找到每个逻辑块，空洞直接补 0
+    bmap_cursor_t cur;
+    bmap_cursor_init(&cur);
+    size_t done = 0;
+    uint32_t ra_hits = 0, ra_misses = 0;
+    uint64_t ra_start = 0, ra_end = 0, ra_window = 0;
+    if (of) {
+        pthread_mutex_lock(&of->ra_lock);
+        ra_start = of->ra_start;
+        ra_end = of->ra_end;
+        ra_window = of->ra_window;
+        pthread_mutex_unlock(&of->ra_lock);
+    }
 
-    if (offset >= bytes_in_block) return 0;
+    while (done < size) {
+        uint64_t pos = offset + done;
+        uint64_t lblk = pos / BLOCK_SIZE;
+        size_t in_blk = pos % BLOCK_SIZE;
+        size_t chunk = BLOCK_SIZE - in_blk;
+        if (chunk > size - done) chunk = size - done;
 
-    size_t copy_len = size;
-    if (offset + copy_len > bytes_in_block) {
-        copy_len = bytes_in_block - offset;
+        uint64_t physical_block_id = 0;
+        if (bmap_lookup(&cur, v, lblk, &physical_block_id) != 0) break;
+
+        if (physical_block_id == 0) {
+            memset(buf + done, 0, chunk);
+        } else {
+            // 统计预读过的块是不是已经在 L1 里了 (用来调整预读窗口)；
+            // 靠近预读前沿的块没到只是预读线程还没赶上，不算 miss
+            if (lblk >= ra_start && lblk < ra_end) {
+                if (lru_contains((int)physical_block_id)) ra_hits++;
+                else if (ra_end - lblk > ra_window) ra_misses++;
+            }
+            // [修改] 直接读到回复缓冲区里 (缓存命中拷一次，压缩块直接解压进去)，
+            // 没压缩的块交给内核从数据文件 splice
+            l3_extent_t ext;
+            int n = smart_read_range((int)physical_block_id, (int)in_blk, (int)chunk, buf + done, rr ? &ext : NULL);
+            if (n < 0) break;
+            if (rr && ext.fd >= 0 && n > 0) rr_add_fd(rr, done, &ext);
+        }
+        done += chunk;
     }
 
-    memcpy(buf, temp_block + offset, copy_len);
+    if (of && done > 0) {
+        readahead(of, v, offset / BLOCK_SIZE, (offset + done - 1) / BLOCK_SIZE, ra_hits, ra_misses);
+    }
 
-    return copy_len;
+    if (done == 0 && size > 0) return -EIO;
+    return done;
+}
+static int read_node(fuse_ino_t ino, char *buf, size_t size, off_t offset,
+                     struct fuse_file_info *fi, read_reply_t *rr) {
+    uint64_t inode_id;
+    int ret = lock_node(ino, fi, ICACHE_SHARED, &inode_id);
+    if (ret != 0) return ret;
+    if (of_find_dirty(inode_id, NULL)) {
+        // 有句柄缓冲着还没落盘的数据：换成 EXCL 锁先下刷，读到的才是最新内容
+        icache_unlock(inode_id);
+        ret = lock_node(ino, fi, ICACHE_EXCL, &inode_id);
+        if (ret != 0) return ret;
+        ret = wbuf_flush_inode(inode_id, NULL);
+        if (ret != 0) {
+            icache_unlock(inode_id);
+            return ret;
+        }
+    }
+    ret = read_locked(inode_id, node_vid(ino), buf, size, offset, fi, rr);
+    icache_unlock(inode_id);
+    return ret;
+}
+// [修改] 用 fuse_bufvec 回复：内存里的段和数据文件里的段交替，每块最多两段 (数据 + 补 0)
+static void smartfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+                         off_t offset, struct fuse_file_info *fi) {
+    size_t nbufs = 2 * (size / BLOCK_SIZE + 2) + 1;
+    read_reply_t rr = { malloc(sizeof(struct fuse_bufvec) + nbufs * sizeof(struct fuse_buf)),
+                        malloc(size ? size : 1), 0 };
+    int ret = -ENOMEM;
+    if (rr.bv && rr.mem) {
+        memset(rr.bv, 0, sizeof(struct fuse_bufvec));
+        ret = read_node(ino, rr.mem, size, offset, fi, &rr);
+    }
+    if (ret < 0) {
+        fuse_reply_err(req, -ret);
+    } else {
+        rr_add_mem(&rr, (size_t)ret);
+        if (rr.bv->count == 0) fuse_reply_buf(req, NULL, 0);
+        else fuse_reply_data(req, rr.bv, FUSE_BUF_SPLICE_MOVE);
+    }
+    free(rr.bv);
+    free(rr.mem);
 }
 
-// 6. 删除文件 (unlink)
-// 6. 删除文件 (unlink) - 升级版：支持硬链接计数
-static int smartfs_unlink(const char *path) {
-    printf("DEBUG: Unlink %s\n", path);
-    
-    // 1. 解析路径
-    char full_path[MAX_FILENAME];
-    strncpy(full_path, path + 1, MAX_FILENAME - 1);
-    full_path[MAX_FILENAME - 1] = '\0';
-
-    char *dir_name = NULL;
-    char *file_name = full_path;
-    uint64_t parent_id = 0;
-
-    char *slash = strchr(full_path, '/');
-    if (slash) {
-        *slash = '\0';
-        dir_name = full_path;
-        file_name = slash + 1;
-        parent_id = find_entry_in_dir(0, dir_name);
-        if (parent_id == 0) return -ENOENT;
-    }
-
-    // 2. 找到目标 Inode
-    uint64_t target_id = find_entry_in_dir(parent_id, file_name);
-    if (target_id == 0) return -ENOENT;
-
-    // 3. 从目录中移除条目 (名字没了)
-    if (remove_dir_entry(parent_id, file_name) != 0) return -ENOENT;
-
-    // 4. 【核心修改】减少链接计数
+// 名字被删掉之后减少链接计数，没人引用了才真正回收 (unlink / rename 覆盖时调用)
+static void drop_link(uint64_t target_id) {
+    icache_lock(target_id, ICACHE_EXCL);
     inode_t inode;
     load_inode(target_id, &inode);
-    
+
     if (inode.link_count > 0) {
         inode.link_count--;
     }
 
-    if (inode.link_count == 0) {
-        // 只有没人引用了，才真正回收
-        printf("DEBUG: Link count is 0, freeing inode %lu\n", target_id);
-        free_inode(target_id);
+    if (inode.mode == 0) {
+        // 等锁的时候已经被别人回收了
+    } else if (inode.link_count == 0) {
+        // 没有名字了才回收 (内核还引用着的话等 forget)
+        printf("DEBUG: Link count is 0, releasing inode %lu\n", target_id);
+        drop_inode(target_id, &inode);
     } else {
         // 还有别的文件名指向它，只保存计数更新
         printf("DEBUG: Link count is %u, keeping inode %lu\n", inode.link_count, target_id);
         save_inode(&inode);
     }
-    
-    return 0;
+    icache_unlock(target_id);
 }
 
-static int smartfs_truncate(const char *path, off_t size, struct fuse_file_info *fi) {
-    (void) fi;
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
+// 6. 删除文件 (unlink) - 支持硬链接计数
+static int remove_file(uint64_t parent_id, const char *file_name) {
+    printf("DEBUG: Unlink %s in dir %lu\n", file_name, parent_id);
+
+    // 1. 找到目标 Inode (目录要用 rmdir)
+    uint64_t target_id = lookup_entry(parent_id, file_name);
+    if (target_id == 0) return -ENOENT;
+    inode_t target;
+    load_inode(target_id, &target);
+    if (S_ISDIR(target.mode)) return -EISDIR;
+
+    // 2. 从目录中移除条目 (名字没了)；以目录里实际删掉的条目为准，
+    //    中间被 rename 换成别的文件也不会减错 Inode 的计数
+    if (remove_dir_entry(parent_id, file_name, &target_id) != 0) return -ENOENT;
+
+    // 3. 【核心修改】减少链接计数
+    drop_link(target_id);
+    return 0;
+}
+static void smartfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    int ret = check_name(parent, name);
+    if (ret == 0) ret = remove_file(node_ino(parent), name);
+    fuse_reply_err(req, -ret);
+}
 
+static int truncate_locked(uint64_t inode_id, off_t size) {
     inode_t inode;
     load_inode(inode_id, &inode);
-
-    // ---------------------------------------------------------
-    // 步骤 1: 找到当前的最新版本
-    // ---------------------------------------------------------
-    int current_idx = inode.total_versions - 1;
-    if (current_idx < 0) current_idx = 0; 
+    bind_codec(&inode);
 
     // =========================================================
-    // 🔴 [修改] Truncate 的时间策略
+    // 🔴 [修改] Truncate 的时间策略 (最新版本就是 inode.current)
     // =========================================================
     int SNAPSHOT_INTERVAL = 30; 
 
-    if (inode.versions[current_idx].file_size > 0) {
+    if (inode.current.file_size > 0) {
         // 只有满足时间间隔，才创建快照
         if (version_mgr_should_snapshot(&inode, SNAPSHOT_INTERVAL)) {
             printf("DEBUG: Truncate triggering snapshot (Time OK)...\n");
-            int res = version_mgr_create_snapshot(&inode, "Auto-save before truncate");
+            int res = snapshot_inode(&inode, "Auto-save before truncate");
             if (res < 0) printf("WARNING: Snapshot failed in truncate.\n");
         } else {
             printf("DEBUG: Truncate skipping snapshot (Time < %ds). Overwriting current version.\n", SNAPSHOT_INTERVAL);
@@ -647,58 +1951,248 @@ static int smartfs_truncate(const char *path, off_t size, struct fuse_file_info
     // ---------------------------------------------------------
     // 步骤 2: 更新最新版本信息
     // ---------------------------------------------------------
-    // 此时 total_versions 可能增加了，我们需要重新指向最新的位置
-    int new_latest_idx = inode.total_versions - 1;
+    // 快照之后 inode.current 已经是新版本了
+    file_version_t *v = &inode.current;
+
+    // [新增] 内联文件截断后还放得下就只改 Inode (缩小时后面的字节清零，再扩展时读到的是 0)，
+    // 放不下了先搬到数据块里
+    if ((inode.flags & SMARTFS_INODE_INLINE) && (uint64_t)size <= SMARTFS_INLINE_MAX) {
+        memset(inode.inline_data + size, 0, SMARTFS_INLINE_MAX - size);
+        v->file_size = size;
+        v->timestamp = time(NULL);
+        save_inode(&inode);
+        inval_version(inode_id, (int)v->version_id, 0);
+        return 0;
+    }
+    int spill = inline_spill(&inode);
+    if (spill != 0) return spill;
+
+    // 缩小到块中间：把尾块按新长度重新存一份，以后再扩展时读到的是 0 而不是旧数据
+    if ((uint64_t)size < v->file_size && size % BLOCK_SIZE != 0) {
+        uint64_t tail_lblk = size / BLOCK_SIZE;
+        uint64_t tail_id = 0;
+        if (bmap_lookup(NULL, v, tail_lblk, &tail_id) == 0 && tail_id > 0) {
+            char tail[BLOCK_SIZE];
+            int new_id = 0;
+            smart_read((long)inode_id, (long)tail_id, tail, BLOCK_SIZE);
+            if (smart_write((long)inode_id, (long)(tail_lblk * BLOCK_SIZE), tail, size % BLOCK_SIZE, &new_id) < 0) return -EIO;
+            uint64_t old_id = 0;
+            if (bmap_assign(NULL, v, tail_lblk, (uint64_t)new_id, &old_id) != 0) {
+                storage_release_block(new_id);
+                return -EIO;
+            }
+            if (old_id != 0) storage_release_block((int)old_id);
+        }
+    }
+
+    // 调整块映射 (截断为 0 时整棵树都会被释放)
+    if (bmap_truncate(NULL, v, (size + BLOCK_SIZE - 1) / BLOCK_SIZE) != 0) return -EIO;
 
     // 更新大小
-    inode.versions[new_latest_idx].file_size = size;
-    inode.versions[new_latest_idx].timestamp = time(NULL);
+    v->file_size = size;
+    v->timestamp = time(NULL);
     
     // 同步更新 Inode 层的指针
-    inode.latest_version = inode.versions[new_latest_idx].version_id;
+    inode.latest_version = v->version_id;
 
-    // 特殊情况：如果是截断为 0，清空块引用
-    if (size == 0) {
-        inode.versions[new_latest_idx].block_count = 0;
-        inode.versions[new_latest_idx].block_list_start_index = 0;
-        printf("DEBUG: Truncate to 0 -> Reset block_count to 0.\n");
+    save_inode(&inode);
+    inval_version(inode_id, (int)v->version_id, 0);
+    return 0;
+}
+// 7. 修改属性 (setattr)：截断、chmod/chown、修改时间都走这里
+static int setattr_locked(uint64_t inode_id, struct stat *attr, int to_set) {
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        int ret = wbuf_flush_inode(inode_id, NULL);
+        if (ret == 0) ret = truncate_locked(inode_id, attr->st_size);
+        if (ret != 0) return ret;
+    }
+
+    inode_t inode;
+    load_inode(inode_id, &inode);
+    if (to_set & FUSE_SET_ATTR_MODE) inode.mode = (inode.mode & S_IFMT) | (attr->st_mode & 07777);
+    if (to_set & FUSE_SET_ATTR_UID) inode.uid = attr->st_uid;
+    if (to_set & FUSE_SET_ATTR_GID) inode.gid = attr->st_gid;
+    // getattr 显示的是最新版本的时间，所以改 current (没有单独的 atime)
+    if (to_set & FUSE_SET_ATTR_MTIME_NOW) inode.current.timestamp = time(NULL);
+    else if (to_set & FUSE_SET_ATTR_MTIME) inode.current.timestamp = attr->st_mtime;
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID |
+                  FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_MTIME_NOW)) {
+        save_inode(&inode);
+        // 版本视图的权限/属主跟着 Inode 走，内核缓存的视图属性也要作废
+        inval_version(inode_id, -1, 0);
+    }
+    return 0;
+}
+static void smartfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr,
+                            int to_set, struct fuse_file_info *fi) {
+    if (node_vid(ino) != 0) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+    uint64_t inode_id;
+    int ret = lock_node(ino, fi, ICACHE_EXCL, &inode_id);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    struct stat st;
+    ret = setattr_locked(inode_id, attr, to_set);
+    if (ret == 0) ret = getattr_locked(inode_id, 0, &st);
+    icache_unlock(inode_id);
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_attr(req, &st, SMARTFS_ATTR_TIMEOUT);
+}
+
+// [新增] 打洞 (fallocate PUNCH_HOLE)：[offset, offset + len) 以后读出来都是 0，文件大小不变。
+// 整块直接从块映射里拿掉 (放掉引用)；首尾不完整的块补 0 交给 write_locked，整块成了 0 也就成了空洞
+static int punch_locked(uint64_t inode_id, off_t offset, off_t len) {
+    static const char zeros[BLOCK_SIZE];
+    inode_t inode;
+    load_inode(inode_id, &inode);
+    uint64_t size = inode.current.file_size;
+    if ((uint64_t)offset >= size) return 0;
+    uint64_t end = ((uint64_t)len > size - offset) ? size : (uint64_t)(offset + len);
+
+    // 整块的范围 [lo, hi)：文件最后一块打到文件末尾也算整块
+    uint64_t lo = (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    uint64_t hi = (end == size) ? (end + BLOCK_SIZE - 1) / BLOCK_SIZE : end / BLOCK_SIZE;
+    if ((inode.flags & SMARTFS_INODE_INLINE) || lo >= hi) {
+        // 内联文件、或者没有整块：直接写 0 (不超过两个块)
+        for (uint64_t pos = offset; pos < end; ) {
+            size_t n = (end - pos < BLOCK_SIZE) ? (size_t)(end - pos) : BLOCK_SIZE;
+            int res = write_locked(inode_id, zeros, n, (off_t)pos);
+            if (res < 0) return res;
+            pos += n;
+        }
+        return 0;
     }
 
+    // 和截断一样先看要不要做快照
+    if (version_mgr_should_snapshot(&inode, 30)) {
+        int res = snapshot_inode(&inode, "Auto-save before punch");
+        if (res < 0) printf("WARNING: Snapshot failed in punch.\n");
+    }
+    file_version_t *v = &inode.current;
+
+    // 只访问有数据的块 (整棵空的子树直接跳过)。bmap_seek 不读游标，但游标里改过的都在 lblk 前面
+    bmap_cursor_t cur;
+    bmap_cursor_init(&cur);
+    int ret = 0;
+    for (uint64_t lblk = lo; lblk < hi; ) {
+        uint64_t next = 0;
+        if (bmap_seek(v, lblk, 1, &next) != 0) {
+            ret = -EIO;
+            break;
+        }
+        if (next >= hi) break;
+        uint64_t old_id = 0;
+        if ((ret = bmap_assign(&cur, v, next, 0, &old_id)) != 0) break;
+        if (old_id != 0) storage_release_block((int)old_id);
+        lblk = next + 1;
+    }
+    if (bmap_cursor_flush(&cur) != 0 && ret == 0) ret = -EIO;
+    v->timestamp = time(NULL);
     save_inode(&inode);
+    inval_version(inode_id, (int)v->version_id, 0);
+    if (ret != 0) return ret;
+
+    // 首尾不完整的部分
+    if ((uint64_t)offset < lo * BLOCK_SIZE) {
+        int res = write_locked(inode_id, zeros, lo * BLOCK_SIZE - offset, offset);
+        if (res < 0) return res;
+    }
+    if (hi * BLOCK_SIZE < end) {
+        int res = write_locked(inode_id, zeros, end - hi * BLOCK_SIZE, (off_t)(hi * BLOCK_SIZE));
+        if (res < 0) return res;
+    }
     return 0;
 }
 
-// 8. 修改时间 (utimens)
-static int smartfs_utimens(const char *path, const struct timespec tv[2],
-                         struct fuse_file_info *fi)
-{
-    (void) fi;
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
+// [新增] fallocate：打洞，或者预留空间。数据块在存储引擎里按内容存，没法预先占好位置，
+// 预留只把文件变大 (后面是空洞)，KEEP_SIZE 时什么都不用做
+static int fallocate_locked(uint64_t inode_id, int mode, off_t offset, off_t length) {
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) return -EOPNOTSUPP;
+    if (offset < 0 || length <= 0) return -EINVAL;
 
+    int ret = wbuf_flush_inode(inode_id, NULL);
+    if (ret != 0) return ret;
     inode_t inode;
     load_inode(inode_id, &inode);
-    if (tv != NULL) {
-        inode.versions[0].timestamp = tv[1].tv_sec;
-    } else {
-        inode.versions[0].timestamp = time(NULL);
+    if (!S_ISREG(inode.mode)) return -ENODEV;
+
+    if (mode & FALLOC_FL_PUNCH_HOLE) {
+        // 和 Linux 一样，打洞必须带 KEEP_SIZE
+        if (!(mode & FALLOC_FL_KEEP_SIZE)) return -EOPNOTSUPP;
+        return punch_locked(inode_id, offset, length);
+    }
+    if (!(mode & FALLOC_FL_KEEP_SIZE) && (uint64_t)(offset + length) > inode.current.file_size) {
+        return truncate_locked(inode_id, offset + length);
     }
-    save_inode(&inode);
     return 0;
 }
 
+static void smartfs_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset,
+                              off_t length, struct fuse_file_info *fi) {
+    if (node_vid(ino) != 0) {
+        fuse_reply_err(req, EROFS);
+        return;
+    }
+    uint64_t inode_id;
+    int ret = lock_node(ino, fi, ICACHE_EXCL, &inode_id);
+    if (ret == 0) {
+        ret = fallocate_locked(inode_id, mode, offset, length);
+        icache_unlock(inode_id);
+    }
+    fuse_reply_err(req, -ret);
+}
+
+// [新增] lseek SEEK_DATA / SEEK_HOLE (其他的内核自己处理)：按块映射找，空洞以块为单位。
+// 文件末尾算一个空洞；off 在文件末尾或者之后返回 -ENXIO
+static off_t seek_locked(uint64_t inode_id, int vid, off_t off, int whence) {
+    inode_t inode;
+    load_inode(inode_id, &inode);
+    version_table_t vt;
+    file_version_t *v = lookup_version(&inode, vid ? VER_QUERY_ID : VER_QUERY_NONE, vid, NULL, &vt);
+    if (!v) return -ENOENT;
+    if (off < 0 || (uint64_t)off >= v->file_size) return -ENXIO;
+    if (inode.flags & SMARTFS_INODE_INLINE) return (whence == SEEK_DATA) ? off : (off_t)v->file_size;
+
+    uint64_t lblk = 0;
+    if (bmap_seek(v, off / BLOCK_SIZE, whence == SEEK_DATA, &lblk) != 0) return -EIO;
+    uint64_t pos = lblk * BLOCK_SIZE;
+    if (pos < (uint64_t)off) pos = off;
+    if (whence == SEEK_DATA) return (pos < v->file_size) ? (off_t)pos : -ENXIO;
+    return (pos < v->file_size) ? (off_t)pos : (off_t)v->file_size;
+}
+
+static void smartfs_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence, struct fuse_file_info *fi) {
+    if (whence != SEEK_DATA && whence != SEEK_HOLE) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    uint64_t inode_id;
+    int ret = lock_node(ino, fi, ICACHE_SHARED, &inode_id);
+    if (ret == 0 && of_find_dirty(inode_id, NULL)) {
+        // 和读一样，缓冲着的数据先下刷
+        icache_unlock(inode_id);
+        ret = lock_node(ino, fi, ICACHE_EXCL, &inode_id);
+        if (ret == 0 && (ret = wbuf_flush_inode(inode_id, NULL)) != 0) icache_unlock(inode_id);
+    }
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    off_t pos = seek_locked(inode_id, node_vid(ino), off, whence);
+    icache_unlock(inode_id);
+    if (pos < 0) fuse_reply_err(req, (int)-pos);
+    else fuse_reply_lseek(req, pos);
+}
+
 // 9. 创建目录 (mkdir)
-static int smartfs_mkdir(const char *path, mode_t mode) {
-    printf("DEBUG: Mkdir %s\n", path);
-    
-    // 解析路径 (暂只支持一级子目录)
-    char full_path[MAX_FILENAME];
-    strncpy(full_path, path + 1, MAX_FILENAME - 1);
-    full_path[MAX_FILENAME - 1] = '\0';
-    
-    // 这里简化：假设只能在根目录创建子目录
-    // 如果支持多级，这里也需要像 create 一样解析 parent
+static int create_dir(uint64_t parent_id, const char *dir_name, mode_t mode, uint64_t *out) {
+    printf("DEBUG: Mkdir %s in dir %lu\n", dir_name, parent_id);
     
+    int res;
     uint64_t new_inode_id = allocate_inode();
     if (new_inode_id == 0) return -ENOSPC;
 
@@ -707,195 +2201,173 @@ static int smartfs_mkdir(const char *path, mode_t mode) {
     new_inode.link_count = 2;
     new_inode.inode_id = new_inode_id;
     new_inode.mode = S_IFDIR | mode;
+    new_inode.flags = inherit_policy(parent_id);
     new_inode.uid = getuid();
     new_inode.gid = getgid();
     new_inode.total_versions = 1;
     new_inode.latest_version = 1;
 
-    uint64_t new_block = allocate_block();
-    if (new_block == 0) return -ENOSPC;
-
-    new_inode.versions[0].block_list_start_index = new_block;
-    new_inode.versions[0].block_count = 1;
-    new_inode.versions[0].file_size = BLOCK_SIZE;
-
-    // 初始化目录内容 (. 和 ..)
-    char buffer[BLOCK_SIZE];
-    smartfs_dir_entry_t *entries = (smartfs_dir_entry_t *)buffer;
-    memset(entries, 0, BLOCK_SIZE);
-
-    strcpy(entries[0].name, ".");
-    entries[0].inode_no = new_inode_id;
-    entries[0].is_valid = 1;
-
-    strcpy(entries[1].name, "..");
-    entries[1].inode_no = 0; 
-    entries[1].is_valid = 1;
+    new_inode.current.version_id = 1;
+    new_inode.current.timestamp = time(NULL);
 
-    lseek(disk_fd, new_block * BLOCK_SIZE, SEEK_SET);
-    write(disk_fd, entries, BLOCK_SIZE);
+    // 初始化目录内容 (目录头记下 ".." 指向的父目录，"." 由 readdir 直接给出)
+    res = dir_init(&new_inode.current, parent_id);
+    if (res != 0) {
+        release_inode_no(new_inode_id);
+        return res;
+    }
 
     save_inode(&new_inode);
     
-    // 添加到根目录 (目前简化版)
-    add_dir_entry(0, full_path, new_inode_id);
+    // 添加到父目录
+    node_get(new_inode_id);
+    res = add_dir_entry(parent_id, dir_name, new_inode_id, new_inode.mode);
+    if (res != 0) {
+        node_put(new_inode_id, 1);
+        free_inode(new_inode_id);
+        return res;
+    }
+    *out = new_inode_id;
     return 0;
 }
+static void smartfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode) {
+    uint64_t inode_id = 0;
+    struct fuse_entry_param e;
+    int ret = check_name(parent, name);
+    if (ret == 0) ret = create_dir(node_ino(parent), name, mode, &inode_id);
+    if (ret == 0) ret = make_entry(inode_id, &e);
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_entry(req, &e);
+}
 
 // 10. 删除目录 (rmdir)
-static int smartfs_rmdir(const char *path) {
-    printf("DEBUG: Rmdir %s\n", path);
-    const char *dirname = path + 1;
+static int remove_dir(uint64_t parent_id, const char *dirname) {
+    printf("DEBUG: Rmdir %s in dir %lu\n", dirname, parent_id);
+    int res;
 
     // 查找目录
-    uint64_t inode_id = find_entry_in_dir(0, dirname);
+    uint64_t inode_id = lookup_entry(parent_id, dirname);
     if (inode_id == 0) return -ENOENT;
 
-    // 检查是否为空
+    // 检查是否为空：持有目录自己的锁直到回收完，期间没人能往里面加东西
+    // (加锁顺序: 子目录在前，remove_dir_entry 里再锁父目录)
+    icache_lock(inode_id, ICACHE_EXCL);
     inode_t inode;
     load_inode(inode_id, &inode);
-    if (!S_ISDIR(inode.mode)) return -ENOTDIR;
-
-    uint64_t block_idx = inode.versions[0].block_list_start_index;
-    char buffer[BLOCK_SIZE];
-    smartfs_dir_entry_t *entries = (smartfs_dir_entry_t *)buffer;
-    
-    lseek(disk_fd, block_idx * BLOCK_SIZE, SEEK_SET);
-    read(disk_fd, entries, BLOCK_SIZE);
-
-    int max_entries = BLOCK_SIZE / sizeof(smartfs_dir_entry_t);
-    for (int i = 0; i < max_entries; i++) {
-        if (entries[i].is_valid) {
-            if (strcmp(entries[i].name, ".") != 0 && 
-                strcmp(entries[i].name, "..") != 0) {
-                return -ENOTEMPTY;
-            }
-        }
+    if (!S_ISDIR(inode.mode)) {
+        res = (inode.mode == 0) ? -ENOENT : -ENOTDIR;
+    } else if ((res = dir_is_empty(&inode.current)) >= 0) {
+        if (res == 0) res = -ENOTEMPTY;
+        else res = remove_dir_entry(parent_id, dirname, NULL);
+        // 还是内核里谁的 cwd 的话留到 forget 再回收 (之后不能再往里面加东西)
+        if (res == 0) drop_inode(inode_id, &inode);
     }
-
-    remove_dir_entry(0, dirname);
-    free_inode(inode_id);
-    return 0;
+    icache_unlock(inode_id);
+    return res;
 }
-static int smartfs_link(const char *from, const char *to) {
-    printf("DEBUG: Link %s -> %s\n", from, to);
-    
-    // 1. 找到源文件的 Inode
-    uint64_t inode_id = resolve_path_to_inode(from);
-    if (inode_id == 0) return -ENOENT;
-
-    // 2. 解析目标路径 (确定要把名字加到哪个目录)
-    char full_path[MAX_FILENAME];
-    strncpy(full_path, to + 1, MAX_FILENAME - 1);
-    full_path[MAX_FILENAME - 1] = '\0';
+static void smartfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    int ret = check_name(parent, name);
+    if (ret == 0) ret = remove_dir(node_ino(parent), name);
+    fuse_reply_err(req, -ret);
+}
+static void smartfs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname) {
+    printf("DEBUG: Link inode %lu -> %s in dir %lu\n", node_ino(ino), newname, node_ino(newparent));
+    int res = check_name(newparent, newname);
+    if (res == 0 && node_vid(ino) != 0) res = -EROFS;
+    if (res != 0) {
+        fuse_reply_err(req, -res);
+        return;
+    }
     
-    char *dir_name = NULL;
-    char *file_name = full_path;
-    uint64_t parent_inode_id = 0; 
-
-    char *slash = strchr(full_path, '/');
-    if (slash) {
-        *slash = '\0';
-        dir_name = full_path;
-        file_name = slash + 1;
-        parent_inode_id = find_entry_in_dir(0, dir_name);
-        if (parent_inode_id == 0) return -ENOENT;
+    // 1. 锁住源文件的 Inode (加名字和加计数之间不能被 unlink 回收)
+    uint64_t inode_id;
+    res = lock_node(ino, NULL, ICACHE_EXCL, &inode_id);
+    if (res != 0) {
+        fuse_reply_err(req, -res);
+        return;
     }
 
-    // 3. 增加 Inode 计数
+    // 2. 在目录中添加新条目 (指向同一个 ID)；已经没有名字的孤儿不能再链接回来
     inode_t inode;
     load_inode(inode_id, &inode);
-    inode.link_count++;
-    save_inode(&inode);
+    if (S_ISDIR(inode.mode)) res = -EPERM;
+    else if (inode.link_count == 0) res = -ENOENT;
+    else res = add_dir_entry(node_ino(newparent), newname, inode_id, inode.mode);
 
-    // 4. 在目录中添加新条目 (指向同一个 ID)
-    return add_dir_entry(parent_inode_id, file_name, inode_id);
+    // 3. 增加 Inode 计数
+    struct fuse_entry_param e;
+    if (res == 0) {
+        inode.link_count++;
+        save_inode(&inode);
+        if ((res = fill_entry(inode_id, 0, &e)) == 0) node_get(inode_id);
+    }
+    icache_unlock(inode_id);
+    if (res != 0) fuse_reply_err(req, -res);
+    else fuse_reply_entry(req, &e);
 }
-static int smartfs_rename(const char *from, const char *to, unsigned int flags) {
-    (void) flags; // 忽略 flags
-    printf("DEBUG: Rename %s -> %s\n", from, to);
+static int rename_locked(uint64_t old_parent_id, const char *old_file_name,
+                         uint64_t new_parent_id, const char *new_file_name, unsigned int flags) {
 
-    // 1. 找到源 Inode
-    uint64_t inode_id = resolve_path_to_inode(from);
+    // 1. 找到源 Inode (旧爸爸里的旧名字)
+    uint64_t inode_id = lookup_entry(old_parent_id, old_file_name);
     if (inode_id == 0) return -ENOENT;
 
-    // 2. 解析目标路径 (新爸爸是谁？)
-    char to_path_copy[MAX_FILENAME];
-    strncpy(to_path_copy, to + 1, MAX_FILENAME - 1);
-    
-    char *new_dir_name = NULL;
-    char *new_file_name = to_path_copy;
-    uint64_t new_parent_id = 0;
-
-    char *slash = strchr(to_path_copy, '/');
-    if (slash) {
-        *slash = '\0';
-        new_dir_name = to_path_copy;
-        new_file_name = slash + 1;
-        new_parent_id = find_entry_in_dir(0, new_dir_name);
-        if (new_parent_id == 0) return -ENOENT;
-    }
-
-    // 3. 解析源路径 (旧爸爸是谁？为了删除旧条目)
-    char from_path_copy[MAX_FILENAME];
-    strncpy(from_path_copy, from + 1, MAX_FILENAME - 1);
-    char *old_dir_name = NULL;
-    char *old_file_name = from_path_copy;
-    uint64_t old_parent_id = 0;
-
-    slash = strchr(from_path_copy, '/');
-    if (slash) {
-        *slash = '\0';
-        old_dir_name = from_path_copy;
-        old_file_name = slash + 1;
-        old_parent_id = find_entry_in_dir(0, old_dir_name);
-    }
-
-    // 4. 添加新条目 (指向同一个 inode_id)
-    if (add_dir_entry(new_parent_id, new_file_name, inode_id) != 0) {
-        return -ENOSPC;
+    // 2. 目标已存在：按 rename 语义覆盖 (先去掉旧名字，否则目录里会出现两个同名条目)
+    uint64_t victim_id = lookup_entry(new_parent_id, new_file_name);
+    if (victim_id != 0 && (flags & RENAME_NOREPLACE)) return -EEXIST;
+    if (victim_id == inode_id) return 0;
+    if (victim_id != 0) {
+        inode_t victim;
+        load_inode(victim_id, &victim);
+        if (S_ISDIR(victim.mode)) return -EISDIR;
+        remove_dir_entry(new_parent_id, new_file_name, NULL);
+        drop_link(victim_id);
+    }
+
+    // 3. 添加新条目 (指向同一个 inode_id)
+    inode_t inode;
+    load_inode(inode_id, &inode);
+    int res = add_dir_entry(new_parent_id, new_file_name, inode_id, inode.mode);
+    if (res != 0) return res;
+
+    // 4. 删除旧条目
+    remove_dir_entry(old_parent_id, old_file_name, NULL);
+
+    // 5. 目录换了上级，".." 跟着改
+    if (S_ISDIR(inode.mode) && new_parent_id != old_parent_id) {
+        icache_lock(inode_id, ICACHE_EXCL);
+        load_inode(inode_id, &inode);
+        if (dir_set_parent(&inode.current, new_parent_id) == 0) save_inode(&inode);
+        icache_unlock(inode_id);
     }
 
-    // 5. 删除旧条目
-    remove_dir_entry(old_parent_id, old_file_name);
-    
     return 0;
 }
-// [修复] 修正参数顺序和变量名，符合 FUSE 3 标准
-// to = 链接的名字 (例如 /soft_link.txt)
-// from = 链接指向的目标 (例如 ../subdir/moved_hello.txt)
-// [修复] 严格符合 FUSE 3 定义：symlink(target, linkpath)
-// target   = 链接指向的目标 (例如 "../subdir/moved_hello.txt")
-// linkpath = 链接本身的路径 (例如 "/soft_link.txt")
-static int smartfs_symlink(const char *target, const char *linkpath) {
-    printf("DEBUG: Symlink target=%s <- linkpath=%s\n", target, linkpath);
-    
-    // 1. 解析 linkpath，分离出父目录和文件名
-    char full_path[MAX_FILENAME];
-    memset(full_path, 0, MAX_FILENAME);
-    // 去掉开头的 '/'
-    const char *rel_path = linkpath;
-    if (rel_path[0] == '/') rel_path++;
-    strncpy(full_path, rel_path, MAX_FILENAME - 1);
-    
-    char *dir_name = NULL;
-    char *file_name = full_path;
-    uint64_t parent_id = 0;
-    
-    char *slash = strchr(full_path, '/');
-    if (slash) {
-        *slash = '\0';
-        dir_name = full_path;
-        file_name = slash + 1;
-        
-        // 查找父目录 Inode
-        parent_id = find_entry_in_dir(0, dir_name);
-        if (parent_id == 0) {
-            printf("DEBUG: Parent dir '%s' not found for symlink.\n", dir_name);
-            return -ENOENT;
-        }
+static void smartfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name,
+                           fuse_ino_t newparent, const char *newname, unsigned int flags) {
+    printf("DEBUG: Rename %s (dir %lu) -> %s (dir %lu)\n", name, node_ino(parent), newname, node_ino(newparent));
+    int res = check_name(parent, name);
+    if (res == 0) res = check_name(newparent, newname);
+    // 只支持 RENAME_NOREPLACE (RENAME_EXCHANGE 等交给内核报不支持)
+    if (res == 0 && (flags & ~RENAME_NOREPLACE)) res = -EINVAL;
+    if (res != 0) {
+        fuse_reply_err(req, -res);
+        return;
     }
 
+    // 查找、删旧名字、加新名字分了好几步，整个过程串行化
+    pthread_mutex_lock(&rename_lock);
+    res = rename_locked(node_ino(parent), name, node_ino(newparent), newname, flags);
+    pthread_mutex_unlock(&rename_lock);
+    fuse_reply_err(req, -res);
+}
+// [修改] low-level 的 symlink(target, parent, name)
+// target = 链接指向的目标 (例如 "../subdir/moved_hello.txt")
+// parent + file_name = 链接本身 (例如 根目录下的 "soft_link.txt")
+static int create_symlink(const char *target, uint64_t parent_id, const char *file_name, uint64_t *out) {
+    printf("DEBUG: Symlink target=%s <- %s in dir %lu\n", target, file_name, parent_id);
+    if (strlen(target) >= BLOCK_SIZE) return -ENAMETOOLONG;
+
     // 2. 分配 Inode
     uint64_t new_inode_id = allocate_inode();
     if (new_inode_id == 0) {
@@ -913,54 +2385,79 @@ static int smartfs_symlink(const char *target, const char *linkpath) {
     new_inode.link_count = 1;
     new_inode.total_versions = 1;
     new_inode.latest_version = 1;
-    new_inode.versions[0].version_id = 1;
-    new_inode.versions[0].timestamp = time(NULL);
-
-    // 4. 分配数据块，写入 target 路径
-    uint64_t block_id = allocate_block();
-    if (block_id == 0) return -ENOSPC;
+    new_inode.current.version_id = 1;
+    new_inode.current.timestamp = time(NULL);
 
-    new_inode.versions[0].block_list_start_index = block_id;
-    new_inode.versions[0].block_count = 1;
-    
     // [修复] 这里必须计算 target 的长度，并写入 target 的内容！
     size_t path_len = strlen(target);
-    new_inode.versions[0].file_size = path_len;
+    new_inode.current.file_size = path_len;
+
+    if (path_len <= SMARTFS_INLINE_MAX) {
+        // [新增] 短路径直接放在 Inode 里，不分配数据块
+        memcpy(new_inode.inline_data, target, path_len);
+        new_inode.flags |= SMARTFS_INODE_INLINE;
+    } else {
+        // 4. 分配数据块，写入 target 路径
+        uint64_t block_id = allocate_block();
+        if (block_id == 0) {
+            release_inode_no(new_inode_id);
+            return -ENOSPC;
+        }
 
-    // 写入目标路径到数据块
-    lseek(disk_fd, block_id * BLOCK_SIZE, SEEK_SET);
-    write(disk_fd, target, path_len + 1); // +1 把 \0 也写进去
+        new_inode.current.block_list_start_index = block_id;
+        new_inode.current.block_count = 1;
+
+        // 写入目标路径到数据块
+        pwrite(disk_fd, target, path_len + 1, (off_t)block_id * BLOCK_SIZE); // +1 把 \0 也写进去
+    }
 
     save_inode(&new_inode);
     
     // 5. 添加到目录
-    int ret = add_dir_entry(parent_id, file_name, new_inode_id);
+    node_get(new_inode_id);
+    int ret = add_dir_entry(parent_id, file_name, new_inode_id, new_inode.mode);
     if (ret != 0) {
         printf("DEBUG: Failed to add dir entry: %d\n", ret);
-        // 回滚：释放 Inode (简单起见，这里仅打印日志)
+        node_put(new_inode_id, 1);
+        free_inode(new_inode_id);
         return ret;
     }
     
     printf("DEBUG: Symlink created successfully. Inode=%lu\n", new_inode_id);
+    *out = new_inode_id;
     return 0;
 }
-static int smartfs_readlink(const char *path, char *buf, size_t size) {
-    printf("DEBUG: Readlink %s\n", path);
+static void smartfs_symlink(fuse_req_t req, const char *link, fuse_ino_t parent, const char *name) {
+    uint64_t inode_id = 0;
+    struct fuse_entry_param e;
+    int ret = check_name(parent, name);
+    if (ret == 0) ret = create_symlink(link, node_ino(parent), name, &inode_id);
+    if (ret == 0) ret = make_entry(inode_id, &e);
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_entry(req, &e);
+}
+static int readlink_locked(uint64_t inode_id, char *buf, size_t size) {
+    printf("DEBUG: Readlink inode %lu\n", inode_id);
     
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
 
     inode_t inode;
     load_inode(inode_id, &inode);
 
     if (!S_ISLNK(inode.mode)) return -EINVAL;
 
-    uint64_t block_id = inode.versions[0].block_list_start_index;
+    // [新增] 内联的目标路径 (没有结尾的 \0，长度是 file_size)
+    if (inode.flags & SMARTFS_INODE_INLINE) {
+        size_t len = inode.current.file_size < size - 1 ? inode.current.file_size : size - 1;
+        memcpy(buf, inode.inline_data, len);
+        buf[len] = '\0';
+        return 0;
+    }
+
+    uint64_t block_id = inode.current.block_list_start_index;
     
     // 读取数据块
     char disk_buf[BLOCK_SIZE];
-    lseek(disk_fd, block_id * BLOCK_SIZE, SEEK_SET);
-    read(disk_fd, disk_buf, BLOCK_SIZE);
+    if (pread(disk_fd, disk_buf, BLOCK_SIZE, (off_t)block_id * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
     
     // 复制到用户 buffer
     strncpy(buf, disk_buf, size - 1);
@@ -968,95 +2465,196 @@ static int smartfs_readlink(const char *path, char *buf, size_t size) {
     
     return 0;
 }
-static int smartfs_open(const char *path, struct fuse_file_info *fi) {
- // 如果用户使用了 "w" 模式 (echo > file)，会带上 O_TRUNC
-    if ((fi->flags & O_TRUNC) && (fi->flags & (O_WRONLY | O_RDWR))) {
-        printf("DEBUG: Open with O_TRUNC detected for %s -> Truncating to 0\n", path);
-        // 手动调用你的截断函数
-        return smartfs_truncate(path, 0, fi);
+static void smartfs_readlink(fuse_req_t req, fuse_ino_t ino) {
+    uint64_t inode_id;
+    char buf[BLOCK_SIZE];
+    int ret = lock_node(ino, NULL, ICACHE_SHARED, &inode_id);
+    if (ret != 0) {
+        fuse_reply_err(req, -ret);
+        return;
     }
-    return 0;
+    ret = readlink_locked(inode_id, buf, sizeof(buf));
+    icache_unlock(inode_id);
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_readlink(req, buf);
+}
+static int open_node(fuse_ino_t ino, struct fuse_file_info *fi) {
+    int writable = (fi->flags & O_ACCMODE) != O_RDONLY;
+    // 历史版本视图只能只读打开
+    if (node_vid(ino) != 0 && writable) return -EROFS;
+
+    // 如果用户使用了 "w" 模式 (echo > file)，会带上 O_TRUNC
+    int trunc = (fi->flags & O_TRUNC) && writable;
+    uint64_t inode_id;
+    int res = lock_node(ino, NULL, trunc ? ICACHE_EXCL : ICACHE_SHARED, &inode_id);
+    if (res != 0) return res;
+    if (trunc) {
+        printf("DEBUG: Open with O_TRUNC detected for inode %lu -> Truncating to 0\n", inode_id);
+        res = wbuf_flush_inode(inode_id, NULL);
+        if (res == 0) res = truncate_locked(inode_id, 0);
+    }
+    icache_unlock(inode_id);
+    if (res != 0) return res;
+
+    // 打开期间 pin 住 Inode 缓存条目 (release 时 unpin)，热文件的元数据一直在内存里
+    return of_open(inode_id, fi);
+}
+static void smartfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    int ret = open_node(ino, fi);
+    if (ret != 0) fuse_reply_err(req, -ret);
+    else fuse_reply_open(req, fi);
 }
 
-static int smartfs_statfs(const char *path, struct statvfs *stbuf) {
-    (void) path;
+static void smartfs_statfs(fuse_req_t req, fuse_ino_t ino) {
+    (void) ino;
+    struct statvfs st;
+    struct statvfs *stbuf = &st;
+    memset(stbuf, 0, sizeof(st));
     stbuf->f_bsize = BLOCK_SIZE;
     stbuf->f_blocks = sb.total_blocks;
+    pthread_mutex_lock(&alloc_lock);
     stbuf->f_bfree = sb.free_blocks;
     stbuf->f_bavail = sb.free_blocks;
+    stbuf->f_files = inode_bitmap.nbits;
+    stbuf->f_ffree = inode_bitmap.free_count;
+    stbuf->f_favail = inode_bitmap.free_count;
+    pthread_mutex_unlock(&alloc_lock);
     stbuf->f_namemax = MAX_FILENAME;
     // ==========================================
     // 🔴 新增：每次运行 df 命令时，打印监控报表
     // ==========================================
     printf("\n[Monitor] Triggering Storage Report...\n");
     print_storage_report(); // 调用模块 C 的报表函数
+    uint64_t runs = 0, longest = 0, free_blocks, free_inodes;
+    pthread_mutex_lock(&alloc_lock);
+    bitmap_free_runs(&block_bitmap, &runs, &longest);
+    free_blocks = block_bitmap.free_count;
+    free_inodes = inode_bitmap.free_count;
+    pthread_mutex_unlock(&alloc_lock);
+    printf("[Alloc] Free blocks: %lu in %lu runs (longest run: %lu blocks), free inodes: %lu\n",
+           free_blocks, runs, longest, free_inodes);
+    dcache_report();
     // ==========================================
-    return 0;
+    fuse_reply_statfs(req, stbuf);
 }
+// [新增] L3 垃圾回收换数据文件之前调用：块映射里已经不指向被回收块的 Inode 先落盘
+static int gc_metadata_sync(void) {
+    return allocator_sync(SMARTFS_STATE_MOUNTED);
+}
+
 // 1. 定义 init 函数
-static void *smartfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg) {
-    (void) conn;
-    
-    // 🔴 关键：在这里开启 use_ino
-    cfg->use_ino = 1; 
-    
-    // 如果你想让内核缓存属性（提高 ls 速度），可以开启这个，但在调试阶段建议关掉
-    // cfg->entry_timeout = 0;
-    // cfg->attr_timeout = 0;
-    // cfg->negative_timeout = 0;
+static void smartfs_init(void *userdata, struct fuse_conn_info *conn) {
+    (void) userdata;
+
+    // [新增] 放大单次请求的大小，大文件顺序读写不再被拆成一堆 4KB 的 FUSE 往返
+    conn->max_write = SMARTFS_MAX_IO_SIZE;
+    conn->max_readahead = SMARTFS_MAX_IO_SIZE;
+    // [新增] 读回复里指向数据文件的段用 splice 交给内核，不经过用户态内存
+    if (conn->capable & FUSE_CAP_SPLICE_WRITE) conn->want |= FUSE_CAP_SPLICE_WRITE;
+    if (conn->capable & FUSE_CAP_SPLICE_MOVE) conn->want |= FUSE_CAP_SPLICE_MOVE;
+
+    // [新增] 预读线程在这里启动：fuse_daemonize 转入后台时会 fork，之前建的线程不会带过去
+    prefetch_init(PREFETCH_THREADS);
+    // [新增] 失效通知线程同理
+    inval_start();
+    // [新增] 写入流水线的工作线程也是
+    write_pipeline_init(write_threads);
+    // [新增] 存储引擎：恢复块号分配位置，指纹日志在后台加载
+    // [修改] 垃圾回收提交前先让元数据落盘；引用计数不可信时从 Inode 表重建
+    storage_set_metadata_sync(gc_metadata_sync);
+    if (storage_mount() != 0) printf("[Init] WARNING: storage engine mount failed, dedup disabled\n");
+    else if (storage_refs_need_rebuild()) refcount_rebuild();
+}
 
-    return NULL;
+// [新增] 卸载时内核不会再发 forget：还留着的孤儿 Inode (删掉时还开着的文件) 在这里回收
+static void node_release_all() {
+    for (int b = 0; b < NODE_BUCKETS; b++) {
+        for (;;) {
+            // 回收要拿 Inode 锁和 alloc_lock，不能拿着 node_lock 做，每次摘一个出来
+            pthread_mutex_lock(&node_lock);
+            node_ref_t *r = node_table[b];
+            if (r) node_table[b] = r->next;
+            pthread_mutex_unlock(&node_lock);
+            if (!r) break;
+
+            uint64_t inode_id = r->inode_id;
+            node_ref_free(r);
+            icache_lock(inode_id, ICACHE_EXCL);
+            inode_t inode;
+            load_inode(inode_id, &inode);
+            if (inode.mode != 0 && inode.link_count == 0 && inode_id != sb.root_inode) free_inode(inode_id);
+            icache_unlock(inode_id);
+        }
+    }
 }
-static int smartfs_flush(const char *path, struct fuse_file_info *fi) {
-    (void) path; (void) fi;
-    // 因为我们的 smartfs_write 是同步写入到 L3 (storage_write) 的，
-    // 这里主要任务是确保 OS 把 disk_fd 的数据刷到物理磁盘。
-    printf("DEBUG: Flush %s\n", path);
+// 卸载：位图落盘，并把超级块标记为正常卸载
+static void smartfs_destroy(void *private_data) {
+    (void) private_data;
+    inval_shutdown();
+    prefetch_shutdown();
+    wbuf_flush_all();
+    node_release_all();
+    write_pipeline_shutdown();
+    storage_unmount();
+    allocator_sync(SMARTFS_STATE_CLEAN);
+    icache_destroy();
+    fsync(disk_fd);
+}
+static void smartfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    // [修改] 先把这个句柄写缓冲里的数据交给存储引擎，
+    // 再确保 OS 把 disk_fd 的数据刷到物理磁盘。
+    printf("DEBUG: Flush inode %lu\n", node_ino(ino));
+    int ret = of_flush(of_get(fi));
+    allocator_sync(SMARTFS_STATE_MOUNTED);
     if (disk_fd > 0) {
         // 调用系统调用 fsync 确保镜像文件落盘
         fsync(disk_fd); 
     }
-    return 0;
-}
-static int smartfs_release(const char *path, struct fuse_file_info *fi) {
-    (void) path; (void) fi;
-    printf("DEBUG: Release %s\n", path);
-    // 如果你有打开的文件句柄表，这里应该释放资源
-    // 对于目前的无状态实现，直接返回成功即可
-    return 0;
+    fuse_reply_err(req, -ret);
 }
-static int smartfs_fsync(const char *path, int isdatasync, struct fuse_file_info *fi) {
-    (void) path; (void) isdatasync; (void) fi;
-    printf("DEBUG: Fsync %s\n", path);
-    if (disk_fd > 0) {
-        // 强制把 test.img 的所有脏页写入物理磁盘
-        return fsync(disk_fd);
+static void smartfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi) {
+    printf("DEBUG: Release inode %lu\n", node_ino(ino));
+    // 缓冲里剩下的数据落盘；打开期间 pin 住的 Inode 缓存条目可以被淘汰了
+    open_file_t *of = of_get(fi);
+    if (of) {
+        of_flush(of);
+        of_close(of);
+        fi->fh = 0;
     }
-    return 0;
+    fuse_reply_err(req, 0);
 }
-static int smartfs_setxattr(const char *path, const char *name, const char *value, size_t size, int flags) {
-    printf("DEBUG: setxattr path=%s name=%s value=%s\n", path, name, value);
+static void smartfs_fsync(fuse_req_t req, fuse_ino_t ino, int isdatasync, struct fuse_file_info *fi) {
+    (void) isdatasync;
+    printf("DEBUG: Fsync inode %lu\n", node_ino(ino));
+    int ret = of_flush(of_get(fi));
+    if (ret == 0 && allocator_sync(SMARTFS_STATE_MOUNTED) != 0) ret = -EIO;
+    // 强制把 test.img 的所有脏页写入物理磁盘
+    if (ret == 0 && disk_fd > 0 && fsync(disk_fd) != 0) ret = -errno;
+    fuse_reply_err(req, -ret);
+}
+static int setxattr_locked(uint64_t inode_id, const char *name, const char *value, size_t size, int flags) {
+    printf("DEBUG: setxattr inode=%lu name=%s value=%.*s\n", inode_id, name, (int)size, value);
 
     if (size > 31) return -ERANGE; // 我们的 Demo 限制值最大 32 字节
 
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
 
     inode_t inode;
     load_inode(inode_id, &inode);
 
     // [新增 1] 手动快照接口
     if (strcmp(name, "user.smartfs.snapshot") == 0) {
+        // 目录的块映射会被 dir_add 原地修改，不能和历史版本共享
+        if (!S_ISREG(inode.mode)) return -EPERM;
+
         char msg[64] = "Manual Snapshot";
         if (size > 0 && size < 63) {
             strncpy(msg, value, size);
             msg[size] = '\0';
         }
         
-        int new_vid = version_mgr_create_snapshot(&inode, msg);
-        if (new_vid < 0) return -ENOSPC; // 可能由于全被Pin住导致无法创建
-        
-        save_inode(&inode);
+        int new_vid = snapshot_inode(&inode, msg);
+        save_inode(&inode);     // [修改] 失败时内联数据也可能已经搬到数据块里了
+        if (new_vid < 0) return new_vid; // 可能由于全被Pin住导致无法创建
         return 0;
     }
 
@@ -1065,10 +2663,13 @@ static int smartfs_setxattr(const char *path, const char *name, const char *valu
         // value 应该是 "v1", "v2" 这样的字符串
         int v_id = 0;
         if (sscanf(value, "v%d", &v_id) == 1) {
-            int status = version_mgr_toggle_pin(&inode, v_id);
+            version_table_t vt;
+            if (load_history(&inode, &vt) != 0) return -EIO;
+            int status = version_mgr_toggle_pin(&vt, v_id);
             if (status < 0) return -ENOENT;
             
             printf("DEBUG: Version v%d pin status changed to %d\n", v_id, status);
+            if (save_history(&inode, &vt) != 0) return -ENOSPC;
             save_inode(&inode);
             return 0;
         }
@@ -1097,13 +2698,39 @@ static int smartfs_setxattr(const char *path, const char *name, const char *valu
         return 0;
     }
 
+    // [新增] 4. 压缩策略 "lz4" / "lz4hc:12" / "zstd:19" / "none"，空值或 "default" 回到文件系统默认。
+    // 只管以后写的块，已经存下的块不重新压缩；设在目录上时新建的文件和子目录继承
+    if (strcmp(name, "user.smartfs.compress") == 0) {
+        if (!S_ISREG(inode.mode) && !S_ISDIR(inode.mode)) return -EPERM;
+        char spec[32];
+        memcpy(spec, value, size);
+        spec[size] = '\0';
+        int codec = CODEC_DEFAULT, level = 0;
+        if (size > 0 && strcmp(spec, "default") != 0 && codec_parse(spec, &codec, &level) != 0) return -EINVAL;
+        int set = (inode.flags & SMARTFS_INODE_CODEC_MASK) != 0;
+        if (flags == 0x1 && set) return -EEXIST;
+        if (flags == 0x2 && !set) return -ENODATA;
+        inode.flags &= ~SMARTFS_INODE_POLICY_MASK;
+        if (codec != CODEC_DEFAULT) {
+            inode.flags |= ((uint32_t)(codec + 1) << SMARTFS_INODE_CODEC_SHIFT) |
+                           ((uint32_t)level << SMARTFS_INODE_LEVEL_SHIFT);
+        }
+        save_inode(&inode);
+        bind_codec(&inode);
+        return 0;
+    }
+
+    // 普通扩展属性存放在版本历史表里
+    version_table_t vt;
+    if (load_history(&inode, &vt) != 0) return -EIO;
+
     // 1. 查找是否存在同名属性
     int empty_slot = -1;
     int found_idx = -1;
 
     for (int i = 0; i < 4; i++) {
-        if (inode.xattrs[i].valid) {
-            if (strcmp(inode.xattrs[i].name, name) == 0) {
+        if (vt.xattrs[i].valid) {
+            if (strcmp(vt.xattrs[i].name, name) == 0) {
                 found_idx = i;
             }
         } else if (empty_slot == -1) {
@@ -1120,24 +2747,35 @@ static int smartfs_setxattr(const char *path, const char *name, const char *valu
     if (target == -1) return -ENOSPC; // 没有空位了
 
     // 写入数据
-    strncpy(inode.xattrs[target].name, name, 31);
-    inode.xattrs[target].name[31] = '\0';
+    strncpy(vt.xattrs[target].name, name, 31);
+    vt.xattrs[target].name[31] = '\0';
     
-    strncpy(inode.xattrs[target].value, value, size);
-    inode.xattrs[target].value[size] = '\0'; // 确保 null结尾
+    strncpy(vt.xattrs[target].value, value, size);
+    vt.xattrs[target].value[size] = '\0'; // 确保 null结尾
     
-    inode.xattrs[target].valid = 1;
+    vt.xattrs[target].valid = 1;
 
+    if (save_history(&inode, &vt) != 0) return -ENOSPC;
     save_inode(&inode);
     return 0;
 }
+static void smartfs_setxattr(fuse_req_t req, fuse_ino_t ino, const char *name,
+                             const char *value, size_t size, int flags) {
+    uint64_t inode_id;
+    int ret = (node_vid(ino) != 0) ? -EROFS : lock_node(ino, NULL, ICACHE_EXCL, &inode_id);
+    if (ret == 0) {
+        // 快照要包含已经写进缓冲的数据
+        ret = wbuf_flush_inode(inode_id, NULL);
+        if (ret == 0) ret = setxattr_locked(inode_id, name, value, size, flags);
+        icache_unlock(inode_id);
+    }
+    fuse_reply_err(req, -ret);
+}
 
 // 获取扩展属性 (getxattr)
-static int smartfs_getxattr(const char *path, const char *name, char *value, size_t size) {
-    printf("DEBUG: getxattr path=%s name=%s\n", path, name);
+static int getxattr_locked(uint64_t inode_id, const char *name, char *value, size_t size) {
+    printf("DEBUG: getxattr inode=%lu name=%s\n", inode_id, name);
 
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
 
     inode_t inode;
     load_inode(inode_id, &inode);
@@ -1149,38 +2787,82 @@ static int smartfs_getxattr(const char *path, const char *name, char *value, siz
         // 这样用户会分配足够的内存再次调用我们
         if (size == 0) return 4096; 
         
-        return version_mgr_list_versions(&inode, value, size);
+        version_table_t vt;
+        if (load_history(&inode, &vt) != 0) return -EIO;
+        return version_mgr_list_versions(&vt, value, size);
     }
 
+    // [新增] 压缩策略记在 Inode 里
+    if (strcmp(name, "user.smartfs.compress") == 0) {
+        int level, codec = inode_codec(&inode, &level);
+        if (codec == CODEC_DEFAULT) return -ENODATA;
+        char spec[32];
+        int len = codec_format(codec, level, spec, sizeof(spec));
+        if (len < 0) return -EIO;
+        if (size == 0) return len;
+        if (size < (size_t)len) return -ERANGE;
+        memcpy(value, spec, len);
+        return len;
+    }
+
+    // 没有扩展属性就不用读历史表 (内核每次写入前都会查 security.capability)
+    if (inode.xattr_count == 0) return -ENODATA;
+
+    version_table_t vt;
+    if (load_history(&inode, &vt) != 0) return -EIO;
+
     for (int i = 0; i < 4; i++) {
-        if (inode.xattrs[i].valid && strcmp(inode.xattrs[i].name, name) == 0) {
-            int val_len = strlen(inode.xattrs[i].value);
+        if (vt.xattrs[i].valid && strcmp(vt.xattrs[i].name, name) == 0) {
+            int val_len = strlen(vt.xattrs[i].value);
             
             if (size == 0) return val_len; // 用户查询 value 长度
             if (size < val_len) return -ERANGE;
 
-            memcpy(value, inode.xattrs[i].value, val_len);
+            memcpy(value, vt.xattrs[i].value, val_len);
             return val_len;
         }
     }
     return -ENODATA; // 属性不存在
 }
+// size == 0 是在问需要多大的缓冲，回复长度；否则回复内容
+static void reply_xattr(fuse_req_t req, char *buf, size_t size, int ret) {
+    if (ret < 0) fuse_reply_err(req, -ret);
+    else if (size == 0) fuse_reply_xattr(req, (size_t)ret);
+    else fuse_reply_buf(req, buf, (size_t)ret);
+}
+static void smartfs_getxattr(fuse_req_t req, fuse_ino_t ino, const char *name, size_t size) {
+    uint64_t inode_id;
+    char *buf = size ? malloc(size) : NULL;
+    int ret = (size && !buf) ? -ENOMEM : lock_node(ino, NULL, ICACHE_SHARED, &inode_id);
+    if (ret == 0) {
+        ret = getxattr_locked(inode_id, name, buf, size);
+        icache_unlock(inode_id);
+    }
+    reply_xattr(req, buf, size, ret);
+    free(buf);
+}
 
 // 列出扩展属性 (listxattr)
-static int smartfs_listxattr(const char *path, char *list, size_t size) {
-    printf("DEBUG: listxattr path=%s\n", path);
+static int listxattr_locked(uint64_t inode_id, char *list, size_t size) {
+    printf("DEBUG: listxattr inode=%lu\n", inode_id);
 
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
 
     inode_t inode;
     load_inode(inode_id, &inode);
 
+    // [新增] 压缩策略不在历史表里，设了也要列出来
+    const char *policy = (inode.flags & SMARTFS_INODE_CODEC_MASK) ? "user.smartfs.compress" : NULL;
+    if (inode.xattr_count == 0 && !policy) return 0;
+
+    version_table_t vt;
+    memset(&vt, 0, sizeof(vt));
+    if (inode.xattr_count > 0 && load_history(&inode, &vt) != 0) return -EIO;
+
     // 计算总长度
-    size_t required_size = 0;
+    size_t required_size = policy ? strlen(policy) + 1 : 0;
     for (int i = 0; i < 4; i++) {
-        if (inode.xattrs[i].valid) {
-            required_size += strlen(inode.xattrs[i].name) + 1; // +1 是为了 \0
+        if (vt.xattrs[i].valid) {
+            required_size += strlen(vt.xattrs[i].name) + 1; // +1 是为了 \0
         }
     }
 
@@ -1189,47 +2871,89 @@ static int smartfs_listxattr(const char *path, char *list, size_t size) {
 
     // 填充列表: name1\0name2\0
     char *ptr = list;
+    if (policy) {
+        strcpy(ptr, policy);
+        ptr += strlen(policy) + 1;
+    }
     for (int i = 0; i < 4; i++) {
-        if (inode.xattrs[i].valid) {
-            strcpy(ptr, inode.xattrs[i].name);
-            ptr += strlen(inode.xattrs[i].name) + 1;
+        if (vt.xattrs[i].valid) {
+            strcpy(ptr, vt.xattrs[i].name);
+            ptr += strlen(vt.xattrs[i].name) + 1;
         }
     }
     return required_size;
 }
+static void smartfs_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size) {
+    uint64_t inode_id;
+    char *buf = size ? malloc(size) : NULL;
+    int ret = (size && !buf) ? -ENOMEM : lock_node(ino, NULL, ICACHE_SHARED, &inode_id);
+    if (ret == 0) {
+        ret = listxattr_locked(inode_id, buf, size);
+        icache_unlock(inode_id);
+    }
+    reply_xattr(req, buf, size, ret);
+    free(buf);
+}
 
 // 删除扩展属性 (removexattr)
-static int smartfs_removexattr(const char *path, const char *name) {
-    printf("DEBUG: removexattr path=%s name=%s\n", path, name);
+static int removexattr_locked(uint64_t inode_id, const char *name) {
+    printf("DEBUG: removexattr inode=%lu name=%s\n", inode_id, name);
 
-    uint64_t inode_id = resolve_path_to_inode(path);
-    if (inode_id == 0) return -ENOENT;
 
     inode_t inode;
     load_inode(inode_id, &inode);
 
+    // [新增] 删掉压缩策略 = 回到文件系统默认 (目录上删掉的，已经建好的子项不受影响)
+    if (strcmp(name, "user.smartfs.compress") == 0) {
+        if (!(inode.flags & SMARTFS_INODE_CODEC_MASK)) return -ENODATA;
+        inode.flags &= ~SMARTFS_INODE_POLICY_MASK;
+        save_inode(&inode);
+        bind_codec(&inode);
+        return 0;
+    }
+
+    if (inode.xattr_count == 0) return -ENODATA;
+
+    version_table_t vt;
+    if (load_history(&inode, &vt) != 0) return -EIO;
+
     for (int i = 0; i < 4; i++) {
-        if (inode.xattrs[i].valid && strcmp(inode.xattrs[i].name, name) == 0) {
-            inode.xattrs[i].valid = 0; // 标记失效
-            memset(inode.xattrs[i].name, 0, 32);
+        if (vt.xattrs[i].valid && strcmp(vt.xattrs[i].name, name) == 0) {
+            vt.xattrs[i].valid = 0; // 标记失效
+            memset(vt.xattrs[i].name, 0, 32);
+            if (save_history(&inode, &vt) != 0) return -EIO;
             save_inode(&inode);
             return 0;
         }
     }
     return -ENODATA;
 }
-static const struct fuse_operations smartfs_oper = {
+static void smartfs_removexattr(fuse_req_t req, fuse_ino_t ino, const char *name) {
+    uint64_t inode_id;
+    int ret = (node_vid(ino) != 0) ? -EROFS : lock_node(ino, NULL, ICACHE_EXCL, &inode_id);
+    if (ret == 0) {
+        ret = removexattr_locked(inode_id, name);
+        icache_unlock(inode_id);
+    }
+    fuse_reply_err(req, -ret);
+}
+// [修改] low-level API：所有操作按节点号寻址，路径只在 lookup 时解析
+static const struct fuse_lowlevel_ops smartfs_oper = {
     .init       = smartfs_init,
+    .destroy    = smartfs_destroy,
+    .lookup     = smartfs_lookup,
+    .forget     = smartfs_forget,
+    .forget_multi = smartfs_forget_multi,
     .getattr  = smartfs_getattr,
+    .setattr  = smartfs_setattr,
     .statfs   = smartfs_statfs,
     .readdir  = smartfs_readdir,
     .create   = smartfs_create,
     .open     = smartfs_open,
     .write    = smartfs_write,
+    .write_buf  = smartfs_write_buf,   // 有 write_buf 时 libfuse 只调用它
     .read     = smartfs_read,
-    .utimens  = smartfs_utimens,
     .unlink   = smartfs_unlink,
-    .truncate = smartfs_truncate,
     .mkdir    = smartfs_mkdir,
     .rmdir    = smartfs_rmdir,
     .rename     = smartfs_rename,
@@ -1243,12 +2967,32 @@ static const struct fuse_operations smartfs_oper = {
     .getxattr   = smartfs_getxattr,
     .listxattr  = smartfs_listxattr,
     .removexattr= smartfs_removexattr,
+    .fallocate  = smartfs_fallocate,
+    .lseek      = smartfs_lseek,
 };
 
 // =========================================================
 // Main Functions
 // =========================================================
 
+// [新增] SmartFS 自己的挂载选项：FUSE 不认识的 -o 选项要先取出来，否则 fuse_session_new 会报错
+struct smartfs_mount_opts {
+    int cdc;                // -o cdc: 按默认参数开启内容定义分块
+    char *cdc_params;       // -o cdc=min:avg:max
+    int write_threads;      // [新增] -o write_threads=N: 写入流水线的工作线程数 (0 = 在 FUSE 线程上写)
+    char *compress;         // [新增] -o compress=codec[:level]: 文件系统默认的压缩编码器
+    int archive_days;       // [新增] -o archive_days=N: 这么多天没读写的块空闲时重新压缩进归档段 (0 = 关)
+};
+
+static const struct fuse_opt smartfs_opt_spec[] = {
+    { "cdc", offsetof(struct smartfs_mount_opts, cdc), 1 },
+    { "cdc=%s", offsetof(struct smartfs_mount_opts, cdc_params), 0 },
+    { "write_threads=%d", offsetof(struct smartfs_mount_opts, write_threads), 0 },
+    { "compress=%s", offsetof(struct smartfs_mount_opts, compress), 0 },
+    { "archive_days=%d", offsetof(struct smartfs_mount_opts, archive_days), 0 },
+    FUSE_OPT_END
+};
+
 int load_superblock() {
     disk_fd = open(disk_path, O_RDWR);
     if (disk_fd < 0) {
@@ -1256,8 +3000,7 @@ int load_superblock() {
         return -1;
     }
 
-    lseek(disk_fd, 0, SEEK_SET);
-    if (read(disk_fd, &sb, sizeof(super_block_t)) != sizeof(super_block_t)) {
+    if (pread(disk_fd, &sb, sizeof(super_block_t), 0) != sizeof(super_block_t)) {
         fprintf(stderr, "Error reading superblock\n");
         return -1;
     }
@@ -1267,6 +3010,26 @@ int load_superblock() {
         return -1;
     }
 
+    // [新增] Inode 格式检查：旧镜像的 Inode 是十几 KB 的大结构，不兼容
+    if (sb.inode_size != sizeof(inode_t)) {
+        fprintf(stderr, "Unsupported inode size %u (expected %zu). Please re-run mkfs.\n",
+                sb.inode_size, sizeof(inode_t));
+        return -1;
+    }
+
+    // [新增] 目录格式检查：旧镜像的目录只有一个块，哈希目录读不了
+    if ((sb.features & SMARTFS_FEATURES_REQUIRED) != SMARTFS_FEATURES_REQUIRED) {
+        fprintf(stderr, "Unsupported disk features 0x%lx (need 0x%llx). Please re-run mkfs.\n",
+                sb.features, SMARTFS_FEATURES_REQUIRED);
+        return -1;
+    }
+
+    // [新增] 指纹算法是格式化时定的，这个构建不支持就不能挂 (去重会全部对不上)
+    if (fp_engine_select((int)sb.fp_algo) != 0) {
+        fprintf(stderr, "Fingerprint algorithm %u is not supported by this build.\n", sb.fp_algo);
+        return -1;
+    }
+
     printf("Superblock loaded successfully!\n");
     return 0;
 }
@@ -1274,11 +3037,56 @@ int load_superblock() {
 // src/main.c 的最底部
 
 int main(int argc, char *argv[]) {
-    // 1. 解析参数 (这部分可能你原来就有)
-    int fuse_stat;
-    struct smartfs_state *smartfs_data;
-    
-    // ... 这里可能有你之前的参数解析代码 ...
+    // 1. 解析参数 (挂载点、-f 前台、-s 单线程、-d 调试 ...)
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts;
+    if (fuse_parse_cmdline(&args, &opts) != 0) return 1;
+    if (opts.show_help) {
+        printf("usage: %s [options] <mountpoint>\n\n", argv[0]);
+        printf("SmartFS options:\n"
+               "    -o cdc[=min:avg:max]   content-defined chunking for dedup (default %d:%d:%d)\n"
+               "    -o write_threads=N     write pipeline worker threads (default: one per CPU, 0 = none)\n"
+               "    -o compress=codec[:L]  default block codec: none, lz4, lz4hc, zstd (default lz4);\n"
+               "                           per file/directory: setfattr -n user.smartfs.compress -v zstd:19\n"
+               "    -o archive_days=N      recompress blocks idle for N days into the archive tier (default %d, 0 = off)\n\n",
+               CDC_DEFAULT_MIN, CDC_DEFAULT_AVG, CDC_DEFAULT_MAX, ARCHIVE_DEFAULT_DAYS);
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        return 0;
+    }
+    if (opts.show_version) {
+        fuse_lowlevel_version();
+        return 0;
+    }
+    if (opts.mountpoint == NULL) {
+        fprintf(stderr, "usage: %s [options] <mountpoint>\n", argv[0]);
+        return 1;
+    }
+    struct smartfs_mount_opts mopts = { 0, NULL, -1, NULL, ARCHIVE_DEFAULT_DAYS };
+    if (fuse_opt_parse(&args, &mopts, smartfs_opt_spec, NULL) != 0) return 1;
+    if (mopts.cdc || mopts.cdc_params) {
+        size_t cmin = CDC_DEFAULT_MIN, cavg = CDC_DEFAULT_AVG, cmax = CDC_DEFAULT_MAX;
+        if ((mopts.cdc_params && sscanf(mopts.cdc_params, "%zu:%zu:%zu", &cmin, &cavg, &cmax) != 3) ||
+            cdc_configure(cmin, cavg, cmax) != 0) {
+            fprintf(stderr, "Invalid cdc=min:avg:max (need %d <= min < avg < max <= %d)\n", CDC_MIN_CHUNK, CDC_MAX_CHUNK);
+            return 1;
+        }
+    }
+    free(mopts.cdc_params);
+    if (mopts.compress) {
+        int codec, level;
+        if (codec_parse(mopts.compress, &codec, &level) != 0 || compress_set_default(codec, level) != 0) {
+            fprintf(stderr, "Invalid or unsupported compress=%s\n", mopts.compress);
+            return 1;
+        }
+        free(mopts.compress);
+    }
+    if (mopts.archive_days < 0) {
+        fprintf(stderr, "Invalid archive_days=%d\n", mopts.archive_days);
+        return 1;
+    }
+    archive_configure(mopts.archive_days);
+    write_threads = (mopts.write_threads < 0) ? write_pipeline_default_threads() : mopts.write_threads;
 
     // 2. 打开磁盘镜像文件
     disk_fd = open("test.img", O_RDWR);
@@ -1290,22 +3098,46 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "Failed to load superblock. Did you run mkfs?\n");
         return 1;
     }
+    if (disk_mount() != 0) {
+        fprintf(stderr, "Failed to load allocation bitmaps.\n");
+        return 1;
+    }
     printf("[Init] Superblock loaded. Free blocks: %lu\n", sb.free_blocks);
-    // [新增] 将 disk_fd 传给模块 C
-    storage_attach_disk(disk_fd); // <--- 加上这一行
+    dcache_init(DCACHE_CAPACITY);
+    storage_add_report(icache_report);
     // ==========================================
     // 🔴 必须添加：初始化模块 C (存储引擎)
     // ==========================================
-    printf("[Init] Initializing LRU Cache (Capacity: 100 blocks)...\n");
-    lru_init(100);  // <--- 加上这一行！分配100个块的缓存空间
+    printf("[Init] Initializing LRU Cache (Capacity: %d blocks)...\n", L1_CACHE_BLOCKS);
+    lru_init(L1_CACHE_BLOCKS);
+    storage_add_report(prefetch_report);
+    storage_add_report(write_pipeline_report);
+    storage_add_report(inval_report);
     // ==========================================
     // [新增] 初始化 WAL (检查是否有崩溃日志需要恢复) [cite: 1]
     printf("[Init] Initializing Write-Ahead Logging (WAL)...\n");
     wal_init();
 
-    // 3. 启动 FUSE
+    // 3. 启动 FUSE (low-level 会话；默认多线程，-s 单线程)
     printf("[Init] Starting SmartFS...\n");
-    fuse_stat = fuse_main(argc, argv, &smartfs_oper, smartfs_data);
-
-    return fuse_stat;
+    int ret = 1;
+    struct fuse_session *se = fuse_session_new(&args, &smartfs_oper, sizeof(smartfs_oper), NULL);
+    if (se == NULL) goto out;
+    smartfs_session = se;
+    if (fuse_set_signal_handlers(se) != 0) goto out_destroy;
+    if (fuse_session_mount(se, opts.mountpoint) != 0) goto out_signals;
+
+    fuse_daemonize(opts.foreground);
+    if (opts.singlethread) ret = fuse_session_loop(se);
+    else ret = fuse_session_loop_mt(se, opts.clone_fd);
+
+    fuse_session_unmount(se);
+out_signals:
+    fuse_remove_signal_handlers(se);
+out_destroy:
+    fuse_session_destroy(se);
+out:
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return ret ? 1 : 0;
 }
\ No newline at end of file
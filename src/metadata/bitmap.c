@@ -0,0 +1,215 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "bitmap.h"
+#include "../include/smartfs_types.h"
+
+#define BITS_PER_WORD 64
+#define BITS_PER_DISK_BLOCK ((uint64_t)BLOCK_SIZE * 8)
+#define NO_WORD UINT64_MAX
+
+// 根据 words[w] 的内容刷新两级摘要里对应的位
+static inline void summary_update(smartfs_bitmap_t *bm, uint64_t w) {
+    uint64_t s = w / BITS_PER_WORD;
+    uint64_t m = 1ULL << (w % BITS_PER_WORD);
+    if (bm->words[w] != ~0ULL) bm->avail[s] |= m; else bm->avail[s] &= ~m;
+    if (bm->words[w] == 0)     bm->empty[s] |= m; else bm->empty[s] &= ~m;
+}
+
+// 在摘要里找第一个 >= from 的置位 word (invert=1 时找清零的位)
+static uint64_t find_word(const smartfs_bitmap_t *bm, const uint64_t *summary, int invert, uint64_t from) {
+    uint64_t s = from / BITS_PER_WORD;
+    if (s >= bm->nsummary) return NO_WORD;
+
+    uint64_t x = (invert ? ~summary[s] : summary[s]) & (~0ULL << (from % BITS_PER_WORD));
+    for (;;) {
+        if (x) {
+            uint64_t w = s * BITS_PER_WORD + __builtin_ctzll(x);
+            return (w < bm->nwords) ? w : NO_WORD;
+        }
+        if (++s >= bm->nsummary) return NO_WORD;
+        x = invert ? ~summary[s] : summary[s];
+    }
+}
+
+// 第一个 >= pos 的空位，没有返回 NO_WORD
+static uint64_t next_free(const smartfs_bitmap_t *bm, uint64_t pos) {
+    if (pos >= bm->nbits) return NO_WORD;
+    uint64_t w = pos / BITS_PER_WORD;
+    uint64_t x = ~bm->words[w] & (~0ULL << (pos % BITS_PER_WORD));
+    if (!x) {
+        w = find_word(bm, bm->avail, 0, w + 1);
+        if (w == NO_WORD) return NO_WORD;
+        x = ~bm->words[w];
+    }
+    uint64_t bit = w * BITS_PER_WORD + __builtin_ctzll(x);
+    return (bit < bm->nbits) ? bit : NO_WORD;
+}
+
+// 第一个 >= pos 的占用位，没有返回 nbits
+static uint64_t next_used(const smartfs_bitmap_t *bm, uint64_t pos) {
+    if (pos >= bm->nbits) return bm->nbits;
+    uint64_t w = pos / BITS_PER_WORD;
+    uint64_t x = bm->words[w] & (~0ULL << (pos % BITS_PER_WORD));
+    if (!x) {
+        w = find_word(bm, bm->empty, 1, w + 1);  // 跳过整字全空的区域
+        if (w == NO_WORD) return bm->nbits;
+        x = bm->words[w];
+    }
+    uint64_t bit = w * BITS_PER_WORD + __builtin_ctzll(x);
+    return (bit < bm->nbits) ? bit : bm->nbits;
+}
+
+// 超出 nbits 的尾部位永远视为占用
+static void mark_tail(smartfs_bitmap_t *bm) {
+    uint64_t rem = bm->nbits % BITS_PER_WORD;
+    if (rem) bm->words[bm->nwords - 1] |= ~0ULL << rem;
+}
+
+static void rebuild_summary(smartfs_bitmap_t *bm) {
+    memset(bm->avail, 0, bm->nsummary * sizeof(uint64_t));
+    memset(bm->empty, 0, bm->nsummary * sizeof(uint64_t));
+    bm->free_count = 0;
+    for (uint64_t w = 0; w < bm->nwords; w++) {
+        summary_update(bm, w);
+        bm->free_count += BITS_PER_WORD - __builtin_popcountll(bm->words[w]);
+    }
+}
+
+int bitmap_init(smartfs_bitmap_t *bm, uint64_t nbits, uint64_t disk_start, uint64_t disk_blocks) {
+    memset(bm, 0, sizeof(*bm));
+    if (nbits == 0) return -EINVAL;
+    if (nbits > disk_blocks * BITS_PER_DISK_BLOCK) {
+        printf("[Bitmap] Warning: region of %lu blocks only holds %lu bits (wanted %lu)\n",
+               disk_blocks, disk_blocks * BITS_PER_DISK_BLOCK, nbits);
+        nbits = disk_blocks * BITS_PER_DISK_BLOCK;
+    }
+
+    bm->nbits = nbits;
+    bm->nwords = (nbits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    bm->nsummary = (bm->nwords + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    bm->disk_start = disk_start;
+    bm->disk_blocks = disk_blocks;
+
+    // words 按磁盘区域大小分配，方便整块读写
+    bm->words = calloc(disk_blocks * BLOCK_SIZE / sizeof(uint64_t), sizeof(uint64_t));
+    bm->avail = calloc(bm->nsummary, sizeof(uint64_t));
+    bm->empty = calloc(bm->nsummary, sizeof(uint64_t));
+    bm->dirty = calloc(disk_blocks, 1);
+    if (!bm->words || !bm->avail || !bm->empty || !bm->dirty) {
+        bitmap_destroy(bm);
+        return -ENOMEM;
+    }
+    mark_tail(bm);
+    rebuild_summary(bm);
+    return 0;
+}
+
+void bitmap_destroy(smartfs_bitmap_t *bm) {
+    free(bm->words);
+    free(bm->avail);
+    free(bm->empty);
+    free(bm->dirty);
+    memset(bm, 0, sizeof(*bm));
+}
+
+int bitmap_load(smartfs_bitmap_t *bm, int fd) {
+    size_t len = bm->disk_blocks * BLOCK_SIZE;
+    if (pread(fd, bm->words, len, (off_t)bm->disk_start * BLOCK_SIZE) != (ssize_t)len) return -EIO;
+    mark_tail(bm);
+    rebuild_summary(bm);
+    memset(bm->dirty, 0, bm->disk_blocks);
+    return 0;
+}
+
+int bitmap_sync(smartfs_bitmap_t *bm, int fd) {
+    for (uint64_t i = 0; i < bm->disk_blocks; i++) {
+        if (!bm->dirty[i]) continue;
+        const char *src = (const char *)bm->words + i * BLOCK_SIZE;
+        if (pwrite(fd, src, BLOCK_SIZE, (off_t)(bm->disk_start + i) * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
+        bm->dirty[i] = 0;
+    }
+    return 0;
+}
+
+void bitmap_reset(smartfs_bitmap_t *bm) {
+    memset(bm->words, 0, bm->disk_blocks * BLOCK_SIZE);
+    memset(bm->dirty, 1, bm->disk_blocks);
+    mark_tail(bm);
+    rebuild_summary(bm);
+    bm->hint = 0;
+}
+
+int bitmap_test(const smartfs_bitmap_t *bm, uint64_t bit) {
+    if (bit >= bm->nbits) return 1;
+    return (bm->words[bit / BITS_PER_WORD] >> (bit % BITS_PER_WORD)) & 1;
+}
+
+void bitmap_set(smartfs_bitmap_t *bm, uint64_t bit) {
+    if (bit >= bm->nbits) return;
+    uint64_t w = bit / BITS_PER_WORD;
+    uint64_t m = 1ULL << (bit % BITS_PER_WORD);
+    if (bm->words[w] & m) return;
+    bm->words[w] |= m;
+    bm->free_count--;
+    bm->dirty[bit / BITS_PER_DISK_BLOCK] = 1;
+    summary_update(bm, w);
+}
+
+void bitmap_clear(smartfs_bitmap_t *bm, uint64_t bit) {
+    if (bit >= bm->nbits) return;
+    uint64_t w = bit / BITS_PER_WORD;
+    uint64_t m = 1ULL << (bit % BITS_PER_WORD);
+    if (!(bm->words[w] & m)) return;
+    bm->words[w] &= ~m;
+    bm->free_count++;
+    bm->dirty[bit / BITS_PER_DISK_BLOCK] = 1;
+    summary_update(bm, w);
+}
+
+int64_t bitmap_alloc(smartfs_bitmap_t *bm) {
+    if (bm->free_count == 0) return -1;
+
+    // Next-Fit: 从上次分配的位置往后找，找不到再从头绕一圈
+    uint64_t bit = next_free(bm, bm->hint * BITS_PER_WORD);
+    if (bit == NO_WORD) bit = next_free(bm, 0);
+    if (bit == NO_WORD) return -1;
+
+    bitmap_set(bm, bit);
+    bm->hint = bit / BITS_PER_WORD;
+    return (int64_t)bit;
+}
+
+int64_t bitmap_alloc_run(smartfs_bitmap_t *bm, uint64_t n) {
+    if (n == 0 || bm->free_count < n) return -1;
+    if (n == 1) return bitmap_alloc(bm);
+
+    // First-Fit: 空位起点 -> 下一个占用位，区间够长就拿走
+    uint64_t pos = 0;
+    for (;;) {
+        uint64_t start = next_free(bm, pos);
+        if (start == NO_WORD) return -1;
+        uint64_t end = next_used(bm, start);
+        if (end - start >= n) {
+            for (uint64_t i = 0; i < n; i++) bitmap_set(bm, start + i);
+            return (int64_t)start;
+        }
+        pos = end;
+    }
+}
+
+void bitmap_free_runs(const smartfs_bitmap_t *bm, uint64_t *nruns, uint64_t *longest) {
+    uint64_t runs = 0, best = 0, pos = 0;
+    for (;;) {
+        uint64_t start = next_free(bm, pos);
+        if (start == NO_WORD) break;
+        uint64_t end = next_used(bm, start);
+        runs++;
+        if (end - start > best) best = end - start;
+        pos = end;
+    }
+    if (nruns) *nruns = runs;
+    if (longest) *longest = best;
+}
@@ -0,0 +1,50 @@
+#ifndef SMARTFS_BITMAP_H
+#define SMARTFS_BITMAP_H
+
+#include <stdint.h>
+
+// =========================================================
+// 位图分配器 (Inode 位图 / Block 位图共用)
+// =========================================================
+// 位图常驻内存，1 = 已占用。按 64 位字 (word) 操作，配合两级摘要：
+//   avail: 第 w 位 = 1 表示 words[w] 里还有空位   -> 找单个空位
+//   empty: 第 w 位 = 1 表示 words[w] 整个都是空的 -> 快速跳过大段空闲区
+// 修改只标记脏块，由 bitmap_sync 统一落盘。
+typedef struct {
+    uint64_t *words;
+    uint64_t *avail;
+    uint64_t *empty;
+    uint64_t nbits;        // 有效位数
+    uint64_t nwords;
+    uint64_t nsummary;     // 摘要字数
+    uint64_t free_count;
+    uint64_t hint;         // 下一次从哪个 word 开始找 (Next-Fit)
+    uint64_t disk_start;   // 位图在磁盘上的起始块号
+    uint64_t disk_blocks;  // 位图在磁盘上占几个块
+    uint8_t  *dirty;       // 每个磁盘块一个脏标记
+} smartfs_bitmap_t;
+
+int  bitmap_init(smartfs_bitmap_t *bm, uint64_t nbits, uint64_t disk_start, uint64_t disk_blocks);
+void bitmap_destroy(smartfs_bitmap_t *bm);
+
+// 从磁盘区域读入 / 把脏块写回磁盘区域
+int  bitmap_load(smartfs_bitmap_t *bm, int fd);
+int  bitmap_sync(smartfs_bitmap_t *bm, int fd);
+
+// 全部清零 (用于重建)
+void bitmap_reset(smartfs_bitmap_t *bm);
+
+int  bitmap_test(const smartfs_bitmap_t *bm, uint64_t bit);
+void bitmap_set(smartfs_bitmap_t *bm, uint64_t bit);
+void bitmap_clear(smartfs_bitmap_t *bm, uint64_t bit);
+
+// 分配一个空位，返回位号；满了返回 -1
+int64_t bitmap_alloc(smartfs_bitmap_t *bm);
+
+// 分配 n 个连续空位，返回起始位号；找不到返回 -1
+int64_t bitmap_alloc_run(smartfs_bitmap_t *bm, uint64_t n);
+
+// 空闲区段统计: 区段个数与最长区段长度
+void bitmap_free_runs(const smartfs_bitmap_t *bm, uint64_t *nruns, uint64_t *longest);
+
+#endif
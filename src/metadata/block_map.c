@@ -0,0 +1,387 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "block_map.h"
+
+// 由 main.c 提供的块分配接口
+uint64_t allocate_block();
+void free_block(uint64_t block_no);
+// [新增] 数据块引用计数 (main.c 转给存储引擎)：树里多了 / 少了一个指向数据块的指针
+void data_block_ref(uint64_t block_id);
+void data_block_unref(uint64_t block_id);
+
+static int bmap_fd = -1;
+
+void bmap_attach_disk(int fd) {
+    bmap_fd = fd;
+}
+
+// 高度为 depth 的子树能覆盖多少个逻辑块
+static uint64_t bmap_capacity(int depth) {
+    uint64_t cap = 1;
+    while (depth-- > 0) cap *= BMAP_PTRS_PER_BLOCK;
+    return cap;
+}
+
+static int read_index(uint64_t blk, uint64_t *ptrs) {
+    if (pread(bmap_fd, ptrs, BLOCK_SIZE, (off_t)blk * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
+    return 0;
+}
+
+static int write_index(uint64_t blk, const uint64_t *ptrs) {
+    if (pwrite(bmap_fd, ptrs, BLOCK_SIZE, (off_t)blk * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
+    return 0;
+}
+
+// 分配一个新的索引块并写入初始内容
+static uint64_t new_index(const uint64_t *ptrs) {
+    uint64_t blk = allocate_block();
+    if (blk == 0) return 0;
+    if (write_index(blk, ptrs) != 0) {
+        free_block(blk);
+        return 0;
+    }
+    return blk;
+}
+
+// [修改] 叶子里的数据块指针也要放掉引用
+// [修改] data = 0 时只释放索引块：目录的叶子是 allocate_block 分的磁盘块，不是存储引擎的块号
+static void free_subtree(uint64_t blk, int depth, int data) {
+    if (blk == 0 || depth <= 0) return;
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    if ((depth > 1 || data) && read_index(blk, ptrs) == 0) {
+        for (size_t i = 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+            if (ptrs[i] == 0) continue;
+            if (depth > 1) free_subtree(ptrs[i], depth - 1, data);
+            else data_block_unref(ptrs[i]);
+        }
+    }
+    free_block(blk);
+}
+
+void bmap_cursor_init(bmap_cursor_t *cur) {
+    cur->valid = 0;
+    cur->dirty = 0;
+    cur->leaf_blk = 0;
+}
+
+int bmap_cursor_flush(bmap_cursor_t *cur) {
+    if (!cur || !cur->valid || !cur->dirty) return 0;
+    cur->dirty = 0;
+    if (cur->leaf_blk == 0) return 0;
+    return write_index(cur->leaf_blk, cur->ptrs);
+}
+
+// 切换游标到 v 的树；如果树变了，先写回旧叶子
+static int cursor_bind(bmap_cursor_t *cur, const file_version_t *v) {
+    if (cur->valid && cur->root == v->block_list_start_index && cur->depth == v->map_depth) return 0;
+    int ret = bmap_cursor_flush(cur);
+    cur->valid = 0;
+    cur->root = v->block_list_start_index;
+    cur->depth = v->map_depth;
+    return ret;
+}
+
+// 从根向下走到 lblk 所在的叶子，并装入游标
+// create=1 时沿途缺失的索引块会被分配 (调用者负责保证 lblk 在容量内)
+static int cursor_load_leaf(bmap_cursor_t *cur, file_version_t *v, uint64_t lblk, int create) {
+    uint64_t base = lblk - (lblk % BMAP_PTRS_PER_BLOCK);
+    if (cur->valid && cur->leaf_base == base && (cur->leaf_blk != 0 || !create)) return 0;
+
+    int ret = bmap_cursor_flush(cur);
+    if (ret != 0) return ret;
+    cur->valid = 0;
+
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    // [修改] 有树高、根却是 0 (整棵树都是空洞) 时先分配根，不然叶子是 0，写进游标的指针全丢了
+    if (create && v->map_depth > 0 && v->block_list_start_index == 0) {
+        memset(ptrs, 0, sizeof(ptrs));
+        uint64_t root = new_index(ptrs);
+        if (root == 0) return -ENOSPC;
+        v->block_list_start_index = root;
+        cur->root = root;
+    }
+    uint64_t node = v->block_list_start_index;
+    for (int d = v->map_depth; d > 1 && node != 0; d--) {
+        if (read_index(node, ptrs) != 0) return -EIO;
+        size_t idx = (lblk / bmap_capacity(d - 1)) % BMAP_PTRS_PER_BLOCK;
+        if (ptrs[idx] == 0 && create) {
+            uint64_t zero[BMAP_PTRS_PER_BLOCK];
+            memset(zero, 0, sizeof(zero));
+            ptrs[idx] = new_index(zero);
+            if (ptrs[idx] == 0) return -ENOSPC;
+            if (write_index(node, ptrs) != 0) return -EIO;
+        }
+        node = ptrs[idx];
+    }
+
+    if (node != 0) {
+        if (read_index(node, cur->ptrs) != 0) return -EIO;
+    } else {
+        memset(cur->ptrs, 0, sizeof(cur->ptrs));
+    }
+    cur->leaf_blk = node;
+    cur->leaf_base = base;
+    cur->valid = 1;
+    cur->dirty = 0;
+    return 0;
+}
+
+int bmap_lookup(bmap_cursor_t *cur, const file_version_t *v, uint64_t lblk, uint64_t *out) {
+    *out = 0;
+    if (lblk >= v->block_count) return 0;
+    if (v->map_depth == 0) {
+        if (lblk == 0) *out = v->block_list_start_index;
+        return 0;
+    }
+    if (lblk >= bmap_capacity(v->map_depth)) return 0;
+
+    bmap_cursor_t local;
+    if (!cur) {
+        cur = &local;
+        bmap_cursor_init(cur);
+    }
+    int ret = cursor_bind(cur, v);
+    if (ret == 0) ret = cursor_load_leaf(cur, (file_version_t *)v, lblk, 0);
+    if (ret != 0) return ret;
+
+    *out = cur->ptrs[lblk % BMAP_PTRS_PER_BLOCK];
+    return 0;
+}
+
+int bmap_assign(bmap_cursor_t *cur, file_version_t *v, uint64_t lblk, uint64_t value, uint64_t *old) {
+    bmap_cursor_t local;
+    int ret;
+
+    if (old) *old = 0;
+    if ((ret = bmap_unshare(v)) != 0) return ret;
+    if (!cur) {
+        cur = &local;
+        bmap_cursor_init(cur);
+    }
+
+    // 1. 树高不够就在顶上加一层，旧根成为新根的第 0 个孩子
+    while (lblk >= bmap_capacity(v->map_depth)) {
+        if (v->map_depth >= BMAP_MAX_DEPTH) return -EFBIG;
+        if ((ret = bmap_cursor_flush(cur)) != 0) return ret;
+
+        uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+        memset(ptrs, 0, sizeof(ptrs));
+        ptrs[0] = v->block_list_start_index;
+        uint64_t new_root = new_index(ptrs);
+        if (new_root == 0) return -ENOSPC;
+        v->block_list_start_index = new_root;
+        v->map_depth++;
+    }
+
+    // 2. 单块文件: 根就是数据块
+    if (v->map_depth == 0) {
+        if (old) *old = v->block_list_start_index;
+        v->block_list_start_index = value;
+    } else {
+        if ((ret = cursor_bind(cur, v)) != 0) return ret;
+        if ((ret = cursor_load_leaf(cur, v, lblk, value != 0)) != 0) return ret;
+
+        size_t idx = lblk % BMAP_PTRS_PER_BLOCK;
+        if (old) *old = cur->ptrs[idx];
+        if (cur->ptrs[idx] != value) {
+            cur->ptrs[idx] = value;
+            cur->dirty = 1;
+        }
+    }
+
+    if (lblk + 1 > v->block_count) v->block_count = lblk + 1;
+    if (cur == &local) return bmap_cursor_flush(cur);
+    return 0;
+}
+
+// 把 [new_count, ...) 范围内的指针清掉，释放完全越界的子树
+static int trim_subtree(uint64_t blk, int depth, uint64_t base, uint64_t new_count) {
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    if (read_index(blk, ptrs) != 0) return -EIO;
+
+    uint64_t child_cap = bmap_capacity(depth - 1);
+    int changed = 0;
+    for (size_t i = 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+        if (ptrs[i] == 0) continue;
+        uint64_t child_base = base + i * child_cap;
+        if (child_base >= new_count) {
+            if (depth > 1) free_subtree(ptrs[i], depth - 1, 1);
+            else data_block_unref(ptrs[i]);
+            ptrs[i] = 0;
+            changed = 1;
+        } else if (depth > 1 && child_base + child_cap > new_count) {
+            int ret = trim_subtree(ptrs[i], depth - 1, child_base, new_count);
+            if (ret != 0) return ret;
+        }
+    }
+    return changed ? write_index(blk, ptrs) : 0;
+}
+
+int bmap_truncate(bmap_cursor_t *cur, file_version_t *v, uint64_t new_count) {
+    if (cur) {
+        int ret = bmap_cursor_flush(cur);
+        cur->valid = 0;
+        if (ret != 0) return ret;
+    }
+
+    if (new_count >= v->block_count) {
+        v->block_count = new_count;
+        return 0;
+    }
+
+    if (new_count == 0) {
+        bmap_release(v);
+        return 0;
+    }
+    int ret = bmap_unshare(v);
+    if (ret != 0) return ret;
+
+    if (v->map_depth > 0 && v->block_list_start_index != 0) {
+        ret = trim_subtree(v->block_list_start_index, v->map_depth, 0, new_count);
+        if (ret != 0) return ret;
+
+        // 降低树高：只要低一层的树就能装下，就把第 0 个孩子提升为根
+        // [修改] 第 0 个孩子是 0 (开头是空洞)：剩下的全是空洞，直接变成空的单块文件，
+        // 不然 0 号块会被当成索引块读、被释放 (那是超级块)
+        while (v->map_depth > 0 && bmap_capacity(v->map_depth - 1) >= new_count) {
+            uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+            if (read_index(v->block_list_start_index, ptrs) != 0) return -EIO;
+            free_block(v->block_list_start_index);
+            v->block_list_start_index = ptrs[0];
+            v->map_depth--;
+            if (ptrs[0] == 0) {
+                v->map_depth = 0;
+                break;
+            }
+        }
+    }
+    if (v->map_depth > 0 && v->block_list_start_index == 0) v->map_depth = 0;
+    v->block_count = new_count;
+    return 0;
+}
+
+// 在以 blk 为根、高度 depth、从 base 开始的子树里找 >= from 的第一个数据块或空洞
+// 找到返回 1，没有返回 0，读索引块失败返回 -EIO
+static int seek_subtree(uint64_t blk, int depth, uint64_t base, uint64_t from, int data, uint64_t *out) {
+    if (blk == 0 || depth == 0) {
+        if ((blk != 0) != data) return 0;
+        *out = from > base ? from : base;
+        return 1;
+    }
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    if (read_index(blk, ptrs) != 0) return -EIO;
+
+    uint64_t child_cap = bmap_capacity(depth - 1);
+    for (size_t i = from > base ? (from - base) / child_cap : 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+        int ret = seek_subtree(ptrs[i], depth - 1, base + i * child_cap, from, data, out);
+        if (ret != 0) return ret;
+    }
+    return 0;
+}
+
+int bmap_seek(const file_version_t *v, uint64_t lblk, int data, uint64_t *out) {
+    *out = v->block_count;
+    if (lblk >= v->block_count) return 0;
+    // 树的容量之外 (截断变大的部分) 都是空洞
+    if (lblk >= bmap_capacity(v->map_depth)) {
+        if (!data) *out = lblk;
+        return 0;
+    }
+    int ret = seek_subtree(v->block_list_start_index, v->map_depth, 0, lblk, data, out);
+    if (ret < 0) return ret;
+    if (ret == 0 && !data) {
+        uint64_t cap = bmap_capacity(v->map_depth);
+        *out = cap > lblk ? cap : lblk;
+    }
+    if (*out > v->block_count) *out = v->block_count;
+    return 0;
+}
+
+// 深拷贝一棵子树，返回新根
+// [修改] 拷出来的叶子又指向了同样的数据块，每个加一个引用
+static uint64_t clone_subtree(uint64_t blk, int depth) {
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    if (read_index(blk, ptrs) != 0) return 0;
+    if (depth > 1) {
+        for (size_t i = 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+            if (ptrs[i] == 0) continue;
+            ptrs[i] = clone_subtree(ptrs[i], depth - 1);
+            if (ptrs[i] == 0) return 0;
+        }
+    }
+    uint64_t copy = new_index(ptrs);
+    if (copy != 0 && depth == 1) {
+        for (size_t i = 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+            if (ptrs[i]) data_block_ref(ptrs[i]);
+        }
+    }
+    return copy;
+}
+
+int bmap_unshare(file_version_t *v) {
+    if (!v->map_shared) return 0;
+    if (v->map_depth > 0 && v->block_list_start_index != 0) {
+        uint64_t new_root = clone_subtree(v->block_list_start_index, v->map_depth);
+        if (new_root == 0) return -ENOSPC;
+        printf("[BlockMap] CoW: cloned map of v%u (depth %u) -> root %lu\n",
+               v->version_id, v->map_depth, new_root);
+        v->block_list_start_index = new_root;
+    }
+    v->map_shared = 0;
+    return 0;
+}
+
+void bmap_release(file_version_t *v) {
+    // 共享的索引块仍属于旧版本，只断开引用
+    if (v->map_depth > 0 && !v->map_shared) free_subtree(v->block_list_start_index, v->map_depth, 1);
+    // [新增] 单块文件的根就是数据块
+    if (v->map_depth == 0 && v->block_list_start_index != 0) data_block_unref(v->block_list_start_index);
+    v->block_list_start_index = 0;
+    v->map_depth = 0;
+    v->block_count = 0;
+    v->map_shared = 0;
+}
+
+void bmap_release_index(file_version_t *v) {
+    if (v->map_depth > 0 && !v->map_shared) free_subtree(v->block_list_start_index, v->map_depth, 0);
+    v->block_list_start_index = 0;
+    v->map_depth = 0;
+    v->block_count = 0;
+    v->map_shared = 0;
+}
+
+static void walk_index(uint64_t blk, int depth, void (*fn)(uint64_t blk, void *arg), void *arg) {
+    fn(blk, arg);
+    if (depth <= 1) return;
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    if (read_index(blk, ptrs) != 0) return;
+    for (size_t i = 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+        if (ptrs[i]) walk_index(ptrs[i], depth - 1, fn, arg);
+    }
+}
+
+void bmap_for_each_index(const file_version_t *v, void (*fn)(uint64_t blk, void *arg), void *arg) {
+    if (v->map_depth > 0 && v->block_list_start_index != 0) {
+        walk_index(v->block_list_start_index, v->map_depth, fn, arg);
+    }
+}
+
+static void walk_data(uint64_t blk, int depth, void (*fn)(uint64_t block_id, void *arg), void *arg) {
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+    if (read_index(blk, ptrs) != 0) return;
+    for (size_t i = 0; i < BMAP_PTRS_PER_BLOCK; i++) {
+        if (ptrs[i] == 0) continue;
+        if (depth > 1) walk_data(ptrs[i], depth - 1, fn, arg);
+        else fn(ptrs[i], arg);
+    }
+}
+
+void bmap_for_each_data(const file_version_t *v, void (*fn)(uint64_t block_id, void *arg), void *arg) {
+    if (v->map_depth == 0) {
+        if (v->block_list_start_index != 0) fn(v->block_list_start_index, arg);
+    } else if (v->block_list_start_index != 0) {
+        walk_data(v->block_list_start_index, v->map_depth, fn, arg);
+    }
+}
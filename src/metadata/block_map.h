@@ -0,0 +1,74 @@
+#ifndef BLOCK_MAP_H
+#define BLOCK_MAP_H
+
+#include <stdint.h>
+#include "../include/smartfs_types.h"
+
+// =========================================================
+// 块映射 (Block Map) - 文件逻辑块号 -> 数据块 ID
+// =========================================================
+// 每个 file_version_t 拥有一棵自己的基数树 (见 smartfs_types.h 的说明)。
+// 索引块存放在磁盘镜像的数据区，通过 allocate_block()/free_block() 分配。
+
+// 游标：缓存最近访问的叶子索引块，顺序读写时每 512 个块只需一次磁盘 I/O
+typedef struct {
+    uint64_t root;        // 游标所属的树 (根 + 高度)，变化时自动失效
+    uint16_t depth;
+    int      valid;
+    int      dirty;       // 叶子被修改过，需要写回
+    uint64_t leaf_blk;    // 叶子索引块的物理块号 (0 = 该叶子尚不存在)
+    uint64_t leaf_base;   // 叶子覆盖的第一个逻辑块号
+    uint64_t ptrs[BMAP_PTRS_PER_BLOCK];
+} bmap_cursor_t;
+
+void bmap_attach_disk(int fd);
+
+void bmap_cursor_init(bmap_cursor_t *cur);
+
+// 把游标里的脏叶子写回磁盘 (保存 inode 之前必须调用)
+int bmap_cursor_flush(bmap_cursor_t *cur);
+
+/**
+ * 查找逻辑块对应的数据块 ID
+ * @param cur: 可为 NULL (不使用缓存)
+ * @param out: 输出块 ID，0 表示空洞
+ * @return: 0 成功，负数为 -errno
+ */
+int bmap_lookup(bmap_cursor_t *cur, const file_version_t *v, uint64_t lblk, uint64_t *out);
+
+/**
+ * 设置逻辑块对应的数据块 ID，按需增加树高/分配索引块
+ * 调用前需保证 v 的索引块没有被其他版本共享 (见 bmap_unshare)
+ * @param old: 可为 NULL，输出被替换掉的旧块 ID
+ */
+int bmap_assign(bmap_cursor_t *cur, file_version_t *v, uint64_t lblk, uint64_t value, uint64_t *old);
+
+/**
+ * 调整逻辑块数：变大时只改 block_count (新区域为空洞)，
+ * 变小时释放超出范围的索引块并尽量降低树高
+ */
+int bmap_truncate(bmap_cursor_t *cur, file_version_t *v, uint64_t new_count);
+
+/**
+ * [新增] 从 lblk 开始找第一个数据块 (data = 1) 或空洞 (data = 0)，整棵空的子树直接跳过 (SEEK_DATA/SEEK_HOLE 用)
+ * 不读游标：调用者先 bmap_cursor_flush
+ * @param out: 找到的逻辑块号；没有数据块了、或者空洞只在 block_count 之后时输出 block_count
+ */
+int bmap_seek(const file_version_t *v, uint64_t lblk, int data, uint64_t *out);
+
+// 写时复制：如果索引块与旧版本共享，先完整复制一份
+int bmap_unshare(file_version_t *v);
+
+// 释放整棵树的索引块
+// [修改] 数据块由存储引擎管理，这里只把树里 (或者单块文件的根) 指向的数据块各放掉一个引用 (data_block_unref)
+void bmap_release(file_version_t *v);
+// [新增] 只释放索引块，叶子指针 (和深度 0 的根) 不管：目录用，它的叶子是调用者自己分配、自己释放的磁盘块
+void bmap_release_index(file_version_t *v);
+
+// 遍历树上的每一个索引块 (挂载时重建块位图用)
+void bmap_for_each_index(const file_version_t *v, void (*fn)(uint64_t blk, void *arg), void *arg);
+
+// [新增] 遍历树指向的每一个数据块 (挂载时重建引用计数用)
+void bmap_for_each_data(const file_version_t *v, void (*fn)(uint64_t block_id, void *arg), void *arg);
+
+#endif
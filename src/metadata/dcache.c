@@ -0,0 +1,209 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "dcache.h"
+
+// 一个目录项：同时挂在哈希链 (查找) 和 LRU 双向链表 (淘汰) 上
+typedef struct dentry {
+    uint64_t parent;
+    uint64_t ino;
+    uint64_t hash;
+    int negative;
+    struct dentry *hnext;
+    struct dentry *prev, *next;   // head = 最近使用
+    char name[];
+} dentry_t;
+
+static dentry_t **buckets = NULL;
+static uint64_t bucket_mask = 0;
+static uint64_t capacity = 0;
+static dentry_t *lru_head = NULL, *lru_tail = NULL;
+static dcache_stats_t stats;
+static pthread_mutex_t dc_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a 名字哈希，再混入父目录编号
+static uint64_t dentry_hash(uint64_t parent, const char *name) {
+    uint64_t h = 1469598103934665603ULL;
+    for (const unsigned char *p = (const unsigned char *)name; *p; p++) {
+        h ^= *p;
+        h *= 1099511628211ULL;
+    }
+    h ^= parent * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 29);
+}
+
+static dentry_t *find(uint64_t parent, const char *name, uint64_t h) {
+    for (dentry_t *d = buckets[h & bucket_mask]; d; d = d->hnext) {
+        if (d->hash == h && d->parent == parent && strcmp(d->name, name) == 0) return d;
+    }
+    return NULL;
+}
+
+static void lru_unlink(dentry_t *d) {
+    if (d->prev) d->prev->next = d->next; else lru_head = d->next;
+    if (d->next) d->next->prev = d->prev; else lru_tail = d->prev;
+    d->prev = d->next = NULL;
+}
+
+static void lru_push_front(dentry_t *d) {
+    d->prev = NULL;
+    d->next = lru_head;
+    if (lru_head) lru_head->prev = d;
+    lru_head = d;
+    if (!lru_tail) lru_tail = d;
+}
+
+// 从哈希链和 LRU 链表上摘掉并释放
+static void remove_entry(dentry_t *d) {
+    dentry_t **pp = &buckets[d->hash & bucket_mask];
+    while (*pp && *pp != d) pp = &(*pp)->hnext;
+    if (*pp) *pp = d->hnext;
+    lru_unlink(d);
+    stats.entries--;
+    if (d->negative) stats.negative_entries--;
+    free(d);
+}
+
+static void insert(uint64_t parent, const char *name, uint64_t ino, int negative) {
+    if (!buckets) return;
+    uint64_t h = dentry_hash(parent, name);
+
+    pthread_mutex_lock(&dc_lock);
+    dentry_t *d = find(parent, name, h);
+    if (d) {
+        // 已有条目 (比如之前的负向条目)，原地更新
+        if (d->negative) stats.negative_entries--;
+        d->ino = ino;
+        d->negative = negative;
+        if (negative) stats.negative_entries++;
+        lru_unlink(d);
+        lru_push_front(d);
+        pthread_mutex_unlock(&dc_lock);
+        return;
+    }
+
+    if (stats.entries >= capacity && lru_tail) {
+        remove_entry(lru_tail);
+        stats.evictions++;
+    }
+
+    size_t len = strlen(name);
+    d = malloc(sizeof(dentry_t) + len + 1);
+    if (!d) {
+        pthread_mutex_unlock(&dc_lock);
+        return;
+    }
+    d->parent = parent;
+    d->ino = ino;
+    d->hash = h;
+    d->negative = negative;
+    memcpy(d->name, name, len + 1);
+    d->hnext = buckets[h & bucket_mask];
+    buckets[h & bucket_mask] = d;
+    lru_push_front(d);
+    stats.entries++;
+    if (negative) stats.negative_entries++;
+    pthread_mutex_unlock(&dc_lock);
+}
+
+void dcache_init(uint64_t max_entries) {
+    if (max_entries == 0) max_entries = 1;
+    // 桶数取不小于容量的 2 的幂，平均链长 <= 1
+    uint64_t n = 1;
+    while (n < max_entries) n <<= 1;
+
+    buckets = calloc(n, sizeof(dentry_t *));
+    if (!buckets) return;
+    bucket_mask = n - 1;
+    capacity = max_entries;
+    lru_head = lru_tail = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void dcache_destroy() {
+    pthread_mutex_lock(&dc_lock);
+    dentry_t *d = lru_head;
+    while (d) {
+        dentry_t *next = d->next;
+        free(d);
+        d = next;
+    }
+    free(buckets);
+    buckets = NULL;
+    lru_head = lru_tail = NULL;
+    stats.entries = stats.negative_entries = 0;
+    pthread_mutex_unlock(&dc_lock);
+}
+
+int dcache_lookup(uint64_t parent, const char *name, uint64_t *out_ino) {
+    if (!buckets) return DCACHE_MISS;
+    uint64_t h = dentry_hash(parent, name);
+
+    pthread_mutex_lock(&dc_lock);
+    dentry_t *d = find(parent, name, h);
+    int ret = DCACHE_MISS;
+    if (!d) {
+        stats.misses++;
+    } else {
+        lru_unlink(d);
+        lru_push_front(d);
+        if (d->negative) {
+            stats.negative_hits++;
+            ret = DCACHE_NEGATIVE;
+        } else {
+            stats.hits++;
+            *out_ino = d->ino;
+            ret = DCACHE_HIT;
+        }
+    }
+    pthread_mutex_unlock(&dc_lock);
+    return ret;
+}
+
+void dcache_add(uint64_t parent, const char *name, uint64_t ino) {
+    insert(parent, name, ino, 0);
+}
+
+void dcache_add_negative(uint64_t parent, const char *name) {
+    insert(parent, name, 0, 1);
+}
+
+void dcache_invalidate(uint64_t parent, const char *name) {
+    if (!buckets) return;
+    uint64_t h = dentry_hash(parent, name);
+
+    pthread_mutex_lock(&dc_lock);
+    dentry_t *d = find(parent, name, h);
+    if (d) remove_entry(d);
+    pthread_mutex_unlock(&dc_lock);
+}
+
+void dcache_purge_dir(uint64_t parent) {
+    if (!buckets) return;
+    pthread_mutex_lock(&dc_lock);
+    dentry_t *d = lru_head;
+    while (d) {
+        dentry_t *next = d->next;
+        if (d->parent == parent) remove_entry(d);
+        d = next;
+    }
+    pthread_mutex_unlock(&dc_lock);
+}
+
+void dcache_get_stats(dcache_stats_t *out) {
+    pthread_mutex_lock(&dc_lock);
+    *out = stats;
+    pthread_mutex_unlock(&dc_lock);
+}
+
+void dcache_report() {
+    dcache_stats_t s;
+    dcache_get_stats(&s);
+    uint64_t lookups = s.hits + s.negative_hits + s.misses;
+    double ratio = lookups ? 100.0 * (s.hits + s.negative_hits) / lookups : 0.0;
+    printf("[DCache] Lookups: %lu, hits: %lu, negative hits: %lu, misses: %lu (hit ratio %.1f%%)\n",
+           lookups, s.hits, s.negative_hits, s.misses, ratio);
+    printf("[DCache] Entries: %lu / %lu (negative: %lu), evictions: %lu\n",
+           s.entries, capacity, s.negative_entries, s.evictions);
+}
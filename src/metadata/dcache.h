@@ -0,0 +1,48 @@
+#ifndef SMARTFS_DCACHE_H
+#define SMARTFS_DCACHE_H
+
+#include <stdint.h>
+
+// =========================================================
+// 目录项缓存 (Dentry Cache) - (父目录 Inode, 名字) -> 子 Inode
+// =========================================================
+// 路径解析每一级都先查这里，未命中才去读磁盘上的目录块。
+// 也缓存“不存在”的结果 (负向条目)，stat 一个不存在的文件不必反复扫目录。
+// 目录内容变化时 (add_dir_entry/remove_dir_entry) 同步更新缓存。
+
+// 查找结果
+#define DCACHE_MISS     0   // 缓存里没有，需要读目录块
+#define DCACHE_HIT      1   // 命中，*out_ino 有效
+#define DCACHE_NEGATIVE 2   // 命中负向条目：确定不存在
+
+typedef struct {
+    uint64_t hits;
+    uint64_t negative_hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t entries;
+    uint64_t negative_entries;
+} dcache_stats_t;
+
+// max_entries: 缓存条目上限 (正向 + 负向)，满了按 LRU 淘汰
+void dcache_init(uint64_t max_entries);
+void dcache_destroy();
+
+int  dcache_lookup(uint64_t parent, const char *name, uint64_t *out_ino);
+
+// 记录 parent 目录下 name -> ino (覆盖已有条目，包括负向条目)
+void dcache_add(uint64_t parent, const char *name, uint64_t ino);
+
+// 记录 parent 目录下不存在 name
+void dcache_add_negative(uint64_t parent, const char *name);
+
+// 删除单个条目
+void dcache_invalidate(uint64_t parent, const char *name);
+
+// 删除父目录为 parent 的所有条目 (rmdir 后 Inode 号可能被新目录复用)
+void dcache_purge_dir(uint64_t parent);
+
+void dcache_get_stats(dcache_stats_t *out);
+void dcache_report();
+
+#endif
@@ -0,0 +1,540 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "dir.h"
+#include "block_map.h"
+
+// 由 main.c 提供的块分配接口
+uint64_t allocate_block();
+void free_block(uint64_t block_no);
+
+#define DIR_LEAF_MAGIC   0x46454C44   // "DLEF"
+#define LEAF_FIRST       sizeof(dir_leaf_t)
+#define COOKIE_BASE      3            // readdir offset: 0 = 开头, 1 = 已列 ".", 2 = 已列 ".."
+
+static int dir_fd = -1;
+
+void dir_attach_disk(int fd) {
+    dir_fd = fd;
+}
+
+// 一次目录操作的上下文：块映射游标 + 目录头 + 外部槽位表的一个块
+typedef struct {
+    file_version_t *v;
+    bmap_cursor_t cur;
+    dir_header_t hdr;
+    int hdr_dirty;
+    uint32_t tbl_lblk;
+    int tbl_valid;
+    int tbl_dirty;
+    uint32_t tbl[DIR_SLOTS_PER_BLOCK];
+} dir_ctx_t;
+
+// FNV-1a，再用 murmur3 的 fmix32 打散 (槽位取的是低位)
+static uint32_t dir_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t rev32(uint32_t x) {
+    x = ((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1);
+    x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+    x = ((x >> 4) & 0x0F0F0F0Fu) | ((x & 0x0F0F0F0Fu) << 4);
+    x = ((x >> 8) & 0x00FF00FFu) | ((x & 0x00FF00FFu) << 8);
+    return (x >> 16) | (x << 16);
+}
+
+// ---------------------------------------------------------
+// 逻辑块读写 (通过块映射找到磁盘块，写时按需分配)
+// ---------------------------------------------------------
+static int read_lblk(dir_ctx_t *c, uint64_t lblk, void *buf) {
+    uint64_t blk = 0;
+    int ret = bmap_lookup(&c->cur, c->v, lblk, &blk);
+    if (ret != 0) return ret;
+    if (blk == 0) return -EIO;
+    if (pread(dir_fd, buf, BLOCK_SIZE, (off_t)blk * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
+    return 0;
+}
+
+static int write_lblk(dir_ctx_t *c, uint64_t lblk, const void *buf) {
+    uint64_t blk = 0;
+    int ret = bmap_lookup(&c->cur, c->v, lblk, &blk);
+    if (ret != 0) return ret;
+    if (blk == 0) {
+        blk = allocate_block();
+        if (blk == 0) return -ENOSPC;
+        if ((ret = bmap_assign(&c->cur, c->v, lblk, blk, NULL)) != 0) {
+            free_block(blk);
+            return ret;
+        }
+    }
+    if (pwrite(dir_fd, buf, BLOCK_SIZE, (off_t)blk * BLOCK_SIZE) != BLOCK_SIZE) return -EIO;
+    return 0;
+}
+
+static int ctx_open(dir_ctx_t *c, const file_version_t *v) {
+    c->v = (file_version_t *)v;
+    bmap_cursor_init(&c->cur);
+    c->hdr_dirty = 0;
+    c->tbl_valid = 0;
+    c->tbl_dirty = 0;
+    int ret = read_lblk(c, 0, &c->hdr);
+    if (ret != 0) return ret;
+    if (c->hdr.magic != DIR_MAGIC) return -EIO;
+    return 0;
+}
+
+static int tbl_flush(dir_ctx_t *c) {
+    if (!c->tbl_valid || !c->tbl_dirty) return 0;
+    c->tbl_dirty = 0;
+    return write_lblk(c, c->tbl_lblk, c->tbl);
+}
+
+// 把脏的槽位表块、目录头、块映射叶子写回，并按块数更新目录大小
+static int ctx_close(dir_ctx_t *c) {
+    int ret = tbl_flush(c);
+    if (ret == 0 && c->hdr_dirty) ret = write_lblk(c, 0, &c->hdr);
+    int flush = bmap_cursor_flush(&c->cur);
+    if (ret == 0) ret = flush;
+    c->v->file_size = (uint64_t)c->hdr.nblocks * BLOCK_SIZE;
+    return ret;
+}
+
+// ---------------------------------------------------------
+// 槽位表
+// ---------------------------------------------------------
+static int tbl_load(dir_ctx_t *c, uint32_t lblk) {
+    if (c->tbl_valid && c->tbl_lblk == lblk) return 0;
+    int ret = tbl_flush(c);
+    if (ret != 0) return ret;
+    c->tbl_valid = 0;
+    if ((ret = read_lblk(c, lblk, c->tbl)) != 0) return ret;
+    c->tbl_lblk = lblk;
+    c->tbl_valid = 1;
+    return 0;
+}
+
+static int slot_get(dir_ctx_t *c, uint32_t slot, uint32_t *out) {
+    if (c->hdr.global_depth <= DIR_INLINE_DEPTH) {
+        *out = c->hdr.table[slot];
+        return 0;
+    }
+    int ret = tbl_load(c, DIR_TABLE_LBLK + slot / DIR_SLOTS_PER_BLOCK);
+    if (ret != 0) return ret;
+    *out = c->tbl[slot % DIR_SLOTS_PER_BLOCK];
+    return 0;
+}
+
+static int slot_set(dir_ctx_t *c, uint32_t slot, uint32_t lblk) {
+    if (c->hdr.global_depth <= DIR_INLINE_DEPTH) {
+        c->hdr.table[slot] = lblk;
+        c->hdr_dirty = 1;
+        return 0;
+    }
+    int ret = tbl_load(c, DIR_TABLE_LBLK + slot / DIR_SLOTS_PER_BLOCK);
+    if (ret != 0) return ret;
+    c->tbl[slot % DIR_SLOTS_PER_BLOCK] = lblk;
+    c->tbl_dirty = 1;
+    return 0;
+}
+
+static int leaf_for_hash(dir_ctx_t *c, uint32_t h, uint32_t *lblk) {
+    uint32_t mask = (1u << c->hdr.global_depth) - 1;
+    return slot_get(c, h & mask, lblk);
+}
+
+// 槽位表翻倍：后一半是前一半的拷贝，global_depth + 1
+static int table_double(dir_ctx_t *c) {
+    uint32_t g = c->hdr.global_depth;
+    if (g >= DIR_MAX_DEPTH) return -ENOSPC;
+    uint32_t n = 1u << g;
+    int ret = 0;
+
+    if (g + 1 <= DIR_INLINE_DEPTH) {
+        memcpy(&c->hdr.table[n], c->hdr.table, n * sizeof(uint32_t));
+    } else {
+        if ((ret = tbl_flush(c)) != 0) return ret;
+        c->tbl_valid = 0;
+        uint32_t buf[DIR_SLOTS_PER_BLOCK];
+        if (g == DIR_INLINE_DEPTH) {
+            // 目录头放不下了，搬到外部块 (2n 正好是一个块)
+            memcpy(buf, c->hdr.table, n * sizeof(uint32_t));
+            memcpy(buf + n, c->hdr.table, n * sizeof(uint32_t));
+            ret = write_lblk(c, DIR_TABLE_LBLK, buf);
+        } else {
+            uint32_t nblk = n / DIR_SLOTS_PER_BLOCK;
+            for (uint32_t k = 0; k < nblk && ret == 0; k++) {
+                ret = read_lblk(c, DIR_TABLE_LBLK + k, buf);
+                if (ret == 0) ret = write_lblk(c, DIR_TABLE_LBLK + nblk + k, buf);
+            }
+        }
+        if (ret != 0) return ret;
+    }
+    c->hdr.global_depth = g + 1;
+    c->hdr_dirty = 1;
+    return 0;
+}
+
+// ---------------------------------------------------------
+// 叶子块内的目录项操作
+// ---------------------------------------------------------
+static void leaf_init(char *blk, uint16_t depth) {
+    memset(blk, 0, BLOCK_SIZE);
+    dir_leaf_t *leaf = (dir_leaf_t *)blk;
+    leaf->magic = DIR_LEAF_MAGIC;
+    leaf->local_depth = depth;
+    smartfs_dirent_t *d = (smartfs_dirent_t *)(blk + LEAF_FIRST);
+    d->inode_no = 0;
+    d->rec_len = BLOCK_SIZE - LEAF_FIRST;
+}
+
+// 遍历下一条记录，遇到损坏的 rec_len 返回 NULL
+static smartfs_dirent_t *leaf_next(char *blk, size_t *off) {
+    if (*off + DIRENT_HEADER_SIZE > BLOCK_SIZE) return NULL;
+    smartfs_dirent_t *d = (smartfs_dirent_t *)(blk + *off);
+    if (d->rec_len < DIRENT_HEADER_SIZE || *off + d->rec_len > BLOCK_SIZE) return NULL;
+    *off += d->rec_len;
+    return d;
+}
+
+static smartfs_dirent_t *leaf_find(char *blk, const char *name, size_t len, smartfs_dirent_t **prev) {
+    smartfs_dirent_t *d, *last = NULL;
+    size_t off = LEAF_FIRST;
+    while ((d = leaf_next(blk, &off)) != NULL) {
+        if (d->inode_no != 0 && d->name_len == len && memcmp(d->name, name, len) == 0) {
+            if (prev) *prev = last;
+            return d;
+        }
+        last = d;
+    }
+    return NULL;
+}
+
+// 找一条尾部空闲够用的记录，把它一分为二
+static int leaf_insert(char *blk, const char *name, size_t len, uint64_t ino, uint8_t type) {
+    size_t need = DIRENT_SIZE(len);
+    smartfs_dirent_t *d;
+    size_t off = LEAF_FIRST;
+    while ((d = leaf_next(blk, &off)) != NULL) {
+        size_t used = d->inode_no ? DIRENT_SIZE(d->name_len) : 0;
+        if (d->rec_len - used < need) continue;
+
+        if (used > 0) {
+            smartfs_dirent_t *n = (smartfs_dirent_t *)((char *)d + used);
+            n->rec_len = d->rec_len - used;
+            d->rec_len = used;
+            d = n;
+        }
+        d->inode_no = ino;
+        d->name_len = (uint8_t)len;
+        d->file_type = type;
+        memcpy(d->name, name, len);
+        ((dir_leaf_t *)blk)->count++;
+        return 0;
+    }
+    return -ENOSPC;
+}
+
+// 删除：空间并入前一条记录；块里第一条则只标记为空闲
+static void leaf_remove(char *blk, smartfs_dirent_t *d, smartfs_dirent_t *prev) {
+    if (prev) {
+        prev->rec_len += d->rec_len;
+    } else {
+        d->inode_no = 0;
+    }
+    ((dir_leaf_t *)blk)->count--;
+}
+
+// 叶子满了：local_depth + 1，按哈希的第 local_depth 位把目录项分到两个叶子
+static int split_leaf(dir_ctx_t *c, uint32_t lblk, char *leaf, uint32_t h) {
+    uint16_t ld = ((dir_leaf_t *)leaf)->local_depth;
+    int ret;
+    if (ld >= c->hdr.global_depth && (ret = table_double(c)) != 0) return ret;
+
+    char old[BLOCK_SIZE], sib[BLOCK_SIZE];
+    memcpy(old, leaf, BLOCK_SIZE);
+    leaf_init(leaf, ld + 1);
+    leaf_init(sib, ld + 1);
+
+    uint32_t bit = 1u << ld;
+    smartfs_dirent_t *d;
+    size_t off = LEAF_FIRST;
+    while ((d = leaf_next(old, &off)) != NULL) {
+        if (d->inode_no == 0) continue;
+        char *dst = (dir_hash(d->name, d->name_len) & bit) ? sib : leaf;
+        leaf_insert(dst, d->name, d->name_len, d->inode_no, d->file_type);
+    }
+
+    uint32_t new_lblk = c->hdr.nblocks;
+    if ((ret = write_lblk(c, new_lblk, sib)) != 0) return ret;
+    c->hdr.nblocks++;
+    c->hdr_dirty = 1;
+    if ((ret = write_lblk(c, lblk, leaf)) != 0) return ret;
+
+    // 低 ld 位与 h 相同、第 ld 位为 1 的槽位改指新叶子
+    uint32_t nslots = 1u << c->hdr.global_depth;
+    for (uint32_t s = (h & (bit - 1)) | bit; s < nslots; s += bit << 1) {
+        if ((ret = slot_set(c, s, new_lblk)) != 0) return ret;
+    }
+    return 0;
+}
+
+// ---------------------------------------------------------
+// 对外接口
+// ---------------------------------------------------------
+int dir_init(file_version_t *v, uint64_t parent_ino) {
+    v->block_list_start_index = 0;
+    v->block_count = 0;
+    v->map_depth = 0;
+    v->map_shared = 0;
+
+    dir_ctx_t c;
+    c.v = v;
+    bmap_cursor_init(&c.cur);
+    c.tbl_valid = 0;
+    c.tbl_dirty = 0;
+    memset(&c.hdr, 0, sizeof(c.hdr));
+    c.hdr.magic = DIR_MAGIC;
+    c.hdr.global_depth = 0;
+    c.hdr.nblocks = 2;
+    c.hdr.parent_ino = parent_ino;
+    c.hdr.table[0] = 1;
+    c.hdr_dirty = 1;
+
+    char leaf[BLOCK_SIZE];
+    leaf_init(leaf, 0);
+    int ret = write_lblk(&c, 1, leaf);
+    int close = ctx_close(&c);
+    if (ret != 0 || close != 0) {
+        dir_release(v);
+        return ret ? ret : close;
+    }
+    return 0;
+}
+
+int dir_lookup(const file_version_t *v, const char *name, uint64_t *out_ino) {
+    size_t len = strlen(name);
+    if (len == 0 || len > MAX_FILENAME) return -ENOENT;
+
+    dir_ctx_t c;
+    int ret = ctx_open(&c, v);
+    if (ret != 0) return ret;
+
+    uint32_t lblk;
+    char leaf[BLOCK_SIZE];
+    if ((ret = leaf_for_hash(&c, dir_hash(name, len), &lblk)) != 0) return ret;
+    if ((ret = read_lblk(&c, lblk, leaf)) != 0) return ret;
+
+    smartfs_dirent_t *d = leaf_find(leaf, name, len, NULL);
+    if (!d) return -ENOENT;
+    *out_ino = d->inode_no;
+    return 0;
+}
+
+int dir_add(file_version_t *v, const char *name, uint64_t ino, mode_t mode) {
+    size_t len = strlen(name);
+    if (len == 0) return -EINVAL;
+    if (len > MAX_FILENAME) return -ENAMETOOLONG;
+
+    dir_ctx_t c;
+    int ret = ctx_open(&c, v);
+    if (ret != 0) return ret;
+
+    uint32_t h = dir_hash(name, len);
+    char leaf[BLOCK_SIZE];
+    for (;;) {
+        uint32_t lblk;
+        if ((ret = leaf_for_hash(&c, h, &lblk)) != 0) break;
+        if ((ret = read_lblk(&c, lblk, leaf)) != 0) break;
+        if (leaf_find(leaf, name, len, NULL)) {
+            ret = -EEXIST;
+            break;
+        }
+        if (leaf_insert(leaf, name, len, ino, (uint8_t)((mode & S_IFMT) >> 12)) == 0) {
+            if ((ret = write_lblk(&c, lblk, leaf)) == 0) {
+                c.hdr.nentries++;
+                c.hdr_dirty = 1;
+            }
+            break;
+        }
+        if ((ret = split_leaf(&c, lblk, leaf, h)) != 0) break;
+    }
+
+    int close = ctx_close(&c);
+    return ret ? ret : close;
+}
+
+int dir_remove(file_version_t *v, const char *name, uint64_t *out_ino) {
+    size_t len = strlen(name);
+    if (len == 0 || len > MAX_FILENAME) return -ENOENT;
+
+    dir_ctx_t c;
+    int ret = ctx_open(&c, v);
+    if (ret != 0) return ret;
+
+    uint32_t lblk;
+    char leaf[BLOCK_SIZE];
+    smartfs_dirent_t *d = NULL, *prev = NULL;
+    if ((ret = leaf_for_hash(&c, dir_hash(name, len), &lblk)) == 0 &&
+        (ret = read_lblk(&c, lblk, leaf)) == 0) {
+        d = leaf_find(leaf, name, len, &prev);
+        if (!d) ret = -ENOENT;
+    }
+    if (ret == 0) {
+        if (out_ino) *out_ino = d->inode_no;
+        leaf_remove(leaf, d, prev);
+        if ((ret = write_lblk(&c, lblk, leaf)) == 0) {
+            c.hdr.nentries--;
+            c.hdr_dirty = 1;
+        }
+    }
+
+    int close = ctx_close(&c);
+    return ret ? ret : close;
+}
+
+int dir_is_empty(const file_version_t *v) {
+    dir_ctx_t c;
+    int ret = ctx_open(&c, v);
+    if (ret != 0) return ret;
+    return c.hdr.nentries == 0;
+}
+
+int dir_set_parent(file_version_t *v, uint64_t parent_ino) {
+    dir_ctx_t c;
+    int ret = ctx_open(&c, v);
+    if (ret != 0) return ret;
+    c.hdr.parent_ino = parent_ino;
+    c.hdr_dirty = 1;
+    return ctx_close(&c);
+}
+
+// readdir 排序用：位反转后的哈希 + 名字
+typedef struct {
+    uint32_t key;
+    smartfs_dirent_t *d;
+} dir_sort_t;
+
+static int sort_cmp(const void *a, const void *b) {
+    const dir_sort_t *x = a, *y = b;
+    if (x->key != y->key) return (x->key < y->key) ? -1 : 1;
+    size_t n = (x->d->name_len < y->d->name_len) ? x->d->name_len : y->d->name_len;
+    int r = memcmp(x->d->name, y->d->name, n);
+    if (r != 0) return r;
+    return (int)x->d->name_len - (int)y->d->name_len;
+}
+
+// offset 编码: COOKIE_BASE + (位反转哈希 << 8 | 同哈希中的序号)
+// 叶子负责的名字在位反转哈希空间里是一段连续区间，分裂只会把区间切成两半，
+// 所以按这个顺序遍历，offset 在目录变化后依然有效
+int dir_iterate(const file_version_t *v, uint64_t self_ino, off_t offset, dir_fill_t fill, void *arg) {
+    dir_ctx_t c;
+    int ret = ctx_open(&c, v);
+    if (ret != 0) return ret;
+
+    if (offset < 1 && fill(arg, ".", self_ino, S_IFDIR, 1)) return 0;
+    if (offset < 2 && fill(arg, "..", c.hdr.parent_ino, S_IFDIR, 2)) return 0;
+
+    uint64_t key = 0;
+    uint32_t dup = 0;
+    if (offset >= COOKIE_BASE) {
+        key = (uint64_t)(offset - COOKIE_BASE) >> 8;
+        dup = (uint32_t)(offset - COOKIE_BASE) & 0xFF;
+    }
+
+    char leaf[BLOCK_SIZE];
+    dir_sort_t ents[BLOCK_SIZE / 16];
+    while (key <= UINT32_MAX) {
+        uint32_t h = rev32((uint32_t)key);
+        uint32_t lblk;
+        if ((ret = leaf_for_hash(&c, h, &lblk)) != 0) return ret;
+        if ((ret = read_lblk(&c, lblk, leaf)) != 0) return ret;
+
+        uint16_t ld = ((dir_leaf_t *)leaf)->local_depth;
+        uint32_t pattern = ld ? (h & ((1u << ld) - 1)) : 0;
+        uint64_t range_end = (uint64_t)rev32(pattern) + (1ULL << (32 - ld));
+
+        int n = 0;
+        smartfs_dirent_t *d;
+        size_t off = LEAF_FIRST;
+        while ((d = leaf_next(leaf, &off)) != NULL) {
+            if (d->inode_no == 0) continue;
+            ents[n].key = rev32(dir_hash(d->name, d->name_len));
+            ents[n].d = d;
+            n++;
+        }
+        qsort(ents, n, sizeof(ents[0]), sort_cmp);
+
+        uint32_t seq = 0;
+        for (int i = 0; i < n; i++) {
+            seq = (i > 0 && ents[i].key == ents[i - 1].key) ? seq + 1 : 0;
+            if (ents[i].key < key || (ents[i].key == key && seq < dup)) continue;
+
+            char name[MAX_FILENAME + 1];
+            memcpy(name, ents[i].d->name, ents[i].d->name_len);
+            name[ents[i].d->name_len] = '\0';
+            off_t next = COOKIE_BASE + (((off_t)ents[i].key << 8) | (seq + 1 < 0xFF ? seq + 1 : 0xFF));
+            if (fill(arg, name, ents[i].d->inode_no, (mode_t)ents[i].d->file_type << 12, next)) return 0;
+        }
+        key = range_end;
+        dup = 0;
+    }
+    return 0;
+}
+
+void dir_for_each_block(const file_version_t *v, void (*fn)(uint64_t blk, void *arg), void *arg) {
+    dir_ctx_t c;
+    if (ctx_open(&c, v) == 0) {
+        uint64_t blk;
+        for (uint32_t lblk = 0; lblk < c.hdr.nblocks; lblk++) {
+            if (bmap_lookup(&c.cur, v, lblk, &blk) == 0 && blk) fn(blk, arg);
+        }
+        if (c.hdr.global_depth > DIR_INLINE_DEPTH) {
+            uint32_t nblk = (1u << c.hdr.global_depth) / DIR_SLOTS_PER_BLOCK;
+            for (uint32_t k = 0; k < nblk; k++) {
+                if (bmap_lookup(&c.cur, v, DIR_TABLE_LBLK + k, &blk) == 0 && blk) fn(blk, arg);
+            }
+        }
+    } else if (v->map_depth == 0 && v->block_list_start_index) {
+        fn(v->block_list_start_index, arg);
+    }
+    bmap_for_each_index(v, fn, arg);
+}
+
+static void free_one(uint64_t blk, void *arg) {
+    (void) arg;
+    free_block(blk);
+}
+
+void dir_release(file_version_t *v) {
+    // 先释放叶子和槽位表 (需要通过索引块找到它们)，再释放索引块
+    dir_ctx_t c;
+    if (ctx_open(&c, v) == 0) {
+        uint64_t blk;
+        for (uint32_t lblk = 0; lblk < c.hdr.nblocks; lblk++) {
+            if (bmap_lookup(&c.cur, v, lblk, &blk) == 0 && blk) free_one(blk, NULL);
+        }
+        if (c.hdr.global_depth > DIR_INLINE_DEPTH) {
+            uint32_t nblk = (1u << c.hdr.global_depth) / DIR_SLOTS_PER_BLOCK;
+            for (uint32_t k = 0; k < nblk; k++) {
+                if (bmap_lookup(&c.cur, v, DIR_TABLE_LBLK + k, &blk) == 0 && blk) free_one(blk, NULL);
+            }
+        }
+    } else if (v->map_depth == 0 && v->block_list_start_index) {
+        free_block(v->block_list_start_index);
+    }
+    // [修改] 叶子上面已经还给块分配器了，不能再当成存储引擎的数据块放引用
+    bmap_release_index(v);
+    v->file_size = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef SMARTFS_DIR_H
+#define SMARTFS_DIR_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "../include/smartfs_types.h"
+
+// =========================================================
+// 哈希目录 (格式见 smartfs_types.h 第 5 节)
+// =========================================================
+// 所有接口都操作目录 Inode 的 current 版本 (块映射里存磁盘块号)。
+// dir_init/dir_add 可能改变 v 的块映射，调用者随后要 save_inode。
+// 返回值: 0 成功，负数为 -errno
+
+void dir_attach_disk(int fd);
+
+// 初始化空目录: 目录头 + 一个叶子
+int dir_init(file_version_t *v, uint64_t parent_ino);
+
+int dir_lookup(const file_version_t *v, const char *name, uint64_t *out_ino);
+
+// 名字已存在返回 -EEXIST
+int dir_add(file_version_t *v, const char *name, uint64_t ino, mode_t mode);
+
+// out_ino 可为 NULL，输出被删掉的条目指向的 Inode
+int dir_remove(file_version_t *v, const char *name, uint64_t *out_ino);
+
+// 1 = 空目录 (只剩 . 和 ..)，0 = 非空，负数为错误
+int dir_is_empty(const file_version_t *v);
+
+// 目录被移动到新的上级目录后更新 ".."
+int dir_set_parent(file_version_t *v, uint64_t parent_ino);
+
+/**
+ * 按 readdir 的 offset 继续列目录
+ * 顺序是哈希位反转后的顺序，叶子分裂不会改变已返回条目的相对位置，
+ * 所以中途有插入/删除时也能从 offset 接着往下列
+ * @param fill: 返回非 0 表示缓冲区满了，停止遍历
+ *              next_off 是下一条的 offset，原样交给 FUSE 的 filler 即可
+ */
+typedef int (*dir_fill_t)(void *arg, const char *name, uint64_t ino, mode_t mode, off_t next_off);
+int dir_iterate(const file_version_t *v, uint64_t self_ino, off_t offset, dir_fill_t fill, void *arg);
+
+// 释放目录占用的全部块 (叶子、槽位表、块映射索引块)
+void dir_release(file_version_t *v);
+
+// 遍历目录占用的每一个磁盘块 (挂载时重建块位图用)
+void dir_for_each_block(const file_version_t *v, void (*fn)(uint64_t blk, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "icache.h"
+
+// 一个缓存条目：同时挂在哈希链 (查找) 和 LRU 双向链表 (淘汰) 上
+typedef struct icache_entry {
+    inode_t inode;
+    uint64_t id;
+    uint32_t refcnt;
+    int dirty;
+    pthread_rwlock_t rw;          // [新增] Inode 锁 (icache_lock)
+    struct icache_entry *hnext;
+    struct icache_entry *prev, *next;   // head = 最近使用；被 pin 住的条目不在 LRU 链表上
+} icache_entry_t;
+
+static int ic_fd = -1;
+static uint64_t ic_area_off = 0;
+static icache_entry_t **buckets = NULL;
+static uint64_t bucket_mask = 0;
+static uint64_t capacity = 0;
+static icache_entry_t *lru_head = NULL, *lru_tail = NULL;
+static icache_stats_t stats;
+static pthread_mutex_t ic_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void icache_attach_disk(int fd, uint64_t inode_area_off) {
+    ic_fd = fd;
+    ic_area_off = inode_area_off;
+}
+
+static off_t inode_offset(uint64_t id) {
+    return (off_t)(ic_area_off + id * sizeof(inode_t));
+}
+
+static int disk_read(uint64_t id, inode_t *out) {
+    if (pread(ic_fd, out, sizeof(inode_t), inode_offset(id)) != sizeof(inode_t)) {
+        memset(out, 0, sizeof(inode_t));
+        return -EIO;
+    }
+    return 0;
+}
+
+static int disk_write(const inode_t *in) {
+    if (pwrite(ic_fd, in, sizeof(inode_t), inode_offset(in->inode_id)) != sizeof(inode_t)) return -EIO;
+    return 0;
+}
+
+static icache_entry_t *find(uint64_t id) {
+    for (icache_entry_t *e = buckets[id & bucket_mask]; e; e = e->hnext) {
+        if (e->id == id) return e;
+    }
+    return NULL;
+}
+
+static void lru_unlink(icache_entry_t *e) {
+    if (e->prev) e->prev->next = e->next; else lru_head = e->next;
+    if (e->next) e->next->prev = e->prev; else lru_tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(icache_entry_t *e) {
+    e->prev = NULL;
+    e->next = lru_head;
+    if (lru_head) lru_head->prev = e;
+    lru_head = e;
+    if (!lru_tail) lru_tail = e;
+}
+
+static void touch(icache_entry_t *e) {
+    if (e->refcnt > 0 || e == lru_head) return;
+    lru_unlink(e);
+    lru_push_front(e);
+}
+
+// 写回 (如果脏) 后从哈希链和 LRU 链表上摘掉并释放
+static void remove_entry(icache_entry_t *e) {
+    if (e->dirty) {
+        disk_write(&e->inode);
+        stats.writebacks++;
+        stats.dirty--;
+    }
+    icache_entry_t **pp = &buckets[e->id & bucket_mask];
+    while (*pp && *pp != e) pp = &(*pp)->hnext;
+    if (*pp) *pp = e->hnext;
+    if (e->refcnt == 0) lru_unlink(e);
+    stats.entries--;
+    pthread_rwlock_destroy(&e->rw);
+    free(e);
+}
+
+// 满了就淘汰 LRU 尾部的条目；全部被 pin 住时允许暂时超出上限
+static void make_room() {
+    if (stats.entries < capacity || !lru_tail) return;
+    remove_entry(lru_tail);
+    stats.evictions++;
+}
+
+// 取得条目 (未命中则从磁盘读入)，调用者持有 ic_lock
+static icache_entry_t *get_entry(uint64_t id, int count_stats) {
+    icache_entry_t *e = find(id);
+    if (e) {
+        if (count_stats) stats.hits++;
+        touch(e);
+        return e;
+    }
+    if (count_stats) stats.misses++;
+
+    make_room();
+    e = calloc(1, sizeof(icache_entry_t));
+    if (!e) return NULL;
+    disk_read(id, &e->inode);
+    pthread_rwlock_init(&e->rw, NULL);
+    e->id = id;
+    e->hnext = buckets[id & bucket_mask];
+    buckets[id & bucket_mask] = e;
+    lru_push_front(e);
+    stats.entries++;
+    return e;
+}
+
+void icache_init(uint64_t max_entries) {
+    if (max_entries == 0) max_entries = 1;
+    // 桶数取不小于容量的 2 的幂，平均链长 <= 1
+    uint64_t n = 1;
+    while (n < max_entries) n <<= 1;
+
+    buckets = calloc(n, sizeof(icache_entry_t *));
+    if (!buckets) return;
+    bucket_mask = n - 1;
+    capacity = max_entries;
+    lru_head = lru_tail = NULL;
+    memset(&stats, 0, sizeof(stats));
+}
+
+void icache_destroy() {
+    pthread_mutex_lock(&ic_lock);
+    for (uint64_t b = 0; buckets && b <= bucket_mask; b++) {
+        while (buckets[b]) {
+            icache_entry_t *e = buckets[b];
+            if (e->refcnt > 0) {
+                // 卸载时还没 release 的文件：放回 LRU 链表，按普通条目释放
+                e->refcnt = 0;
+                lru_push_front(e);
+            }
+            remove_entry(e);
+        }
+    }
+    free(buckets);
+    buckets = NULL;
+    pthread_mutex_unlock(&ic_lock);
+}
+
+void icache_read(uint64_t inode_id, inode_t *out) {
+    if (!buckets) {
+        disk_read(inode_id, out);
+        return;
+    }
+    pthread_mutex_lock(&ic_lock);
+    icache_entry_t *e = get_entry(inode_id, 1);
+    if (e) memcpy(out, &e->inode, sizeof(inode_t));
+    else disk_read(inode_id, out);
+    pthread_mutex_unlock(&ic_lock);
+}
+
+void icache_write(const inode_t *in) {
+    if (!buckets) {
+        disk_write(in);
+        return;
+    }
+    pthread_mutex_lock(&ic_lock);
+    icache_entry_t *e = find(in->inode_id);
+    if (e) {
+        touch(e);
+    } else {
+        // 整个 Inode 都会被覆盖，不用先从磁盘读
+        make_room();
+        e = calloc(1, sizeof(icache_entry_t));
+        if (!e) {
+            disk_write(in);
+            pthread_mutex_unlock(&ic_lock);
+            return;
+        }
+        pthread_rwlock_init(&e->rw, NULL);
+        e->id = in->inode_id;
+        e->hnext = buckets[e->id & bucket_mask];
+        buckets[e->id & bucket_mask] = e;
+        lru_push_front(e);
+        stats.entries++;
+    }
+    memcpy(&e->inode, in, sizeof(inode_t));
+    if (!e->dirty) {
+        e->dirty = 1;
+        stats.dirty++;
+    }
+    pthread_mutex_unlock(&ic_lock);
+}
+
+// 调用者持有 ic_lock
+static icache_entry_t *pin_locked(uint64_t inode_id) {
+    icache_entry_t *e = get_entry(inode_id, 0);
+    if (e && e->refcnt++ == 0) {
+        lru_unlink(e);
+        stats.pinned++;
+    }
+    return e;
+}
+
+static void unpin_locked(icache_entry_t *e) {
+    if (e && e->refcnt > 0 && --e->refcnt == 0) {
+        lru_push_front(e);
+        stats.pinned--;
+    }
+}
+
+void icache_pin(uint64_t inode_id) {
+    if (!buckets) return;
+    pthread_mutex_lock(&ic_lock);
+    pin_locked(inode_id);
+    pthread_mutex_unlock(&ic_lock);
+}
+
+void icache_unpin(uint64_t inode_id) {
+    if (!buckets) return;
+    pthread_mutex_lock(&ic_lock);
+    unpin_locked(find(inode_id));
+    pthread_mutex_unlock(&ic_lock);
+}
+
+void icache_lock(uint64_t inode_id, int mode) {
+    if (!buckets) return;
+    pthread_mutex_lock(&ic_lock);
+    icache_entry_t *e = pin_locked(inode_id);
+    pthread_mutex_unlock(&ic_lock);
+    if (!e) return;
+
+    // 在 ic_lock 外面等锁，别的 Inode 的缓存操作不受影响
+    if (mode == ICACHE_EXCL) pthread_rwlock_wrlock(&e->rw);
+    else pthread_rwlock_rdlock(&e->rw);
+}
+
+void icache_unlock(uint64_t inode_id) {
+    if (!buckets) return;
+    pthread_mutex_lock(&ic_lock);
+    icache_entry_t *e = find(inode_id);
+    if (e) {
+        pthread_rwlock_unlock(&e->rw);
+        unpin_locked(e);
+    }
+    pthread_mutex_unlock(&ic_lock);
+}
+
+int icache_flush() {
+    if (!buckets) return 0;
+    int ret = 0;
+    pthread_mutex_lock(&ic_lock);
+    for (uint64_t b = 0; b <= bucket_mask && stats.dirty > 0; b++) {
+        for (icache_entry_t *e = buckets[b]; e; e = e->hnext) {
+            if (!e->dirty) continue;
+            if (disk_write(&e->inode) != 0) {
+                ret = -EIO;
+                continue;
+            }
+            e->dirty = 0;
+            stats.dirty--;
+            stats.writebacks++;
+        }
+    }
+    pthread_mutex_unlock(&ic_lock);
+    return ret;
+}
+
+void icache_get_stats(icache_stats_t *out) {
+    pthread_mutex_lock(&ic_lock);
+    *out = stats;
+    pthread_mutex_unlock(&ic_lock);
+}
+
+void icache_report() {
+    icache_stats_t s;
+    icache_get_stats(&s);
+    uint64_t lookups = s.hits + s.misses;
+    double ratio = lookups ? 100.0 * s.hits / lookups : 0.0;
+    printf("[ICache] Lookups: %lu, hits: %lu, misses: %lu (hit ratio %.1f%%)\n",
+           lookups, s.hits, s.misses, ratio);
+    printf("[ICache] Entries: %lu / %lu (dirty: %lu, pinned: %lu), evictions: %lu, writebacks: %lu\n",
+           s.entries, capacity, s.dirty, s.pinned, s.evictions, s.writebacks);
+}
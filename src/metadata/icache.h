@@ -0,0 +1,53 @@
+#ifndef SMARTFS_ICACHE_H
+#define SMARTFS_ICACHE_H
+
+#include <stdint.h>
+#include "../include/smartfs_types.h"
+
+// =========================================================
+// Inode 缓存 (Inode Cache) - 写回式，带引用计数和脏标记
+// =========================================================
+// load_inode/save_inode 都走这里：命中时只是一次内存拷贝，
+// save 只把条目标记为脏，等 flush/fsync/卸载 (或被淘汰) 时才写回 Inode 表。
+// 打开的文件会被 pin 住 (引用计数 > 0)，不会被 LRU 淘汰。
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t writebacks;     // 写回磁盘的 Inode 个数
+    uint64_t entries;
+    uint64_t dirty;
+    uint64_t pinned;
+} icache_stats_t;
+
+// inode_area_off: Inode 表在镜像里的字节偏移
+void icache_attach_disk(int fd, uint64_t inode_area_off);
+
+// max_entries: 缓存条目上限；未初始化时所有读写直接访问磁盘
+void icache_init(uint64_t max_entries);
+// 写回所有脏条目并释放缓存
+void icache_destroy();
+
+void icache_read(uint64_t inode_id, inode_t *out);
+void icache_write(const inode_t *in);
+
+// 引用计数：open 时 pin，release 时 unpin
+void icache_pin(uint64_t inode_id);
+void icache_unpin(uint64_t inode_id);
+
+// [新增] Inode 读写锁 (每个 Inode 一把，目录的锁同时保护目录内容)
+// 加锁期间条目被 pin 住，锁对象不会随 LRU 淘汰消失。
+// 同时持有多把锁时必须遵守 main.c 里约定的顺序 (子目录在前，父目录在后)
+#define ICACHE_SHARED 0
+#define ICACHE_EXCL   1
+void icache_lock(uint64_t inode_id, int mode);
+void icache_unlock(uint64_t inode_id);
+
+// 把所有脏条目写回 Inode 表，返回 0 成功，-EIO 失败
+int icache_flush();
+
+void icache_get_stats(icache_stats_t *out);
+void icache_report();
+
+#endif
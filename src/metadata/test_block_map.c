@@ -0,0 +1,107 @@
+// 块映射截断测试：开头是空洞的文件截短之后，树不能把 0 号块 (超级块) 当成根
+//
+//   gcc -std=gnu99 -D_FILE_OFFSET_BITS=64 src/metadata/test_block_map.c src/metadata/block_map.c -o test_block_map
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "block_map.h"
+
+#define DISK_BLOCKS 64
+
+// 替代 main.c 的块分配：0 号块是超级块，永远不会分出去
+static int used[DISK_BLOCKS];
+static int freed_zero = 0;
+static int failures = 0;
+
+uint64_t allocate_block() {
+    for (uint64_t b = 1; b < DISK_BLOCKS; b++) {
+        if (!used[b]) {
+            used[b] = 1;
+            return b;
+        }
+    }
+    return 0;
+}
+void free_block(uint64_t block_no) {
+    if (block_no == 0) freed_zero = 1;
+    else used[block_no] = 0;
+}
+void data_block_ref(uint64_t block_id) { (void) block_id; }
+void data_block_unref(uint64_t block_id) { (void) block_id; }
+
+#define EXPECT(cond, msg) do { \
+    if (cond) printf("验证通过：%s\n", msg); \
+    else { printf("验证失败：%s\n", msg); failures++; } \
+} while (0)
+
+static int used_blocks() {
+    int n = 0;
+    for (int b = 1; b < DISK_BLOCKS; b++) n += used[b];
+    return n;
+}
+
+// 两层的树，第 0 个子树是空洞，只有逻辑块 600 有数据；截短到 keep 块
+static void truncate_leading_hole(int fd, uint64_t keep) {
+    char msg[128];
+    uint64_t zero[BMAP_PTRS_PER_BLOCK];
+    memset(zero, 0, sizeof(zero));
+    file_version_t v;
+    memset(&v, 0, sizeof(v));
+    v.map_depth = 2;
+    v.block_list_start_index = allocate_block();
+    if (pwrite(fd, zero, BLOCK_SIZE, (off_t)v.block_list_start_index * BLOCK_SIZE) != BLOCK_SIZE) {
+        failures++;
+        return;
+    }
+    v.block_count = 601;
+    bmap_assign(NULL, &v, 600, 777777, NULL);
+
+    uint64_t got = 1;
+    snprintf(msg, sizeof(msg), "截短到 %lu 块后树变空，没有碰 0 号块", (unsigned long)keep);
+    EXPECT(bmap_truncate(NULL, &v, keep) == 0 && v.block_list_start_index == 0 && !freed_zero, msg);
+    snprintf(msg, sizeof(msg), "截短到 %lu 块后只剩空洞", (unsigned long)keep);
+    EXPECT(bmap_lookup(NULL, &v, 0, &got) == 0 && got == 0, msg);
+
+    // 截短后还能接着写，新的根是重新分配的
+    uint64_t lblk = keep > 1 ? 5 : 0;
+    v.block_count = keep;
+    snprintf(msg, sizeof(msg), "截短到 %lu 块后重新写入", (unsigned long)keep);
+    EXPECT(bmap_assign(NULL, &v, lblk, 888888, NULL) == 0 && bmap_lookup(NULL, &v, lblk, &got) == 0 &&
+           got == 888888 && v.block_list_start_index != 0, msg);
+    bmap_release(&v);
+}
+
+int main() {
+    printf("=== 块映射截断测试 ===\n");
+
+    char path[] = "/tmp/test_block_map.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || ftruncate(fd, (off_t)DISK_BLOCKS * BLOCK_SIZE) != 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    bmap_attach_disk(fd);
+
+    truncate_leading_hole(fd, 1);
+    truncate_leading_hole(fd, 300);
+    EXPECT(used_blocks() == 0, "索引块全部回收");
+
+    // 有高度但根还没分配的树 (截短留下的)：游标写入时要先分配根
+    file_version_t v;
+    memset(&v, 0, sizeof(v));
+    v.map_depth = 1;
+    v.block_count = 10;
+    bmap_cursor_t cur;
+    bmap_cursor_init(&cur);
+    uint64_t got = 0;
+    EXPECT(bmap_assign(&cur, &v, 5, 888888, NULL) == 0 && bmap_cursor_flush(&cur) == 0 &&
+           v.block_list_start_index != 0 && bmap_lookup(NULL, &v, 5, &got) == 0 && got == 888888,
+           "根为 0 的树经过游标写入");
+    bmap_release(&v);
+
+    close(fd);
+    return failures ? 1 : 0;
+}
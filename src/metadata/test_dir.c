@@ -0,0 +1,104 @@
+// 目录释放测试：mkdir / rmdir 只能把目录自己的块还给块分配器，不能动存储引擎的引用计数
+//
+//   gcc -std=gnu99 -D_FILE_OFFSET_BITS=64 src/metadata/test_dir.c src/metadata/dir.c src/metadata/block_map.c -o test_dir
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "dir.h"
+#include "block_map.h"
+
+#define DISK_BLOCKS 4096
+
+// 替代 main.c 的块分配和存储引擎引用计数：记下每个块的状态，重复释放 / 动了引用计数都算错
+static int used[DISK_BLOCKS];
+static int refs[DISK_BLOCKS];
+static int bad_frees = 0;
+static int ref_calls = 0;
+static int failures = 0;
+
+uint64_t allocate_block() {
+    for (uint64_t b = 1; b < DISK_BLOCKS; b++) {
+        if (!used[b]) {
+            used[b] = 1;
+            return b;
+        }
+    }
+    return 0;
+}
+void free_block(uint64_t block_no) {
+    if (block_no == 0 || block_no >= DISK_BLOCKS || !used[block_no]) bad_frees++;
+    else used[block_no] = 0;
+}
+void data_block_ref(uint64_t block_id) {
+    ref_calls++;
+    if (block_id < DISK_BLOCKS) refs[block_id]++;
+}
+void data_block_unref(uint64_t block_id) {
+    ref_calls++;
+    if (block_id < DISK_BLOCKS) refs[block_id]--;
+}
+
+#define EXPECT(cond, msg) do { \
+    if (cond) printf("验证通过：%s\n", msg); \
+    else { printf("验证失败：%s\n", msg); failures++; } \
+} while (0)
+
+static int used_blocks() {
+    int n = 0;
+    for (int b = 1; b < DISK_BLOCKS; b++) n += used[b];
+    return n;
+}
+
+static int refs_changed() {
+    int n = 0;
+    for (int b = 0; b < DISK_BLOCKS; b++) n += (refs[b] != 0);
+    return n;
+}
+
+// 建目录、加 n 个条目、删掉 keep 之外的条目、释放
+static void mkdir_rmdir(int n, int keep) {
+    char msg[128], name[32];
+    file_version_t v;
+    memset(&v, 0, sizeof(v));
+    int ok = dir_init(&v, 1) == 0;
+    for (int i = 0; ok && i < n; i++) {
+        snprintf(name, sizeof(name), "entry_%d", i);
+        ok = dir_add(&v, name, 100 + i, S_IFREG | 0644) == 0;
+    }
+    for (int i = keep; ok && i < n; i++) {
+        snprintf(name, sizeof(name), "entry_%d", i);
+        ok = dir_remove(&v, name, NULL) == 0;
+    }
+    snprintf(msg, sizeof(msg), "%d 个条目的目录建好又删掉 (深度 %u)", n, v.map_depth);
+    EXPECT(ok, msg);
+    dir_release(&v);
+
+    snprintf(msg, sizeof(msg), "%d 个条目：存储引擎的引用计数一个没动", n);
+    EXPECT(ref_calls == 0 && refs_changed() == 0, msg);
+    snprintf(msg, sizeof(msg), "%d 个条目：块全部还回去，没有重复释放", n);
+    EXPECT(used_blocks() == 0 && bad_frees == 0, msg);
+}
+
+int main() {
+    printf("=== 目录释放测试 ===\n");
+
+    char path[] = "/tmp/test_dir.XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0 || ftruncate(fd, (off_t)DISK_BLOCKS * BLOCK_SIZE) != 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    unlink(path);
+    bmap_attach_disk(fd);
+    dir_attach_disk(fd);
+
+    mkdir_rmdir(0, 0);
+    mkdir_rmdir(300, 0);
+    mkdir_rmdir(3000, 10);
+
+    close(fd);
+    return failures ? 1 : 0;
+}
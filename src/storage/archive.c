@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "storage.h"
+
+// =========================================================
+// [新增] 冷块归档：空闲时把很久没碰过的块用强编码器重新压一遍
+// =========================================================
+// 写入路径为了速度用 LZ4 (或者负载高时的快速级别)，大部分块写完就再也不读了。
+//   - 每个块记一个"最后一次被读写是哪天" (ATIME_FILE，每块 2 字节，按页懒分配)；
+//   - 后台线程每 ARCHIVE_INTERVAL_SEC 醒一次，这段时间里 L3 没有前台读写、系统负载也低，
+//     就扫一遍块号：archive_days 天没碰过的 LZ4 块解压、用 ARCHIVE_CODEC 重新压，
+//     至少小 ARCHIVE_MIN_GAIN% 才换 (l3_archive 写进归档段，数据文件里的旧记录交给垃圾回收)；
+//   - 扫的时候前台来了读写就停下，下次再接着扫 (已经归档的块不会再碰)。
+// 归档的块读的时候照常按索引里的编码器解压，写回去的新数据是新块，所以块只会归档一次。
+// 访问记录丢了 (崩溃) 只是把块当成今天刚碰过，不会误归档热块。
+
+#define ATIME_FILE "/tmp/smartfs.atime"
+#define ATIME_MAGIC 0x41544d45u             // "ATME"
+#define ATIME_PER_PAGE 4096                 // 每页 4096 个块
+#define ATIME_PAGES (1 << 16)               // 最多 2^28 个块，再大的块号不记 (不归档)
+#define ATIME_HEADER 4096                   // 文件头占一页，之后按块号 * 2 字节放
+#define ATIME_UNKNOWN 0                     // 没记过：扫到时当今天
+#define ATIME_DONE 0xFFFF                   // 已经归档 / 压不小，不再看
+#define ARCHIVE_INTERVAL_SEC 60
+#define ARCHIVE_IDLE_LOAD 1.0               // 负载超过这个不做
+#define ARCHIVE_MIN_GAIN 10                 // 至少小 10% 才值得换
+#ifdef SMARTFS_HAVE_ZSTD
+#define ARCHIVE_CODEC CODEC_ZSTD
+#define ARCHIVE_LEVEL 19
+#else
+#define ARCHIVE_CODEC CODEC_LZ4HC
+#define ARCHIVE_LEVEL 12
+#endif
+
+typedef struct {
+    uint32_t magic;
+    uint32_t pages;         // 文件里有多少页访问记录
+} atime_header_t;
+
+typedef struct {
+    unsigned long runs;             // 扫描次数
+    unsigned long aborted;          // 前台有读写，扫到一半停下
+    unsigned long scanned;          // 看过的冷块
+    unsigned long archived;         // 换进归档段的块
+    unsigned long not_worth;        // 重新压了也没小多少
+    unsigned long failures;         // 读 / 解压失败，或者条目中途变了
+    unsigned long bytes_before;     // 归档块原来的压缩长度
+    unsigned long bytes_after;
+} archive_stats_t;
+
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;   // 页分配、统计、后台线程
+static pthread_mutex_t run_lock = PTHREAD_MUTEX_INITIALIZER;       // 同一时间只扫一遍
+static pthread_cond_t archive_wake = PTHREAD_COND_INITIALIZER;
+static uint16_t *atime_pages[ATIME_PAGES];      // 读写用原子操作，分配持 archive_lock
+static archive_stats_t archive_stats;
+static int archive_days = ARCHIVE_DEFAULT_DAYS;
+static int archive_stopping = 0;
+static pthread_t archive_thread;
+static int archive_running = 0;
+
+static uint16_t today() {
+    return (uint16_t)(time(NULL) / 86400);
+}
+
+// 块号对应的记录；alloc = 0 时页还没分配返回 NULL
+static uint16_t *atime_slot(int block_id, int alloc) {
+    if (block_id <= 0 || block_id / ATIME_PER_PAGE >= ATIME_PAGES) return NULL;
+    uint16_t **pp = &atime_pages[block_id / ATIME_PER_PAGE];
+    uint16_t *page = __atomic_load_n(pp, __ATOMIC_ACQUIRE);
+    if (!page && alloc) {
+        pthread_mutex_lock(&archive_lock);
+        page = *pp;
+        if (!page && (page = calloc(ATIME_PER_PAGE, sizeof(uint16_t)))) __atomic_store_n(pp, page, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&archive_lock);
+    }
+    return page ? page + block_id % ATIME_PER_PAGE : NULL;
+}
+
+// 读写路径上调用：当天已经记过就不写 (不弄脏缓存行)
+void archive_touch(int block_id) {
+    uint16_t *slot = atime_slot(block_id, 1);
+    if (!slot) return;
+    uint16_t d = today(), cur = __atomic_load_n(slot, __ATOMIC_RELAXED);
+    if (cur != d && cur != ATIME_DONE) __atomic_store_n(slot, d, __ATOMIC_RELAXED);
+}
+
+void archive_configure(int days) {
+    pthread_mutex_lock(&archive_lock);
+    archive_days = days < 0 ? 0 : days;
+    pthread_mutex_unlock(&archive_lock);
+}
+
+// 归档一个块：返回 1 = 换进了归档段，0 = 不是候选 / 压不小，-1 = 失败
+static int archive_block(int block_id, const l3_extent_t *loc) {
+    if (loc->raw || loc->recipe || loc->archived || loc->dict_id != 0 || loc->raw_len <= 0 || loc->length <= 0) return 0;
+    if (loc->codec != CODEC_LZ4 && !(loc->codec == CODEC_LZ4HC && ARCHIVE_CODEC != CODEC_LZ4HC)) return 0;
+    const codec_t *c = codec_get(ARCHIVE_CODEC);
+    if (!c) return 0;
+
+    char *in = malloc(loc->length);
+    char *raw = malloc(loc->raw_len);
+    int cap = loc->length - loc->length * ARCHIVE_MIN_GAIN / 100;
+    char *out = malloc(cap > 0 ? cap : 1);
+    int ret = -1;
+    if (in && raw && out && pread(loc->fd, in, loc->length, loc->offset) == loc->length &&
+        smart_decompress(loc->codec, 0, in, loc->length, raw, loc->raw_len) == loc->raw_len) {
+        int n = cap > 0 ? c->compress(raw, loc->raw_len, out, cap, ARCHIVE_LEVEL) : 0;
+        if (n <= 0) ret = 0;
+        else if (storage_block_live(block_id) && l3_archive(block_id, loc, out, n, ARCHIVE_CODEC) == 0) ret = 1;
+        if (ret == 1) {
+            pthread_mutex_lock(&archive_lock);
+            archive_stats.bytes_before += loc->length;
+            archive_stats.bytes_after += n;
+            pthread_mutex_unlock(&archive_lock);
+        }
+    }
+    free(in);
+    free(raw);
+    free(out);
+    return ret;
+}
+
+// 扫一遍块号。throttle = 1 时 (后台线程) 前台一有读写就停下；自己调 l3_locate 也会加计数，要扣掉
+int archive_run(int min_age_days, int throttle) {
+    pthread_mutex_lock(&run_lock);
+    int n = l3_next_block_id();
+    uint16_t d = today();
+    unsigned long scanned = 0, archived = 0, not_worth = 0, failures = 0, own = 0;
+    unsigned long ops_seen = l3_activity();
+    int aborted = 0;
+    for (int id = 1; id < n; id++) {
+        if (throttle && l3_activity() - own != ops_seen) {
+            aborted = 1;
+            break;
+        }
+        uint16_t *slot = atime_slot(id, 1);
+        if (!slot) break;
+        uint16_t stamp = __atomic_load_n(slot, __ATOMIC_RELAXED);
+        if (stamp == ATIME_DONE) continue;
+        if (stamp == ATIME_UNKNOWN) {
+            __atomic_store_n(slot, d, __ATOMIC_RELAXED);
+            stamp = d;
+        }
+        if (d - stamp < min_age_days || !storage_block_live(id)) continue;
+
+        l3_extent_t loc;
+        own++;
+        if (l3_locate(id, &loc) != 0) continue;
+        scanned++;
+        int ret = archive_block(id, &loc);
+        if (ret == 1) archived++;
+        else if (ret == 0) not_worth++;
+        else failures++;
+        // 失败可能只是条目中途变了 (块被释放)，下次再看
+        if (ret >= 0) __atomic_store_n(slot, ATIME_DONE, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&run_lock);
+
+    pthread_mutex_lock(&archive_lock);
+    archive_stats.runs++;
+    archive_stats.aborted += aborted;
+    archive_stats.scanned += scanned;
+    archive_stats.archived += archived;
+    archive_stats.not_worth += not_worth;
+    archive_stats.failures += failures;
+    pthread_mutex_unlock(&archive_lock);
+    if (archived > 0) printf("[Archive] %lu cold blocks recompressed with %s:%d\n", archived,
+                             codec_get(ARCHIVE_CODEC)->name, ARCHIVE_LEVEL);
+    return (int)archived;
+}
+
+// 一个间隔里 L3 没有前台读写、负载也低才扫
+static void *archive_worker(void *arg) {
+    (void) arg;
+    unsigned long ops_seen = l3_activity();
+    pthread_mutex_lock(&archive_lock);
+    while (!archive_stopping) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ARCHIVE_INTERVAL_SEC;
+        pthread_cond_timedwait(&archive_wake, &archive_lock, &ts);
+        int days = archive_days;
+        if (archive_stopping) break;
+        pthread_mutex_unlock(&archive_lock);
+        unsigned long ops = l3_activity();
+        if (days > 0 && ops == ops_seen && get_system_load() < ARCHIVE_IDLE_LOAD) archive_run(days, 1);
+        ops_seen = l3_activity();
+        pthread_mutex_lock(&archive_lock);
+    }
+    pthread_mutex_unlock(&archive_lock);
+    return NULL;
+}
+
+// 挂载：读入访问记录 (头不对就当全都没记过)，启动后台线程
+int archive_open() {
+    pthread_mutex_lock(&archive_lock);
+    memset(&archive_stats, 0, sizeof(archive_stats));
+    int fd = open(ATIME_FILE, O_RDONLY);
+    atime_header_t hdr;
+    if (fd >= 0 && pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.magic == ATIME_MAGIC) {
+        size_t bytes = ATIME_PER_PAGE * sizeof(uint16_t);
+        for (uint32_t p = 0; p < hdr.pages && p < ATIME_PAGES; p++) {
+            uint16_t *page = malloc(bytes);
+            if (!page) break;
+            if (pread(fd, page, bytes, ATIME_HEADER + (off_t)p * bytes) != (ssize_t)bytes) {
+                free(page);
+                break;
+            }
+            free(atime_pages[p]);
+            atime_pages[p] = page;
+        }
+    }
+    if (fd >= 0) close(fd);
+    archive_stopping = 0;
+    if (!archive_running) archive_running = (pthread_create(&archive_thread, NULL, archive_worker, NULL) == 0);
+    int ret = archive_running ? 0 : -1;
+    pthread_mutex_unlock(&archive_lock);
+    return ret;
+}
+
+// 卸载：停后台线程，访问记录整个重写 (没分配的页写 0)
+void archive_close() {
+    pthread_mutex_lock(&archive_lock);
+    archive_stopping = 1;
+    pthread_cond_signal(&archive_wake);
+    int running = archive_running;
+    archive_running = 0;
+    pthread_mutex_unlock(&archive_lock);
+    if (running) pthread_join(archive_thread, NULL);
+
+    pthread_mutex_lock(&run_lock);
+    pthread_mutex_lock(&archive_lock);
+    uint32_t pages = 0;
+    for (uint32_t p = 0; p < ATIME_PAGES; p++) if (atime_pages[p]) pages = p + 1;
+    int fd = open(ATIME_FILE, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int ok = fd >= 0;
+    static const uint16_t zeros[ATIME_PER_PAGE];
+    size_t bytes = ATIME_PER_PAGE * sizeof(uint16_t);
+    for (uint32_t p = 0; ok && p < pages; p++) {
+        const uint16_t *page = atime_pages[p] ? atime_pages[p] : zeros;
+        ok = pwrite(fd, page, bytes, ATIME_HEADER + (off_t)p * bytes) == (ssize_t)bytes;
+    }
+    // 头最后写：中途失败的文件下次挂载当作没有
+    atime_header_t hdr = { ATIME_MAGIC, pages };
+    ok = ok && pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && fsync(fd) == 0;
+    if (!ok) printf("[Archive] Cannot save %s: %s\n", ATIME_FILE, strerror(errno));
+    if (fd >= 0) close(fd);
+    for (uint32_t p = 0; p < pages; p++) {
+        free(atime_pages[p]);
+        atime_pages[p] = NULL;
+    }
+    pthread_mutex_unlock(&archive_lock);
+    pthread_mutex_unlock(&run_lock);
+}
+
+void archive_report() {
+    pthread_mutex_lock(&archive_lock);
+    archive_stats_t s = archive_stats;
+    int days = archive_days;
+    pthread_mutex_unlock(&archive_lock);
+    if (s.runs == 0) return;
+    printf("[Archive] Blocks idle %d+ days -> %s:%d: %lu runs (%lu aborted), %lu scanned, %lu archived "
+           "(%lu -> %lu bytes), %lu not worth it, %lu failed\n",
+           days, codec_get(ARCHIVE_CODEC)->name, ARCHIVE_LEVEL, s.runs, s.aborted, s.scanned, s.archived,
+           s.bytes_before, s.bytes_after, s.not_worth, s.failures);
+}
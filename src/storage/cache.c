@@ -5,23 +5,31 @@
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #define BLOCK_SIZE 4096
 
 // === L1 Cache (内存链表) ===
 typedef struct CacheNode {
     int block_id;
+    int len;          // 缓存数据的真实长度 (解压后的块内容)
     char *data;
     struct CacheNode *prev, *next;
+    struct CacheNode *hnext;    // [新增] 同一个哈希桶里的下一个节点
 } CacheNode;
 
 typedef struct {
     int capacity;
     int size;
     CacheNode *head, *tail;
+    // [新增] block_id -> 节点的哈希表 (桶数取不小于容量的 2 的幂)，查找不用再扫整条 LRU 链表
+    CacheNode **buckets;
+    unsigned int bucket_mask;
 } LRUCache;
 
 static LRUCache *l1_cache = NULL;
+// [新增] L1 链表和 L2 槽位共用一把锁；数据都拷进/拷出调用者的缓冲区，不把内部指针交出去
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // === L2 Cache (MMap 文件) ===
 #define L2_CAPACITY 100
@@ -30,6 +38,7 @@ static LRUCache *l1_cache = NULL;
 typedef struct {
     int valid;
     int block_id;
+    int len;
     char data[BLOCK_SIZE];
 } L2CacheEntry;
 
@@ -42,25 +51,35 @@ void init_l2_cache() {
     size_t file_size = L2_CAPACITY * sizeof(L2CacheEntry);
     ftruncate(l2_fd, file_size);
     l2_mmap_ptr = (L2CacheEntry *)mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, l2_fd, 0);
+    if (l2_mmap_ptr == MAP_FAILED) {
+        l2_mmap_ptr = NULL;
+        return;
+    }
+    // [新增] 挂载时作废上次留下的条目：L3 文件可能被单独删掉重建，块号对不上，
+    // 旧条目可能对应别的数据 (而且旧版本存的是压缩后的内容)
+    for (int i = 0; i < L2_CAPACITY; i++) l2_mmap_ptr[i].valid = 0;
 }
 
 // L2 写入
-void l2_put(int block_id, const char *data) {
+void l2_put(int block_id, const char *data, int len) {
     if (!l2_mmap_ptr) return;
     int index = block_id % L2_CAPACITY;
     l2_mmap_ptr[index].valid = 1;
     l2_mmap_ptr[index].block_id = block_id;
-    memcpy(l2_mmap_ptr[index].data, data, BLOCK_SIZE);
-    msync(&l2_mmap_ptr[index], sizeof(L2CacheEntry), MS_SYNC);
+    l2_mmap_ptr[index].len = len;
+    memcpy(l2_mmap_ptr[index].data, data, len);
+    // [修改] 不再 msync：L2 挂载时整个作废，掉电丢了也无所谓，交给内核慢慢回写。
+    // 原来每次 L1 淘汰都拿着 cache_lock 同步写一次盘，所有读请求都跟着等
     printf("[L2] ↘️ Evicted to L2: Block #%d (Slot %d)\n", block_id, index);
 }
 
-// L2 读取
-char* l2_get(int block_id) {
+// L2 读取 (调用者持有 cache_lock)
+char* l2_get(int block_id, int *out_len) {
     if (!l2_mmap_ptr) return NULL;
     int index = block_id % L2_CAPACITY;
     if (l2_mmap_ptr[index].valid && l2_mmap_ptr[index].block_id == block_id) {
         printf("[L2] 🚀 L2 Cache Hit: Block #%d\n", block_id);
+        *out_len = l2_mmap_ptr[index].len;
         return l2_mmap_ptr[index].data;
     }
     return NULL;
@@ -69,14 +88,41 @@ char* l2_get(int block_id) {
 // === L1 操作实现 ===
 
 void lru_init(int capacity) {
+    if (capacity < 1) capacity = 1;
+    unsigned int nbuckets = 1;
+    while (nbuckets < (unsigned int)capacity) nbuckets <<= 1;
+
     l1_cache = (LRUCache *)malloc(sizeof(LRUCache));
     l1_cache->capacity = capacity;
     l1_cache->size = 0;
     l1_cache->head = l1_cache->tail = NULL;
+    l1_cache->buckets = (CacheNode **)calloc(nbuckets, sizeof(CacheNode *));
+    l1_cache->bucket_mask = nbuckets - 1;
     init_l2_cache();
     printf("[Cache] 🧠 L1 Initialized (%d blocks) + L2 MMap Linked.\n", capacity);
 }
 
+// [新增] 哈希表操作 (调用者持有 cache_lock)
+static CacheNode **lru_bucket(int block_id) {
+    return &l1_cache->buckets[(unsigned int)block_id & l1_cache->bucket_mask];
+}
+
+static CacheNode *lru_find(int block_id) {
+    for (CacheNode *curr = *lru_bucket(block_id); curr; curr = curr->hnext) {
+        if (curr->block_id == block_id) return curr;
+    }
+    return NULL;
+}
+
+static void lru_unhash(CacheNode *node) {
+    for (CacheNode **pp = lru_bucket(node->block_id); *pp; pp = &(*pp)->hnext) {
+        if (*pp == node) {
+            *pp = node->hnext;
+            return;
+        }
+    }
+}
+
 void lru_remove_node(CacheNode *node) {
     if (node->prev) node->prev->next = node->next;
     else l1_cache->head = node->next;
@@ -92,65 +138,103 @@ void lru_add_to_head(CacheNode *node) {
     if (!l1_cache->tail) l1_cache->tail = node;
 }
 
-// 【关键修正】这里现在严格匹配 storage.h，只有 2 个参数！
-void lru_put(int block_id, const char *data) {
-    if (!l1_cache) return;
+// [修改] 带上数据长度 (块内容的真实长度，可能不足 4KB) (调用者持有 cache_lock)
+static void lru_put_locked(int block_id, const char *data, int len) {
+    if (len > BLOCK_SIZE) len = BLOCK_SIZE;
 
     // 1. 查重更新
-    CacheNode *curr = l1_cache->head;
-    while (curr) {
-        if (curr->block_id == block_id) {
-            memcpy(curr->data, data, BLOCK_SIZE);
-            lru_remove_node(curr);
-            lru_add_to_head(curr);
-            return;
-        }
-        curr = curr->next;
+    CacheNode *curr = lru_find(block_id);
+    if (curr) {
+        memcpy(curr->data, data, len);
+        curr->len = len;
+        lru_remove_node(curr);
+        lru_add_to_head(curr);
+        return;
     }
 
-    // 2. 淘汰逻辑 (L1 -> L2)
+    // 2. 淘汰逻辑 (L1 -> L2)，[修改] 淘汰掉的节点直接拿来装新块
+    CacheNode *new_node;
     if (l1_cache->size >= l1_cache->capacity) {
-        CacheNode *tail = l1_cache->tail;
+        new_node = l1_cache->tail;
         // 把被淘汰的数据写入 L2
-        l2_put(tail->block_id, tail->data); 
-        
-        lru_remove_node(tail);
-        free(tail->data);
-        free(tail);
+        l2_put(new_node->block_id, new_node->data, new_node->len);
+
+        lru_remove_node(new_node);
+        lru_unhash(new_node);
         l1_cache->size--;
+    } else {
+        new_node = (CacheNode *)malloc(sizeof(CacheNode));
+        new_node->data = (char *)malloc(BLOCK_SIZE);
     }
 
     // 3. 新增
-    CacheNode *new_node = (CacheNode *)malloc(sizeof(CacheNode));
     new_node->block_id = block_id;
-    new_node->data = (char *)malloc(BLOCK_SIZE);
-    memcpy(new_node->data, data, BLOCK_SIZE);
-    
+    new_node->len = len;
+    memcpy(new_node->data, data, len);
+
+    CacheNode **bucket = lru_bucket(block_id);
+    new_node->hnext = *bucket;
+    *bucket = new_node;
     lru_add_to_head(new_node);
     l1_cache->size++;
     printf("[L1] 📥 Added to L1: Block #%d\n", block_id);
 }
 
-char* lru_get(int block_id) {
-    if (!l1_cache) return NULL;
-    CacheNode *curr = l1_cache->head;
-    while (curr) {
-        if (curr->block_id == block_id) {
-            printf("[L1] ✅ L1 Hit: Block #%d\n", block_id);
-            lru_remove_node(curr);
-            lru_add_to_head(curr);
-            return curr->data;
-        }
-        curr = curr->next;
+void lru_put(int block_id, const char *data, int len) {
+    if (!l1_cache) return;
+    pthread_mutex_lock(&cache_lock);
+    lru_put_locked(block_id, data, len);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// [新增] 只查 L1，不调整 LRU 顺序 (预读用来跳过已经缓存的块)
+int lru_contains(int block_id) {
+    if (!l1_cache) return 0;
+    pthread_mutex_lock(&cache_lock);
+    int found = lru_find(block_id) != NULL;
+    pthread_mutex_unlock(&cache_lock);
+    return found;
+}
+
+// [新增] 从长度为 blen 的块里拷 [off, off + len) 到 out，块里没有的部分补 0
+static void copy_range(const char *data, int blen, int off, char *out, int len) {
+    int n = (blen > off) ? blen - off : 0;
+    if (n > len) n = len;
+    if (n > 0) memcpy(out, data + off, n);
+    if (n < len) memset(out + (n > 0 ? n : 0), 0, len - n);
+}
+
+// [新增] 命中时只拷需要的那一段 (读请求直接拷进回复缓冲区，不再经过中间的整块缓冲)
+int lru_read(int block_id, int off, char *out, int len) {
+    if (!l1_cache) return -1;
+    int blen = -1;
+    pthread_mutex_lock(&cache_lock);
+    CacheNode *curr = lru_find(block_id);
+    if (curr) {
+        printf("[L1] ✅ L1 Hit: Block #%d\n", block_id);
+        lru_remove_node(curr);
+        lru_add_to_head(curr);
+        blen = curr->len;
+        copy_range(curr->data, blen, off, out, len);
     }
     
     // 查 L2
-    char *l2_data = l2_get(block_id);
+    int l2_len = 0;
+    char *l2_data = (blen < 0) ? l2_get(block_id, &l2_len) : NULL;
     if (l2_data) {
         // 如果 L2 找到了，把它“升级”回 L1
-        lru_put(block_id, l2_data); 
-        // 再次获取（这次一定在 L1 里了）
-        return lru_get(block_id);
+        // 注意：升级时 L1 可能把尾部淘汰进 L2 的同一个槽位，必须先拷出来
+        char block[BLOCK_SIZE];
+        blen = l2_len;
+        memcpy(block, l2_data, blen);
+        copy_range(block, blen, off, out, len);
+        lru_put_locked(block_id, block, blen);
     }
-    return NULL;
-}
\ No newline at end of file
+    pthread_mutex_unlock(&cache_lock);
+    return blen;
+}
+
+// [修改] 命中时把数据拷到 out (至少 BLOCK_SIZE 字节)，返回长度；未命中返回 -1
+int lru_get(int block_id, char *out) {
+    return lru_read(block_id, 0, out, BLOCK_SIZE);
+}
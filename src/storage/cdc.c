@@ -0,0 +1,90 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "storage.h"
+
+// =========================================================
+// 内容定义分块 (FastCDC)
+// =========================================================
+// 固定 4KB 分块时，文件开头插入一个字节，后面每一块的内容都变了，一个也去不了重。
+// 按内容切：对数据做 Gear 滚动哈希 (fp = (fp << 1) + gear[byte]，第 k 位只和最近 k+1 个字节有关)，
+// 哈希的某几位全为 0 的位置就是切点。切点只取决于附近的内容，插入/删除之后的切点会重新对齐。
+//
+// FastCDC 的几个做法：
+//   - 前 min 字节不找切点 (块不会太碎，也省掉这段的哈希计算)
+//   - 归一化：不到 avg 时用多 2 位的掩码 (难切)，过了 avg 用少 2 位的掩码 (好切)，块长集中在 avg 附近
+//   - 一次滚两个字节：gear_ls = gear << 1，先按左移过的掩码判断第一个字节，结果和逐字节完全一样，循环次数减半
+// Gear 哈希每一步都依赖上一步，没法用 SIMD 并行，逐字节的这个循环就是瓶颈。
+//
+// Gear 表用固定种子生成：切点必须每次挂载都一样，否则重新挂载后就切不出同样的块了。
+
+static uint64_t gear[256];
+static uint64_t gear_ls[256];
+static size_t cdc_min = 0, cdc_avg = 0, cdc_max = 0;   // cdc_avg == 0 表示没开
+static uint64_t mask_s, mask_l, mask_s_ls, mask_l_ls;
+
+// 掩码放在第 62 位往下：左移一位 (两字节滚动) 之后也不会丢位
+static uint64_t make_mask(int bits) {
+    return ((1ULL << bits) - 1) << (63 - bits);
+}
+
+static void gear_init() {
+    uint64_t x = 0x534d415254465343ULL;    // "SMARTFSC"
+    for (int i = 0; i < 256; i++) {
+        // splitmix64
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+        gear_ls[i] = gear[i] << 1;
+    }
+}
+
+// 开启分块 (挂载时调用，之后只读)：CDC_MIN_CHUNK <= min < avg < max <= CDC_MAX_CHUNK，avg 向下取 2 的幂
+int cdc_configure(size_t min, size_t avg, size_t max) {
+    if (min < CDC_MIN_CHUNK || max > CDC_MAX_CHUNK || !(min < avg && avg < max)) return -1;
+    int bits = 0;
+    while ((2UL << bits) <= avg) bits++;
+    if ((1UL << bits) <= min) return -1;
+    gear_init();
+    cdc_min = min;
+    cdc_avg = 1UL << bits;
+    cdc_max = max;
+    mask_s = make_mask(bits + 2);
+    mask_l = make_mask(bits - 2);
+    mask_s_ls = mask_s << 1;
+    mask_l_ls = mask_l << 1;
+    printf("[CDC] Content-defined chunking: min %zu, avg %zu, max %zu\n", cdc_min, cdc_avg, cdc_max);
+    return 0;
+}
+
+int cdc_enabled() {
+    return cdc_avg != 0;
+}
+
+// 从 src 开头切下一块，返回块长 (1..n)
+size_t cdc_next_cut(const unsigned char *src, size_t n) {
+    if (n <= cdc_min) return n;
+    if (n > cdc_max) n = cdc_max;
+    size_t normal = n < cdc_avg ? n : cdc_avg;
+
+    uint64_t fp = 0;
+    size_t i = cdc_min;
+    for (; i + 2 <= normal; i += 2) {
+        fp = (fp << 2) + gear_ls[src[i]];
+        if (!(fp & mask_s_ls)) return i + 1;
+        fp += gear[src[i + 1]];
+        if (!(fp & mask_s)) return i + 2;
+    }
+    for (; i + 2 <= n; i += 2) {
+        fp = (fp << 2) + gear_ls[src[i]];
+        if (!(fp & (i < normal ? mask_s_ls : mask_l_ls))) return i + 1;
+        fp += gear[src[i + 1]];
+        if (!(fp & (i + 1 < normal ? mask_s : mask_l))) return i + 2;
+    }
+    if (i < n) {
+        fp = (fp << 1) + gear[src[i]];
+        if (!(fp & (i < normal ? mask_s : mask_l))) return i + 1;
+    }
+    return n;
+}
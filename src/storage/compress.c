@@ -1,64 +1,426 @@
 #include "storage.h"
 #include <lz4.h>
+#include <lz4hc.h>
+#ifdef SMARTFS_HAVE_ZSTD
+#include <zstd.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
 
 #define BLOCK_SIZE 4096
 
+// =========================================================
+// [修改] 可压缩性估计 + 负载采样
+// =========================================================
+// 原来每块都调一次 getloadavg (系统调用 + 解析 /proc)，又只认块开头的 JPEG/PNG/ZIP/gzip 魔数，
+// mp4、zstd 文件中间的块照样整块跑一遍 LZ4 再扔掉。现在：
+//   1. 负载每秒最多读一次，其余时候用缓存的值
+//   2. 从块里均匀取 SAMPLE_STRIPS 段、共 512 字节算字节直方图，估计碰撞熵 (Rényi-2)；
+//      超过 7 bit/字节的 (已经压缩/加密过的数据) 不压缩
+//   3. 按 Inode 记连续压不动的块数，连续 SKIP_AFTER 块压不动之后，这个文件后面的块连估计都不做，
+//      直接存原文；每跳过 SKIP_PROBE 块再试一次 (文件内容可能变了)
+
+#define SAMPLE_STRIPS 16
+#define STRIP_LEN 32
+#define SAMPLE_LEN (SAMPLE_STRIPS * STRIP_LEN)
+#define LOAD_INTERVAL_NS 1000000000L
+#define SKIP_SLOTS 1024
+#define SKIP_AFTER 4
+#define SKIP_PROBE 64
+
+typedef uint32_t hist_vec_t __attribute__((vector_size(32)));
+
+typedef struct {
+    long inode_id;
+    uint32_t streak;        // 连续压不动的块数
+    uint32_t skipped;       // 连着跳过了多少块 (到 SKIP_PROBE 再试一次)
+} skip_slot_t;
+
+typedef struct {
+    unsigned long compressed;       // 压缩后变小了的块
+    unsigned long raw;              // 压不小，存原文
+    unsigned long estimator_skips;  // 估计压不动，没跑压缩
+    unsigned long inode_skips;      // 文件已经确认压不动，什么都没做
+    unsigned long fast_mode;        // 高负载时用的快速模式
+    unsigned long policy_raw;       // [新增] 文件策略是 none，直接存原文
+    unsigned long codec_blocks[CODEC_MAX];  // [新增] 按编码器分：压小了的块数、压缩前后字节数
+    unsigned long codec_in[CODEC_MAX];
+    unsigned long codec_out[CODEC_MAX];
+} CompressStats;
+
+// [新增] 按 Inode 的压缩策略 (见 compress_set_file_policy)，只记不用默认策略的文件
+#define POLICY_BUCKETS 256
+
+typedef struct policy_node {
+    long inode_id;
+    int codec;
+    int level;
+    struct policy_node *next;
+} policy_node_t;
+
+static pthread_mutex_t compress_lock = PTHREAD_MUTEX_INITIALIZER;   // 负载缓存、跳过表、策略、统计
+static double cached_load = 0.0;
+static long load_stamp = 0;         // 上次读负载的时间 (CLOCK_MONOTONIC，纳秒)，0 = 还没读过
+static skip_slot_t skip_slots[SKIP_SLOTS];
+static CompressStats compress_stats;
+static policy_node_t *policies[POLICY_BUCKETS];
+static int default_codec = CODEC_LZ4;
+static int default_level = 0;       // 0 = 编码器自己的默认级别
+
+static long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
 // 获取系统负载
+// [修改] 每秒最多读一次，其余时候返回上次的值
 double get_system_load() {
-    double load[1];
-    if (getloadavg(load, 1) != -1) return load[0];
-    return 0.0;
+    long now = now_ns();
+    pthread_mutex_lock(&compress_lock);
+    if (load_stamp == 0 || now - load_stamp >= LOAD_INTERVAL_NS) {
+        double load[1];
+        cached_load = (getloadavg(load, 1) != -1) ? load[0] : 0.0;
+        load_stamp = now;
+    }
+    double load = cached_load;
+    pthread_mutex_unlock(&compress_lock);
+    return load;
+}
+
+// [新增] 采样估计块是不是已经压不动了：SAMPLE_LEN 字节的直方图算 sum(c^2)，
+// 碰撞熵 H2 = log2(N^2 / sum(c^2)) > 7 等价于 sum(c^2) * 128 < N^2 (不用算对数)。
+// 四张直方图轮流计数 (相邻字节相同也不用等上一次加完)，合并和平方和用向量扩展一次 8 个
+static int estimate_incompressible(const char *data, int len) {
+    if (len < SAMPLE_LEN) return 0;     // 太短的块 LZ4 本来就快，直接试
+    uint32_t hist[4][256] __attribute__((aligned(32)));
+    memset(hist, 0, sizeof(hist));
+
+    const unsigned char *p = (const unsigned char *)data;
+    long step = (len - STRIP_LEN) / (SAMPLE_STRIPS - 1);
+    for (int s = 0; s < SAMPLE_STRIPS; s++) {
+        const unsigned char *strip = p + s * step;
+        for (int i = 0; i < STRIP_LEN; i += 4) {
+            hist[0][strip[i]]++;
+            hist[1][strip[i + 1]]++;
+            hist[2][strip[i + 2]]++;
+            hist[3][strip[i + 3]]++;
+        }
+    }
+
+    hist_vec_t sum = { 0 };
+    for (int b = 0; b < 256; b += 8) {
+        hist_vec_t c, t;
+        memcpy(&c, &hist[0][b], sizeof(c));
+        memcpy(&t, &hist[1][b], sizeof(t)); c += t;
+        memcpy(&t, &hist[2][b], sizeof(t)); c += t;
+        memcpy(&t, &hist[3][b], sizeof(t)); c += t;
+        sum += c * c;
+    }
+    uint32_t sq = 0;
+    for (int i = 0; i < 8; i++) sq += sum[i];
+    return (uint64_t)sq * 128 < (uint64_t)SAMPLE_LEN * SAMPLE_LEN;
+}
+
+static skip_slot_t *skip_slot(long inode_id) {
+    return &skip_slots[((unsigned long)inode_id * 2654435761u) % SKIP_SLOTS];
+}
+
+// 这个文件最近的块都压不动：跳过这一块 (返回 1)，每 SKIP_PROBE 块放一块过去再试
+static int inode_skip(long inode_id) {
+    if (inode_id <= 0) return 0;
+    pthread_mutex_lock(&compress_lock);
+    skip_slot_t *s = skip_slot(inode_id);
+    int skip = s->inode_id == inode_id && s->streak >= SKIP_AFTER && ++s->skipped % SKIP_PROBE != 0;
+    if (skip) compress_stats.inode_skips++;
+    pthread_mutex_unlock(&compress_lock);
+    return skip;
+}
+
+// 记下这一块的结果：raw = 1 压不动 (估计的或者 LZ4 试过的)
+static void inode_record(long inode_id, int raw) {
+    if (inode_id <= 0) return;
+    pthread_mutex_lock(&compress_lock);
+    skip_slot_t *s = skip_slot(inode_id);
+    if (s->inode_id != inode_id) {
+        s->inode_id = inode_id;
+        s->streak = 0;
+        s->skipped = 0;
+    }
+    s->streak = raw ? s->streak + 1 : 0;
+    if (!raw) s->skipped = 0;
+    pthread_mutex_unlock(&compress_lock);
+}
+
+static void count(unsigned long *counter) {
+    pthread_mutex_lock(&compress_lock);
+    (*counter)++;
+    pthread_mutex_unlock(&compress_lock);
+}
+
+// =========================================================
+// [新增] 编码器注册表 (见 storage.h codec_t)
+// =========================================================
+// 块用哪个编码器压的记在 L3 索引条目里 (l3_extent_t.codec)，解压时按它选，不再"先按 LZ4 解、失败当原文"猜。
+// level 的含义跟着编码器走：LZ4 是加速倍数 (越大越快、压得越差)，LZ4HC / zstd 是压缩级别 (越大压得越小)
+
+static int lz4_compress(const char *in, int len, char *out, int cap, int level) {
+    return LZ4_compress_fast(in, out, len, cap, level);
+}
+
+static int lz4hc_compress(const char *in, int len, char *out, int cap, int level) {
+    return LZ4_compress_HC(in, out, len, cap, level);
+}
+
+static int lz4_decompress(const char *in, int len, char *out, int cap) {
+    return LZ4_decompress_safe(in, out, len, cap);
+}
+
+static int none_decompress(const char *in, int len, char *out, int cap) {
+    if (len > cap) return -1;
+    memcpy(out, in, len);
+    return len;
+}
+
+// 旧索引没记压没压缩：先按 LZ4 解，失败说明存的是原文
+static int legacy_decompress(const char *in, int len, char *out, int cap) {
+    int d_size = LZ4_decompress_safe(in, out, len, cap);
+    return d_size >= 0 ? d_size : none_decompress(in, len, out, cap);
+}
+
+#ifdef SMARTFS_HAVE_ZSTD
+static int zstd_compress(const char *in, int len, char *out, int cap, int level) {
+    size_t n = ZSTD_compress(out, (size_t)cap, in, (size_t)len, level);
+    return ZSTD_isError(n) ? -1 : (int)n;
+}
+
+static int zstd_decompress(const char *in, int len, char *out, int cap) {
+    size_t n = ZSTD_decompress(out, (size_t)cap, in, (size_t)len);
+    return ZSTD_isError(n) ? -1 : (int)n;
 }
+#endif
 
-// 智能跳过检测
-int is_already_compressed(const char *data, int len) {
-    if (len < 4) return 0; 
-    unsigned char *bytes = (unsigned char *)data;
-    if (bytes[0] == 0xFF && bytes[1] == 0xD8 && bytes[2] == 0xFF) return 1;
-    if (bytes[0] == 0x89 && bytes[1] == 0x50 && bytes[2] == 0x4E && bytes[3] == 0x47) return 1;
-    if (bytes[0] == 0x50 && bytes[1] == 0x4B && bytes[2] == 0x03 && bytes[3] == 0x04) return 1;
-    if (bytes[0] == 0x1F && bytes[1] == 0x8B) return 1;
-    return 0; 
+static const codec_t codecs[] = {
+    { CODEC_NONE,   "none",   0, 0,  0, 0, NULL,           none_decompress },
+    { CODEC_LZ4,    "lz4",    1, 65537, 1, 5, lz4_compress, lz4_decompress },
+    { CODEC_LZ4HC,  "lz4hc",  1, LZ4HC_CLEVEL_MAX, LZ4HC_CLEVEL_DEFAULT, 1, lz4hc_compress, lz4_decompress },
+#ifdef SMARTFS_HAVE_ZSTD
+    { CODEC_ZSTD,   "zstd",   1, 22, 3, 1, zstd_compress,  zstd_decompress },
+#endif
+    { CODEC_LEGACY, "legacy", 0, 0,  0, 0, NULL,           legacy_decompress },
+};
+
+const codec_t *codec_get(int id) {
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        if (codecs[i].id == id) return &codecs[i];
+    }
+    return NULL;
+}
+
+// "lz4" / "lz4hc:12" / "zstd:19" / "none"；没写级别的 *level = 0 (用默认级别)
+int codec_parse(const char *spec, int *codec, int *level) {
+    char name[16];
+    int lvl = 0;
+    const char *colon = strchr(spec, ':');
+    size_t n = colon ? (size_t)(colon - spec) : strlen(spec);
+    if (n == 0 || n >= sizeof(name)) return -1;
+    memcpy(name, spec, n);
+    name[n] = '\0';
+    if (colon) {
+        char *end;
+        long v = strtol(colon + 1, &end, 10);
+        if (end == colon + 1 || *end != '\0') return -1;
+        lvl = (int)v;
+    }
+    for (size_t i = 0; i < sizeof(codecs) / sizeof(codecs[0]); i++) {
+        const codec_t *c = &codecs[i];
+        if (strcmp(c->name, name) != 0 || (!c->compress && c->id != CODEC_NONE)) continue;
+        if (colon && (c->id == CODEC_NONE || lvl < c->min_level || lvl > c->max_level)) return -1;
+        *codec = c->id;
+        *level = lvl;
+        return 0;
+    }
+    return -1;
+}
+
+int codec_format(int codec, int level, char *buf, size_t size) {
+    const codec_t *c = codec_get(codec);
+    if (!c) return -1;
+    return level > 0 ? snprintf(buf, size, "%s:%d", c->name, level) : snprintf(buf, size, "%s", c->name);
+}
+
+int compress_set_default(int codec, int level) {
+    const codec_t *c = codec_get(codec);
+    if (!c || (!c->compress && codec != CODEC_NONE)) return -1;
+    pthread_mutex_lock(&compress_lock);
+    default_codec = codec;
+    default_level = level;
+    pthread_mutex_unlock(&compress_lock);
+    return 0;
+}
+
+// 按文件的策略 (codec == CODEC_DEFAULT 就删掉，回到文件系统默认)
+void compress_set_file_policy(long inode_id, int codec, int level) {
+    policy_node_t **pp = &policies[((unsigned long)inode_id * 2654435761u) % POLICY_BUCKETS];
+    pthread_mutex_lock(&compress_lock);
+    while (*pp && (*pp)->inode_id != inode_id) pp = &(*pp)->next;
+    policy_node_t *p = *pp;
+    if (codec == CODEC_DEFAULT) {
+        if (p) {
+            *pp = p->next;
+            free(p);
+        }
+    } else {
+        if (!p && (p = calloc(1, sizeof(*p))) != NULL) {
+            p->inode_id = inode_id;
+            *pp = p;
+        }
+        if (p) {
+            p->codec = codec;
+            p->level = level;
+        }
+    }
+    pthread_mutex_unlock(&compress_lock);
+}
+
+// [新增] 文件删掉了：策略和压不动的记录都清掉，Inode 号分给新文件时从头来
+void compress_forget_file(long inode_id) {
+    compress_set_file_policy(inode_id, CODEC_DEFAULT, 0);
+    pthread_mutex_lock(&compress_lock);
+    skip_slot_t *s = skip_slot(inode_id);
+    if (s->inode_id == inode_id) memset(s, 0, sizeof(*s));
+    pthread_mutex_unlock(&compress_lock);
+}
+
+static void policy_get(long inode_id, int *codec, int *level) {
+    pthread_mutex_lock(&compress_lock);
+    *codec = default_codec;
+    *level = default_level;
+    for (policy_node_t *p = policies[((unsigned long)inode_id * 2654435761u) % POLICY_BUCKETS]; p; p = p->next) {
+        if (p->inode_id == inode_id) {
+            *codec = p->codec;
+            *level = p->level;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&compress_lock);
 }
 
 // 智能压缩
-int smart_compress(const char *input, int input_len, char *output) {
-    if (is_already_compressed(input, input_len)) {
-        printf("[Compress] ⏩ Smart Skip: Detected compressed data, skipping.\n");
+// [修改] output 至少 input_len 字节 (压不小就存原文)；CDC 的数据块可能比 4KB 大，输出上限按输入长度算
+// [修改] *codec 返回实际用的编码器 (存原文是 CODEC_NONE)，写 L3 时要一起记下
+int smart_compress(const char *input, int input_len, char *output, int *codec) {
+    return smart_compress_file(0, input, input_len, output, codec, NULL);
+}
+
+static int store_raw(long inode_id, const char *input, int input_len, char *output, int *codec) {
+    inode_record(inode_id, 1);
+    memcpy(output, input, input_len);
+    *codec = CODEC_NONE;
+    return input_len;
+}
+
+// [新增] 带 Inode 号：按文件记住压不动的文件，后面的块直接跳过
+// [修改] 按这个文件的策略 (没有就用文件系统默认) 选编码器和级别
+// [修改] 小块先试训练好的字典 (见 dict.c)
+int smart_compress_file(long inode_id, const char *input, int input_len, char *output, int *codec, int *dict_id) {
+    int id, level;
+    if (dict_id) *dict_id = 0;
+    policy_get(inode_id, &id, &level);
+    const codec_t *c = codec_get(id);
+    if (!c || !c->compress) {
+        count(&compress_stats.policy_raw);
+        memcpy(output, input, input_len);
+        *codec = CODEC_NONE;
+        return input_len;
+    }
+    if (inode_skip(inode_id)) {
         memcpy(output, input, input_len);
-        return input_len; 
+        *codec = CODEC_NONE;
+        return input_len;
+    }
+    if (estimate_incompressible(input, input_len)) {
+        printf("[Compress] ⏩ Smart Skip: high-entropy data, skipping.\n");
+        count(&compress_stats.estimator_skips);
+        return store_raw(inode_id, input, input_len, output, codec);
     }
 
-    double load = get_system_load();
-    int c_size;
+    // lz4 / zstd 策略的小块：抽样给字典训练，已经有字典就用 zstd + 字典 (lz4hc 是特意选的，不换)
+    if (dict_id && input_len <= DICT_BLOCK_MAX && (c->id == CODEC_LZ4 || c->id == CODEC_ZSTD)) {
+        dict_sample(input, input_len);
+        int d_size = dict_compress(input, input_len, output, input_len, c->id == CODEC_ZSTD ? level : 0, dict_id);
+        if (d_size > 0) {
+            printf("[Compress] ✅ Compressed with dictionary v%d: %d -> %d bytes\n", *dict_id, input_len, d_size);
+            count(&compress_stats.compressed);
+            inode_record(inode_id, 0);
+            *codec = CODEC_ZSTD;
+            return d_size;
+        }
+    }
 
+    double load = get_system_load();
+    if (level <= 0) level = c->default_level;
     if (load > 2.0) {
+        // 高负载时换成编码器的快速级别 (LZ4 是加速倍数，越大越快)
         printf("[Compress] 🔥 High Load (%.2f)! Switching to FAST mode.\n", load);
-        c_size = LZ4_compress_fast(input, output, input_len, BLOCK_SIZE, 5);
-    } else {
-        c_size = LZ4_compress_default(input, output, input_len, BLOCK_SIZE);
+        count(&compress_stats.fast_mode);
+        if (c->id == CODEC_LZ4 ? level < c->fast_level : level > c->fast_level) level = c->fast_level;
     }
+    int c_size = c->compress(input, input_len, output, input_len, level);
 
     if (c_size <= 0 || c_size >= input_len) {
         printf("[Compress] ⚠️ Compression inefficient (Load: %.2f), storing raw data.\n", load);
-        memcpy(output, input, input_len);
-        return input_len;
+        count(&compress_stats.raw);
+        return store_raw(inode_id, input, input_len, output, codec);
     }
 
-    printf("[Compress] ✅ Compressed (Load: %.2f): %d -> %d bytes\n", load, input_len, c_size);
+    printf("[Compress] ✅ Compressed with %s:%d (Load: %.2f): %d -> %d bytes\n", c->name, level, load, input_len, c_size);
+    pthread_mutex_lock(&compress_lock);
+    compress_stats.compressed++;
+    compress_stats.codec_blocks[c->id]++;
+    compress_stats.codec_in[c->id] += input_len;
+    compress_stats.codec_out[c->id] += c_size;
+    pthread_mutex_unlock(&compress_lock);
+    inode_record(inode_id, 0);
+    *codec = c->id;
     return c_size;
 }
 
 // 智能解压
-int smart_decompress(const char *input, int input_len, char *output, int max_output_len) {
-    int d_size = LZ4_decompress_safe(input, output, input_len, max_output_len);
-    if (d_size < 0) {
-        // 如果解压失败，可能原本就没压缩（Smart Skip 的数据），直接拷贝
-        memcpy(output, input, input_len);
-        return input_len;
+// [修改] 按块记着的编码器解压，失败 (数据坏了、编码器这个构建不支持) 返回 -1
+// [修改] 用字典压的块 (dict_id > 0) 按版本找字典
+int smart_decompress(int codec, int dict_id, const char *input, int input_len, char *output, int max_output_len) {
+    if (dict_id > 0) {
+        if (codec != CODEC_ZSTD) return -1;
+        return dict_decompress(dict_id, input, input_len, output, max_output_len);
     }
-    return d_size;
-}
\ No newline at end of file
+    const codec_t *c = codec_get(codec);
+    if (!c) {
+        printf("[Compress] ❌ Codec %d is not supported by this build.\n", codec);
+        return -1;
+    }
+    int d_size = c->decompress(input, input_len, output, max_output_len);
+    return d_size < 0 ? -1 : d_size;
+}
+
+void compress_report() {
+    pthread_mutex_lock(&compress_lock);
+    CompressStats s = compress_stats;
+    int codec = default_codec, level = default_level;
+    pthread_mutex_unlock(&compress_lock);
+    char def[32];
+    codec_format(codec, level, def, sizeof(def));
+    printf("[Compress] default %s: %lu compressed, %lu stored raw after compression, %lu skipped by estimator, "
+           "%lu skipped for incompressible files, %lu stored raw by policy, %lu in fast mode\n",
+           def, s.compressed, s.raw, s.estimator_skips, s.inode_skips, s.policy_raw, s.fast_mode);
+    for (int i = 0; i < CODEC_MAX; i++) {
+        const codec_t *c = codec_get(i);
+        if (!c || s.codec_blocks[i] == 0) continue;
+        printf("[Compress]   %-6s %lu blocks, %lu -> %lu bytes (%.1f%%)\n", c->name, s.codec_blocks[i],
+               s.codec_in[i], s.codec_out[i], s.codec_out[i] * 100.0 / s.codec_in[i]);
+    }
+}
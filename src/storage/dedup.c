@@ -1,31 +1,142 @@
 #include "storage.h"
+#include "smartfs_types.h"
 #include <stdio.h>
 #include <string.h>
-#include <openssl/sha.h> 
+#include <pthread.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#ifdef SMARTFS_HAVE_BLAKE3
+#include <blake3.h>
+#endif
 
-// 核心算法：输入任意数据，输出它的唯一指纹
-void calculate_sha256(const char *input, size_t len, char *output) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
+// =========================================================
+// [新增] 指纹算法 (见 storage.h fp_engine_t)
+// =========================================================
+// 指纹算法是镜像格式化时定的 (super_block_t.fp_algo)，指纹库里的摘要都是它算的，挂载后不能换。
+//   sha256:  OpenSSL EVP 一次性接口，CPU 有 SHA-NI 时 OpenSSL 自动用；
+//            一批块一起算时，没有 SHA-NI 就用多缓冲实现 (sha256_mb.c)，8 个块一起算
+//   blake2b: OpenSSL 自带的 BLAKE2b-512 取前 32 字节，64 位机器上纯软件比 SHA-256 快
+//   blake3:  编译时找到 libblake3 才有 (SIMD 由库自己选)
+
+static const EVP_MD *md_sha256 = NULL;
+static const EVP_MD *md_blake2b = NULL;
+static int have_sha_ni = 0;
+static pthread_once_t md_once = PTHREAD_ONCE_INIT;
+
+// 每次 EVP_sha256() 都要在 OpenSSL 3 里查一遍算法实现，启动时取一次就够了
+static void md_init() {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    md_sha256 = EVP_MD_fetch(NULL, "SHA256", NULL);
+    md_blake2b = EVP_MD_fetch(NULL, "BLAKE2B-512", NULL);
+#endif
+    if (!md_sha256) md_sha256 = EVP_sha256();
+    if (!md_blake2b) md_blake2b = EVP_blake2b512();
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int a, b, c, d;
+    if (__get_cpuid_count(7, 0, &a, &b, &c, &d)) have_sha_ni = (b >> 29) & 1;
+#endif
+}
+
+static void sha256_one(const char *input, size_t len, unsigned char *digest) {
+    EVP_Digest(input, len, digest, NULL, md_sha256, NULL);
+}
+
+// SHA-NI 单个算比多缓冲还快；没有 SHA-NI 时凑够 4 个以上才值得走多缓冲
+static void sha256_many(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]) {
+    int i = 0;
+    if (!have_sha_ni) {
+        for (; n - i >= 4; i += SHA256_MB_LANES) {
+            int k = n - i < SHA256_MB_LANES ? n - i : SHA256_MB_LANES;
+            sha256_mb(inputs + i, lens + i, k, digests + i);
+        }
+    }
+    for (; i < n; i++) sha256_one(inputs[i], lens[i], digests[i]);
+}
+
+static void blake2b_one(const char *input, size_t len, unsigned char *digest) {
+    unsigned char full[64];
+    EVP_Digest(input, len, full, NULL, md_blake2b, NULL);
+    memcpy(digest, full, FP_DIGEST_LEN);
+}
+
+static void blake2b_many(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]) {
+    for (int i = 0; i < n; i++) blake2b_one(inputs[i], lens[i], digests[i]);
+}
+
+#ifdef SMARTFS_HAVE_BLAKE3
+static void blake3_one(const char *input, size_t len, unsigned char *digest) {
+    blake3_hasher h;
+    blake3_hasher_init(&h);
+    blake3_hasher_update(&h, input, len);
+    blake3_hasher_finalize(&h, digest, FP_DIGEST_LEN);
+}
 
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, input, len);
-    SHA256_Final(hash, &sha256);
+static void blake3_many(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]) {
+    for (int i = 0; i < n; i++) blake3_one(inputs[i], lens[i], digests[i]);
+}
+#endif
+
+static const fp_engine_t engines[] = {
+    { SMARTFS_FP_SHA256, "sha256", sha256_one, sha256_many },
+    { SMARTFS_FP_BLAKE2B, "blake2b", blake2b_one, blake2b_many },
+#ifdef SMARTFS_HAVE_BLAKE3
+    { SMARTFS_FP_BLAKE3, "blake3", blake3_one, blake3_many },
+#endif
+};
 
-    for(int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        sprintf(output + (i * 2), "%02x", hash[i]);
+static const fp_engine_t *current = &engines[0];
+
+const fp_engine_t *fp_engine_get(int id) {
+    pthread_once(&md_once, md_init);
+    for (size_t i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+        if (engines[i].id == id) return &engines[i];
     }
-    output[64] = 0; 
+    return NULL;
+}
+
+int fp_engine_select(int id) {
+    const fp_engine_t *e = fp_engine_get(id);
+    if (!e) return -1;
+    current = e;
+    printf("[Dedup] Fingerprint: %s%s\n", e->name,
+           (id == SMARTFS_FP_SHA256) ? (have_sha_ni ? " (SHA-NI)" : " (multi-buffer batches)") : "");
+    return 0;
+}
+
+const fp_engine_t *fp_engine_current() {
+    pthread_once(&md_once, md_init);
+    return current;
+}
+
+void calculate_fingerprint(const char *input, size_t len, unsigned char *digest) {
+    fp_engine_current()->hash(input, len, digest);
+}
+
+void calculate_fingerprints(const char *const *inputs, const size_t *lens, int n, unsigned char (*digests)[FP_DIGEST_LEN]) {
+    fp_engine_current()->hash_many(inputs, lens, n, digests);
+}
+
+// 核心算法：输入任意数据，输出它的唯一指纹
+// [修改] 直接输出 32 字节摘要 (指纹索引按原始字节比较)，写入路径上不再做十六进制编码
+// [修改] 固定算 SHA-256；写入路径用 calculate_fingerprint (按镜像选定的算法)
+void calculate_sha256(const char *input, size_t len, unsigned char *digest) {
+    pthread_once(&md_once, md_init);
+    sha256_one(input, len, digest);
 }
 
 /*int main() {
     // 测试一下功能
     const char *data = "SmartFS Storage Engine Test";
-    char result[65];
+    unsigned char result[FP_DIGEST_LEN];
 
     calculate_sha256(data, strlen(data), result);
 
     printf("原始数据: %s\n", data);
-    printf("数据指纹: %s\n", result);
+    printf("数据指纹: ");
+    for (int i = 0; i < FP_DIGEST_LEN; i++) printf("%02x", result[i]);
+    printf("\n");
     return 0;
-}*/
\ No newline at end of file
+}*/
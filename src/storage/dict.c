@@ -0,0 +1,340 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "storage.h"
+#ifdef SMARTFS_HAVE_ZSTD
+#include <zstd.h>
+#include <zdict.h>
+#endif
+
+// =========================================================
+// [新增] 小块的 zstd 字典压缩
+// =========================================================
+// 几百字节的 JSON / 配置文件单独压，LZ4 / zstd 都找不到多少重复；拿同一棵目录树里别的小文件
+// 训练出的字典当"前文"，同样的速度能压小很多。
+//   - 写入路径把不超过 DICT_BLOCK_MAX 的块抽样拷进样本缓冲 (dict_sample)；
+//   - 样本够了、离上次训练超过 DICT_RETRAIN_SEC，后台线程用 ZDICT 训练一版新字典；
+//   - 新字典先追加进 DICT_FILE 并 fsync，然后才给压缩用：块在 L3 索引里记着字典号，
+//     读的时候按号找字典，所以字典只追加、不删除 (最多 DICT_MAX_VERSIONS 版，到了就不再训练)。
+// 字典按文件系统训练 (所有目录共用最新一版)。没有 libzstd 的构建里这些接口都是空的，块照常压缩。
+
+#define DICT_FILE "/tmp/smartfs.dict"
+#define DICT_MAGIC 0x53444943u              // "SDIC"
+#define DICT_SIZE (16 * 1024)               // 每版字典的大小
+#define DICT_SAMPLE_BYTES (2L << 20)        // 样本缓冲 (ZDICT 建议样本总量是字典的 100 倍左右)
+#define DICT_SAMPLE_MAX 8192                // 样本个数上限
+#define DICT_TRAIN_MIN (256L * 1024)        // 样本少于这么多不训练
+#define DICT_RETRAIN_SEC 600                // 两次训练至少隔这么久
+#define DICT_MAX_VERSIONS 64
+#define DICT_LEVEL 3                        // 用字典压缩时的默认级别
+#define DICT_CTX_POOL 16                    // 压缩 / 解压上下文池 (建一个上下文要分配几百 KB)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t id;
+    uint32_t len;
+    uint32_t check;         // 字典内容的校验值，崩溃时没写完的记录对不上
+} dict_record_t;
+
+typedef struct {
+    unsigned long versions;         // 现有的字典版数
+    unsigned long trained;          // 这次挂载训练出的版数
+    unsigned long train_failures;   // 样本不合适，ZDICT 训练失败
+    unsigned long samples;          // 抽进样本缓冲的块
+    unsigned long blocks;           // 用字典压小了的块
+    unsigned long bytes_in;
+    unsigned long bytes_out;
+} dict_stats_t;
+
+static pthread_mutex_t dict_lock = PTHREAD_MUTEX_INITIALIZER;
+static dict_stats_t dict_stats;
+
+#ifdef SMARTFS_HAVE_ZSTD
+
+typedef struct {
+    void *data;
+    size_t len;
+    ZSTD_CDict *cdict;      // 按 DICT_LEVEL 预处理好的字典，多个线程共用
+    ZSTD_DDict *ddict;
+} dict_t;
+
+static pthread_cond_t dict_wake = PTHREAD_COND_INITIALIZER;    // 样本够了 / 卸载
+static pthread_cond_t dict_done = PTHREAD_COND_INITIALIZER;    // 一次训练结束
+static int dict_fd = -1;
+static off_t dict_end = 0;
+static dict_t dicts[DICT_MAX_VERSIONS + 1];     // 按字典号 (从 1 开始)，卸载前不释放
+static int latest = 0;                          // 最新一版的字典号，0 = 还没有
+static char *samples = NULL;
+static size_t sample_sizes[DICT_SAMPLE_MAX];
+static size_t sample_bytes = 0;
+static unsigned sample_count = 0;
+static time_t last_train = 0;
+static int training = 0;
+static int stopping = 0;
+static pthread_t trainer;
+static int trainer_running = 0;
+static ZSTD_CCtx *cctx_pool[DICT_CTX_POOL];
+static ZSTD_DCtx *dctx_pool[DICT_CTX_POOL];
+static int ncctx = 0, ndctx = 0;
+
+static uint32_t dict_check(const void *data, size_t len) {
+    // FNV-1a，只用来识别没写完的记录
+    const unsigned char *p = data;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+// 调用者持有 dict_lock。字典交给 dicts[id] (之后归它管)
+static int dict_install(uint32_t id, void *data, size_t len) {
+    ZSTD_CDict *c = ZSTD_createCDict(data, len, DICT_LEVEL);
+    ZSTD_DDict *d = ZSTD_createDDict(data, len);
+    if (!c || !d) {
+        ZSTD_freeCDict(c);
+        ZSTD_freeDDict(d);
+        return -1;
+    }
+    dicts[id].data = data;
+    dicts[id].len = len;
+    dicts[id].cdict = c;
+    dicts[id].ddict = d;
+    if ((int)id > latest) latest = (int)id;
+    dict_stats.versions++;
+    return 0;
+}
+
+static int trainable_locked() {
+    return latest < DICT_MAX_VERSIONS && sample_bytes >= DICT_TRAIN_MIN &&
+           time(NULL) - last_train >= DICT_RETRAIN_SEC;
+}
+
+// 调用者持有 dict_lock，训练期间放开：样本缓冲换出来 (训练期间写入路径接着往新缓冲里抽样)，
+// 训练好追加进字典文件再启用。返回新字典号，失败返回 -1
+static int train_locked() {
+    char *buf = samples;
+    size_t *sizes = malloc(sample_count * sizeof(size_t));
+    char *fresh = malloc(DICT_SAMPLE_BYTES);
+    last_train = time(NULL);
+    if (!sizes || !fresh) {
+        free(sizes);
+        free(fresh);
+        return -1;
+    }
+    unsigned n = sample_count;
+    memcpy(sizes, sample_sizes, n * sizeof(size_t));
+    samples = fresh;
+    sample_bytes = 0;
+    sample_count = 0;
+    training = 1;
+    uint32_t id = (uint32_t)latest + 1;
+    pthread_mutex_unlock(&dict_lock);
+
+    void *dict = malloc(DICT_SIZE);
+    size_t len = dict ? ZDICT_trainFromBuffer(dict, DICT_SIZE, buf, sizes, n) : 0;
+    int ok = dict && !ZDICT_isError(len) && len > 0;
+    if (ok) {
+        // 先落盘再启用：L3 里记着这个字典号的块，重新挂载后一定找得到字典
+        dict_record_t r = { DICT_MAGIC, id, (uint32_t)len, dict_check(dict, len) };
+        ok = pwrite(dict_fd, &r, sizeof(r), dict_end) == sizeof(r) &&
+             pwrite(dict_fd, dict, len, dict_end + (off_t)sizeof(r)) == (ssize_t)len && fsync(dict_fd) == 0;
+    }
+    free(buf);
+    free(sizes);
+
+    pthread_mutex_lock(&dict_lock);
+    training = 0;
+    pthread_cond_broadcast(&dict_done);
+    if (ok && dict_install(id, dict, len) == 0) {
+        dict_end += (off_t)(sizeof(dict_record_t) + len);
+        dict_stats.trained++;
+        printf("[Dict] Trained dictionary v%u from %u samples (%zu bytes)\n", id, n, len);
+        return (int)id;
+    }
+    dict_stats.train_failures++;
+    free(dict);
+    return -1;
+}
+
+static void *train_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&dict_lock);
+    for (;;) {
+        while (!stopping && (training || !samples || !trainable_locked())) pthread_cond_wait(&dict_wake, &dict_lock);
+        if (stopping) break;
+        train_locked();
+    }
+    pthread_mutex_unlock(&dict_lock);
+    return NULL;
+}
+
+// 挂载：读入所有版本的字典，启动后台训练线程
+int dict_open() {
+    pthread_mutex_lock(&dict_lock);
+    memset(&dict_stats, 0, sizeof(dict_stats));
+    dict_fd = open(DICT_FILE, O_RDWR | O_CREAT, 0644);
+    if (dict_fd < 0) {
+        printf("[Dict] Cannot open %s: %s\n", DICT_FILE, strerror(errno));
+        pthread_mutex_unlock(&dict_lock);
+        return -1;
+    }
+    off_t pos = 0;
+    dict_record_t r;
+    while (pread(dict_fd, &r, sizeof(r), pos) == sizeof(r) && r.magic == DICT_MAGIC &&
+           r.id == (uint32_t)latest + 1 && r.id <= DICT_MAX_VERSIONS && r.len > 0 && r.len <= DICT_SIZE) {
+        void *data = malloc(r.len);
+        if (!data || pread(dict_fd, data, r.len, pos + (off_t)sizeof(r)) != (ssize_t)r.len ||
+            dict_check(data, r.len) != r.check || dict_install(r.id, data, r.len) != 0) {
+            free(data);
+            break;
+        }
+        pos += (off_t)(sizeof(r) + r.len);
+    }
+    // 崩溃时追加了一半的字典：截掉 (它还没启用过，没有块用它)
+    struct stat st;
+    if (fstat(dict_fd, &st) == 0 && st.st_size > pos && ftruncate(dict_fd, pos) != 0) {
+        printf("[Dict] Cannot trim torn dictionary tail\n");
+    }
+    dict_end = pos;
+    samples = malloc(DICT_SAMPLE_BYTES);
+    sample_bytes = 0;
+    sample_count = 0;
+    last_train = 0;
+    stopping = 0;
+    trainer_running = (pthread_create(&trainer, NULL, train_worker, NULL) == 0);
+    printf("[Dict] %s: %d dictionaries\n", DICT_FILE, latest);
+    pthread_mutex_unlock(&dict_lock);
+    return 0;
+}
+
+void dict_close() {
+    pthread_mutex_lock(&dict_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&dict_wake);
+    int running = trainer_running;
+    trainer_running = 0;
+    pthread_mutex_unlock(&dict_lock);
+    if (running) pthread_join(trainer, NULL);
+
+    pthread_mutex_lock(&dict_lock);
+    for (int i = 1; i <= latest; i++) {
+        ZSTD_freeCDict(dicts[i].cdict);
+        ZSTD_freeDDict(dicts[i].ddict);
+        free(dicts[i].data);
+    }
+    memset(dicts, 0, sizeof(dicts));
+    latest = 0;
+    for (int i = 0; i < ncctx; i++) ZSTD_freeCCtx(cctx_pool[i]);
+    for (int i = 0; i < ndctx; i++) ZSTD_freeDCtx(dctx_pool[i]);
+    ncctx = ndctx = 0;
+    free(samples);
+    samples = NULL;
+    if (dict_fd >= 0) close(dict_fd);
+    dict_fd = -1;
+    pthread_mutex_unlock(&dict_lock);
+}
+
+// 小块抽进样本缓冲 (满了就不再收，等下一次训练换新缓冲)
+void dict_sample(const char *data, int len) {
+    if (len <= 0 || len > DICT_BLOCK_MAX) return;
+    pthread_mutex_lock(&dict_lock);
+    if (samples && latest < DICT_MAX_VERSIONS && sample_count < DICT_SAMPLE_MAX &&
+        sample_bytes + (size_t)len <= DICT_SAMPLE_BYTES) {
+        memcpy(samples + sample_bytes, data, len);
+        sample_sizes[sample_count++] = (size_t)len;
+        sample_bytes += (size_t)len;
+        dict_stats.samples++;
+        if (!training && trainable_locked()) pthread_cond_signal(&dict_wake);
+    }
+    pthread_mutex_unlock(&dict_lock);
+}
+
+// 用最新一版字典压缩：level <= 0 用预处理好的 DICT_LEVEL，否则按 level 现算。
+// 还没有字典、压不进 cap 返回 <= 0；成功时 *dict_id 是用的字典号
+int dict_compress(const char *input, int input_len, char *output, int cap, int level, int *dict_id) {
+    pthread_mutex_lock(&dict_lock);
+    int id = latest;
+    ZSTD_CCtx *cctx = (id > 0 && ncctx > 0) ? cctx_pool[--ncctx] : NULL;
+    pthread_mutex_unlock(&dict_lock);
+    if (id == 0) return 0;
+    if (!cctx && !(cctx = ZSTD_createCCtx())) return -1;
+
+    size_t n = (level <= 0 || level == DICT_LEVEL)
+        ? ZSTD_compress_usingCDict(cctx, output, (size_t)cap, input, (size_t)input_len, dicts[id].cdict)
+        : ZSTD_compress_usingDict(cctx, output, (size_t)cap, input, (size_t)input_len,
+                                  dicts[id].data, dicts[id].len, level);
+
+    pthread_mutex_lock(&dict_lock);
+    if (ncctx < DICT_CTX_POOL) cctx_pool[ncctx++] = cctx;
+    else ZSTD_freeCCtx(cctx);
+    int ok = !ZSTD_isError(n) && n > 0 && (int)n < input_len;
+    if (ok) {
+        dict_stats.blocks++;
+        dict_stats.bytes_in += input_len;
+        dict_stats.bytes_out += n;
+    }
+    pthread_mutex_unlock(&dict_lock);
+    if (!ok) return 0;
+    *dict_id = id;
+    return (int)n;
+}
+
+int dict_decompress(int dict_id, const char *input, int input_len, char *output, int cap) {
+    pthread_mutex_lock(&dict_lock);
+    int known = dict_id > 0 && dict_id <= latest;
+    ZSTD_DCtx *dctx = (known && ndctx > 0) ? dctx_pool[--ndctx] : NULL;
+    pthread_mutex_unlock(&dict_lock);
+    if (!known) {
+        printf("[Dict] ❌ Dictionary v%d not found\n", dict_id);
+        return -1;
+    }
+    if (!dctx && !(dctx = ZSTD_createDCtx())) return -1;
+
+    size_t n = ZSTD_decompress_usingDDict(dctx, output, (size_t)cap, input, (size_t)input_len, dicts[dict_id].ddict);
+
+    pthread_mutex_lock(&dict_lock);
+    if (ndctx < DICT_CTX_POOL) dctx_pool[ndctx++] = dctx;
+    else ZSTD_freeDCtx(dctx);
+    pthread_mutex_unlock(&dict_lock);
+    return ZSTD_isError(n) ? -1 : (int)n;
+}
+
+// 测试和基准用：不等样本攒够、不管训练间隔，马上用现有样本训练一版 (同步)，返回新字典号
+int dict_train_now() {
+    pthread_mutex_lock(&dict_lock);
+    while (training) pthread_cond_wait(&dict_done, &dict_lock);
+    int id = (samples && sample_count > 0 && latest < DICT_MAX_VERSIONS) ? train_locked() : -1;
+    pthread_mutex_unlock(&dict_lock);
+    return id;
+}
+
+#else   // 没有 libzstd：不训练，块照常压缩
+
+int dict_open() { return 0; }
+void dict_close() {}
+void dict_sample(const char *data, int len) { (void) data; (void) len; }
+int dict_compress(const char *input, int input_len, char *output, int cap, int level, int *dict_id) {
+    return 0;
+}
+int dict_decompress(int dict_id, const char *input, int input_len, char *output, int cap) {
+    printf("[Dict] ❌ Block uses dictionary v%d, but this build has no zstd\n", dict_id);
+    return -1;
+}
+int dict_train_now() { return -1; }
+
+#endif
+
+void dict_report() {
+    pthread_mutex_lock(&dict_lock);
+    dict_stats_t s = dict_stats;
+    pthread_mutex_unlock(&dict_lock);
+    if (s.versions == 0 && s.samples == 0) return;
+    printf("[Dict] %lu dictionaries (%lu trained, %lu failed), %lu samples; %lu small blocks %lu -> %lu bytes\n",
+           s.versions, s.trained, s.train_failures, s.samples, s.blocks, s.bytes_in, s.bytes_out);
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "storage.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// =========================================================
+// 指纹索引：SHA-256 摘要 (32 字节原始值) -> 块号
+// =========================================================
+// 开放寻址哈希表，布局和 SwissTable 一样：槽位 16 个一组，每个槽位另有 1 字节控制字节
+// (空 / 哈希值的低 7 位)。查找时一组 16 个控制字节一次比较 (SSE2 一条指令)，
+// 只有控制字节对上的槽位才去比 32 字节的摘要，绝大多数情况下一次就能定位。
+// SHA-256 本身就是均匀分布的，直接拿摘要的前 8 字节当哈希值。
+//
+// 装满 7/8 时扩容成两倍，但不一次搬完：旧表保留下来，之后每次插入顺手搬 FP_MIGRATE_GROUPS 组，
+// 查找时新表没有再查旧表。几亿条指纹的表扩容时也不会让某一次写入卡住。
+//
+// 不加锁，调用者负责互斥 (fp_store.c 持有 fp_lock)。
+
+#define FP_GROUP 16
+#define FP_CTRL_EMPTY 0x80          // 最高位为 1 = 空槽；满的槽位存哈希低 7 位 (最高位为 0)
+#define FP_INITIAL_CAPACITY 1024
+#define FP_MIGRATE_GROUPS 2
+
+typedef struct {
+    unsigned char digest[FP_DIGEST_LEN];
+    int block_id;
+} fp_slot_t;
+
+typedef struct {
+    uint8_t *ctrl;          // cap 字节，16 字节对齐
+    fp_slot_t *slots;
+    size_t cap;             // 槽位数，2 的幂且至少一组
+    size_t used;
+} fp_table_t;
+
+static fp_table_t cur;      // 新条目都插在这里
+static fp_table_t old;      // 扩容期间还没搬完的旧表 (cap == 0 表示没有)
+static size_t migrate_group = 0;
+static unsigned long fp_resizes = 0;
+static unsigned long fp_entries = 0;
+
+static uint64_t fp_hash(const unsigned char *digest) {
+    uint64_t h;
+    memcpy(&h, digest, sizeof(h));
+    return h;
+}
+
+// 组内控制字节等于 tag 的槽位掩码 (第 i 位 = 第 i 个槽位)
+static uint32_t group_match(const uint8_t *ctrl, uint8_t tag) {
+#if defined(__SSE2__)
+    __m128i g = _mm_load_si128((const __m128i *)ctrl);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8((char)tag)));
+#else
+    uint32_t mask = 0;
+    for (int i = 0; i < FP_GROUP; i++) mask |= (uint32_t)(ctrl[i] == tag) << i;
+    return mask;
+#endif
+}
+
+static int table_alloc(fp_table_t *t, size_t cap) {
+    void *ctrl = NULL;
+    if (posix_memalign(&ctrl, 16, cap) != 0) return -1;
+    t->slots = malloc(cap * sizeof(fp_slot_t));
+    if (!t->slots) {
+        free(ctrl);
+        return -1;
+    }
+    memset(ctrl, FP_CTRL_EMPTY, cap);
+    t->ctrl = ctrl;
+    t->cap = cap;
+    t->used = 0;
+    return 0;
+}
+
+static void table_free(fp_table_t *t) {
+    free(t->ctrl);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+// 探测序列：从 hash 决定的组开始，按 1, 2, 3... 组的步长跳 (三角数，组数是 2 的幂时能走遍所有组)
+static fp_slot_t *table_slot(const fp_table_t *t, const unsigned char *digest, uint64_t h) {
+    if (t->cap == 0) return NULL;
+    size_t mask = t->cap / FP_GROUP - 1;
+    size_t g = (h >> 7) & mask;
+    uint8_t tag = h & 0x7f;
+    for (size_t step = 1; step <= mask + 1; step++) {
+        const uint8_t *ctrl = t->ctrl + g * FP_GROUP;
+        uint32_t m = group_match(ctrl, tag);
+        while (m) {
+            int i = __builtin_ctz(m);
+            fp_slot_t *s = &t->slots[g * FP_GROUP + i];
+            if (memcmp(s->digest, digest, FP_DIGEST_LEN) == 0) return s;
+            m &= m - 1;
+        }
+        // 组里还有空槽说明插入时没走到后面，后面不会有
+        if (group_match(ctrl, FP_CTRL_EMPTY)) return NULL;
+        g = (g + step) & mask;
+    }
+    return NULL;
+}
+
+static int table_find(const fp_table_t *t, const unsigned char *digest, uint64_t h) {
+    const fp_slot_t *s = table_slot(t, digest, h);
+    return s ? s->block_id : -1;
+}
+
+// 调用者保证表没满、digest 不在表里
+static void table_put(fp_table_t *t, const unsigned char *digest, uint64_t h, int block_id) {
+    size_t mask = t->cap / FP_GROUP - 1;
+    size_t g = (h >> 7) & mask;
+    for (size_t step = 1;; step++) {
+        uint32_t m = group_match(t->ctrl + g * FP_GROUP, FP_CTRL_EMPTY);
+        if (m) {
+            size_t idx = g * FP_GROUP + __builtin_ctz(m);
+            t->ctrl[idx] = h & 0x7f;
+            memcpy(t->slots[idx].digest, digest, FP_DIGEST_LEN);
+            t->slots[idx].block_id = block_id;
+            t->used++;
+            return;
+        }
+        g = (g + step) & mask;
+    }
+}
+
+// 把旧表的 n 组搬进新表，搬完释放旧表
+static void migrate(size_t n) {
+    size_t groups = old.cap / FP_GROUP;
+    while (old.cap && n-- > 0) {
+        const uint8_t *ctrl = old.ctrl + migrate_group * FP_GROUP;
+        for (int i = 0; i < FP_GROUP; i++) {
+            if (ctrl[i] & FP_CTRL_EMPTY) continue;
+            const fp_slot_t *s = &old.slots[migrate_group * FP_GROUP + i];
+            table_put(&cur, s->digest, fp_hash(s->digest), s->block_id);
+        }
+        if (++migrate_group == groups) {
+            table_free(&old);
+            migrate_group = 0;
+        }
+    }
+}
+
+// 查找摘要对应的块号，没有返回 -1
+int fp_index_lookup(const unsigned char *digest) {
+    uint64_t h = fp_hash(digest);
+    int block_id = table_find(&cur, digest, h);
+    if (block_id < 0) block_id = table_find(&old, digest, h);
+    return block_id;
+}
+
+// 登记摘要 -> 块号。内存不够扩容又装不下时返回 -1，只是少去重
+// [修改] 摘要已经在表里就改成新块号：旧块没有引用了 (等着垃圾回收)，同样的内容又存了一份新的
+int fp_index_insert(const unsigned char *digest, int block_id) {
+    uint64_t h = fp_hash(digest);
+    fp_slot_t *s = table_slot(&cur, digest, h);
+    if (!s) s = table_slot(&old, digest, h);
+    if (s) {
+        s->block_id = block_id;
+        return 0;
+    }
+    if (cur.cap == 0 && table_alloc(&cur, FP_INITIAL_CAPACITY) != 0) return -1;
+
+    if ((cur.used + 1) * 8 > cur.cap * 7) {
+        // 上一次扩容还没搬完 (几乎不会发生：新表装满之前早就搬完了)，先一次搬完
+        if (old.cap) migrate(old.cap / FP_GROUP);
+        fp_table_t next;
+        if (table_alloc(&next, cur.cap * 2) == 0) {
+            old = cur;
+            cur = next;
+            migrate_group = 0;
+            fp_resizes++;
+        } else if (cur.used + 1 >= cur.cap) {
+            return -1;
+        }
+    }
+
+    migrate(FP_MIGRATE_GROUPS);
+    table_put(&cur, digest, h, block_id);
+    fp_entries++;
+    return 0;
+}
+
+// 遍历所有条目 (扩容期间新旧两张表里还没搬走的部分都算)
+void fp_index_foreach(void (*fn)(const unsigned char *digest, int block_id, void *arg), void *arg) {
+    const fp_table_t *tables[2] = { &cur, &old };
+    for (int t = 0; t < 2; t++) {
+        size_t from = (t == 1) ? migrate_group * FP_GROUP : 0;
+        for (size_t i = from; i < tables[t]->cap; i++) {
+            if (!(tables[t]->ctrl[i] & FP_CTRL_EMPTY)) fn(tables[t]->slots[i].digest, tables[t]->slots[i].block_id, arg);
+        }
+    }
+}
+
+void fp_index_clear() {
+    table_free(&cur);
+    table_free(&old);
+    migrate_group = 0;
+    fp_entries = 0;
+}
+
+unsigned long fp_index_count() {
+    return fp_entries;
+}
+
+void fp_index_report() {
+    printf("[FpIndex] Fingerprints: %lu, capacity: %lu slots, resizes: %lu%s\n",
+           fp_entries, (unsigned long)cur.cap, fp_resizes, old.cap ? " (migrating)" : "");
+}
@@ -0,0 +1,403 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "storage.h"
+#include "smartfs_types.h"
+
+// =========================================================
+// 持久化指纹库：日志 + 内存哈希表 + Bloom 过滤器
+// =========================================================
+// 每登记一个新块，就往 FP_LOG_FILE 追加一条 (摘要, 块号) 记录；内存里的 fp_index 只是它的索引。
+// 挂载时不等日志读完：后台线程分批把日志灌进 fp_index，写入路径马上可以用。
+// 查找先问 Bloom 过滤器，“肯定没有”直接返回 —— 新数据 (绝大多数写入) 不用等加载；
+// 只有过滤器说“可能有”、而表还没加载完时才等下一批。
+// 过滤器在正常卸载时存成 FP_BLOOM_FILE，记下它覆盖到日志的哪个位置；
+// 日志只追加，所以这份存档一直有效，下次挂载只补上它之后的记录。
+// 没有存档 (第一次挂载或上次崩溃前从没正常卸载过) 时过滤器跟着后台加载一起建，建好之前查找都要等。
+//
+// 指纹库只是优化：记录丢了只是少去重一次，不会读错数据。
+// 记录在块数据和 L3 索引写完之后才追加，日志里的块号一定能读。
+//
+// [新增] 日志第一条是头记录 (块号 0，摘要位置放 FP_LOG_MAGIC + 指纹算法号)。
+// 日志放在镜像外面，挂载一个换了指纹算法的镜像时，旧摘要一条也对不上，只能清空重来；
+// 没有头的日志是加头之前写的，那时只有 SHA-256。
+
+#define FP_LOG_FILE   "/tmp/smartfs.fp"
+#define FP_BLOOM_FILE "/tmp/smartfs.bloom"
+#define FP_BLOOM_MAGIC 0x534d4246u          // "SMBF"
+#define FP_BLOOM_K 8                         // 每个摘要置 8 位
+#define FP_BLOOM_BITS_PER_KEY 12             // 误判率约 0.3%
+#define FP_BLOOM_MIN_BITS (1ULL << 23)       // 1MB
+#define FP_LOAD_BATCH 4096                   // 后台加载每批记录数 (每批拿一次 fp_lock)
+#define FP_LOG_MAGIC "SMARTFS-FPLOG"
+
+typedef struct {
+    unsigned char digest[FP_DIGEST_LEN];
+    int32_t block_id;
+    uint32_t check;         // 摘要和块号的校验值，崩溃时没写完的记录对不上
+} fp_record_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t k;
+    uint64_t nbits;
+    uint64_t nkeys;
+    uint64_t log_len;       // 过滤器包含了日志 [0, log_len) 里的所有记录
+} fp_bloom_header_t;
+
+typedef struct {
+    unsigned long bloom_negative;   // 过滤器直接否定的查找
+    unsigned long bloom_false_pos;  // 过滤器说可能有、表里却没有
+    unsigned long load_waits;       // 查找等后台加载的次数
+    unsigned long loaded;           // 从日志加载的记录数
+    unsigned long skipped;          // 校验不过 (崩溃留下的) 记录
+} fp_store_stats_t;
+
+static pthread_mutex_t fp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fp_cond = PTHREAD_COND_INITIALIZER;   // 每加载完一批广播一次
+static int log_fd = -1;
+static off_t log_end = 0;           // 下一条记录追加的位置
+static off_t load_end = 0;          // 挂载时的日志长度，后台线程加载到这里为止
+static off_t log_start = 0;         // 第一条数据记录的位置 (头记录之后；旧日志没有头)
+static uint64_t *bloom = NULL;
+static uint64_t bloom_bits = 0;     // 2 的幂
+static uint64_t bloom_keys = 0;
+static int bloom_ready = 0;         // 过滤器已经包含日志里所有记录 (否则它的否定不可信)
+static int loaded = 1;              // fp_index 已经包含日志里所有记录 (没打开过日志时就是空的)
+static int stopping = 0;
+static pthread_t loader;
+static int loader_running = 0;
+static fp_store_stats_t fp_stats;
+
+static uint32_t record_check(const fp_record_t *r) {
+    // FNV-1a，只用来识别没写完的记录
+    uint32_t h = 2166136261u;
+    const unsigned char *p = (const unsigned char *)r;
+    for (size_t i = 0; i < offsetof(fp_record_t, check); i++) h = (h ^ p[i]) * 16777619u;
+    return h ? h : 1;
+}
+
+// 头记录：块号 0 的记录在加载时本来就会跳过
+static void header_record(fp_record_t *r, int algo) {
+    uint32_t id = (uint32_t)algo;
+    memset(r, 0, sizeof(*r));
+    memcpy(r->digest, FP_LOG_MAGIC, sizeof(FP_LOG_MAGIC));
+    memcpy(r->digest + sizeof(FP_LOG_MAGIC), &id, sizeof(id));
+    r->check = record_check(r);
+}
+
+// 日志是哪个算法写的：有头看头，没头的是旧日志 (SHA-256)
+static int log_algo(off_t *data_start) {
+    fp_record_t r;
+    *data_start = 0;
+    if (pread(log_fd, &r, sizeof(r), 0) != sizeof(r) || r.check != record_check(&r) || r.block_id != 0 ||
+        memcmp(r.digest, FP_LOG_MAGIC, sizeof(FP_LOG_MAGIC)) != 0) {
+        return SMARTFS_FP_SHA256;
+    }
+    uint32_t id;
+    memcpy(&id, r.digest + sizeof(FP_LOG_MAGIC), sizeof(id));
+    *data_start = sizeof(r);
+    return (int)id;
+}
+
+// 摘要均匀分布 (SHA-256 / BLAKE2b 都是)：第 0 个 64 位字给 fp_index 用，这里用第 1、2 个字做双重哈希
+static void bloom_pos(const unsigned char *digest, uint64_t *h1, uint64_t *h2) {
+    memcpy(h1, digest + 8, sizeof(*h1));
+    memcpy(h2, digest + 16, sizeof(*h2));
+    *h2 |= 1;
+}
+
+static void bloom_add(const unsigned char *digest) {
+    uint64_t h1, h2;
+    bloom_pos(digest, &h1, &h2);
+    for (int i = 0; i < FP_BLOOM_K; i++) {
+        uint64_t b = (h1 + i * h2) & (bloom_bits - 1);
+        bloom[b / 64] |= 1ULL << (b % 64);
+    }
+    bloom_keys++;
+}
+
+static int bloom_test(const unsigned char *digest) {
+    uint64_t h1, h2;
+    bloom_pos(digest, &h1, &h2);
+    for (int i = 0; i < FP_BLOOM_K; i++) {
+        uint64_t b = (h1 + i * h2) & (bloom_bits - 1);
+        if (!(bloom[b / 64] & (1ULL << (b % 64)))) return 0;
+    }
+    return 1;
+}
+
+static uint64_t bloom_size_for(uint64_t keys) {
+    uint64_t bits = FP_BLOOM_MIN_BITS;
+    while (bits < keys * FP_BLOOM_BITS_PER_KEY * 2) bits *= 2;
+    return bits;
+}
+
+static int bloom_alloc(uint64_t nbits) {
+    uint64_t *b = calloc(nbits / 64, sizeof(uint64_t));
+    if (!b) return -1;
+    free(bloom);
+    bloom = b;
+    bloom_bits = nbits;
+    bloom_keys = 0;
+    return 0;
+}
+
+static void bloom_add_cb(const unsigned char *digest, int block_id, void *arg) {
+    (void) block_id;
+    (void) arg;
+    bloom_add(digest);
+}
+
+// 条目多到误判率明显变高时，用 fp_index 里的全部摘要重建一个大一倍的过滤器 (调用者持有 fp_lock)
+// 只在加载完之后做；容量每次翻倍，分摊下来每次插入 O(1)
+static void bloom_maybe_grow() {
+    if (!loaded || bloom_keys * FP_BLOOM_BITS_PER_KEY <= bloom_bits) return;
+    uint64_t *saved = bloom;
+    uint64_t saved_bits = bloom_bits, saved_keys = bloom_keys;
+    bloom = NULL;
+    if (bloom_alloc(bloom_size_for(fp_index_count())) != 0) {
+        bloom = saved;
+        bloom_bits = saved_bits;
+        bloom_keys = saved_keys;
+        return;
+    }
+    free(saved);
+    fp_index_foreach(bloom_add_cb, NULL);
+    printf("[FpStore] Bloom filter grown to %lu bits\n", (unsigned long)bloom_bits);
+}
+
+// 读过滤器存档：有效就返回它覆盖到的日志位置，否则返回 -1
+static off_t bloom_load() {
+    int fd = open(FP_BLOOM_FILE, O_RDONLY);
+    if (fd < 0) return -1;
+    fp_bloom_header_t hdr;
+    off_t covered = -1;
+    if (pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.magic == FP_BLOOM_MAGIC &&
+        hdr.k == FP_BLOOM_K && hdr.nbits >= 64 && (hdr.nbits & (hdr.nbits - 1)) == 0 &&
+        (off_t)hdr.log_len <= log_end && bloom_alloc(hdr.nbits) == 0) {
+        size_t len = hdr.nbits / 8;
+        if (pread(fd, bloom, len, sizeof(hdr)) == (ssize_t)len) {
+            bloom_keys = hdr.nkeys;
+            covered = (off_t)hdr.log_len;
+        }
+    }
+    close(fd);
+    return covered;
+}
+
+static void bloom_save() {
+    char tmp[sizeof(FP_BLOOM_FILE) + 4];
+    snprintf(tmp, sizeof(tmp), "%s.new", FP_BLOOM_FILE);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return;
+    fp_bloom_header_t hdr = { FP_BLOOM_MAGIC, FP_BLOOM_K, bloom_bits, bloom_keys, (uint64_t)log_end };
+    size_t len = bloom_bits / 8;
+    int ok = pwrite(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+             pwrite(fd, bloom, len, sizeof(hdr)) == (ssize_t)len && fsync(fd) == 0;
+    close(fd);
+    // 写完整了才替换旧存档
+    if (ok) rename(tmp, FP_BLOOM_FILE);
+    else unlink(tmp);
+}
+
+// 后台加载：按顺序读挂载时的日志 [0, load_end)，每批拿一次锁灌进 fp_index (过滤器没存档时也灌进过滤器)
+static void *load_worker(void *arg) {
+    (void) arg;
+    fp_record_t *batch = malloc(FP_LOAD_BATCH * sizeof(fp_record_t));
+    off_t pos = log_start;
+    int stop = 0;
+    while (batch && !stop && pos < load_end) {
+        size_t want = FP_LOAD_BATCH * sizeof(fp_record_t);
+        if ((off_t)want > load_end - pos) want = (size_t)(load_end - pos);
+        ssize_t got = pread(log_fd, batch, want, pos);
+        if (got <= 0) break;
+        int n = (int)(got / sizeof(fp_record_t));
+
+        pthread_mutex_lock(&fp_lock);
+        for (int i = 0; i < n; i++) {
+            const fp_record_t *r = &batch[i];
+            if (r->check != record_check(r) || r->block_id <= 0) {
+                fp_stats.skipped++;
+                continue;
+            }
+            if (!bloom_ready) bloom_add(r->digest);
+            // [修改] 同一个摘要登记过几次时留块号最大 (最新) 的那条：旧的块可能已经没有引用、被回收了
+            if (fp_index_lookup(r->digest) < r->block_id) fp_index_insert(r->digest, r->block_id);
+            fp_stats.loaded++;
+        }
+        stop = stopping;
+        pthread_cond_broadcast(&fp_cond);
+        pthread_mutex_unlock(&fp_lock);
+        pos += (off_t)n * sizeof(fp_record_t);
+    }
+    free(batch);
+
+    // 读盘失败或者卸载时没加载完：表和过滤器都不完整，只能当成“查不到”，不能存档
+    pthread_mutex_lock(&fp_lock);
+    loaded = 1;
+    if (pos >= load_end) {
+        bloom_ready = 1;
+        bloom_maybe_grow();
+    }
+    pthread_cond_broadcast(&fp_cond);
+    pthread_mutex_unlock(&fp_lock);
+    printf("[FpStore] Fingerprint log loaded: %lu records (%lu skipped)\n", fp_stats.loaded, fp_stats.skipped);
+    return NULL;
+}
+
+// 挂载：打开日志，读过滤器存档并补上存档之后的记录，然后在后台加载 fp_index
+int fp_store_open() {
+    pthread_mutex_lock(&fp_lock);
+    log_fd = open(FP_LOG_FILE, O_RDWR | O_CREAT, 0644);
+    if (log_fd < 0) {
+        printf("[FpStore] Cannot open %s: %s\n", FP_LOG_FILE, strerror(errno));
+        pthread_mutex_unlock(&fp_lock);
+        return -1;
+    }
+    struct stat st;
+    log_end = (fstat(log_fd, &st) == 0) ? st.st_size : 0;
+    // 崩溃时追加了一半的尾记录：截掉，之后的记录接着整条对齐写
+    if (log_end % sizeof(fp_record_t) != 0) {
+        log_end -= log_end % sizeof(fp_record_t);
+        if (ftruncate(log_fd, log_end) != 0) printf("[FpStore] Cannot trim torn log tail\n");
+    }
+
+    // 算法和镜像对不上：旧记录全部作废，过滤器存档也是按旧记录建的
+    int algo = fp_engine_current()->id;
+    int old_algo = log_end > 0 ? log_algo(&log_start) : algo;
+    if (old_algo != algo) {
+        printf("[FpStore] Log was written with fingerprint algorithm %d, image uses %d: starting a new log\n",
+               old_algo, algo);
+        if (ftruncate(log_fd, 0) != 0) printf("[FpStore] Cannot reset log\n");
+        unlink(FP_BLOOM_FILE);
+        log_end = 0;
+    }
+    if (log_end == 0) {
+        fp_record_t hdr;
+        header_record(&hdr, algo);
+        if (pwrite(log_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr)) log_end = sizeof(hdr);
+        log_start = log_end;
+    }
+    load_end = log_end;
+    loaded = (log_end <= log_start);
+    stopping = 0;
+    memset(&fp_stats, 0, sizeof(fp_stats));
+
+    off_t covered = bloom_load();
+    if (covered >= 0) {
+        // 存档之后 (没有正常卸载) 追加的记录补进过滤器：只读这一小段
+        fp_record_t r;
+        for (off_t pos = covered; pos < log_end; pos += sizeof(r)) {
+            if (pread(log_fd, &r, sizeof(r), pos) != sizeof(r)) break;
+            if (r.check == record_check(&r) && r.block_id > 0) bloom_add(r.digest);
+        }
+        bloom_ready = 1;
+    } else {
+        bloom_ready = (bloom_alloc(bloom_size_for(log_end / sizeof(fp_record_t))) == 0 && log_end <= log_start);
+        if (!bloom) {
+            pthread_mutex_unlock(&fp_lock);
+            return -1;
+        }
+    }
+
+    if (!loaded) loader_running = (pthread_create(&loader, NULL, load_worker, NULL) == 0);
+    if (!loaded && !loader_running) {
+        pthread_mutex_unlock(&fp_lock);
+        load_worker(NULL);
+        pthread_mutex_lock(&fp_lock);
+    }
+    printf("[FpStore] Log %s: %lu records (%s), bloom %s\n", FP_LOG_FILE,
+           (unsigned long)((log_end - log_start) / sizeof(fp_record_t)), fp_engine_current()->name,
+           covered >= 0 ? "restored" : "rebuilding");
+    pthread_mutex_unlock(&fp_lock);
+    return 0;
+}
+
+// 卸载：停掉后台加载，全部加载完的话把过滤器存档
+void fp_store_close() {
+    pthread_mutex_lock(&fp_lock);
+    stopping = 1;
+    int running = loader_running;
+    loader_running = 0;
+    pthread_mutex_unlock(&fp_lock);
+    if (running) pthread_join(loader, NULL);
+
+    pthread_mutex_lock(&fp_lock);
+    if (log_fd >= 0) {
+        fsync(log_fd);
+        if (bloom_ready) bloom_save();
+        close(log_fd);
+        log_fd = -1;
+    }
+    fp_index_clear();
+    free(bloom);
+    bloom = NULL;
+    bloom_bits = bloom_keys = 0;
+    bloom_ready = 0;
+    loaded = 1;
+    pthread_mutex_unlock(&fp_lock);
+}
+
+// 查找摘要对应的块号，没有返回 -1
+int fp_store_lookup(const unsigned char *digest) {
+    int block_id = -1;
+    pthread_mutex_lock(&fp_lock);
+    for (;;) {
+        if (bloom_ready && !bloom_test(digest)) {
+            fp_stats.bloom_negative++;
+            break;
+        }
+        block_id = fp_index_lookup(digest);
+        if (block_id >= 0) break;
+        if (loaded) {
+            fp_stats.bloom_false_pos++;
+            break;
+        }
+        // 可能在还没加载到的那部分日志里：等下一批
+        fp_stats.load_waits++;
+        pthread_cond_wait(&fp_cond, &fp_lock);
+    }
+    pthread_mutex_unlock(&fp_lock);
+    return block_id;
+}
+
+// 登记新块的摘要 (块数据和 L3 索引已经写完)
+void fp_store_add(const unsigned char *digest, int block_id) {
+    fp_record_t r;
+    memcpy(r.digest, digest, FP_DIGEST_LEN);
+    r.block_id = block_id;
+    r.check = record_check(&r);
+
+    pthread_mutex_lock(&fp_lock);
+    if (bloom) bloom_add(digest);
+    fp_index_insert(digest, block_id);
+    bloom_maybe_grow();
+    off_t pos = log_end;
+    if (log_fd >= 0) log_end += sizeof(r);
+    int fd = log_fd;
+    pthread_mutex_unlock(&fp_lock);
+
+    // 各线程写各自预留的位置；没写成只是下次挂载少这一条
+    if (fd >= 0 && pwrite(fd, &r, sizeof(r), pos) != (ssize_t)sizeof(r)) {
+        printf("[FpStore] Failed to append fingerprint for Block #%d\n", block_id);
+    }
+}
+
+void fp_store_report() {
+    pthread_mutex_lock(&fp_lock);
+    fp_store_stats_t s = fp_stats;
+    int done = loaded;
+    uint64_t nbits = bloom_bits;
+    fp_index_report();
+    pthread_mutex_unlock(&fp_lock);
+    printf("[FpStore] Bloom: %lu bits, negatives %lu, false positives %lu; load %s (%lu records, %lu waits)\n",
+           (unsigned long)nbits, s.bloom_negative, s.bloom_false_pos,
+           done ? "done" : "in progress", s.loaded, s.load_waits);
+}
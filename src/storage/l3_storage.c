@@ -1,11 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "storage.h"  // 确保能找到这个头文件
 
 #define L3_DATA_FILE "/tmp/smartfs.data"
 #define L3_IDX_FILE  "/tmp/smartfs.idx"
+#define L3_IDX_GC_FILE "/tmp/smartfs.idx.gc"
+#define L3_ARCHIVE_FILE "/tmp/smartfs.archive"   // [新增] 归档段：冷块用强编码器重新压缩后放这里
+#define L3_IDX_MAGIC 0x4c334758     // 索引第 0 项 (块号 0 不用) 的 valid 字段："L3GX"，offset 字段是数据文件的代数
+                                    // [新增] length 字段是归档段的代数
 
 // [新增] 全局变量：保存从 main 传来的磁盘 fd
 static int main_disk_fd = -1;
@@ -19,86 +29,713 @@ void storage_attach_disk(int fd) {
 }
 
 // 索引条目结构
+// [修改] flags / raw_len 放在原来的对齐填充里，条目还是 24 字节；旧索引里这两个字段是 0 (不知道是否压缩)
 typedef struct {
     int valid;      // 1=有效
+    int flags;      // L3_FLAG_RAW: 存的是原文 (Smart Skip 或压缩没收益)；[新增] 8~15 位是编码器，16~31 位是字典版本
     long offset;    // 数据在 .data 文件中的起始位置
     int length;     // 数据长度 (压缩后的)
+    int raw_len;    // 解压后的长度
 } IndexEntry;
 
-// 辅助：获取或创建索引条目
-void update_index(int block_id, long offset, int length) {
-    FILE *f = fopen(L3_IDX_FILE, "rb+");
-    if (!f) f = fopen(L3_IDX_FILE, "wb+"); // 不存在则创建
-    
-    if (!f) {
-        printf("[L3 ERROR] 无法打开索引文件 %s: %s\n", L3_IDX_FILE, strerror(errno));
-        return;
+#define L3_FLAG_RAW 1
+#define L3_FLAG_RECIPE 2    // [新增] 分片清单 (见 smart_write_cdc)
+// [新增] 压缩块用的编码器 (CODEC_*)。加这个字段之前写的压缩块这里是 0，都是 LZ4 压的
+#define L3_CODEC_SHIFT 8
+#define L3_CODEC_MASK 0xff00
+#define L3_DICT_SHIFT 16     // [新增] 用字典压的块：字典版本 (0 = 没用字典)
+#define L3_FLAG_ARCHIVE 4    // [新增] 数据在归档段里 (见 l3_archive)
+
+// [新增] 数据文件和索引文件只打开一次，之后所有线程都用 pread/pwrite 按偏移读写，
+// 没有共享的文件位置。只有"分配追加位置"这一步需要加锁。
+// [修改] 垃圾回收会换一对新文件：读写前在锁里拿一对 (索引, 数据) fd，之后一直用这一对
+static int data_fd = -1;
+static int idx_fd = -1;
+static off_t data_tail = 0;     // 数据文件下一次追加的位置
+static uint32_t data_gen = 0;   // [新增] 数据文件的代数 (每回收一次加 1)，0 就是 L3_DATA_FILE
+static pthread_mutex_t l3_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t l3_cond = PTHREAD_COND_INITIALIZER;   // 追加全部写完 / 换文件结束
+static int appends = 0;         // 预留了位置、还没写完索引的追加
+static int swapping = 0;        // 垃圾回收正在换文件，新的追加先等着
+// [新增] 归档段只追加，平时垃圾回收换文件时里面的记录原样留着
+// [修改] 死掉的字节多了也换一代 (和数据文件一起，见 l3_gc_run)
+static int archive_fd = -1;
+static off_t archive_tail = 0;
+static uint32_t archive_gen = 0;    // 0 就是 L3_ARCHIVE_FILE
+// [新增] 归档会原地改已有的索引条目：读条目和改条目互斥，读者不会拿到写了一半的条目
+static pthread_rwlock_t entry_rw = PTHREAD_RWLOCK_INITIALIZER;
+
+static void data_path(uint32_t gen, char *buf, size_t size) {
+    if (gen == 0) snprintf(buf, size, "%s", L3_DATA_FILE);
+    else snprintf(buf, size, "%s.%u", L3_DATA_FILE, gen);
+}
+
+static void archive_path(uint32_t gen, char *buf, size_t size) {
+    if (gen == 0) snprintf(buf, size, "%s", L3_ARCHIVE_FILE);
+    else snprintf(buf, size, "%s.%u", L3_ARCHIVE_FILE, gen);
+}
+
+// 调用者持有 l3_lock
+// [修改] 先开索引：第 0 项记着现在用的是第几代数据文件 (没回收过的旧索引这一项是 0)
+static int l3_open_locked() {
+    if (data_fd >= 0 && idx_fd >= 0) return 0;
+    if (idx_fd < 0) {
+        idx_fd = open(L3_IDX_FILE, O_RDWR | O_CREAT, 0644); // 不存在则创建
+        if (idx_fd < 0) {
+            printf("[L3 ERROR] 无法打开索引文件 %s: %s\n", L3_IDX_FILE, strerror(errno));
+            return -1;
+        }
+        IndexEntry hdr;
+        if (pread(idx_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.valid == L3_IDX_MAGIC) {
+            data_gen = (uint32_t)hdr.offset;
+            archive_gen = (uint32_t)hdr.length;
+        }
     }
+    if (data_fd < 0) {
+        char path[64];
+        data_path(data_gen, path, sizeof(path));
+        printf("[L3 DEBUG] 正在尝试打开文件: %s ...\n", path);
+        data_fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (data_fd < 0) {
+            printf("[L3 ERROR] 打开数据文件失败 %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        struct stat st;
+        data_tail = (fstat(data_fd, &st) == 0) ? st.st_size : 0;
+    }
+    if (archive_fd < 0) {
+        char path[64];
+        archive_path(archive_gen, path, sizeof(path));
+        archive_fd = open(path, O_RDWR | O_CREAT, 0644);
+        if (archive_fd < 0) {
+            printf("[L3 ERROR] 打开归档段失败 %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        struct stat st;
+        archive_tail = (fstat(archive_fd, &st) == 0) ? st.st_size : 0;
+    }
+    return 0;
+}
 
+// 拿一对当前的 (索引, 数据) fd
+// [修改] 还有归档段的 fd (可以为 NULL)
+static int l3_open(int *ifd, int *dfd, int *afd) {
+    pthread_mutex_lock(&l3_lock);
+    int ret = l3_open_locked();
+    if (ifd) *ifd = idx_fd;
+    if (dfd) *dfd = data_fd;
+    if (afd) *afd = archive_fd;
+    pthread_mutex_unlock(&l3_lock);
+    return ret;
+}
+
+// 辅助：写入第 block_id 个索引条目
+static int update_index(int fd, int block_id, long offset, int length, int raw_len, int flags) {
     IndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
     entry.valid = 1;
+    entry.flags = flags;
     entry.offset = offset;
     entry.length = length;
+    entry.raw_len = raw_len;
 
-    // 定位到第 block_id 个位置
-    fseek(f, block_id * sizeof(IndexEntry), SEEK_SET);
-    fwrite(&entry, sizeof(IndexEntry), 1, f);
-    fclose(f);
+    off_t pos = (off_t)block_id * sizeof(IndexEntry);
+    if (pwrite(fd, &entry, sizeof(IndexEntry), pos) != sizeof(IndexEntry)) {
+        printf("[L3 ERROR] 写索引失败 (Block #%d): %s\n", block_id, strerror(errno));
+        return -1;
+    }
+    return 0;
 }
 
+static void gc_note_append(int block_id);
+static unsigned long l3_ops = 0;    // 前台读写次数 (垃圾回收看它决定要不要让路)，原子操作
+
 // === L3 写接口 ===
-int l3_write(int block_id, const char *data, int len) {
-    // 1. 打开数据文件 (追加模式)
-    printf("[L3 DEBUG] 正在尝试打开文件: %s 进行写入...\n", L3_DATA_FILE);
-    FILE *f_data = fopen(L3_DATA_FILE, "ab"); 
-    if (!f_data)
-    {
-        printf("[L3 ERROR] 打开数据文件失败 %s: %s\n", L3_DATA_FILE, strerror(errno));
+static int l3_append(int block_id, const char *data, int len, int raw_len, int flags) {
+    __atomic_add_fetch(&l3_ops, 1, __ATOMIC_RELAXED);
+    // 1. 打开文件并预留追加位置
+    pthread_mutex_lock(&l3_lock);
+    while (swapping) pthread_cond_wait(&l3_cond, &l3_lock);
+    if (l3_open_locked() != 0) {
+        pthread_mutex_unlock(&l3_lock);
         return -1;
-    } 
+    }
+    off_t offset = data_tail;
+    data_tail += len;
+    int dfd = data_fd, ifd = idx_fd;
+    appends++;
+    pthread_mutex_unlock(&l3_lock);
 
-    // 2. 获取当前写入位置
-    fseek(f_data, 0, SEEK_END);
-    long offset = ftell(f_data);
+    // 2. 写入压缩数据 (不持锁，各线程写各自预留的区间)
+    int ret = 0;
+    if (pwrite(dfd, data, len, offset) != len) {
+        printf("[L3 ERROR] 写数据失败 (Block #%d): %s\n", block_id, strerror(errno));
+        ret = -1;
+    }
 
-    // 3. 写入压缩数据
-    fwrite(data, 1, len, f_data);
-    fclose(f_data);
+    // 3. 数据写完再更新索引，读者看到索引时数据一定已经在文件里
+    if (ret == 0 && update_index(ifd, block_id, offset, len, raw_len, flags) != 0) ret = -1;
 
-    // 4. 更新索引
-    update_index(block_id, offset, len);
-    
-    printf("[L3] 💾 Persisted Block #%d to Disk (Offset: %ld, Len: %d)\n", block_id, offset, len);
+    pthread_mutex_lock(&l3_lock);
+    if (ret == 0) gc_note_append(block_id);
+    if (--appends == 0) pthread_cond_broadcast(&l3_cond);
+    pthread_mutex_unlock(&l3_lock);
+    if (ret != 0) return -1;
+
+    printf("[L3] 💾 Persisted Block #%d to Disk (Offset: %ld, Len: %d)\n", block_id, (long)offset, len);
     return 0;
 }
 
-// === L3 读接口 ===
-int l3_read(int block_id, char *buffer, int max_len) {
-    // 1. 查索引
-    FILE *f_idx = fopen(L3_IDX_FILE, "rb");
-    if (!f_idx) return -1;
+// [修改] raw_len 是原文长度，和 len 相等说明存的就是原文 (压缩结果不会和原文一样长)
+// [修改] 压缩块记下编码器，读的时候按它解压
+int l3_write(int block_id, const char *data, int len, int raw_len, int codec, int dict_id) {
+    if (codec == CODEC_NONE || len == raw_len) return l3_append(block_id, data, len, raw_len, L3_FLAG_RAW);
+    return l3_append(block_id, data, len, raw_len,
+                     ((codec << L3_CODEC_SHIFT) & L3_CODEC_MASK) | (int)((unsigned)dict_id << L3_DICT_SHIFT));
+}
+
+int l3_write_recipe(int block_id, const char *data, int len) {
+    return l3_append(block_id, data, len, len, L3_FLAG_RECIPE);
+}
+
+// [新增] 查索引：块在数据文件里的位置、长度、是否压缩。
+// 数据文件只追加不覆盖，拿到的位置之后一直有效，调用者可以不持锁直接 pread / splice
+// [修改] 垃圾回收换掉的旧文件会再开一段时间 (见 retire_fd)，拿到的 fd 和位置照样能读
+int l3_locate(int block_id, l3_extent_t *ext) {
+    int ifd, dfd, afd;
+    if (l3_open(&ifd, &dfd, &afd) != 0) return -1;
+    __atomic_add_fetch(&l3_ops, 1, __ATOMIC_RELAXED);
 
     IndexEntry entry;
-    fseek(f_idx, block_id * sizeof(IndexEntry), SEEK_SET);
-    if (fread(&entry, sizeof(IndexEntry), 1, f_idx) < 1 || !entry.valid) {
+    off_t pos = (off_t)block_id * sizeof(IndexEntry);
+    pthread_rwlock_rdlock(&entry_rw);
+    ssize_t got = pread(ifd, &entry, sizeof(IndexEntry), pos);
+    pthread_rwlock_unlock(&entry_rw);
+    if (got != sizeof(IndexEntry) || entry.valid != 1) {
         printf("[L3] ❌ Block #%d not found in Index.\n", block_id);
-        fclose(f_idx);
         return -1;
     }
-    fclose(f_idx);
+    ext->archived = (entry.flags & L3_FLAG_ARCHIVE) != 0;
+    ext->fd = ext->archived ? afd : dfd;
+    ext->offset = entry.offset;
+    ext->length = entry.length;
+    ext->raw_len = entry.raw_len;
+    ext->raw = (entry.flags & L3_FLAG_RAW) != 0;
+    ext->recipe = (entry.flags & L3_FLAG_RECIPE) != 0;
+    // [新增] 编码器：没记的压缩块是 LZ4；连 raw_len 都没有的旧索引不知道压没压缩，只能猜
+    ext->codec = (entry.flags & L3_CODEC_MASK) >> L3_CODEC_SHIFT;
+    ext->dict_id = (int)((unsigned)entry.flags >> L3_DICT_SHIFT);
+    if (ext->raw || ext->recipe) ext->codec = CODEC_NONE;
+    else if (ext->codec == 0) ext->codec = (entry.raw_len > 0) ? CODEC_LZ4 : CODEC_LEGACY;
+    return 0;
+}
 
-    // 2. 读数据
-    FILE *f_data = fopen(L3_DATA_FILE, "rb");
-    if (!f_data) return -1;
+// [新增] 索引文件按块号定位条目，文件长度就说明了用过的最大块号。
+// 条目在块数据写完后才写，崩溃时分配了号却没写索引的块没人引用，重用它也没关系
+int l3_next_block_id() {
+    int ifd;
+    if (l3_open(&ifd, NULL, NULL) != 0) return -1;
+    struct stat st;
+    if (fstat(ifd, &st) != 0) return -1;
+    long next = st.st_size / (long)sizeof(IndexEntry);
+    return next < 1 ? 1 : (int)next;
+}
 
-    fseek(f_data, entry.offset, SEEK_SET);
-    
+// === L3 读接口 ===
+int l3_read(int block_id, char *buffer, int max_len) {
+    // 1. 查索引
+    l3_extent_t entry;
+    if (l3_locate(block_id, &entry) != 0) return -1;
+
+    // 2. 读数据
     int read_len = entry.length;
     if (read_len > max_len) read_len = max_len; // 防止溢出
     
-    fread(buffer, 1, read_len, f_data);
-    fclose(f_data);
+    if (pread(entry.fd, buffer, read_len, entry.offset) != read_len) {
+        printf("[L3] ❌ Block #%d 数据读取不完整.\n", block_id);
+        return -1;
+    }
 
     printf("[L3] 💿 Loaded Block #%d from Disk (Size: %d)\n", block_id, read_len);
     return read_len;
-}
\ No newline at end of file
+}
+
+// =========================================================
+// [新增] 垃圾回收：压缩数据文件
+// =========================================================
+// 数据文件只追加，块的最后一个引用没了 (l3_release) 它占的地方就成了空洞。
+// 死掉的字节超过 L3_GC_MIN_DEAD、并且占到文件的 L3_GC_DEAD_PCT% 时，后台线程把活着的记录
+// 依次拷进下一代数据文件，同时写一份新索引，最后 rename 新索引，一步切换过去：
+//   - 拷贝期间照常追加 (写到旧文件)，写完的块号记进 gc_log；
+//   - 换文件时短暂挡住新的追加，等在写的追加写完，只补拷 gc_log 里的记录，然后 rename、换 fd；
+//   - 读者在换文件之前拿到的 (旧 fd, 旧位置) 还要能读：旧 fd 不马上关，退役 L3_GC_RETIRE_SEC 秒后才关。
+// 新索引第 0 项记着新数据文件的代数，崩溃时要么还是旧的一对文件，要么已经是新的一对。
+// 提交之前先让 main.c 把元数据落盘 (sync_metadata)，崩溃后重建引用计数时看到的就是回收时的状态。
+//
+// 限速：按 L3_GC_RATE 拷贝，每批之间看一眼前台有没有读写，有就多歇 L3_GC_BUSY_PAUSE_US。
+//
+// [新增] 归档段的死字节 (archive_dead) 也超过同样的门槛时，这一趟顺便把归档段换一代：
+// 活着的归档记录拷进下一代归档段，新索引第 0 项记着它的代数，和数据文件一起随 rename 切换。
+// 归档块被释放时 l3_release 分不出它在哪个文件里，归档段的死字节要等扫索引 (挂载时 / 每次回收) 才算进来，
+// 所以归档段最早在发现死字节之后的下一趟回收时才换。
+
+#define L3_GC_MIN_DEAD (4L << 20)
+#define L3_GC_DEAD_PCT 25
+#define L3_GC_INTERVAL_SEC 10
+#define L3_GC_BATCH 256                 // 每批处理的索引条目数
+#define L3_GC_RATE (32L << 20)          // 字节/秒
+#define L3_GC_BUSY_PAUSE_US 20000
+#define L3_GC_RETIRE_SEC 30
+
+typedef struct {
+    unsigned long runs;
+    unsigned long moved;            // 拷到新文件的记录
+    unsigned long dropped;          // 清掉的死记录
+    unsigned long bytes_reclaimed;
+    unsigned long pauses;           // 给前台让路的次数
+    double last_secs;
+    unsigned long archive_runs;     // [新增] 归档段换代次数
+    unsigned long archive_reclaimed;
+} l3_gc_stats_t;
+
+static long dead_bytes = 0;             // l3_lock 保护
+static long archive_dead = 0;           // [新增] 归档段里死掉的字节 (扫索引时才知道，见上面)
+static int gc_active = 0;               // 正在拷贝：追加写完要记进 gc_log
+static int *gc_log = NULL;
+static size_t gc_log_n = 0, gc_log_cap = 0;
+// [修改] 退役的 fd 不限个数：回收跑得再勤，也要等够 L3_GC_RETIRE_SEC 才关
+static struct retired_fd { int fd; time_t when; } *retired = NULL;
+static int nretired = 0, retired_cap = 0;
+static l3_gc_stats_t gc_stats;
+static int (*gc_live)(int block_id) = NULL;
+static int (*gc_sync)(void) = NULL;
+static pthread_t gc_thread;
+static int gc_thread_running = 0;
+static int gc_stop = 0;
+static pthread_cond_t gc_wake = PTHREAD_COND_INITIALIZER;
+
+// 调用者持有 l3_lock。记不下 (内存不够) 就让这次回收作废
+static void gc_note_append(int block_id) {
+    if (!gc_active) return;
+    if (gc_log_n == gc_log_cap) {
+        size_t cap = gc_log_cap ? gc_log_cap * 2 : 1024;
+        int *p = realloc(gc_log, cap * sizeof(int));
+        if (!p) {
+            gc_active = -1;
+            return;
+        }
+        gc_log = p;
+        gc_log_cap = cap;
+    }
+    gc_log[gc_log_n++] = block_id;
+}
+
+static int gc_due_locked() {
+    return dead_bytes >= L3_GC_MIN_DEAD && dead_bytes * 100 >= (long)data_tail * L3_GC_DEAD_PCT;
+}
+
+// [新增] 归档段用同样的门槛
+static int archive_due_locked() {
+    return archive_dead >= L3_GC_MIN_DEAD && archive_dead * 100 >= (long)archive_tail * L3_GC_DEAD_PCT;
+}
+
+// [新增] 块的最后一个引用没了 (引用计数归零时由 smart_write.c 调用)
+void l3_release(int block_id, int length) {
+    (void) block_id;
+    pthread_mutex_lock(&l3_lock);
+    dead_bytes += length;
+    if (gc_due_locked()) pthread_cond_signal(&gc_wake);
+    pthread_mutex_unlock(&l3_lock);
+}
+
+// 调用者持有 l3_lock。放够时间的顺手关掉，再给接下来要退役的 n 个 fd 留好位置；
+// 留不出来 (内存不够) 返回 -1，这次回收不能换文件 (不能为了腾地方提前关掉还可能有人在读的 fd)
+static int retire_reserve(int n) {
+    time_t now = time(NULL);
+    int keep = 0;
+    for (int i = 0; i < nretired; i++) {
+        if (now - retired[i].when >= L3_GC_RETIRE_SEC) close(retired[i].fd);
+        else retired[keep++] = retired[i];
+    }
+    nretired = keep;
+    if (nretired + n <= retired_cap) return 0;
+    int cap = retired_cap ? retired_cap * 2 : 8;
+    while (cap < nretired + n) cap *= 2;
+    struct retired_fd *p = realloc(retired, cap * sizeof(*p));
+    if (!p) return -1;
+    retired = p;
+    retired_cap = cap;
+    return 0;
+}
+
+// 调用者持有 l3_lock，之前 retire_reserve 留过位置。换下来的 fd 留给还在读的人
+static void retire_fd(int fd) {
+    retired[nretired].fd = fd;
+    retired[nretired].when = time(NULL);
+    nretired++;
+}
+
+// 把 src 里的一条记录拷到 dst 的 to 位置
+static int gc_copy(int src, int dst, long from, off_t to, int len, char **buf, size_t *cap) {
+    if ((size_t)len > *cap) {
+        char *p = realloc(*buf, len);
+        if (!p) return -1;
+        *buf = p;
+        *cap = len;
+    }
+    if (pread(src, *buf, len, from) != len) return -1;
+    return pwrite(dst, *buf, len, to) == len ? 0 : -1;
+}
+
+static double gc_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 一批拷完之后歇一会儿：拷了多少按限速折算，前台有读写再多让一点
+static void gc_throttle(size_t bytes, unsigned long *ops_seen, unsigned long *pauses) {
+    useconds_t us = (useconds_t)(bytes * 1000000.0 / L3_GC_RATE);
+    unsigned long ops = __atomic_load_n(&l3_ops, __ATOMIC_RELAXED);
+    if (ops != *ops_seen) {
+        us += L3_GC_BUSY_PAUSE_US;
+        (*pauses)++;
+        *ops_seen = ops;
+    }
+    if (us > 0) usleep(us);
+}
+
+// 做一次回收，返回回收的字节数，没做 (正在回收 / 没开 / 没有死掉的记录) 返回 0，失败返回 -1
+// throttle = 0 时不限速 (同步调用，比如测试)
+// [修改] 归档段到了门槛就一起换代，回收的字节数也算上归档段缩小的部分
+int l3_gc_run(int throttle) {
+    pthread_mutex_lock(&l3_lock);
+    int compact_archive = archive_due_locked();
+    if (gc_active || !gc_live || (dead_bytes == 0 && !compact_archive) || l3_open_locked() != 0) {
+        pthread_mutex_unlock(&l3_lock);
+        return 0;
+    }
+    gc_active = 1;
+    gc_log_n = 0;
+    int src_data = data_fd, src_idx = idx_fd, src_arch = archive_fd;
+    uint32_t gen = data_gen, agen = archive_gen;
+    pthread_mutex_unlock(&l3_lock);
+
+    double t0 = gc_now();
+    char new_data_path[64], old_data_path[64], new_arch_path[64], old_arch_path[64];
+    data_path(gen + 1, new_data_path, sizeof(new_data_path));
+    data_path(gen, old_data_path, sizeof(old_data_path));
+    archive_path(agen + 1, new_arch_path, sizeof(new_arch_path));
+    archive_path(agen, old_arch_path, sizeof(old_arch_path));
+    int dst_data = open(new_data_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int dst_idx = open(L3_IDX_GC_FILE, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    int dst_arch = compact_archive ? open(new_arch_path, O_RDWR | O_CREAT | O_TRUNC, 0644) : -1;
+    struct stat st;
+    int ok = dst_data >= 0 && dst_idx >= 0 && (!compact_archive || dst_arch >= 0) && fstat(src_idx, &st) == 0;
+    long nids = ok ? st.st_size / (long)sizeof(IndexEntry) : 0;
+
+    // 1. 按块号顺序拷活着的记录 (不挡读写)
+    IndexEntry batch[L3_GC_BATCH];
+    char *buf = NULL;
+    size_t buf_cap = 0;
+    off_t tail = 0, atail = 0;
+    unsigned long moved = 0, dropped = 0, pauses = 0, ops_seen = __atomic_load_n(&l3_ops, __ATOMIC_RELAXED);
+    long reclaimed = 0, archive_freed = 0;
+    for (long id = 1; ok && id < nids; id += L3_GC_BATCH) {
+        int n = (nids - id < L3_GC_BATCH) ? (int)(nids - id) : L3_GC_BATCH;
+        size_t len = (size_t)n * sizeof(IndexEntry);
+        off_t pos = (off_t)id * sizeof(IndexEntry);
+        if (pread(src_idx, batch, len, pos) != (ssize_t)len) {
+            ok = 0;
+            break;
+        }
+        size_t copied = 0;
+        for (int i = 0; i < n && ok; i++) {
+            IndexEntry *e = &batch[i];
+            if (e->valid != 1) {
+                memset(e, 0, sizeof(*e));
+                continue;
+            }
+            if (!gc_live((int)(id + i))) {
+                // [修改] 归档段里的记录不在数据文件里，死了也只是在归档段里留个洞
+                if (e->flags & L3_FLAG_ARCHIVE) archive_freed += e->length;
+                else reclaimed += e->length;
+                dropped++;
+                memset(e, 0, sizeof(*e));
+                continue;
+            }
+            if (e->flags & L3_FLAG_ARCHIVE) {
+                // [新增] 数据在归档段里：不换归档段时条目原样留着，换的话拷进下一代归档段
+                if (!compact_archive) continue;
+                if (gc_copy(src_arch, dst_arch, e->offset, atail, e->length, &buf, &buf_cap) != 0) ok = 0;
+                e->offset = atail;
+                atail += e->length;
+            } else {
+                if (gc_copy(src_data, dst_data, e->offset, tail, e->length, &buf, &buf_cap) != 0) ok = 0;
+                e->offset = tail;
+                tail += e->length;
+            }
+            copied += e->length;
+            moved++;
+        }
+        if (ok && pwrite(dst_idx, batch, len, pos) != (ssize_t)len) ok = 0;
+
+        pthread_mutex_lock(&l3_lock);
+        if (gc_stop || gc_active < 0) ok = 0;
+        pthread_mutex_unlock(&l3_lock);
+        if (ok && throttle) gc_throttle(copied, &ops_seen, &pauses);
+    }
+
+    // 2. 让元数据先落盘，再把新文件刷下去
+    if (ok && gc_sync && gc_sync() != 0) ok = 0;
+    if (ok && fsync(dst_data) != 0) ok = 0;
+    if (ok && compact_archive && fsync(dst_arch) != 0) ok = 0;
+
+    // 3. 换文件：挡住新的追加，等在写的写完，补拷拷贝期间写进来的记录
+    pthread_mutex_lock(&l3_lock);
+    swapping = 1;
+    while (appends > 0) pthread_cond_wait(&l3_cond, &l3_lock);
+    if (gc_active < 0 || retire_reserve(compact_archive ? 3 : 2) != 0) ok = 0;
+    for (size_t k = 0; ok && k < gc_log_n; k++) {
+        IndexEntry e;
+        off_t pos = (off_t)gc_log[k] * sizeof(IndexEntry);
+        if (pread(src_idx, &e, sizeof(e), pos) != sizeof(e)) {
+            ok = 0;
+            break;
+        }
+        // [新增] 拷贝期间归档了的块：只换条目，数据已经在归档段里 ([修改] 归档段也换代的话拷过去)
+        if (!(e.flags & L3_FLAG_ARCHIVE)) {
+            if (gc_copy(src_data, dst_data, e.offset, tail, e.length, &buf, &buf_cap) != 0) {
+                ok = 0;
+                break;
+            }
+            e.offset = tail;
+            tail += e.length;
+        } else if (compact_archive) {
+            if (gc_copy(src_arch, dst_arch, e.offset, atail, e.length, &buf, &buf_cap) != 0) {
+                ok = 0;
+                break;
+            }
+            e.offset = atail;
+            atail += e.length;
+        }
+        moved++;
+        if (pwrite(dst_idx, &e, sizeof(e), pos) != sizeof(e)) ok = 0;
+    }
+    IndexEntry hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.valid = L3_IDX_MAGIC;
+    hdr.offset = gen + 1;
+    hdr.length = (int)(compact_archive ? agen + 1 : agen);
+    ok = ok && pwrite(dst_idx, &hdr, sizeof(hdr), 0) == sizeof(hdr) &&
+         fsync(dst_data) == 0 && (!compact_archive || fsync(dst_arch) == 0) && fsync(dst_idx) == 0 &&
+         rename(L3_IDX_GC_FILE, L3_IDX_FILE) == 0;
+
+    if (ok) {
+        retire_fd(src_data);
+        retire_fd(src_idx);
+        data_fd = dst_data;
+        idx_fd = dst_idx;
+        // [修改] 归档了的块在旧文件里的记录也没拷过来：按文件实际缩小的量算
+        if ((long)(data_tail - tail) > reclaimed) reclaimed = (long)(data_tail - tail);
+        data_tail = tail;
+        data_gen = gen + 1;
+        unlink(old_data_path);
+        dead_bytes = dead_bytes > reclaimed ? dead_bytes - reclaimed : 0;
+        if (compact_archive) {
+            // [新增] 新归档段里只有拷过来的活记录；拷贝期间没抢到条目的归档写在旧段里，跟着一起扔掉
+            long areclaimed = (long)(archive_tail - atail);
+            retire_fd(src_arch);
+            archive_fd = dst_arch;
+            archive_tail = atail;
+            archive_gen = agen + 1;
+            archive_dead = 0;
+            unlink(old_arch_path);
+            gc_stats.archive_runs++;
+            gc_stats.archive_reclaimed += areclaimed;
+            printf("[L3 GC] %s -> %s: %ld bytes reclaimed\n", old_arch_path, new_arch_path, areclaimed);
+            reclaimed += areclaimed;
+        } else {
+            archive_dead += archive_freed;
+        }
+        gc_stats.runs++;
+        gc_stats.moved += moved;
+        gc_stats.dropped += dropped;
+        gc_stats.bytes_reclaimed += reclaimed;
+        gc_stats.pauses += pauses;
+        gc_stats.last_secs = gc_now() - t0;
+    }
+    gc_active = 0;
+    swapping = 0;
+    pthread_cond_broadcast(&l3_cond);
+    pthread_mutex_unlock(&l3_lock);
+    free(buf);
+
+    if (!ok) {
+        if (dst_data >= 0) close(dst_data);
+        if (dst_idx >= 0) close(dst_idx);
+        if (dst_arch >= 0) close(dst_arch);
+        unlink(new_data_path);
+        unlink(L3_IDX_GC_FILE);
+        if (compact_archive) unlink(new_arch_path);
+        printf("[L3 GC] Compaction of %s abandoned\n", old_data_path);
+        return -1;
+    }
+    printf("[L3 GC] %s -> %s: %lu records kept, %lu dropped, %ld bytes reclaimed (%.2fs)\n",
+           old_data_path, new_data_path, moved, dropped, reclaimed, gc_stats.last_secs);
+    return (int)(reclaimed > 0x7fffffffL ? 0x7fffffffL : reclaimed);
+}
+
+// 挂载后算一遍已有的死字节 (上次卸载前释放了、还没来得及回收的)
+// [修改] 归档段里的分开记
+static void gc_scan_dead() {
+    int ifd;
+    if (l3_open(&ifd, NULL, NULL) != 0) return;
+    struct stat st;
+    if (fstat(ifd, &st) != 0) return;
+    long nids = st.st_size / (long)sizeof(IndexEntry), dead = 0, adead = 0;
+    IndexEntry batch[L3_GC_BATCH];
+    for (long id = 1; id < nids; id += L3_GC_BATCH) {
+        int n = (nids - id < L3_GC_BATCH) ? (int)(nids - id) : L3_GC_BATCH;
+        if (pread(ifd, batch, (size_t)n * sizeof(IndexEntry), (off_t)id * sizeof(IndexEntry)) != (ssize_t)(n * sizeof(IndexEntry))) break;
+        for (int i = 0; i < n; i++) {
+            if (batch[i].valid != 1 || gc_live((int)(id + i))) continue;
+            if (batch[i].flags & L3_FLAG_ARCHIVE) adead += batch[i].length;
+            else dead += batch[i].length;
+        }
+    }
+    pthread_mutex_lock(&l3_lock);
+    dead_bytes += dead;
+    archive_dead += adead;
+    pthread_mutex_unlock(&l3_lock);
+}
+
+static void *gc_worker(void *arg) {
+    (void) arg;
+    gc_scan_dead();
+    pthread_mutex_lock(&l3_lock);
+    while (!gc_stop) {
+        if (gc_due_locked() || archive_due_locked()) {
+            pthread_mutex_unlock(&l3_lock);
+            int ret = l3_gc_run(1);
+            pthread_mutex_lock(&l3_lock);
+            if (ret > 0) continue;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += L3_GC_INTERVAL_SEC;
+        pthread_cond_timedwait(&gc_wake, &l3_lock, &ts);
+    }
+    pthread_mutex_unlock(&l3_lock);
+    return NULL;
+}
+
+// live(block_id): 块还有没有引用；sync_metadata 可以为 NULL
+int l3_gc_start(int (*live)(int block_id), int (*sync_metadata)(void)) {
+    pthread_mutex_lock(&l3_lock);
+    gc_live = live;
+    gc_sync = sync_metadata;
+    gc_stop = 0;
+    // 死字节由新线程扫描索引重新算 (停着的时候释放的也在里面)
+    if (!gc_thread_running) dead_bytes = archive_dead = 0;
+    if (!gc_thread_running) gc_thread_running = (pthread_create(&gc_thread, NULL, gc_worker, NULL) == 0);
+    int ret = gc_thread_running ? 0 : -1;
+    pthread_mutex_unlock(&l3_lock);
+    return ret;
+}
+
+void l3_gc_stop() {
+    pthread_mutex_lock(&l3_lock);
+    gc_stop = 1;
+    int running = gc_thread_running;
+    gc_thread_running = 0;
+    pthread_cond_signal(&gc_wake);
+    pthread_mutex_unlock(&l3_lock);
+    if (running) pthread_join(gc_thread, NULL);
+
+    pthread_mutex_lock(&l3_lock);
+    gc_live = NULL;
+    gc_sync = NULL;
+    for (int i = 0; i < nretired; i++) close(retired[i].fd);
+    free(retired);
+    retired = NULL;
+    nretired = retired_cap = 0;
+    free(gc_log);
+    gc_log = NULL;
+    gc_log_n = gc_log_cap = 0;
+    pthread_mutex_unlock(&l3_lock);
+}
+
+void l3_gc_report() {
+    pthread_mutex_lock(&l3_lock);
+    l3_gc_stats_t s = gc_stats;
+    long dead = dead_bytes, size = (long)data_tail;
+    uint32_t gen = data_gen;
+    pthread_mutex_unlock(&l3_lock);
+    printf("[L3 GC] Data file gen %u: %ld bytes, %ld dead; %lu runs, %lu records moved, %lu dropped, "
+           "%lu bytes reclaimed, %lu pauses (last run %.2fs)\n",
+           gen, size, dead, s.runs, s.moved, s.dropped, s.bytes_reclaimed, s.pauses, s.last_secs);
+    pthread_mutex_lock(&l3_lock);
+    long asize = (long)archive_tail, adead = archive_dead;
+    uint32_t agen = archive_gen;
+    pthread_mutex_unlock(&l3_lock);
+    if (asize > 0 || s.archive_runs > 0) {
+        printf("[L3 GC] Archive segment gen %u: %ld bytes, %ld dead; %lu compactions, %lu bytes reclaimed\n",
+               agen, asize, adead, s.archive_runs, s.archive_reclaimed);
+    }
+}
+
+// [新增] 前台读写计数 (后台任务看它判断是不是空闲)
+unsigned long l3_activity() {
+    return __atomic_load_n(&l3_ops, __ATOMIC_RELAXED);
+}
+
+// =========================================================
+// [新增] 归档段：冷块换成强编码器压缩的版本
+// =========================================================
+// 新数据先追加进归档段并刷盘，然后持锁原地改索引条目 (指向归档段)，一次 pwrite 换过去：
+// 崩溃时条目要么还指着数据文件里的旧记录，要么指着已经落盘的新记录。
+// 条目在 old 之后变了 (块已经被释放、又归档过了) 就放弃，归档段里多写的这段当死字节。
+// 数据文件里的旧记录成了死字节，由垃圾回收清掉；正在回收时记进 gc_log，换文件时补上新条目
+// [修改] 写完之前归档段换了代 (写的是已经扔掉的旧段) 也放弃，块留到下次归档
+int l3_archive(int block_id, const l3_extent_t *old, const char *data, int len, int codec) {
+    pthread_mutex_lock(&l3_lock);
+    if (l3_open_locked() != 0) {
+        pthread_mutex_unlock(&l3_lock);
+        return -1;
+    }
+    off_t offset = archive_tail;
+    archive_tail += len;
+    int afd = archive_fd;
+    uint32_t agen = archive_gen;
+    pthread_mutex_unlock(&l3_lock);
+
+    int ok = pwrite(afd, data, len, offset) == len && fdatasync(afd) == 0;
+
+    pthread_mutex_lock(&l3_lock);
+    while (swapping) pthread_cond_wait(&l3_cond, &l3_lock);
+    int same_gen = (archive_gen == agen);
+    IndexEntry e;
+    off_t pos = (off_t)block_id * sizeof(IndexEntry);
+    ok = ok && same_gen && pread(idx_fd, &e, sizeof(e), pos) == sizeof(e) && e.valid == 1 &&
+         !(e.flags & (L3_FLAG_RAW | L3_FLAG_RECIPE | L3_FLAG_ARCHIVE)) &&
+         e.length == old->length && e.raw_len == old->raw_len;
+    if (ok) {
+        IndexEntry n = e;
+        n.flags = L3_FLAG_ARCHIVE | ((codec << L3_CODEC_SHIFT) & L3_CODEC_MASK);
+        n.offset = offset;
+        n.length = len;
+        pthread_rwlock_wrlock(&entry_rw);
+        ok = pwrite(idx_fd, &n, sizeof(n), pos) == sizeof(n);
+        pthread_rwlock_unlock(&entry_rw);
+    }
+    if (ok) {
+        dead_bytes += e.length;
+        gc_note_append(block_id);
+        if (gc_due_locked()) pthread_cond_signal(&gc_wake);
+    } else if (same_gen) {
+        archive_dead += len;
+    }
+    pthread_mutex_unlock(&l3_lock);
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,106 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "storage.h"
+
+// =========================================================
+// 预读线程池
+// =========================================================
+// main.c 发现顺序读时把后面几个块的块号提交进来，后台线程负责
+// L3 读盘 + 解压 + 放进 L1，读请求到达时直接在 L1 命中，不用等磁盘。
+// 队列满了直接丢弃：预读只是优化，不能反过来拖慢读请求。
+
+#define PREFETCH_QUEUE    256
+#define PREFETCH_MAX_THREADS 8
+
+typedef struct {
+    unsigned long submitted;    // 入队的块数
+    unsigned long dropped;      // 队列满被丢掉的块数
+    unsigned long loaded;       // 真正从 L3 读进 L1 的块数
+    unsigned long cached;       // 出队时已经在 L1 里，跳过
+    unsigned long failed;
+} PrefetchStats;
+
+static int queue[PREFETCH_QUEUE];
+static int q_head = 0, q_count = 0;
+static pthread_mutex_t pf_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pf_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t workers[PREFETCH_MAX_THREADS];
+static int nworkers = 0;
+static int stopping = 0;
+static PrefetchStats pf_stats;
+
+static void *prefetch_worker(void *arg) {
+    (void) arg;
+    pthread_mutex_lock(&pf_lock);
+    for (;;) {
+        while (q_count == 0 && !stopping) pthread_cond_wait(&pf_cond, &pf_lock);
+        if (stopping) break;
+        int block_id = queue[q_head];
+        q_head = (q_head + 1) % PREFETCH_QUEUE;
+        q_count--;
+        pthread_mutex_unlock(&pf_lock);
+
+        int ret = smart_prefetch(block_id);
+
+        pthread_mutex_lock(&pf_lock);
+        if (ret > 0) pf_stats.loaded++;
+        else if (ret == 0) pf_stats.cached++;
+        else pf_stats.failed++;
+    }
+    pthread_mutex_unlock(&pf_lock);
+    return NULL;
+}
+
+void prefetch_init(int nthreads) {
+    if (nthreads > PREFETCH_MAX_THREADS) nthreads = PREFETCH_MAX_THREADS;
+    pthread_mutex_lock(&pf_lock);
+    stopping = 0;
+    q_head = q_count = 0;
+    memset(&pf_stats, 0, sizeof(pf_stats));
+    pthread_mutex_unlock(&pf_lock);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&workers[nworkers], NULL, prefetch_worker, NULL) != 0) break;
+        nworkers++;
+    }
+    printf("[Prefetch] %d worker thread(s) started.\n", nworkers);
+}
+
+void prefetch_shutdown() {
+    pthread_mutex_lock(&pf_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&pf_cond);
+    pthread_mutex_unlock(&pf_lock);
+    for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+    nworkers = 0;
+}
+
+int prefetch_submit(const int *block_ids, int n) {
+    int queued = 0;
+    pthread_mutex_lock(&pf_lock);
+    if (nworkers > 0 && !stopping) {
+        for (int i = 0; i < n; i++) {
+            if (q_count == PREFETCH_QUEUE) {
+                pf_stats.dropped += n - i;
+                break;
+            }
+            queue[(q_head + q_count) % PREFETCH_QUEUE] = block_ids[i];
+            q_count++;
+            queued++;
+        }
+        pf_stats.submitted += queued;
+        if (queued > 0) pthread_cond_broadcast(&pf_cond);
+    }
+    pthread_mutex_unlock(&pf_lock);
+    return queued;
+}
+
+void prefetch_report() {
+    pthread_mutex_lock(&pf_lock);
+    PrefetchStats s = pf_stats;
+    pthread_mutex_unlock(&pf_lock);
+    printf("[Prefetch] Submitted: %lu, loaded: %lu, already cached: %lu, dropped: %lu, failed: %lu\n",
+           s.submitted, s.loaded, s.cached, s.dropped, s.failed);
+}
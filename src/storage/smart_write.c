@@ -1,88 +1,772 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
 #include "storage.h" 
+#include "smartfs_types.h"
 
-#define MAX_BLOCKS 1024   
-StorageStats global_stats = {0, 0, 0, 0};
+StorageStats global_stats = {0, 0, 0, 0, 0};
 #define VIRTUAL_DISK_CAPACITY (100 * 1024 * 1024)
 
-typedef struct { char hash[65]; int block_id; } DedupEntry;
-DedupEntry mock_db[MAX_BLOCKS]; 
-int db_count = 0;
-int ref_counts[MAX_BLOCKS];
+// [新增] 指纹库、块号分配、引用计数、统计信息都由 store_lock 保护；
+// 算哈希、压缩、L3 读写这些耗时的步骤都在锁外面做，多个线程可以并行
+static pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+static int next_block_id = 1;   // 从 1 开始，避免 0 值歧义 (0 = 空洞)
 
-int lookup_fingerprint(const char *hash) {
-    for (int i = 0; i < db_count; i++) if (strcmp(mock_db[i].hash, hash) == 0) return mock_db[i].block_id;
-    return -1; 
+// =========================================================
+// [新增] 块引用计数
+// =========================================================
+// 原来的 ref_counts[1024] 只加不减，块号超过 1024 就不记了，空间永远收不回来。
+// 现在块映射里每有一个逻辑块指向它算一个引用 (几个版本共享同一棵索引树时只算一次)，
+// 分片清单的每一段算它所在数据块一个引用；覆盖、截断、删除、淘汰版本时释放。
+// 计数归零的块不会再被引用 (查重命中时先确认计数不为 0，指纹库里的旧条目就这样作废)，
+// L3 垃圾回收 (l3_storage.c) 把它从数据文件里清掉。
+//
+// 计数放在内存里，按页记脏，正常卸载时写回 REF_FILE；文件不在或者上次没有正常卸载时，
+// 由 main.c 从 Inode 表重建 (和块位图一样)。重建之前不做垃圾回收。
+
+#define REF_FILE "/tmp/smartfs.ref"
+#define REF_MAGIC 0x53524346u               // "SRCF"
+#define REF_PAGE 4096
+#define REF_PER_PAGE (REF_PAGE / sizeof(uint32_t))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t state;         // SMARTFS_STATE_CLEAN = 正常卸载时写的，计数可信
+    uint64_t count;         // 计数的个数 (块号 0 .. count-1)
+} ref_header_t;             // 文件第 0 页，计数从第 1 页开始
+
+typedef struct {
+    unsigned long freed;        // 归零的块
+    unsigned long underflows;   // 释放了没有引用的块 (说明哪里多放了一次)
+} ref_stats_t;
+
+static uint32_t *refs = NULL;       // store_lock 保护
+static unsigned char *refs_dirty = NULL;
+static size_t refs_cap = 0;         // REF_PER_PAGE 的倍数
+static int refs_valid = 0;
+static int ref_fd = -1;
+static ref_stats_t ref_stats;
+static int (*metadata_sync)(void) = NULL;
+
+// 调用者持有 store_lock
+static int refs_reserve(size_t n) {
+    if (n <= refs_cap) return 0;
+    size_t cap = refs_cap ? refs_cap : REF_PER_PAGE;
+    while (cap < n) cap *= 2;
+    uint32_t *r = realloc(refs, cap * sizeof(uint32_t));
+    if (!r) return -1;
+    refs = r;
+    unsigned char *d = realloc(refs_dirty, cap / REF_PER_PAGE);
+    if (!d) return -1;
+    refs_dirty = d;
+    memset(refs + refs_cap, 0, (cap - refs_cap) * sizeof(uint32_t));
+    memset(refs_dirty + refs_cap / REF_PER_PAGE, 0, (cap - refs_cap) / REF_PER_PAGE);
+    refs_cap = cap;
+    return 0;
+}
+
+// [新增] 最后一个引用正在释放 (storage_release_block 还没做完)：查重不能再引用它，
+// 垃圾回收还把它当活块 (分片清单要等它引用的数据块都放掉才能清)
+#define REF_DYING UINT32_MAX
+
+static uint32_t ref_get(int block_id) {
+    return (block_id > 0 && (size_t)block_id < refs_cap) ? refs[block_id] : 0;
+}
+
+static void ref_set(int block_id, uint32_t n) {
+    if (block_id <= 0 || refs_reserve((size_t)block_id + 1) != 0) return;
+    refs[block_id] = n;
+    refs_dirty[block_id / REF_PER_PAGE] = 1;
+}
+
+// 查重命中：块还活着才引用它 (调用者持有 store_lock)
+static int ref_if_live(int block_id) {
+    uint32_t n = ref_get(block_id);
+    if (n == 0 || n == REF_DYING) return 0;
+    ref_set(block_id, n + 1);
+    return 1;
+}
+
+// 读入上次正常卸载时写下的计数，然后标记成“挂载中”：这次没有正常卸载的话下次要重建
+static void refs_load() {
+    ref_fd = open(REF_FILE, O_RDWR | O_CREAT, 0644);
+    if (ref_fd < 0) {
+        printf("[Refs] Cannot open %s: %s\n", REF_FILE, strerror(errno));
+        return;
+    }
+    ref_header_t hdr;
+    if (pread(ref_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.magic == REF_MAGIC &&
+        hdr.state == SMARTFS_STATE_CLEAN && hdr.count <= (uint64_t)next_block_id &&
+        refs_reserve(hdr.count) == 0) {
+        size_t len = hdr.count * sizeof(uint32_t);
+        refs_valid = pread(ref_fd, refs, len, REF_PAGE) == (ssize_t)len;
+    }
+    // 一个块都还没存过，没什么可重建的
+    if (!refs_valid && next_block_id <= 1) refs_valid = 1;
+    if (!refs_valid) memset(refs, 0, refs_cap * sizeof(uint32_t));
+
+    hdr.magic = REF_MAGIC;
+    hdr.state = SMARTFS_STATE_MOUNTED;
+    hdr.count = 0;
+    if (pwrite(ref_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fsync(ref_fd) != 0) {
+        printf("[Refs] Cannot mark %s in use\n", REF_FILE);
+    }
+    printf("[Refs] Reference counts %s\n", refs_valid ? "loaded" : "need rebuilding");
+}
+
+// 正常卸载：写回脏页，最后写头 (CLEAN)
+static void refs_save() {
+    if (ref_fd < 0) return;
+    int ok = refs_valid;
+    for (size_t p = 0; ok && p < refs_cap / REF_PER_PAGE; p++) {
+        if (!refs_dirty[p]) continue;
+        off_t pos = REF_PAGE + (off_t)p * REF_PAGE;
+        if (pwrite(ref_fd, refs + p * REF_PER_PAGE, REF_PAGE, pos) != REF_PAGE) ok = 0;
+        else refs_dirty[p] = 0;
+    }
+    if (ok) {
+        ref_header_t hdr = { REF_MAGIC, SMARTFS_STATE_CLEAN, (uint64_t)next_block_id };
+        ok = fsync(ref_fd) == 0 && pwrite(ref_fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && fsync(ref_fd) == 0;
+    }
+    if (!ok) printf("[Refs] Reference counts not saved, they will be rebuilt on next mount\n");
+    close(ref_fd);
+    ref_fd = -1;
+}
+
+// 垃圾回收 (还有冷块归档) 问：这个块还有没有引用
+int storage_block_live(int block_id) {
+    pthread_mutex_lock(&store_lock);
+    int live = ref_get(block_id) > 0;
+    pthread_mutex_unlock(&store_lock);
+    return live;
+}
+
+void storage_set_metadata_sync(int (*fn)(void)) {
+    metadata_sync = fn;
+}
+
+// [新增] 挂载：块号接着 L3 索引里用过的继续分配 (原来每次挂载从 1 开始，会覆盖旧块的索引)，
+// 指纹库从日志恢复，重新挂载后照样去重
+// [修改] 读入引用计数；计数可信才启动垃圾回收，否则等调用者重建完 (storage_refs_rebuild_end)
+int storage_mount() {
+    int next = l3_next_block_id();
+    if (next < 0) return -1;
+    pthread_mutex_lock(&store_lock);
+    next_block_id = next;
+    refs_valid = 0;
+    memset(&ref_stats, 0, sizeof(ref_stats));
+    refs_load();
+    int valid = refs_valid;
+    pthread_mutex_unlock(&store_lock);
+    printf("[Storage] Next block id: %d\n", next);
+    if (dict_open() != 0) return -1;
+    if (archive_open() != 0) return -1;
+    if (valid) l3_gc_start(storage_block_live, metadata_sync);
+    return fp_store_open();
+}
+
+void storage_unmount() {
+    l3_gc_stop();
+    fp_store_close();
+    archive_close();
+    dict_close();
+    pthread_mutex_lock(&store_lock);
+    refs_save();
+    pthread_mutex_unlock(&store_lock);
+}
+
+// [修改] 指纹库换成 fp_store.c (持久化日志 + 哈希表 + Bloom 过滤器)，
+// 原来是线性扫描、最多 1024 条的内存数组，满了就不再去重，重新挂载就全忘了
+int lookup_fingerprint(const unsigned char *hash) {
+    return fp_store_lookup(hash);
 }
 
-void save_fingerprint(const char *hash, int block_id) {
-    if (db_count < MAX_BLOCKS) {
-        strcpy(mock_db[db_count].hash, hash);
-        mock_db[db_count].block_id = block_id;
-        db_count++;
+void save_fingerprint(const unsigned char *hash, int block_id) {
+    fp_store_add(hash, block_id);
+}
+
+int storage_refs_need_rebuild() {
+    pthread_mutex_lock(&store_lock);
+    int need = !refs_valid;
+    pthread_mutex_unlock(&store_lock);
+    return need;
+}
+
+void storage_refs_rebuild_begin() {
+    pthread_mutex_lock(&store_lock);
+    if (refs_cap) memset(refs, 0, refs_cap * sizeof(uint32_t));
+    if (refs_cap) memset(refs_dirty, 1, refs_cap / REF_PER_PAGE);
+    pthread_mutex_unlock(&store_lock);
+    printf("[Refs] Rebuilding reference counts from the inode table...\n");
+}
+
+void storage_ref_block(int block_id) {
+    if (block_id <= 0) return;
+    pthread_mutex_lock(&store_lock);
+    uint32_t n = ref_get(block_id);
+    if (n != REF_DYING) ref_set(block_id, n + 1);
+    else ref_stats.underflows++;
+    pthread_mutex_unlock(&store_lock);
+}
+
+static void recipe_refs(const l3_extent_t *loc, int delta);
+
+// 块映射里的引用都数完了：分片清单对数据块的引用只能读清单才知道
+void storage_refs_rebuild_end() {
+    pthread_mutex_lock(&store_lock);
+    int n = next_block_id;
+    pthread_mutex_unlock(&store_lock);
+    unsigned long live = 0;
+    for (int id = 1; id < n; id++) {
+        pthread_mutex_lock(&store_lock);
+        int held = ref_get(id) > 0;
+        pthread_mutex_unlock(&store_lock);
+        if (!held) continue;
+        live++;
+        l3_extent_t loc;
+        if (l3_locate(id, &loc) == 0 && loc.recipe) recipe_refs(&loc, 1);
     }
+    pthread_mutex_lock(&store_lock);
+    refs_valid = 1;
+    pthread_mutex_unlock(&store_lock);
+    printf("[Refs] %lu blocks referenced\n", live);
+    l3_gc_start(storage_block_live, metadata_sync);
+}
+
+// 去掉一个引用；最后一个引用没了：清单先放掉它引用的数据块 (计数这时是 REF_DYING，垃圾回收不会先把清单清掉)，
+// 再把计数清零、告诉 L3 这个块死了
+// [修改] 判断是不是最后一个引用和标记 REF_DYING 在同一次持锁里做：原来放开锁之后才清零，
+// 中间查重命中的引用会被覆盖掉，块被当成死块回收
+void storage_release_block(int block_id) {
+    if (block_id <= 0) return;
+    pthread_mutex_lock(&store_lock);
+    uint32_t n = ref_get(block_id);
+    if (n != 1) {
+        if (n > 1 && n != REF_DYING) ref_set(block_id, n - 1);
+        else ref_stats.underflows++;
+        pthread_mutex_unlock(&store_lock);
+        return;
+    }
+    ref_set(block_id, REF_DYING);
+    pthread_mutex_unlock(&store_lock);
+
+    l3_extent_t loc;
+    int located = l3_locate(block_id, &loc) == 0;
+    if (located && loc.recipe) recipe_refs(&loc, -1);
+
+    pthread_mutex_lock(&store_lock);
+    ref_set(block_id, 0);
+    ref_stats.freed++;
+    pthread_mutex_unlock(&store_lock);
+    // [修改] 归档块的旧记录已经算过死字节了，归档段不回收
+    if (located) l3_release(block_id, loc.archived ? 0 : loc.length);
+}
+
+static int store_compressed(const char *data, int len, const char *compressed_data, int c_size, int codec,
+                            int dict_id, const unsigned char *hash, int cache);
+
+// [新增] 存一份新数据：压缩、写 L3、登记指纹，返回新块号 (固定分块的块和 CDC 切出的数据块共用)
+// cache = 1 时把原文放进 L1 (只有 4KB 逻辑块才放，CDC 数据块不是按块号读的)
+// [修改] 带上 Inode 号，压缩时按文件记住压不动的文件
+static int store_new(long inode_id, const char *data, int len, const unsigned char *hash, int cache) {
+    // [修改] 压缩输出不需要先清零，只有前 c_size 个字节会写到 L3
+    char stack_buf[4096 + 100];
+    char *compressed_data = (len <= 4096) ? stack_buf : malloc(len);
+    if (!compressed_data) return -1;
+    int codec, dict_id;
+    int c_size = smart_compress_file(inode_id, data, len, compressed_data, &codec, &dict_id);
+    int new_block_id = store_compressed(data, len, compressed_data, c_size, codec, dict_id, hash, cache);
+    if (compressed_data != stack_buf) free(compressed_data);
+    return new_block_id;
+}
+
+// [新增] 压缩好的数据落盘 (写入流水线的压缩和落盘在不同线程上做，从 store_new 拆出来)
+static int store_compressed(const char *data, int len, const char *compressed_data, int c_size, int codec,
+                            int dict_id, const unsigned char *hash, int cache) {
+    // ==========================================================
+    // 🔴 [关键修复 1] 彻底抛弃 Inode ID，使用全局递增 ID
+    // 这样保证每次写入生成的 ID 都是全宇宙唯一的，绝对不会和旧缓存冲突
+    // ==========================================================
+    // [修改] 分配块号时就带上调用者的引用：写 L3 的时候垃圾回收也不会把它当成死块
+    pthread_mutex_lock(&store_lock);
+    int new_block_id = next_block_id++;
+    ref_set(new_block_id, 1);
+    global_stats.bytes_after_dedup += len;
+    global_stats.total_physical_bytes += c_size;
+    pthread_mutex_unlock(&store_lock);
+
+    // 写入 L3 磁盘
+    int ret = l3_write(new_block_id, compressed_data, c_size, len, codec, dict_id);
+    if (ret != 0) {
+        pthread_mutex_lock(&store_lock);
+        ref_set(new_block_id, 0);
+        pthread_mutex_unlock(&store_lock);
+        return -1;
+    }
+
+    // [修改] L1 缓存的是解压后的内容，刚写的数据直接放原文，读命中时不用再解压
+    if (cache) {
+        printf("  -> 🔥 将新数据加入 LRU 缓存 (Block #%d)\n", new_block_id);
+        lru_put(new_block_id, data, len);
+    }
+
+    // 数据落盘之后才登记指纹，别的线程查重命中时这个块一定已经可读
+    // (两个线程同时写相同的新数据时各存一份，只是少去重一次)
+    save_fingerprint(hash, new_block_id);
+    archive_touch(new_block_id);
+    return new_block_id;
+}
+
+// [新增] 查重：指纹库里有、而且还有引用的块直接拿来用 (带上调用者的一个引用)，返回块号；没有返回 0
+// 指纹库自己加锁；还在后台加载时可能要等一会儿，不能拿着 store_lock 等
+// [修改] 指纹库里的块可能已经没有引用了 (等着回收)，那就当成新数据
+int storage_dedup_block(const unsigned char *digest, int len) {
+    int existing_block = lookup_fingerprint(digest);
+    pthread_mutex_lock(&store_lock);
+    global_stats.total_logical_bytes += len;
+    if (existing_block != -1 && ref_if_live(existing_block)) {
+        printf("  -> 发现重复数据！引用已有块 Block #%d\n", existing_block);
+        global_stats.deduplication_count++;
+        pthread_mutex_unlock(&store_lock);
+        archive_touch(existing_block);
+        return existing_block;
+    }
+    pthread_mutex_unlock(&store_lock);
+    return 0;
+}
+
+int storage_store_block(const char *data, int len, const char *compressed, int c_size, int codec, int dict_id,
+                        const unsigned char *digest) {
+    return store_compressed(data, len, compressed, c_size, codec, dict_id, digest, 1);
+}
+
+// =========================================================
+// [新增] 全零块：预分配的区域、合并缓冲里补的 0 之类。不算指纹、不压缩、不进 L3，
+// 块号给 0，块映射里就是空洞，读的时候直接补 0 (L1/L2/L3 都不碰)
+// =========================================================
+typedef uint64_t zero_vec_t __attribute__((vector_size(32)));
+
+// 一次看 128 个字节 (四个向量 OR 在一起，编译成 SSE2/AVX2)，有非零就返回；
+// 有数据的块开头 8 个字节基本就不是 0，先看一眼
+static int is_zero(const char *data, int len) {
+    int i = 0;
+    if (len >= 8) {
+        uint64_t head;
+        memcpy(&head, data, sizeof(head));
+        if (head != 0) return 0;
+    }
+    for (; i + 128 <= len; i += 128) {
+        zero_vec_t v[4];
+        memcpy(v, data + i, sizeof(v));
+        zero_vec_t x = v[0] | v[1] | v[2] | v[3];
+        if ((x[0] | x[1] | x[2] | x[3]) != 0) return 0;
+    }
+    for (; i < len; i++) {
+        if (data[i] != 0) return 0;
+    }
+    return 1;
+}
+
+int storage_zero_block(const char *data, int len) {
+    if (!is_zero(data, len)) return 0;
+    pthread_mutex_lock(&store_lock);
+    global_stats.total_logical_bytes += len;
+    global_stats.zero_blocks++;
+    pthread_mutex_unlock(&store_lock);
+    return 1;
 }
 
 // === 核心写入 ===
 // === 修改后的 smart_write 函数 ===
 int smart_write(long inode_id, long offset, const char *data, int len, int *out_block_id) {
-    global_stats.total_logical_bytes += len;
-    printf("\n[SmartWrite] 收到写入请求: Inode=%ld, 大小=%d 字节\n", inode_id, len);
+    // [新增] 全零块直接当成空洞 (块号 0)
+    if (storage_zero_block(data, len)) {
+        if (out_block_id) *out_block_id = 0;
+        return len;
+    }
+    unsigned char hash[FP_DIGEST_LEN];
+    calculate_fingerprint(data, len, hash);
+    return smart_write_digest(inode_id, offset, data, len, hash, out_block_id);
+}
 
-    char hash[65];
-    calculate_sha256(data, len, hash);
+// [修改] 指纹由调用者算好传进来：写入路径一次算一批块 (见 calculate_fingerprints)
+int smart_write_digest(long inode_id, long offset, const char *data, int len,
+                       const unsigned char *hash, int *out_block_id) {
+    printf("\n[SmartWrite] 收到写入请求: Inode=%ld, 大小=%d 字节\n", inode_id, len);
 
     // 1. 查重逻辑
-    int existing_block = lookup_fingerprint(hash);
-    if (existing_block != -1) {
-        printf("  -> 发现重复数据！引用已有块 Block #%d\n", existing_block);
-        global_stats.deduplication_count++;
-        ref_counts[existing_block]++;
-        
+    int existing_block = storage_dedup_block(hash, len);
+    if (existing_block > 0) {
         // 【关键修改 A】如果是重复数据，把旧块 ID 传出去
         if (out_block_id != NULL) {
             *out_block_id = existing_block;
         }
         return len;
-    } 
+    }
     
-    // 2. 新写入逻辑
+    // 2. 新写入逻辑 (压缩不持锁)
     printf("  -> 新数据，准备存储...\n");
-    char *compressed_data = malloc(4096 + 100);
-    memset(compressed_data, 0, 4096 + 100); 
-    int c_size = smart_compress(data, len, compressed_data);
+    int new_block_id = store_new(inode_id, data, len, hash, 1);
+    if (new_block_id < 0) return -1;
 
-    global_stats.bytes_after_dedup += len;
-    global_stats.total_physical_bytes += c_size;
-    
-    // 生成新 ID (队友原本的逻辑)
-// ==========================================================
-    // 🔴 [关键修复 1] 彻底抛弃 Inode ID，使用全局递增 ID
-    // 这样保证每次写入生成的 ID 都是全宇宙唯一的，绝对不会和旧缓存冲突
-    // ==========================================================
-    // db_count 是从 0 开始的，我们让 block_id 从 1 开始，避免 0 值歧义
-    int new_block_id = db_count + 1; 
+    if (out_block_id) *out_block_id = new_block_id;
+    return len;
+}
 
-    ref_counts[new_block_id] = 1;
+// =========================================================
+// [新增] CDC 模式 (挂载选项 -o cdc)
+// =========================================================
+// 块映射还是按 4KB 逻辑块，但整段写入先按内容切成变长的数据块 (cdc.c)，数据块按指纹去重后存进 L3，
+// 每个逻辑块存一份分片清单：它由哪几个数据块的哪几段拼成。文件中间插入数据之后，后面的切点会重新对齐，
+// 切出来的数据块和原来一样，只需要存新的清单。
+// 指纹库只登记数据本身 (固定分块的块、CDC 数据块)，不登记清单：查到的块号读出来一定就是那份内容，
+// 所以逻辑块整块命中 (和已有的块、或者恰好 4KB 的数据块一样) 时直接引用，不用清单。
 
-    ref_counts[new_block_id] = 1;
+#define RECIPE_MAGIC 0x43525253u                        // "SRRC"
+#define RECIPE_MAX_SLICES (4096 / CDC_MIN_CHUNK + 2)     // 除了每段写入的最后一块，数据块都不短于 min
+#define RECIPE_SIZE(n) (offsetof(recipe_t, slices) + (n) * sizeof(recipe_slice_t))
 
-    // 写入 L3 磁盘
-    l3_write(new_block_id, compressed_data, c_size);
+typedef struct {
+    int32_t chunk_id;
+    uint32_t off;       // 这一段在数据块里的偏移
+    uint32_t len;
+} recipe_slice_t;
 
-    save_fingerprint(hash, new_block_id);
+typedef struct {
+    uint32_t magic;
+    uint32_t nslices;
+    recipe_slice_t slices[RECIPE_MAX_SLICES];
+} recipe_t;
+
+typedef struct {
+    unsigned long chunks_new;
+    unsigned long chunks_dup;
+    unsigned long chunk_bytes;      // 新存的数据块原文总长 (算平均块长)
+    unsigned long recipes;
+    unsigned long block_hits;       // 逻辑块整块命中
+} cdc_stats_t;
+
+static cdc_stats_t cdc_stats;       // store_lock 保护
+
+// 清单的每一段算它的数据块一个引用 (调用者持有 store_lock)。
+// 数据块这时都还带着 cdc_store_chunks 的临时引用，写清单失败时减回去也不会归零
+static void slices_ref_locked(const recipe_t *r, int delta) {
+    for (uint32_t i = 0; i < r->nslices; i++) {
+        int id = r->slices[i].chunk_id;
+        ref_set(id, ref_get(id) + delta);
+    }
+}
+
+// 数据块 c 是 data 里的 [cut[c], cut[c + 1])
+static int cdc_split(const char *data, int len, size_t *cut) {
+    int n = 0;
+    size_t pos = 0;
+    cut[0] = 0;
+    while (pos < (size_t)len) {
+        pos += cdc_next_cut((const unsigned char *)data + pos, (size_t)len - pos);
+        cut[++n] = pos;
+    }
+    return n;
+}
+
+// 把 need 里标出来的数据块存好 (已有的直接引用)，块号填进 ids；一次算 SHA256_MB_LANES 个指纹
+// [修改] ids 里的每个块号带着一个临时引用 (清单写完由调用者放掉)
+static int cdc_store_chunks(long inode_id, const char *data, const size_t *cut, int nchunks, const char *need, int *ids) {
+    int c = 0;
+    while (c < nchunks) {
+        const char *srcs[SHA256_MB_LANES];
+        size_t lens[SHA256_MB_LANES];
+        int which[SHA256_MB_LANES];
+        unsigned char digests[SHA256_MB_LANES][FP_DIGEST_LEN];
+        int n = 0;
+        for (; c < nchunks && n < SHA256_MB_LANES; c++) {
+            if (!need[c]) continue;
+            srcs[n] = data + cut[c];
+            lens[n] = cut[c + 1] - cut[c];
+            which[n++] = c;
+        }
+        calculate_fingerprints(srcs, lens, n, digests);
+
+        for (int i = 0; i < n; i++) {
+            int id = lookup_fingerprint(digests[i]);
+            pthread_mutex_lock(&store_lock);
+            int hit = id != -1 && ref_if_live(id);
+            if (hit) {
+                global_stats.deduplication_count++;
+                cdc_stats.chunks_dup++;
+            }
+            pthread_mutex_unlock(&store_lock);
+            if (!hit) {
+                id = store_new(inode_id, srcs[i], (int)lens[i], digests[i], 0);
+                if (id < 0) return -1;
+                pthread_mutex_lock(&store_lock);
+                cdc_stats.chunks_new++;
+                cdc_stats.chunk_bytes += lens[i];
+                pthread_mutex_unlock(&store_lock);
+            }
+            ids[which[i]] = id;
+        }
+    }
+    return 0;
+}
+
+int smart_write_cdc(long inode_id, long offset, const char *data, int len, int *out_block_ids) {
+    printf("\n[SmartWrite] CDC 写入请求: Inode=%ld, Offset=%ld, 大小=%d 字节\n", inode_id, offset, len);
+    int nblk = (len + 4095) / 4096;
+    int max_chunks = len / CDC_MIN_CHUNK + 1;
+    size_t *cut = malloc((max_chunks + 1) * sizeof(size_t));
+    int *chunk_ids = calloc(max_chunks, sizeof(int));
+    char *need = calloc(max_chunks, 1);
+    char *miss = calloc(nblk, 1);
+    int ret = -1, nchunks = 0;
+    memset(out_block_ids, 0, nblk * sizeof(int));
+    if (!cut || !chunk_ids || !need || !miss) goto out;
+
+    pthread_mutex_lock(&store_lock);
+    global_stats.total_logical_bytes += len;
+    pthread_mutex_unlock(&store_lock);
+
+    // 1. 逻辑块整块查重 ([新增] 全零的逻辑块是空洞，块号 0，不用切也不用清单)
+    int nmiss = 0;
+    for (int b = 0; b < nblk; ) {
+        const char *srcs[SHA256_MB_LANES];
+        size_t lens[SHA256_MB_LANES];
+        int which[SHA256_MB_LANES];
+        unsigned char digests[SHA256_MB_LANES][FP_DIGEST_LEN];
+        int n = 0;
+        for (; b < nblk && n < SHA256_MB_LANES; b++) {
+            const char *src = data + (size_t)b * 4096;
+            size_t blen = (len - b * 4096 < 4096) ? (size_t)(len - b * 4096) : 4096;
+            if (is_zero(src, (int)blen)) {
+                pthread_mutex_lock(&store_lock);
+                global_stats.zero_blocks++;
+                pthread_mutex_unlock(&store_lock);
+                continue;
+            }
+            srcs[n] = src;
+            lens[n] = blen;
+            which[n++] = b;
+        }
+        if (n > 0) calculate_fingerprints(srcs, lens, n, digests);
+        for (int i = 0; i < n; i++) {
+            int id = lookup_fingerprint(digests[i]);
+            pthread_mutex_lock(&store_lock);
+            int hit = id != -1 && ref_if_live(id);
+            if (hit) {
+                global_stats.deduplication_count++;
+                cdc_stats.block_hits++;
+            }
+            pthread_mutex_unlock(&store_lock);
+            if (!hit) {
+                miss[which[i]] = 1;
+                nmiss++;
+                continue;
+            }
+            out_block_ids[which[i]] = id;
+        }
+    }
+    if (nmiss == 0) {
+        ret = len;
+        goto out;
+    }
+
+    // 2. 整段切块，只存没命中的逻辑块用到的数据块
+    nchunks = cdc_split(data, len, cut);
+    for (int b = 0, c = 0; b < nblk; b++) {
+        size_t bs = (size_t)b * 4096, be = bs + 4096;
+        while (cut[c + 1] <= bs) c++;
+        for (int k = c; k < nchunks && cut[k] < be; k++) need[k] |= miss[b];
+    }
+    if (cdc_store_chunks(inode_id, data, cut, nchunks, need, chunk_ids) != 0) goto out;
+
+    // 3. 每个没命中的逻辑块写一份分片清单
+    for (int b = 0, c = 0; b < nblk; b++) {
+        size_t bs = (size_t)b * 4096, be = bs + 4096;
+        if (be > (size_t)len) be = (size_t)len;
+        while (cut[c + 1] <= bs) c++;
+        if (!miss[b]) continue;
+
+        recipe_t r;
+        r.magic = RECIPE_MAGIC;
+        r.nslices = 0;
+        for (int k = c; k < nchunks && cut[k] < be; k++) {
+            size_t from = cut[k] > bs ? cut[k] : bs;
+            size_t to = cut[k + 1] < be ? cut[k + 1] : be;
+            recipe_slice_t *sl = &r.slices[r.nslices++];
+            sl->chunk_id = chunk_ids[k];
+            sl->off = (uint32_t)(from - cut[k]);
+            sl->len = (uint32_t)(to - from);
+        }
+        int rsize = (int)RECIPE_SIZE(r.nslices);
+
+        pthread_mutex_lock(&store_lock);
+        int recipe_id = next_block_id++;
+        global_stats.total_physical_bytes += rsize;
+        cdc_stats.recipes++;
+        ref_set(recipe_id, 1);
+        slices_ref_locked(&r, 1);
+        pthread_mutex_unlock(&store_lock);
+
+        if (l3_write_recipe(recipe_id, (const char *)&r, rsize) != 0) {
+            pthread_mutex_lock(&store_lock);
+            ref_set(recipe_id, 0);
+            slices_ref_locked(&r, -1);
+            pthread_mutex_unlock(&store_lock);
+            goto out;
+        }
+        // 缓存拼好的内容，刚写完就读的时候不用再拼
+        lru_put(recipe_id, data + bs, (int)(be - bs));
+        out_block_ids[b] = recipe_id;
+    }
+    printf("  -> CDC: %d 个逻辑块, %d 个数据块, %d 块需要分片清单\n", nblk, nchunks, nmiss);
+    ret = len;
+out:
+    // 清单已经各自引用了数据块，放掉 cdc_store_chunks 拿的临时引用；失败时交出去的块号也收回来
+    for (int k = 0; chunk_ids && k < nchunks; k++) storage_release_block(chunk_ids[k]);
+    for (int b = 0; ret < 0 && b < nblk; b++) {
+        storage_release_block(out_block_ids[b]);
+        out_block_ids[b] = 0;
+    }
+    free(cut);
+    free(chunk_ids);
+    free(need);
+    free(miss);
+    return ret;
+}
+
+// 读数据块里的 [off, off + len)：没压缩的直接 pread 这一段，压缩的整块解压
+static int read_chunk(int chunk_id, uint32_t off, uint32_t len, char *dst) {
+    l3_extent_t c;
+    if (l3_locate(chunk_id, &c) != 0 || c.recipe) return -1;
+    if (c.raw) {
+        if ((long)off + len > (long)c.length) return -1;
+        return pread(c.fd, dst, len, c.offset + off) == (ssize_t)len ? 0 : -1;
+    }
+    if (c.raw_len <= 0 || (long)off + len > (long)c.raw_len) return -1;
+    char *buf = malloc((size_t)c.length + c.raw_len);
+    if (!buf) return -1;
+    int ret = -1;
+    if (pread(c.fd, buf, c.length, c.offset) == c.length &&
+        smart_decompress(c.codec, c.dict_id, buf, c.length, buf + c.length, c.raw_len) == c.raw_len) {
+        memcpy(dst, buf + c.length + off, len);
+        ret = 0;
+    }
+    free(buf);
+    return ret;
+}
+
+static int read_recipe(const l3_extent_t *loc, recipe_t *r) {
+    int n = loc->length < (int)sizeof(*r) ? loc->length : (int)sizeof(*r);
+    if (n < (int)RECIPE_SIZE(0) || pread(loc->fd, r, n, loc->offset) != n ||
+        r->magic != RECIPE_MAGIC || r->nslices > RECIPE_MAX_SLICES || (int)RECIPE_SIZE(r->nslices) > n) {
+        return -1;
+    }
+    return 0;
+}
 
-    printf("  -> 🔥 将新数据加入 LRU 缓存 (Block #%d)\n", new_block_id);
-    lru_put(new_block_id, compressed_data); 
+// [新增] 清单引用的数据块一起加 / 减一个引用 (重建计数、释放清单时用)
+static void recipe_refs(const l3_extent_t *loc, int delta) {
+    recipe_t r;
+    if (read_recipe(loc, &r) != 0) return;
+    for (uint32_t i = 0; i < r.nslices; i++) {
+        if (delta > 0) storage_ref_block(r.slices[i].chunk_id);
+        else storage_release_block(r.slices[i].chunk_id);
+    }
+}
 
-    free(compressed_data);
+// 按分片清单拼出逻辑块，返回长度
+static int load_recipe(const l3_extent_t *loc, char *out) {
+    recipe_t r;
+    if (read_recipe(loc, &r) != 0) return -1;
+    uint32_t pos = 0;
+    for (uint32_t i = 0; i < r.nslices; i++) {
+        const recipe_slice_t *sl = &r.slices[i];
+        if (sl->len > 4096 - pos || read_chunk(sl->chunk_id, sl->off, sl->len, out + pos) != 0) return -1;
+        pos += sl->len;
+    }
+    return (int)pos;
+}
 
-if (out_block_id) *out_block_id = new_block_id;
+// [修改] 从 L3 读出一个块到 out (至少 4096 字节)，成功后回填 L1，返回块的长度
+// 没压缩的块直接 pread 进 out；压缩块直接解压进 out，不再经过中间缓冲
+static int load_block(int block_id, const l3_extent_t *loc, char *out) {
+    int len;
+    if (loc->recipe) {
+        len = load_recipe(loc, out);
+        if (len < 0) {
+            printf("  -> ❌ 分片清单读取失败 (Block #%d)\n", block_id);
+            return -1;
+        }
+    } else if (loc->raw) {
+        len = loc->length > 4096 ? 4096 : loc->length;
+        if (pread(loc->fd, out, len, loc->offset) != len) {
+            printf("  -> ❌ L3 也找不到该数据 (IO Error or Not Found)\n");
+            return -1;
+        }
+    } else {
+        char compressed_data[4096 + 100];
+        int l3_len = loc->length > (int)sizeof(compressed_data) ? (int)sizeof(compressed_data) : loc->length;
+        if (l3_len <= 0 || pread(loc->fd, compressed_data, l3_len, loc->offset) != l3_len) {
+            printf("  -> ❌ L3 也找不到该数据 (IO Error or Not Found)\n");
+            return -1;
+        }
+
+        // [关键修复] 告诉解压器：只解压这 l3_len 个字节，后面的别管！
+        len = smart_decompress(loc->codec, loc->dict_id, compressed_data, l3_len, out, 4096);
+        if (len <= 0) {
+            printf("  -> ⚠️ 解压失败! (InputLen=%d)\n", l3_len);
+            return -1;
+        }
+    }
+
+    // 回填缓存
+    printf("  -> 🔥 触发回写机制: 将数据重载入 L1 缓存\n");
+    lru_put(block_id, out, len);
     return len;
 }
 
+// [新增] 零拷贝读 (见 storage.h)
+int smart_read_range(int block_id, int off, int len, char *dst, l3_extent_t *ext) {
+    if (ext) ext->fd = -1;
+    archive_touch(block_id);
+
+    // 1. 查 L1/L2 缓存：命中直接拷进 dst
+    int blen = lru_read(block_id, off, dst, len);
+    if (blen >= 0) return blen > off ? (blen - off < len ? blen - off : len) : 0;
+
+    printf("  -> 🐢 缓存未命中，查询 L3 物理磁盘...\n");
+    l3_extent_t loc;
+    if (l3_locate(block_id, &loc) != 0) return -1;
+
+    // 2. 没压缩的块：告诉调用者它在数据文件里的位置，数据不经过用户态
+    if (loc.raw && ext) {
+        int n = loc.length > off ? loc.length - off : 0;
+        if (n > len) n = len;
+        *ext = loc;
+        ext->offset += off;
+        ext->length = n;
+        memset(dst + n, 0, len - n);
+        return n;
+    }
+
+    // 3. 整块读直接解压进 dst，只读一部分才需要中间缓冲
+    char block[4096];
+    char *out = (off == 0 && len >= 4096) ? dst : block;
+    blen = load_block(block_id, &loc, out);
+    if (blen < 0) return -1;
+    int n = blen > off ? blen - off : 0;
+    if (n > len) n = len;
+    if (out == block && n > 0) memcpy(dst, block + off, n);
+    memset(dst + n, 0, len - n);
+    return n;
+}
+
 // === 核心读取 (修复了 L3 解压长度问题) ===
 int smart_read(long inode_id, long offset, char *buffer, int buf_len) {
     printf("\n[SmartRead] 读取请求: Inode=%ld\n", inode_id);
@@ -91,61 +775,55 @@ int smart_read(long inode_id, long offset, char *buffer, int buf_len) {
     // 在 main.c 里，我们传的是 smart_read(inode, physical_block_id, ...)
     // 所以这里的 offset 实际上就是唯一的 block_id
     // ==========================================================
-    int block_id = (int)offset;
-
-    // 1. 查 L1/L2 缓存
-    char *compressed_data = lru_get(block_id);
-    char *temp_buf = NULL; 
-    
-    // [关键修复] 定义解压时的输入长度
-    // 如果是缓存命中，默认是 4096 (因为缓存块固定大小)
-    // 如果是 L3 命中，我们会更新这个值为实际读取长度
-    int input_len = 4096; 
-
-    // 2. 缓存未命中，查 L3 磁盘
-    if (compressed_data == NULL) {
-        printf("  -> 🐢 缓存未命中，查询 L3 物理磁盘...\n");
-        temp_buf = malloc(4096 + 100);
-        // [安全优化] 先清零，避免脏数据干扰 LZ4
-        memset(temp_buf, 0, 4096 + 100);
-        
-        int l3_len = l3_read(block_id, temp_buf, 4096);
-        
-        if (l3_len > 0) {
-            compressed_data = temp_buf; 
-            
-            // [关键修复] 告诉解压器：只解压这 l3_len 个字节，后面的别管！
-            input_len = l3_len;
-
-            // 回填缓存
-            printf("  -> 🔥 触发回写机制: 将数据重载入 L1 缓存\n");
-            lru_put(block_id, compressed_data);
-        } else {
-            printf("  -> ❌ L3 也找不到该数据 (IO Error or Not Found)\n");
-            free(temp_buf);
-            return -1;
-        }
-    }
+    int len = smart_read_range((int)offset, 0, buf_len, buffer, NULL);
+    if (len < 0) return -1;
+    printf("  -> ✅ 读取成功 (大小: %d 字节)\n", len);
+    return len;
+}
 
-    // 3. 解压 (使用正确的 input_len)
-    int decompressed_size = smart_decompress(
-        compressed_data, input_len, buffer, buf_len
-    );
+// [新增] 预读：块不在 L1 里就从 L3 读出来解压放进去 (预读线程调用)
+int smart_prefetch(int block_id) {
+    if (lru_contains(block_id)) return 0;
+    l3_extent_t loc;
+    char block[4096];
+    if (l3_locate(block_id, &loc) != 0) return -1;
+    return load_block(block_id, &loc, block) < 0 ? -1 : 1;
+}
 
-    if (temp_buf) free(temp_buf); 
+static void (*report_sections[STORAGE_REPORT_MAX])(void);
+static int report_count = 0;
 
-    if (decompressed_size > 0) {
-        printf("  -> ✅ 读取成功 (大小: %d 字节)\n", decompressed_size);
-        return decompressed_size;
-    } else {
-        printf("  -> ⚠️ 解压失败! (InputLen=%d)\n", input_len);
-        return -1;
-    }
+void storage_add_report(void (*fn)(void)) {
+    if (report_count < STORAGE_REPORT_MAX) report_sections[report_count++] = fn;
 }
 
 void print_storage_report() {
+    pthread_mutex_lock(&store_lock);
+    StorageStats snap = global_stats;
+    pthread_mutex_unlock(&store_lock);
+
     printf("\n📊 ========== SmartFS 存储效率监控报告 ==========\n");
-    printf("用户写入总量: %lu 字节\n", global_stats.total_logical_bytes);
-    printf("实际占用磁盘: %lu 字节\n", global_stats.total_physical_bytes);
+    printf("用户写入总量: %lu 字节\n", snap.total_logical_bytes);
+    printf("实际占用磁盘: %lu 字节\n", snap.total_physical_bytes);
+    printf("[Zero] %lu all-zero blocks stored as holes\n", snap.zero_blocks);
+    compress_report();
+    dict_report();
+    fp_store_report();
+    pthread_mutex_lock(&store_lock);
+    ref_stats_t rs = ref_stats;
+    int valid = refs_valid;
+    pthread_mutex_unlock(&store_lock);
+    printf("[Refs] Reference counts %s; %lu blocks freed, %lu underflows\n",
+           valid ? "valid" : "not rebuilt yet", rs.freed, rs.underflows);
+    l3_gc_report();
+    archive_report();
+    if (cdc_enabled()) {
+        pthread_mutex_lock(&store_lock);
+        cdc_stats_t c = cdc_stats;
+        pthread_mutex_unlock(&store_lock);
+        printf("[CDC] Chunks: %lu new (avg %lu bytes), %lu deduplicated; %lu recipes, %lu whole-block hits\n",
+               c.chunks_new, c.chunks_new ? c.chunk_bytes / c.chunks_new : 0, c.chunks_dup, c.recipes, c.block_hits);
+    }
+    for (int i = 0; i < report_count; i++) report_sections[i]();
     printf("==================================================\n");
 }
\ No newline at end of file
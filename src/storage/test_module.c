@@ -23,31 +23,33 @@ int main() {
     for(int i=0; i<10; i++) strcat(buffer1, data1); 
     
     // 模拟写入 Inode 100, Offset 0
-    smart_write(100, 0, buffer1, strlen(buffer1));
+    // [修改] smart_write 多了一个参数：返回数据存在哪个块 (读的时候按块号读)
+    int block1 = 0, block2 = 0, block3 = 0;
+    smart_write(100, 0, buffer1, strlen(buffer1), &block1);
 
     // -------------------------------------------------
     // 场景 B: 写入完全相同的数据 (预期: 触发去重)
     // -------------------------------------------------
     printf("\n>>> [测试 2] 再次写入相同数据 (Duplicate)...\n");
     // 模拟写入 Inode 101 (不同的文件), 但内容一样
-    smart_write(101, 0, buffer1, strlen(buffer1));
+    smart_write(101, 0, buffer1, strlen(buffer1), &block2);
+    printf("  -> Block #%d / #%d (相同说明去重生效)\n", block1, block2);
 
     // -------------------------------------------------
     // 场景 C: 写入不同数据 (预期: 新增记录)
     // -------------------------------------------------
     printf("\n>>> [测试 3] 写入新数据 (Unique)...\n");
     const char *data2 = "This is completely different data.";
-    smart_write(100, 4096, data2, strlen(data2));
+    smart_write(100, 4096, data2, strlen(data2), &block3);
 
     // -------------------------------------------------
     // 场景 D: 缓存命中测试
     // -------------------------------------------------
     printf("\n>>> [测试 4] 读取刚刚写入的数据 (Cache Hit)...\n");
     char read_buf[4096];
-    // 读取刚才的 Block #1 (假设 smart_write 生成的 ID 是 1)
-    // 注意：这里的 block_id 计算逻辑要和 smart_read 里的保持一致
+    // [修改] smart_read 的第二个参数是块号 (smart_write 返回的)
     // 我们只是简单调用 smart_read 看看它是否打印 "命中缓存"
-    smart_read(100, 0, read_buf, strlen(buffer1));
+    smart_read(100, block1, read_buf, strlen(buffer1));
 
     // -------------------------------------------------
     // 最终报告
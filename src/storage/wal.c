@@ -4,11 +4,16 @@
 #include <unistd.h>
 #include <stdint.h>  // [修复 1] 引入 uint32_t 定义
 #include <time.h>    // [修复 2] 引入 time() 定义
+#include <pthread.h>
 #include "storage.h"
 
 #define WAL_LOG_FILE "/tmp/smartfs.wal"
 
-static uint32_t g_current_tx_id = 0;
+// [修改] 事务号按线程保存：多线程挂载时每个 FUSE 请求在自己的线程里开/提交事务
+static __thread uint32_t g_current_tx_id = 0;
+// 进行中的事务数；只有最后一个事务提交时才清理日志，不会删掉别人还没提交的记录
+static int g_active_tx = 0;
+static pthread_mutex_t wal_lock = PTHREAD_MUTEX_INITIALIZER;
 
 // [修复 3] 前置声明 (告诉编译器这俩函数在后面，不要乱猜类型)
 void wal_recover();
@@ -21,6 +26,9 @@ void wal_init() {
 
 void wal_begin(const char *op_name) {
     g_current_tx_id = (uint32_t)time(NULL);
+    pthread_mutex_lock(&wal_lock);
+    g_active_tx++;
+    pthread_mutex_unlock(&wal_lock);
     printf("[WAL] 🟢 Transaction #%u Started: %s\n", g_current_tx_id, op_name);
 }
 
@@ -29,6 +37,7 @@ void wal_log_write(int block_id, uint32_t checksum) {
     FILE *f = fopen(WAL_LOG_FILE, "ab");
     if (!f) return;
     // 写入逻辑块 ID 和 校验和
+    // 追加模式下一行一次 write，多线程的记录不会交错
     fprintf(f, "TX:%u|BLOCK:%d|CRC:%u\n", g_current_tx_id, block_id, checksum);
     fflush(f);
     fsync(fileno(f)); 
@@ -37,8 +46,13 @@ void wal_log_write(int block_id, uint32_t checksum) {
 
 void wal_commit() {
     printf("[WAL] 🔵 Transaction #%u Committed\n", g_current_tx_id);
-    wal_checkpoint(); // 现在编译器知道它是个 void 函数了
+    if (g_current_tx_id == 0) return;
     g_current_tx_id = 0;
+    pthread_mutex_lock(&wal_lock);
+    if (g_active_tx > 0 && --g_active_tx == 0) {
+        wal_checkpoint(); // 现在编译器知道它是个 void 函数了
+    }
+    pthread_mutex_unlock(&wal_lock);
 }
 
 void wal_recover() {
@@ -0,0 +1,419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "storage.h"
+
+// =========================================================
+// [新增] 并行写入流水线
+// =========================================================
+// 原来 smart_write 在 FUSE 线程上串行地算指纹、查重、压缩、写 L3、放进 L1，
+// 一个 1MB 的写请求只用得上一个核。现在每个块是一个任务，按阶段流过四个队列：
+//
+//   指纹 -> 查重 -> 压缩 -> 落盘
+//
+// 工作线程总是先做最靠后的阶段 (先把快做完的块送出去)，指纹阶段一次取
+// SHA256_MB_LANES 个块一起算。一个写请求的各块、多个写请求的块都分到所有工作线程上。
+//
+// 流水线里最多 WP_MAX_INFLIGHT 个块，每个阶段的队列都放得下全部，转阶段不会阻塞；
+// 满了之后提交的线程 (FUSE 线程) 在 smart_write_many 里等，压力一直传到内核。
+//
+// 落盘按批做：一批里的块都压缩完 (或者查重命中) 之后，由一个线程按原来的顺序依次追加到 L3，
+// 同一个写请求的块在数据文件里还是连续的，顺序读时相邻的块能合成一段 splice。
+//
+// 同一批里 (或者同时在写的几个请求里) 内容相同的新块：第一个当"领头"去存，
+// 后面的挂在它身上等，领头做完再重新查重，就能命中它刚登记的指纹，不会各存一份。
+
+#define WP_MAX_THREADS 16
+#define WP_MAX_INFLIGHT 256
+#define WP_COMPRESS_BUF (4096 + 100)
+
+enum { WP_HASH, WP_DEDUP, WP_COMPRESS, WP_PERSIST, WP_STAGES };
+
+typedef struct wp_batch wp_batch_t;
+
+typedef struct wp_job {
+    const char *data;
+    int len;
+    int block_id;                   // 结果：块号 (带一个引用)，失败是 -1
+    unsigned char digest[FP_DIGEST_LEN];
+    char *compressed;               // 压缩阶段的输出 (任务自己带缓冲)
+    int c_size;
+    int codec;                      // [新增] 压缩用的编码器和字典版本，落盘时记进 L3 索引
+    int dict_id;
+    int leading;                    // 在领头链表上
+    int settled;                    // 已经压缩完 / 在跟随 / 做完了 (不会挡着这一批落盘)
+    int ready;                      // 压缩完了，等这一批落盘
+    int storing;                    // 这一轮正在落盘
+    struct wp_job *next;            // 领头链表 / 跟随链表
+    struct wp_job *followers;       // 等这个块存完的同内容任务
+    wp_batch_t *batch;
+} wp_job_t;
+
+struct wp_batch {
+    wp_job_t *jobs;
+    int n;
+    int pending;                    // 还没做完的块
+    int unsettled;                  // 已经进了流水线、还没 settled 的块
+    int nready;
+    int persisting;                 // 落盘任务已经排上 / 正在做 (一批同时只有一个)
+    long inode_id;                  // [新增] 压缩时按文件记住压不动的文件
+    pthread_cond_t done;
+};
+
+typedef struct {
+    unsigned long blocks;           // 经过流水线的块数
+    unsigned long dedup_hits;       // 查重命中 (包括跟随者重新查重后命中的)
+    unsigned long followers;        // 挂在同内容领头任务上等的次数
+    unsigned long stored;           // 新存的块
+    unsigned long failed;
+    unsigned long stalls;           // 提交时流水线满了要等的次数 (反压)
+    unsigned long max_queue[WP_STAGES];
+} WritePipelineStats;
+
+static wp_job_t *queues[WP_STAGES][WP_MAX_INFLIGHT];
+static int q_head[WP_STAGES], q_count[WP_STAGES];
+static int inflight = 0;
+static wp_job_t *leaders = NULL;    // 正在查重 / 压缩 / 落盘的领头任务
+static pthread_mutex_t wp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wp_work = PTHREAD_COND_INITIALIZER;   // 有任务了 / 要退出
+static pthread_cond_t wp_room = PTHREAD_COND_INITIALIZER;   // 流水线腾出位置了
+static pthread_t workers[WP_MAX_THREADS];
+static int nworkers = 0;
+static int stopping = 0;
+static WritePipelineStats wp_stats;
+
+static const char *stage_names[WP_STAGES] = { "hash", "dedup", "compress", "persist" };
+
+// 以下都由持有 wp_lock 的调用者使用
+static void push_locked(int stage, wp_job_t *job) {
+    queues[stage][(q_head[stage] + q_count[stage]) % WP_MAX_INFLIGHT] = job;
+    q_count[stage]++;
+    if ((unsigned long)q_count[stage] > wp_stats.max_queue[stage]) wp_stats.max_queue[stage] = q_count[stage];
+    pthread_cond_signal(&wp_work);
+}
+
+static wp_job_t *pop_locked(int stage) {
+    wp_job_t *job = queues[stage][q_head[stage]];
+    q_head[stage] = (q_head[stage] + 1) % WP_MAX_INFLIGHT;
+    q_count[stage]--;
+    return job;
+}
+
+// 这一批进了流水线的块都 settled 了、有压缩好的块：排一个落盘任务 (拿第一个等着的块当代表)
+static void maybe_persist_locked(wp_batch_t *b) {
+    if (b->unsettled > 0 || b->nready == 0 || b->persisting) return;
+    for (int i = 0; i < b->n; i++) {
+        if (b->jobs[i].ready) {
+            b->persisting = 1;
+            push_locked(WP_PERSIST, &b->jobs[i]);
+            return;
+        }
+    }
+}
+
+static void settle_locked(wp_job_t *job) {
+    if (job->settled) return;
+    job->settled = 1;
+    job->batch->unsettled--;
+    maybe_persist_locked(job->batch);
+}
+
+// 任务结束：跟随者回到查重阶段，所在的批次少一个
+static void finish_locked(wp_job_t *job) {
+    settle_locked(job);
+    if (job->leading) {
+        wp_job_t **pp = &leaders;
+        while (*pp != job) pp = &(*pp)->next;
+        *pp = job->next;
+        job->leading = 0;
+    }
+    for (wp_job_t *f = job->followers, *next; f; f = next) {
+        next = f->next;
+        f->settled = 0;
+        f->batch->unsettled++;
+        push_locked(WP_DEDUP, f);
+    }
+    job->followers = NULL;
+    wp_stats.blocks++;
+    if (job->block_id <= 0) wp_stats.failed++;
+    inflight--;
+    pthread_cond_signal(&wp_room);
+    if (--job->batch->pending == 0) pthread_cond_signal(&job->batch->done);
+}
+
+// 同内容的任务已经有领头了就挂上去，返回 1；否则自己当领头
+static int follow_or_lead_locked(wp_job_t *job) {
+    for (wp_job_t *l = leaders; l; l = l->next) {
+        if (l->len == job->len && memcmp(l->digest, job->digest, FP_DIGEST_LEN) == 0) {
+            job->next = l->followers;
+            l->followers = job;
+            wp_stats.followers++;
+            settle_locked(job);
+            return 1;
+        }
+    }
+    job->leading = 1;
+    job->next = leaders;
+    leaders = job;
+    return 0;
+}
+
+// 按顺序把这一批压缩好的块追加到 L3 (调用时持有 wp_lock，中间放开)
+static void persist_batch_locked(wp_batch_t *b) {
+    for (int i = 0; i < b->n; i++) {
+        if (b->jobs[i].ready) {
+            b->jobs[i].ready = 0;
+            b->jobs[i].storing = 1;
+        }
+    }
+    b->nready = 0;
+    pthread_mutex_unlock(&wp_lock);
+
+    for (int i = 0; i < b->n; i++) {
+        wp_job_t *job = &b->jobs[i];
+        if (job->storing) job->block_id = storage_store_block(job->data, job->len, job->compressed, job->c_size, job->codec,
+                                                              job->dict_id, job->digest);
+    }
+
+    pthread_mutex_lock(&wp_lock);
+    b->persisting = 0;
+    for (int i = 0; i < b->n; i++) {
+        wp_job_t *job = &b->jobs[i];
+        if (!job->storing) continue;
+        job->storing = 0;
+        if (job->block_id > 0) wp_stats.stored++;
+        finish_locked(job);
+    }
+    // 这一轮里又有块压缩好了 (跟随者的领头失败，重新走了一遍)
+    maybe_persist_locked(b);
+}
+
+static void *wp_worker(void *arg) {
+    (void) arg;
+    wp_job_t *batch[SHA256_MB_LANES];
+    pthread_mutex_lock(&wp_lock);
+    for (;;) {
+        int stage = WP_STAGES - 1;
+        while (stage >= 0 && q_count[stage] == 0) stage--;
+        if (stage < 0) {
+            if (stopping) break;
+            pthread_cond_wait(&wp_work, &wp_lock);
+            continue;
+        }
+
+        if (stage == WP_HASH) {
+            int n = 0;
+            while (n < SHA256_MB_LANES && q_count[WP_HASH] > 0) batch[n++] = pop_locked(WP_HASH);
+            pthread_mutex_unlock(&wp_lock);
+
+            const char *inputs[SHA256_MB_LANES];
+            size_t lens[SHA256_MB_LANES];
+            unsigned char digests[SHA256_MB_LANES][FP_DIGEST_LEN];
+            for (int i = 0; i < n; i++) {
+                inputs[i] = batch[i]->data;
+                lens[i] = (size_t)batch[i]->len;
+            }
+            calculate_fingerprints(inputs, lens, n, digests);
+
+            pthread_mutex_lock(&wp_lock);
+            for (int i = 0; i < n; i++) {
+                memcpy(batch[i]->digest, digests[i], FP_DIGEST_LEN);
+                push_locked(WP_DEDUP, batch[i]);
+            }
+            continue;
+        }
+
+        if (stage == WP_PERSIST) {
+            persist_batch_locked(pop_locked(WP_PERSIST)->batch);
+            continue;
+        }
+
+        wp_job_t *job = pop_locked(stage);
+        if (stage == WP_DEDUP && follow_or_lead_locked(job)) continue;
+        pthread_mutex_unlock(&wp_lock);
+
+        int next = -1;
+        if (stage == WP_DEDUP) {
+            job->block_id = storage_dedup_block(job->digest, job->len);
+            if (job->block_id == 0) next = WP_COMPRESS;
+        } else if (job->len <= 4096) {
+            job->c_size = smart_compress_file(job->batch->inode_id, job->data, job->len, job->compressed, &job->codec,
+                                              &job->dict_id);
+            next = WP_PERSIST;
+        } else {
+            job->block_id = -1;
+        }
+
+        pthread_mutex_lock(&wp_lock);
+        if (next == WP_COMPRESS) {
+            push_locked(next, job);
+        } else if (next == WP_PERSIST) {
+            job->ready = 1;
+            job->batch->nready++;
+            settle_locked(job);
+        } else {
+            if (job->block_id > 0) wp_stats.dedup_hits++;
+            finish_locked(job);
+        }
+    }
+    pthread_mutex_unlock(&wp_lock);
+    return NULL;
+}
+
+// nthreads <= 0 时不开线程，smart_write_many 在调用线程上逐块做
+void write_pipeline_init(int nthreads) {
+    if (nthreads > WP_MAX_THREADS) nthreads = WP_MAX_THREADS;
+    pthread_mutex_lock(&wp_lock);
+    stopping = 0;
+    memset(q_head, 0, sizeof(q_head));
+    memset(q_count, 0, sizeof(q_count));
+    memset(&wp_stats, 0, sizeof(wp_stats));
+    pthread_mutex_unlock(&wp_lock);
+
+    for (int i = 0; i < nthreads; i++) {
+        if (pthread_create(&workers[nworkers], NULL, wp_worker, NULL) != 0) break;
+        nworkers++;
+    }
+    printf("[WritePipeline] %d worker thread(s) started.\n", nworkers);
+}
+
+// 调用前所有写入都已经返回 (卸载时)，队列是空的
+void write_pipeline_shutdown() {
+    pthread_mutex_lock(&wp_lock);
+    stopping = 1;
+    pthread_cond_broadcast(&wp_work);
+    pthread_mutex_unlock(&wp_lock);
+    for (int i = 0; i < nworkers; i++) pthread_join(workers[i], NULL);
+    nworkers = 0;
+}
+
+// 单核机器上开线程只多了交接的开销，返回 0
+int write_pipeline_default_threads() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n <= 1) return 0;
+    return (n > WP_MAX_THREADS) ? WP_MAX_THREADS : (int)n;
+}
+
+// 没有工作线程：在调用线程上按原来的方式做 (指纹一次算一批)
+static int write_many_inline(long inode_id, const long *offsets, const char *const *data, const int *lens,
+                             int n, int *out_block_ids) {
+    int ret = 0;
+    for (int at = 0; at < n; at += SHA256_MB_LANES) {
+        int k = (n - at < SHA256_MB_LANES) ? n - at : SHA256_MB_LANES;
+        size_t sizes[SHA256_MB_LANES];
+        unsigned char digests[SHA256_MB_LANES][FP_DIGEST_LEN];
+        for (int i = 0; i < k; i++) sizes[i] = (size_t)lens[at + i];
+        calculate_fingerprints(data + at, sizes, k, digests);
+        for (int i = 0; i < k; i++) {
+            out_block_ids[at + i] = -1;
+            if (smart_write_digest(inode_id, offsets[at + i], data[at + i], lens[at + i], digests[i],
+                                   &out_block_ids[at + i]) < 0) ret = -1;
+        }
+    }
+    return ret;
+}
+
+static int write_many(long inode_id, const long *offsets, const char *const *data, const int *lens,
+                      int n, int *out_block_ids) {
+    pthread_mutex_lock(&wp_lock);
+    int pooled = nworkers > 0 && !stopping;
+    pthread_mutex_unlock(&wp_lock);
+    if (!pooled) return write_many_inline(inode_id, offsets, data, lens, n, out_block_ids);
+
+    // 任务和压缩缓冲一次分配；块长超过 4KB 的 (调用者不应该给) 在压缩阶段直接失败。
+    // 流水线满了就等：前面已经进去的块凑不齐一批也会先落盘，腾出位置
+    wp_job_t *jobs = calloc((size_t)n, sizeof(wp_job_t));
+    char *cbufs = malloc((size_t)n * WP_COMPRESS_BUF);
+    if (!jobs || !cbufs) {
+        free(jobs);
+        free(cbufs);
+        return write_many_inline(inode_id, offsets, data, lens, n, out_block_ids);
+    }
+
+    wp_batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.jobs = jobs;
+    batch.n = n;
+    batch.pending = n;
+    batch.inode_id = inode_id;
+    pthread_cond_init(&batch.done, NULL);
+
+    pthread_mutex_lock(&wp_lock);
+    for (int i = 0; i < n; i++) {
+        wp_job_t *job = &jobs[i];
+        job->data = data[i];
+        job->len = lens[i];
+        job->compressed = cbufs + (size_t)i * WP_COMPRESS_BUF;
+        job->batch = &batch;
+        if (inflight == WP_MAX_INFLIGHT) {
+            wp_stats.stalls++;
+            while (inflight == WP_MAX_INFLIGHT) pthread_cond_wait(&wp_room, &wp_lock);
+        }
+        inflight++;
+        batch.unsettled++;
+        push_locked(WP_HASH, job);
+    }
+    while (batch.pending > 0) pthread_cond_wait(&batch.done, &wp_lock);
+    pthread_mutex_unlock(&wp_lock);
+
+    int ret = 0;
+    for (int i = 0; i < n; i++) {
+        out_block_ids[i] = jobs[i].block_id;
+        if (jobs[i].block_id <= 0) ret = -1;
+    }
+    pthread_cond_destroy(&batch.done);
+    free(jobs);
+    free(cbufs);
+    return ret;
+}
+
+// [新增] 全零块不进流水线 (块号 0 = 空洞)，剩下的块挤在一起交下去
+int smart_write_many(long inode_id, const long *offsets, const char *const *data, const int *lens,
+                     int n, int *out_block_ids) {
+    if (n <= 0) return 0;
+    int m = 0;
+    for (int i = 0; i < n; i++) {
+        out_block_ids[i] = storage_zero_block(data[i], lens[i]) ? 0 : -1;
+        if (out_block_ids[i] != 0) m++;
+    }
+    if (m == n) return write_many(inode_id, offsets, data, lens, n, out_block_ids);
+    if (m == 0) return 0;
+
+    long *offs = malloc((size_t)m * sizeof(long));
+    const char **srcs = malloc((size_t)m * sizeof(char *));
+    int *sizes = malloc((size_t)m * sizeof(int));
+    int *ids = malloc((size_t)m * sizeof(int));
+    int *at = malloc((size_t)m * sizeof(int));
+    int ret = -1;
+    if (offs && srcs && sizes && ids && at) {
+        for (int i = 0, k = 0; i < n; i++) {
+            if (out_block_ids[i] == 0) continue;
+            offs[k] = offsets[i];
+            srcs[k] = data[i];
+            sizes[k] = lens[i];
+            at[k++] = i;
+        }
+        ret = write_many(inode_id, offs, srcs, sizes, m, ids);
+        for (int k = 0; k < m; k++) out_block_ids[at[k]] = ids[k];
+    }
+    free(offs);
+    free(srcs);
+    free(sizes);
+    free(ids);
+    free(at);
+    return ret;
+}
+
+void write_pipeline_report() {
+    pthread_mutex_lock(&wp_lock);
+    WritePipelineStats s = wp_stats;
+    int threads = nworkers;
+    pthread_mutex_unlock(&wp_lock);
+    printf("[WritePipeline] %d threads; blocks: %lu (%lu new, %lu dedup, %lu waited on an identical block), "
+           "failed: %lu, stalls: %lu; max queue",
+           threads, s.blocks, s.stored, s.dedup_hits, s.followers, s.failed, s.stalls);
+    for (int i = 0; i < WP_STAGES; i++) printf(" %s=%lu", stage_names[i], s.max_queue[i]);
+    printf("\n");
+}
@@ -0,0 +1,164 @@
+// 异常退出后重新挂载的测试：位图要从 Inode 表重建，已有的文件一个都不能丢
+//
+// 直接把 main.c 编进来调用里面的 static 函数 (不经过内核)：
+//   gcc -std=gnu99 -D_FILE_OFFSET_BITS=64 -Isrc/include -Isrc/versioning -Isrc/storage -Isrc/metadata
+//       src/test_remount.c <smartfs 的其余源文件> -lfuse3 -lcrypto -llz4 -lpthread -o test_remount
+//   ./mkfs test.img && ./test_remount
+#define main smartfs_main
+#include "main.c"
+#undef main
+
+#define BIG_BLOCKS 700          // 超过一个索引块能放的指针数，块映射至少两层
+#define NEW_BLOCKS 256
+
+static int failures = 0;
+#define EXPECT(cond, msg) do { \
+    if (cond) printf("验证通过：%s\n", msg); \
+    else { printf("验证失败：%s\n", msg); failures++; } \
+} while (0)
+
+// 每个块的内容都不一样，不会被去重合并
+static void fill_block(char *blk, uint64_t tag, uint64_t i) {
+    for (int k = 0; k < BLOCK_SIZE; k += 16) {
+        snprintf(blk + k, 16, "%06lu:%08lu", (unsigned long)tag, (unsigned long)(i * BLOCK_SIZE + k));
+    }
+}
+
+static int mount_image(void) {
+    if (load_superblock() != 0) return -1;
+    if (disk_mount() != 0) return -1;
+    write_threads = 2;
+    struct fuse_conn_info conn;
+    memset(&conn, 0, sizeof(conn));
+    smartfs_init(NULL, &conn);
+    return 0;
+}
+
+// 模拟掉电：数据和 Inode 都已经落盘，但超级块停在 MOUNTED，位图也没写下去
+static void crash(void) {
+    inval_shutdown();
+    prefetch_shutdown();
+    write_pipeline_shutdown();
+    storage_unmount();
+    allocator_sync(SMARTFS_STATE_MOUNTED);
+    icache_destroy();
+
+    size_t len = (size_t)(sb.inode_area_start - sb.inode_bitmap_start) * BLOCK_SIZE;
+    char *zero = calloc(1, len);
+    if (zero) {
+        if (pwrite(disk_fd, zero, len, (off_t)sb.inode_bitmap_start * BLOCK_SIZE) != (ssize_t)len) perror("pwrite");
+        free(zero);
+    }
+    fsync(disk_fd);
+    close(disk_fd);
+    disk_fd = -1;
+    // 各模块回到进程刚启动时的样子，重新挂载不能沾上一次挂载留下的 fd
+    storage_attach_disk(-1);
+    bmap_attach_disk(-1);
+    dir_attach_disk(-1);
+    icache_attach_disk(-1, 0);
+}
+
+static int write_file(uint64_t inode_id, uint64_t tag, uint64_t blocks) {
+    char blk[BLOCK_SIZE];
+    icache_lock(inode_id, ICACHE_EXCL);
+    for (uint64_t i = 0; i < blocks; i++) {
+        fill_block(blk, tag, i);
+        if (write_locked(inode_id, blk, BLOCK_SIZE, (off_t)(i * BLOCK_SIZE)) != BLOCK_SIZE) {
+            icache_unlock(inode_id);
+            return -1;
+        }
+    }
+    icache_unlock(inode_id);
+    return 0;
+}
+
+static int check_file(uint64_t inode_id, uint64_t tag, uint64_t blocks) {
+    char blk[BLOCK_SIZE], want[BLOCK_SIZE];
+    int ret = 0;
+    icache_lock(inode_id, ICACHE_SHARED);
+    for (uint64_t i = 0; i < blocks && ret == 0; i++) {
+        fill_block(want, tag, i);
+        if (read_locked(inode_id, 0, blk, BLOCK_SIZE, (off_t)(i * BLOCK_SIZE), NULL, NULL) != BLOCK_SIZE ||
+            memcmp(blk, want, BLOCK_SIZE) != 0) ret = -1;
+    }
+    icache_unlock(inode_id);
+    return ret;
+}
+
+static uint64_t lookup(uint64_t parent_id, const char *name) {
+    inode_t parent;
+    uint64_t ino = 0;
+    load_inode(parent_id, &parent);
+    if (!S_ISDIR(parent.mode) || dir_lookup(&parent.current, name, &ino) != 0) return 0;
+    return ino;
+}
+
+static void count_unmarked(uint64_t blk, void *arg) {
+    if (!bitmap_test(&block_bitmap, blk)) (*(int *)arg)++;
+}
+
+// 这个 Inode 和它占用的元数据块 (目录块 / 索引块 / 软链接块) 在位图里都标记了没有
+static int unmarked_blocks(uint64_t inode_id) {
+    inode_t node;
+    int missing = 0;
+    load_inode(inode_id, &node);
+    if (!bitmap_test(&inode_bitmap, inode_id)) missing++;
+    if (S_ISDIR(node.mode)) dir_for_each_block(&node.current, count_unmarked, &missing);
+    else if (S_ISLNK(node.mode)) count_unmarked(node.current.block_list_start_index, &missing);
+    else bmap_for_each_index(&node.current, count_unmarked, &missing);
+    return missing;
+}
+
+int main() {
+    printf("=== 异常退出后重新挂载测试 ===\n");
+
+    char target[400];
+    memset(target, 'x', sizeof(target) - 1);    // 放不进 Inode 的长目标，要占一个块
+    target[sizeof(target) - 1] = '\0';
+    memcpy(target, "../dir/big/", 11);
+
+    // 1. 第一次挂载：建目录、大文件、软链接
+    lru_init(100);
+    wal_init();
+    if (mount_image() != 0) {
+        printf("挂载失败 (先运行 mkfs test.img)\n");
+        return 1;
+    }
+    uint64_t dir_id, big_id, link_id;
+    if (create_dir(sb.root_inode, "dir", 0755, &dir_id) != 0 ||
+        create_file(dir_id, "big", 0644, &big_id) != 0 ||
+        create_symlink(target, sb.root_inode, "link", &link_id) != 0 ||
+        write_file(big_id, 1, BIG_BLOCKS) != 0) {
+        printf("建立测试文件失败\n");
+        return 1;
+    }
+
+    // 2. 不正常卸载，再挂载一次
+    crash();
+    if (mount_image() != 0) {
+        printf("重新挂载失败\n");
+        return 1;
+    }
+    EXPECT(lookup(sb.root_inode, "dir") == dir_id && lookup(dir_id, "big") == big_id &&
+           lookup(sb.root_inode, "link") == link_id, "目录项都还在");
+    EXPECT(unmarked_blocks(sb.root_inode) == 0 && unmarked_blocks(dir_id) == 0 &&
+           unmarked_blocks(big_id) == 0 && unmarked_blocks(link_id) == 0,
+           "重建后的位图标记了所有 Inode 和元数据块");
+
+    // 3. 之后的分配不能占用已有文件的 Inode 和块
+    uint64_t new_id;
+    EXPECT(create_file(sb.root_inode, "new", 0644, &new_id) == 0 && new_id != dir_id &&
+           new_id != big_id && new_id != link_id, "新文件分到了空闲的 Inode");
+    EXPECT(write_file(new_id, 2, NEW_BLOCKS) == 0, "新文件写入成功");
+    EXPECT(check_file(big_id, 1, BIG_BLOCKS) == 0, "旧文件内容没有被覆盖");
+    EXPECT(check_file(new_id, 2, NEW_BLOCKS) == 0, "新文件内容正确");
+    char buf[BLOCK_SIZE];
+    icache_lock(link_id, ICACHE_SHARED);
+    int ret = readlink_locked(link_id, buf, sizeof(buf));
+    icache_unlock(link_id);
+    EXPECT(ret == 0 && strcmp(buf, target) == 0, "软链接目标没有被覆盖");
+
+    smartfs_destroy(NULL);
+    return failures ? 1 : 0;
+}
@@ -4,14 +4,58 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <stdint.h>
+#include <time.h>
 #include <sys/stat.h>
 #include "smartfs_types.h"
+#include "block_map.h"
+#include "dir.h"
 
 #define DISK_SIZE (100 * 1024 * 1024)
 
+// 格式化时的块分配：从数据区开头顺序往后分 (block_map.c/dir.c 需要)
+static uint64_t next_block = 0;
+
+uint64_t allocate_block() {
+    return next_block++;
+}
+
+void free_block(uint64_t block_no) {
+    (void) block_no;
+}
+
+// 格式化时还没有数据块
+void data_block_ref(uint64_t block_id) {
+    (void) block_id;
+}
+
+void data_block_unref(uint64_t block_id) {
+    (void) block_id;
+}
+
+// [新增] 去重指纹算法，格式化时选定 (-H)，之后不能换
+static const struct { const char *name; uint32_t id; } fp_algos[] = {
+    { "sha256", SMARTFS_FP_SHA256 },
+    { "blake2b", SMARTFS_FP_BLAKE2B },
+    { "blake3", SMARTFS_FP_BLAKE3 },
+};
+
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        printf("Usage: %s <disk_image_name>\n", argv[0]);
+    const char *prog = argv[0];
+    uint32_t fp_algo = SMARTFS_FP_SHA256;
+    const char *fp_name = "sha256";
+    if (argc == 4 && strcmp(argv[1], "-H") == 0) {
+        fp_name = NULL;
+        for (size_t i = 0; i < sizeof(fp_algos) / sizeof(fp_algos[0]); i++) {
+            if (strcmp(argv[2], fp_algos[i].name) == 0) {
+                fp_algo = fp_algos[i].id;
+                fp_name = fp_algos[i].name;
+            }
+        }
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2 || fp_name == NULL) {
+        printf("Usage: %s [-H sha256|blake2b|blake3] <disk_image_name>\n", prog);
         return 1;
     }
 
@@ -33,9 +77,9 @@ int main(int argc, char *argv[]) {
     sb.inode_area_start   = 3; // 第3块开始存 Inode 表
     sb.data_area_start    = 3 + (1024); // 假设预留1024块给Inode(够存几万个文件了)
     
-    // 计算真正的空闲块 (简单减去元数据占用的)
-    sb.free_blocks = sb.total_blocks - sb.data_area_start;
     sb.root_inode = 0; // 根目录的 Inode 号定为 0
+    sb.state = SMARTFS_STATE_CLEAN;
+    sb.inode_size = sizeof(inode_t);
 
     // 3. 创建根目录 Inode (Inode #0)
     inode_t root_inode;
@@ -45,43 +89,46 @@ int main(int argc, char *argv[]) {
     root_inode.uid = getuid();
     root_inode.gid = getgid();
     root_inode.latest_version = 1;
+    root_inode.total_versions = 1;
+    root_inode.link_count = 2;
     
-    // 根目录使用第0个数据块
-    file_version_t *v1 = &root_inode.versions[0];
+    // 4. 创建根目录的哈希目录 (目录头 + 一个叶子，".." 指向自己)
+    file_version_t *v1 = &root_inode.current;
     v1->version_id = 1;
-    v1->block_count = 1;
-    v1->file_size = BLOCK_SIZE;
-    // 这里的 block_list_start_index 需要复杂的间接寻址，
-    // 为了Demo简单，我们暂时约定：
-    // 根目录的数据直接存在 data_area_start + 0 这个位置
-    
-    // 4. 写入根目录的数据块 (包含 . 和 ..)
-    smartfs_dir_entry_t entries[2];
-    // Entry 1: .
-    strcpy(entries[0].name, ".");
-    entries[0].inode_no = 0;
-    entries[0].is_valid = 1;
-    // Entry 2: ..
-    strcpy(entries[1].name, "..");
-    entries[1].inode_no = 0; // 根目录的上级还是自己
-    entries[1].is_valid = 1;
+    v1->timestamp = time(NULL);
+    next_block = sb.data_area_start;
+    bmap_attach_disk(fd);
+    dir_attach_disk(fd);
+    if (dir_init(v1, 0) != 0) { perror("dir_init"); close(fd); return 1; }
+    sb.free_blocks = sb.total_blocks - next_block; // 减去元数据和根目录占用的块
+    sb.features = SMARTFS_FEATURES_REQUIRED;
+    sb.fp_algo = fp_algo;
 
     // 5. 执行写入
     // 写入 SuperBlock
     lseek(fd, 0, SEEK_SET);
     write(fd, &sb, sizeof(sb));
 
+    // 写入位图：Inode #0 (根目录) 已占用；超级块/位图/Inode 区/根目录的块已占用
+    unsigned char bitmap[BLOCK_SIZE];
+    memset(bitmap, 0, BLOCK_SIZE);
+    bitmap[0] = 0x01;
+    lseek(fd, sb.inode_bitmap_start * BLOCK_SIZE, SEEK_SET);
+    write(fd, bitmap, BLOCK_SIZE);
+
+    memset(bitmap, 0, BLOCK_SIZE);
+    for (uint64_t b = 0; b < next_block; b++) bitmap[b / 8] |= (unsigned char)(1 << (b % 8));
+    lseek(fd, sb.block_bitmap_start * BLOCK_SIZE, SEEK_SET);
+    write(fd, bitmap, BLOCK_SIZE);
+
     // 写入 Root Inode (在 Inode 区域的第0个位置)
     off_t inode_offset = sb.inode_area_start * BLOCK_SIZE;
     lseek(fd, inode_offset, SEEK_SET);
     write(fd, &root_inode, sizeof(root_inode));
 
-    // 写入 Root Directory Data (在数据区域的第0个位置)
-    off_t data_offset = sb.data_area_start * BLOCK_SIZE;
-    lseek(fd, data_offset, SEEK_SET);
-    write(fd, entries, sizeof(entries));
-
-    printf("Format success! Root Inode created at block %lu\n", sb.inode_area_start);
+    printf("Format success! Root Inode created at block %lu (inode size %u bytes, %lu inodes, fingerprint %s)\n",
+           sb.inode_area_start, sb.inode_size,
+           (sb.data_area_start - sb.inode_area_start) * BLOCK_SIZE / sizeof(inode_t), fp_name);
     close(fd);
     return 0;
 }
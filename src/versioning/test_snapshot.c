@@ -3,11 +3,11 @@
 #include <assert.h>
 #include "version_mgr.h"
 
-// 模拟打印 Inode 里的所有版本
-void dump_versions(inode_t *inode) {
-    printf("\n=== Dumping Inode Versions (Total: %d) ===\n", inode->total_versions);
-    for (uint32_t i = 0; i < inode->total_versions; i++) {
-        file_version_t *v = &inode->versions[i];
+// 模拟打印版本表里的所有版本
+void dump_versions(version_table_t *vt) {
+    printf("\n=== Dumping Inode Versions (Total: %d) ===\n", vt->total_versions);
+    for (uint32_t i = 0; i < vt->total_versions; i++) {
+        file_version_t *v = &vt->versions[i];
         printf("[%d] ID: v%d | Size: %lu | Msg: %s\n", 
                i, v->version_id, v->file_size, v->commit_msg);
     }
@@ -17,9 +17,9 @@ void dump_versions(inode_t *inode) {
 int main() {
     printf("=== Starting Snapshot Engine Stress Test ===\n");
 
-    // 1. 模拟一个 Inode
-    inode_t my_file;
-    version_mgr_init_inode(&my_file); // 自动创建 v1
+    // 1. 模拟一个文件的版本历史表
+    version_table_t my_file;
+    version_mgr_init_table(&my_file); // 自动创建 v1
 
     // 2. 正常增长测试 (创建 v2 - v5)
     char msg[64];
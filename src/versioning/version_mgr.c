@@ -5,18 +5,16 @@
 #include "version_mgr.h"
 #include <errno.h>
 // 内部辅助函数：获取最新版本的索引
-static int get_latest_index(inode_t *inode) {
-    if (inode->total_versions == 0) return -1;
-    return inode->total_versions - 1;
+static int get_latest_index(version_table_t *vt) {
+    if (vt->total_versions == 0) return -1;
+    return vt->total_versions - 1;
 }
 
-void version_mgr_init_inode(inode_t *inode) {
-    inode->total_versions = 0;
-    inode->latest_version = 0;
-    memset(inode->versions, 0, sizeof(inode->versions));
+void version_mgr_init_table(version_table_t *vt) {
+    memset(vt, 0, sizeof(*vt));
     
     // 创建初始版本 v1
-    version_mgr_create_snapshot(inode, "Initial Creation");
+    version_mgr_create_snapshot(vt, "Initial Creation");
 }
 
 static time_t parse_time_str(const char *str) {
@@ -38,8 +36,8 @@ static time_t parse_time_str(const char *str) {
 }
 
 
-file_version_t* version_mgr_find_by_time_str(inode_t *inode, const char *time_str) {
-    if (!inode || inode->total_versions == 0) return NULL;
+file_version_t* version_mgr_find_by_time_str(version_table_t *vt, const char *time_str) {
+    if (!vt || vt->total_versions == 0) return NULL;
 
     time_t target_time = parse_time_str(time_str);
     
@@ -51,9 +49,9 @@ file_version_t* version_mgr_find_by_time_str(inode_t *inode, const char *time_st
 
     // 因为数组可能会由于 rotation 变得无序(逻辑上有序)，建议按 version_id 遍历或者假设物理顺序
     // 简化起见，我们倒序遍历数组（通常是新的在后面）
-    for (int i = inode->total_versions - 1; i >= 0; i--) {
-        if (inode->versions[i].timestamp <= target_time) {
-            best_match = &inode->versions[i];
+    for (int i = vt->total_versions - 1; i >= 0; i--) {
+        if (vt->versions[i].timestamp <= target_time) {
+            best_match = &vt->versions[i];
             break; // 找到了最近的一个过去版本
         }
     }
@@ -64,8 +62,8 @@ file_version_t* version_mgr_find_by_time_str(inode_t *inode, const char *time_st
     return best_match;
 }
 
-size_t version_mgr_list_versions(inode_t *inode, char *buf, size_t size) {
-    if (!inode) return 0;
+size_t version_mgr_list_versions(version_table_t *vt, char *buf, size_t size) {
+    if (!vt) return 0;
     
     char line[256];
     size_t total_len = 0;
@@ -73,13 +71,14 @@ size_t version_mgr_list_versions(inode_t *inode, char *buf, size_t size) {
     // 如果 buffer 太小无法写入，这只是一个简单的 demo 实现
     // 实际应先计算长度
     
-    for (int i = 0; i < inode->total_versions; i++) {
-        file_version_t *v = &inode->versions[i];
+    for (int i = 0; i < vt->total_versions; i++) {
+        file_version_t *v = &vt->versions[i];
         
         // 格式化时间
-        struct tm *tm_info = localtime(&v->timestamp);
+        struct tm tm_info;
         char time_buf[30];
-        strftime(time_buf, 26, "%Y-%m-%d %H:%M:%S", tm_info);
+        localtime_r(&v->timestamp, &tm_info);   // localtime 的静态缓冲区多线程下会被覆盖
+        strftime(time_buf, 26, "%Y-%m-%d %H:%M:%S", &tm_info);
         
         int len = snprintf(line, sizeof(line), "v%d%s | %s | %s | %lu bytes\n", 
                    v->version_id, 
@@ -96,17 +95,17 @@ size_t version_mgr_list_versions(inode_t *inode, char *buf, size_t size) {
     return total_len;
 }
 
-int version_mgr_create_snapshot(inode_t *inode, const char *commit_msg) {
-    if (!inode) return -1;
+int version_mgr_create_snapshot(version_table_t *vt, const char *commit_msg) {
+    if (!vt) return -1;
 
     // --- [修改] 升级后的清理策略 (Rotation Policy) ---
-    if (inode->total_versions >= MAX_VERSIONS) {
+    if (vt->total_versions >= MAX_VERSIONS) {
         printf("[VersionMgr] Max versions reached. Trying to make room...\n");
         
         // 寻找一个可以删除的受害者（从最老的开始找）
         int victim_idx = -1;
-        for (int i = 0; i < inode->total_versions - 1; i++) { // 保留最新的一个不删
-            if (inode->versions[i].is_pinned == 0) {
+        for (int i = 0; i < vt->total_versions - 1; i++) { // 保留最新的一个不删
+            if (vt->versions[i].is_pinned == 0) {
                 victim_idx = i;
                 break;
             }
@@ -114,11 +113,11 @@ int version_mgr_create_snapshot(inode_t *inode, const char *commit_msg) {
 
         if (victim_idx != -1) {
             // 找到了受害者，移动数组覆盖它
-            printf("  Dropping version v%d (index %d)\n", inode->versions[victim_idx].version_id, victim_idx);
-            for (int i = victim_idx; i < inode->total_versions - 1; i++) {
-                inode->versions[i] = inode->versions[i+1];
+            printf("  Dropping version v%d (index %d)\n", vt->versions[victim_idx].version_id, victim_idx);
+            for (int i = victim_idx; i < vt->total_versions - 1; i++) {
+                vt->versions[i] = vt->versions[i+1];
             }
-            inode->total_versions--;
+            vt->total_versions--;
         } else {
             // 所有历史版本都被 Pin 住了！无法创建新快照
             // 策略：强制删除最老的，或者返回错误。这里简单起见，打印错误并返回
@@ -127,22 +126,25 @@ int version_mgr_create_snapshot(inode_t *inode, const char *commit_msg) {
         }
     }
     // 2. 确定新旧位置
-    int old_idx = get_latest_index(inode);
-    int new_idx = inode->total_versions; // 新位置在末尾
+    int old_idx = get_latest_index(vt);
+    int new_idx = vt->total_versions; // 新位置在末尾
 
-    file_version_t *new_ver = &inode->versions[new_idx];
+    file_version_t *new_ver = &vt->versions[new_idx];
     new_ver->is_pinned = 0; // 初始化
     // 3. 增量存储核心：继承 (Inheritance) 
     // 如果存在旧版本，新版本默认继承旧版本的所有状态
     // 这实现了 Copy-on-Write 的第一步：Copy Metadata
     if (old_idx >= 0) {
-        file_version_t *old_ver = &inode->versions[old_idx];
+        file_version_t *old_ver = &vt->versions[old_idx];
         
-        // 关键：复制旧版本的文件大小和块索引
+        // 关键：复制旧版本的文件大小和块映射的根
         // 这样新版本 v2 在没写入数据前，物理上和 v1 共享完全相同的数据块
         new_ver->file_size = old_ver->file_size;
         new_ver->block_count = old_ver->block_count;
         new_ver->block_list_start_index = old_ver->block_list_start_index;
+        new_ver->map_depth = old_ver->map_depth;
+        // 多层映射的索引块也是共享的，第一次写入时由 bmap_unshare 复制 (CoW)
+        new_ver->map_shared = (old_ver->map_depth > 0);
         
         // 版本号递增
         new_ver->version_id = old_ver->version_id + 1;
@@ -151,6 +153,8 @@ int version_mgr_create_snapshot(inode_t *inode, const char *commit_msg) {
         new_ver->file_size = 0;
         new_ver->block_count = 0;
         new_ver->block_list_start_index = 0; 
+        new_ver->map_depth = 0;
+        new_ver->map_shared = 0;
         new_ver->version_id = 1;
     }
 
@@ -159,8 +163,8 @@ int version_mgr_create_snapshot(inode_t *inode, const char *commit_msg) {
     strncpy(new_ver->commit_msg, commit_msg, sizeof(new_ver->commit_msg) - 1);
 
     // 5. 更新 Inode 全局状态
-    inode->total_versions++;
-    inode->latest_version = new_ver->version_id;
+    vt->total_versions++;
+    vt->latest_version = new_ver->version_id;
 
     printf("[VersionMgr] Snapshot created: v%d (msg: %s) at index %d\n", 
            new_ver->version_id, commit_msg, new_idx);
@@ -169,27 +173,27 @@ int version_mgr_create_snapshot(inode_t *inode, const char *commit_msg) {
     
 }
 
-int version_mgr_toggle_pin(inode_t *inode, int version_id) {
-    file_version_t *v = version_mgr_get_version(inode, version_id);
+int version_mgr_toggle_pin(version_table_t *vt, int version_id) {
+    file_version_t *v = version_mgr_get_version(vt, version_id);
     if (!v) return -ENOENT;
     
     v->is_pinned = !v->is_pinned; // 切换 0 <-> 1
     return v->is_pinned; // 返回新的状态
 }
 
-file_version_t* version_mgr_get_version(inode_t *inode, uint32_t version_id) {
-    if (!inode || inode->total_versions == 0) return NULL;
+file_version_t* version_mgr_get_version(version_table_t *vt, uint32_t version_id) {
+    if (!vt || vt->total_versions == 0) return NULL;
 
     // 如果请求 version_id == 0，返回最新版
     if (version_id == 0) {
-        return &inode->versions[inode->total_versions - 1];
+        return &vt->versions[vt->total_versions - 1];
     }
 
     // 线性查找 (因为存在轮转，版本号和数组下标不一定对应)
     // 例如：数组里可能是 [v3, v4, v5]，你要找 v3，下标是 0
-    for (uint32_t i = 0; i < inode->total_versions; i++) {
-        if (inode->versions[i].version_id == version_id) {
-            return &inode->versions[i];
+    for (uint32_t i = 0; i < vt->total_versions; i++) {
+        if (vt->versions[i].version_id == version_id) {
+            return &vt->versions[i];
         }
     }
     
@@ -198,12 +202,12 @@ file_version_t* version_mgr_get_version(inode_t *inode, uint32_t version_id) {
 
 // 检查是否满足时间间隔策略
 // interval_seconds: 最小间隔秒数 (例如 60秒)
+// 只看 inode 里的 current，不需要读历史表
 int version_mgr_should_snapshot(inode_t *inode, int interval_seconds) {
     if (!inode || inode->total_versions == 0) return 1; // 没版本，肯定要快照
 
     // 获取最新版本
-    int latest_idx = inode->total_versions - 1;
-    time_t last_time = inode->versions[latest_idx].timestamp;
+    time_t last_time = inode->current.timestamp;
     time_t now = time(NULL);
 
     // 如果 (当前时间 - 上次时间) < 间隔，则不快照